@@ -0,0 +1,556 @@
+/*****************************************************************************
+ ** This program is free software; you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation; either version 2 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program; if not, write to the Free Software
+ ** Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ **
+ **
+ ** FILE INFORMATION
+ ** ----------------
+ ** Filename:        tban_bench.c
+ ** Initial author:  marcus.jagemar@gmail.com
+ **
+ **
+ ** DESCRIPTION
+ ** -----------
+ ** End-to-end benchmark of libtban. The real library code paths are
+ ** run against tbanemu (or a real device) and the latency of every
+ ** call is recorded. One JSON object per line is printed for each
+ ** benchmark:
+ **
+ **   {"bench":"tban_queryStatus","device":"tban","iterations":200,
+ **    "errors":0,"total_ms":..,"ops_per_s":..,"min_us":..,"p50_us":..,
+ **    "p90_us":..,"p99_us":..,"max_us":..}
+ **
+ ** Two emulators are started: a TBan with a miniNG attached and a
+ ** BigNG. By default the emulated wire is unlimited and has no
+ ** latency so the numbers show the cost of the library itself; use
+ ** baud/latency to get the figures of a real installation.
+ **
+ ** Against a real device only the queries and the decoding are run,
+ ** the setters would leave the controller reconfigured. Give "writes"
+ ** to run them anyway.
+ **
+ ** The results go to stdout or, with "out <file>", to a file of their
+ ** own; errors go to stderr. The benchmark refuses to run when built
+ ** without NDEBUG: libtban is then built the same way and prints a
+ ** trace of every command on stdout, which would be mixed with the
+ ** results and counted in the timings.
+ **
+ ** REVISION HISTORY
+ ** ----------------
+ **
+ ** Date        Comment
+ ** =================================================================
+ ** 2026-10-17  File created
+ **
+ *****************************************************************************/
+
+/* Standard includes */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+/* TBan includes */
+#include "tban.h"
+#include "big_ng.h"
+#include "mini_ng.h"
+#include "decode.h"
+
+
+/*****************************************************************************
+ * Defaults
+ *****************************************************************************/
+#ifndef TBAN_BENCH_EMU
+#define TBAN_BENCH_EMU        "tbanemu"
+#endif
+#define BENCH_ITERATIONS      200
+#define BENCH_DECODE_FACTOR   1000  /* Decoding is cheap, run it more often */
+#define BENCH_UPLOAD_DIVISOR  10    /* Curve uploads are slow, run them less */
+
+
+/*****************************************************************************
+ * Benchmark configuration
+ *****************************************************************************/
+struct BenchConfig {
+  const char* emu;
+  const char* baud;
+  const char* latency;
+  const char* drain;
+  const char* filter;
+  int         iterations;
+  int         writes;      /* Run the setters on a real device as well */
+  FILE*       out;         /* The result lines */
+};
+
+
+/*****************************************************************************
+ * An emulated (or real) device under test
+ *****************************************************************************/
+struct BenchDevice {
+  const char* label;
+  pid_t       pid;
+  char        path[64];
+  struct TBan tban;
+};
+
+
+/*****************************************************************************
+ * Benchmarked operations. The iteration number is passed so setters
+ * can alternate between values.
+ *****************************************************************************/
+typedef int (*BenchOp)(struct TBan* tban, int iteration);
+
+
+/**********************************************************************
+ * Name        : monotonicNs
+ * Description : Read the monotonic clock.
+ * Arguments   : none
+ * Returning   : Nanoseconds since some unspecified starting point
+ **********************************************************************/
+static long long monotonicNs(void) {
+  struct timespec now;
+
+  (void) clock_gettime(CLOCK_MONOTONIC, &now);
+  return ((long long) now.tv_sec)*1000000000LL + now.tv_nsec;
+}
+
+
+/**********************************************************************
+ * Name        : compareNs
+ * Description : qsort helper, ascending order.
+ * Arguments   : a, b = Samples to compare
+ * Returning   : <0, 0, >0
+ **********************************************************************/
+static int compareNs(const void* a, const void* b) {
+  long long x = *(const long long*) a;
+  long long y = *(const long long*) b;
+
+  return (x > y) - (x < y);
+}
+
+
+/**********************************************************************
+ * Name        : percentile
+ * Description : Nearest rank percentile of sorted samples.
+ * Arguments   : sorted = The samples, ascending
+ *               count  = Number of samples
+ *               pct    = The percentile (0-100)
+ * Returning   : The sample, in microseconds
+ **********************************************************************/
+static double percentile(const long long sorted[], int count, int pct) {
+  int rank = (pct*count + 99)/100;
+
+  if(rank < 1)
+    rank = 1;
+  return sorted[rank-1]/1000.0;
+}
+
+
+/**********************************************************************
+ * Name        : runBench
+ * Description : Run one operation a number of times and print the
+ *               result line.
+ * Arguments   : cfg        = The configuration
+ *               dev        = The device to run on
+ *               name       = Name of the benchmark
+ *               op         = The operation
+ *               iterations = Number of calls
+ * Returning   : none
+ **********************************************************************/
+static void runBench(const struct BenchConfig* cfg, struct BenchDevice* dev,
+                     const char* name, BenchOp op, int iterations) {
+  long long* samples;
+  long long  start, stop, total = 0;
+  int        i, errors = 0, lastError = TBAN_OK;
+
+  if((cfg->filter != NULL) && (strstr(name, cfg->filter) == NULL))
+    return;
+  if(iterations < 1)
+    iterations = 1;
+
+  samples = malloc(iterations*sizeof(samples[0]));
+  if(samples == NULL)
+    return;
+
+  for(i=0; i<iterations; i++) {
+    int result;
+
+    start  = monotonicNs();
+    result = op(&dev->tban, i);
+    stop   = monotonicNs();
+
+    samples[i] = stop - start;
+    total     += samples[i];
+    if(result != TBAN_OK) {
+      errors++;
+      lastError = result;
+    }
+  }
+  qsort(samples, iterations, sizeof(samples[0]), compareNs);
+
+  fprintf(cfg->out, "{\"bench\":\"%s\",\"device\":\"%s\",\"iterations\":%d,\"errors\":%d,",
+          name, dev->label, iterations, errors);
+  if(errors != 0)
+    fprintf(cfg->out, "\"last_error\":\"%s\",", tban_strerror(lastError));
+  fprintf(cfg->out, "\"total_ms\":%.3f,\"ops_per_s\":%.1f,"
+          "\"min_us\":%.3f,\"p50_us\":%.3f,\"p90_us\":%.3f,\"p99_us\":%.3f,\"max_us\":%.3f}\n",
+          total/1e6, (total > 0) ? iterations*1e9/total : 0.0,
+          samples[0]/1000.0,
+          percentile(samples, iterations, 50),
+          percentile(samples, iterations, 90),
+          percentile(samples, iterations, 99),
+          samples[iterations-1]/1000.0);
+  (void) fflush(cfg->out);
+
+  free(samples);
+}
+
+
+/*****************************************************************************
+ * The operations
+ *****************************************************************************/
+static int opQueryStatus(struct TBan* tban, int iteration) {
+  return tban_queryStatus(tban);
+}
+
+static int opBigNGQueryStatus(struct TBan* tban, int iteration) {
+  return bigNG_queryStatus(tban);
+}
+
+static int opMiniNGQueryStatus(struct TBan* tban, int iteration) {
+  return miniNG_queryStatus(tban);
+}
+
+static int opSetChPwm(struct TBan* tban, int iteration) {
+  return tban_setChPwm(tban, iteration % TBAN_NUMBER_CHANNELS, 40 + 2*(iteration % 20));
+}
+
+static int opSetLED(struct TBan* tban, int iteration) {
+  return tban_setLED(tban, iteration & 1);
+}
+
+static int opSetChCurve(struct TBan* tban, int iteration) {
+  unsigned char x[7], y[6];
+  int i;
+
+  for(i=0; i<6; i++) {
+    x[i] = 25 + 5*i + (iteration & 1);
+    y[i] = 30 + 12*i;
+  }
+  /* Temperature of full speed, above the last point */
+  x[6] = x[5] + 10;
+  return tban_setChCurve(tban, iteration % TBAN_NUMBER_CHANNELS, x, y);
+}
+
+static int opMiniNGSetChCurve(struct TBan* tban, int iteration) {
+  unsigned char x[5], y[5];
+  int i;
+
+  for(i=0; i<5; i++) {
+    x[i] = 25 + 5*i + (iteration & 1);
+    y[i] = 40 + 15*i;
+  }
+  return miniNG_setChCurve(tban, iteration % MINI_NG_NUMBER_CHANNELS, x, y);
+}
+
+
+/**********************************************************************
+ * Name        : opDecodeAll
+ * Description : Decode every channel and sensor from the last status
+ *               vectors, the way a monitoring client does per sample.
+ * Arguments   : tban      = The TBan struct to work on
+ *               iteration = Not used
+ * Returning   : First error met, TBAN_OK otherwise
+ **********************************************************************/
+static int opDecodeAll(struct TBan* tban, int iteration) {
+  unsigned int  rpmMax;
+  unsigned char pwm, temp, raw, cal, abscal, mode, target, targetMode, rpm;
+  int result = TBAN_OK;
+  int i;
+
+  if(bigNG_present(tban) == BIGNG_PRESENT) {
+    for(i=0; i<TBAN_NUMBER_CHANNELS; i++)
+      result |= bigNG_getChInfo(tban, i, &rpmMax, &pwm, &temp, &mode, &target, &targetMode);
+    for(i=0; i<TBAN_NUMBER_DIGITAL_SENSORS; i++)
+      result |= bigNG_getdSensorTemp(tban, i, &temp, &raw, &cal, &abscal);
+    for(i=0; i<BIGNG_NUMBER_ADDITIONAL_ANALOG_SENSORS; i++)
+      result |= bigNG_getaSensorTemp(tban, i, &temp, &raw, &cal, &abscal);
+  } else {
+    for(i=0; i<TBAN_NUMBER_CHANNELS; i++)
+      result |= tban_getChInfo(tban, i, &rpmMax, &pwm, &temp, &mode);
+    for(i=0; i<TBAN_NUMBER_DIGITAL_SENSORS; i++)
+      result |= tban_getdSensorTemp(tban, i, &temp, &raw, &cal);
+    for(i=0; i<TBAN_NUMBER_ANALOG_SENSORS; i++)
+      result |= tban_getaSensorTemp(tban, i, &temp, &raw, &cal);
+    if(tban->miniNG.lastQuery != 0) {
+      for(i=0; i<MINI_NG_NUMBER_CHANNELS; i++)
+        result |= miniNG_getChRpm(tban, i, &rpm, &pwm);
+      for(i=0; i<MINI_NG_NUMBER_ANALOG_SENSORS; i++)
+        result |= miniNG_getaSensorTemp(tban, i, &temp, &raw, &cal);
+    }
+  }
+
+  return result;
+}
+
+
+/**********************************************************************
+ * Name        : opBulkDecode
+ * Description : The same as opDecodeAll with the bulk decoder.
+ * Arguments   : tban      = The TBan struct to work on
+ *               iteration = Not used
+ * Returning   : First error met, TBAN_OK otherwise
+ **********************************************************************/
+static int opBulkDecode(struct TBan* tban, int iteration) {
+  struct TBanState state;
+
+  if(bigNG_present(tban) == BIGNG_PRESENT)
+    return bigNG_decodeAll(tban, &state);
+  if(tban->miniNG.lastQuery != 0)
+    return tban_decodeVectors(TBAN_SAMPLE_TBAN | TBAN_SAMPLE_MINING, tban->buf, NULL,
+                              tban->miniNG.buf, &state);
+  return tban_decodeAll(tban, &state);
+}
+
+
+/**********************************************************************
+ * Name        : startEmu
+ * Description : Start an emulator and wait for the name of its pty.
+ * Arguments   : cfg   = The configuration
+ *               dev   = Filled in with the pid and the device path
+ *               model = Extra emulator argument ("mining", "bigng")
+ * Returning   : 0 on success, -1 otherwise
+ **********************************************************************/
+static int startEmu(const struct BenchConfig* cfg, struct BenchDevice* dev, const char* model) {
+  FILE* out;
+  int   fds[2];
+
+  if(pipe(fds) != 0)
+    return -1;
+
+  dev->pid = fork();
+  if(dev->pid < 0)
+    return -1;
+  if(dev->pid == 0) {
+    (void) dup2(fds[1], STDOUT_FILENO);
+    (void) close(fds[0]);
+    (void) close(fds[1]);
+    execlp(cfg->emu, cfg->emu, "baud", cfg->baud, "latency", cfg->latency,
+           "drain", cfg->drain, model, (char*) NULL);
+    _exit(127);
+  }
+
+  (void) close(fds[1]);
+  out = fdopen(fds[0], "r");
+  if((out == NULL) || (fgets(dev->path, sizeof(dev->path), out) == NULL)) {
+    if(out != NULL)
+      (void) fclose(out);
+    return -1;
+  }
+  dev->path[strcspn(dev->path, "\n")] = '\0';
+  (void) fclose(out);
+
+  return 0;
+}
+
+
+/**********************************************************************
+ * Name        : openDevice
+ * Description : Open a device and read its status once.
+ * Arguments   : dev = The device
+ * Returning   : TBAN_OK or the error from libtban
+ **********************************************************************/
+static int openDevice(struct BenchDevice* dev) {
+  struct TBan* tban = &dev->tban;
+  int result;
+
+  if(((result = tban_init(tban, dev->path)) != TBAN_OK) ||
+     ((result = bigNG_init(tban)) != TBAN_OK) ||
+     ((result = miniNG_init(tban)) != TBAN_OK) ||
+     ((result = tban_open(tban)) != TBAN_OK) ||
+     ((result = tban_queryStatus(tban)) != TBAN_OK))
+    return result;
+
+  return TBAN_OK;
+}
+
+
+/**********************************************************************
+ * Name        : closeDevice
+ * Description : Close a device and stop its emulator.
+ * Arguments   : dev = The device
+ * Returning   : none
+ **********************************************************************/
+static void closeDevice(struct BenchDevice* dev) {
+  (void) tban_close(&dev->tban);
+  if(dev->tban.locked == 1)
+    (void) tban_unlock(&dev->tban);
+  (void) tban_free(&dev->tban);
+
+  if(dev->pid > 0) {
+    (void) kill(dev->pid, SIGTERM);
+    (void) waitpid(dev->pid, NULL, 0);
+  }
+}
+
+
+/**********************************************************************
+ * Name        : benchDevice
+ * Description : Run all benchmarks that apply to a device.
+ * Arguments   : cfg = The configuration
+ *               dev = The device, opened
+ * Returning   : none
+ **********************************************************************/
+static void benchDevice(const struct BenchConfig* cfg, struct BenchDevice* dev) {
+  struct TBan* tban = &dev->tban;
+  int n = cfg->iterations;
+  /* The setters change the configuration of a real controller and
+   * leave it changed, only the emulator gets them by default */
+  int writes = (dev->pid > 0) || cfg->writes;
+
+  runBench(cfg, dev, "tban_queryStatus", opQueryStatus, n);
+
+  if(bigNG_present(tban) == BIGNG_PRESENT) {
+    runBench(cfg, dev, "bigNG_queryStatus", opBigNGQueryStatus, n);
+  } else if(miniNG_queryStatus(tban) == TBAN_OK) {
+    runBench(cfg, dev, "miniNG_queryStatus", opMiniNGQueryStatus, n);
+    if(writes)
+      runBench(cfg, dev, "miniNG_setChCurve", opMiniNGSetChCurve, n/BENCH_UPLOAD_DIVISOR);
+  }
+
+  if(writes) {
+    runBench(cfg, dev, "tban_setChPwm", opSetChPwm, n);
+    runBench(cfg, dev, "tban_setLED", opSetLED, n);
+    runBench(cfg, dev, "tban_setChCurve", opSetChCurve, n/BENCH_UPLOAD_DIVISOR);
+  }
+  runBench(cfg, dev, "decodeAll", opDecodeAll, n*BENCH_DECODE_FACTOR);
+  runBench(cfg, dev, "tban_decodeAll", opBulkDecode, n*BENCH_DECODE_FACTOR);
+}
+
+
+/**********************************************************************
+ * Name        : printHelp
+ * Description : 
+ * Arguments   : 
+ * Returning   : -
+ **********************************************************************/
+static void printHelp() {
+  printf("usage: tban_bench [options]\n");
+  printf("  dev <device>                 \tRun against a real device instead of the emulator\n");
+  printf("  emu <path>                   \tEmulator to start (%s)\n", TBAN_BENCH_EMU);
+  printf("  iterations <n>               \tCalls per benchmark (%d)\n", BENCH_ITERATIONS);
+  printf("  baud <rate>                  \tEmulated wire speed, 0 = unlimited (0)\n");
+  printf("  latency <ms>                 \tEmulated answer latency (0)\n");
+  printf("  drain <ms>                   \tEmulated miniNG pass-through time (5)\n");
+  printf("  filter <text>                \tOnly run benchmarks whose name contains text\n");
+  printf("  out <file>                   \tWrite the results to file instead of stdout\n");
+  printf("  writes                       \tAlso run the setters on a real device (changes its settings)\n");
+}
+
+
+int main(int argc, char* argv[]) {
+  struct BenchConfig cfg;
+  struct BenchDevice dev;
+  const char*        device = NULL;
+  const char*        outName = NULL;
+  const char*        models[] = { "mining", "bigng" };
+  int                result, i;
+
+  cfg.emu        = TBAN_BENCH_EMU;
+  cfg.baud       = "0";
+  cfg.latency    = "0";
+  cfg.drain      = "5";
+  cfg.filter     = NULL;
+  cfg.iterations = BENCH_ITERATIONS;
+  cfg.writes     = 0;
+  cfg.out        = stdout;
+
+  for(i=1; i<argc; i++) {
+    if((strcmp(argv[i], "dev") == 0) && (i+1 < argc)) {
+      device = argv[++i];
+    } else if((strcmp(argv[i], "emu") == 0) && (i+1 < argc)) {
+      cfg.emu = argv[++i];
+    } else if((strcmp(argv[i], "iterations") == 0) && (i+1 < argc)) {
+      cfg.iterations = atoi(argv[++i]);
+    } else if((strcmp(argv[i], "baud") == 0) && (i+1 < argc)) {
+      cfg.baud = argv[++i];
+    } else if((strcmp(argv[i], "latency") == 0) && (i+1 < argc)) {
+      cfg.latency = argv[++i];
+    } else if((strcmp(argv[i], "drain") == 0) && (i+1 < argc)) {
+      cfg.drain = argv[++i];
+    } else if((strcmp(argv[i], "filter") == 0) && (i+1 < argc)) {
+      cfg.filter = argv[++i];
+    } else if((strcmp(argv[i], "out") == 0) && (i+1 < argc)) {
+      outName = argv[++i];
+    } else if(strcmp(argv[i], "writes") == 0) {
+      cfg.writes = 1;
+    } else {
+      printHelp();
+      return EXIT_FAILURE;
+    }
+  }
+
+#ifndef NDEBUG
+  /* libtban is built with the same flags and would print its trace */
+  fprintf(stderr, "tban_bench needs a build with NDEBUG, configure with -DCMAKE_BUILD_TYPE=Release\n");
+  return EXIT_FAILURE;
+#endif
+
+  if(outName != NULL) {
+    cfg.out = fopen(outName, "w");
+    if(cfg.out == NULL) {
+      fprintf(stderr, "Cannot open %s: %s\n", outName, strerror(errno));
+      return EXIT_FAILURE;
+    }
+  }
+
+  /* A real device is benchmarked as it is */
+  if(device != NULL) {
+    (void) memset(&dev, 0, sizeof(dev));
+    dev.label = "dev";
+    (void) snprintf(dev.path, sizeof(dev.path), "%s", device);
+    result = openDevice(&dev);
+    if(result != TBAN_OK) {
+      fprintf(stderr, "RUNTIME ERROR: %s(%d) \"%s\" when opening %s\n", tban_strerror(result), result, tban_strerrordesc(result), device);
+      return EXIT_FAILURE;
+    }
+    benchDevice(&cfg, &dev);
+    closeDevice(&dev);
+    return EXIT_SUCCESS;
+  }
+
+  for(i=0; i<2; i++) {
+    (void) memset(&dev, 0, sizeof(dev));
+    dev.label = models[i];
+    if(startEmu(&cfg, &dev, models[i]) != 0) {
+      fprintf(stderr, "Cannot start the emulator %s\n", cfg.emu);
+      return EXIT_FAILURE;
+    }
+    result = openDevice(&dev);
+    if(result != TBAN_OK) {
+      fprintf(stderr, "RUNTIME ERROR: %s(%d) \"%s\" when opening %s\n", tban_strerror(result), result, tban_strerrordesc(result), dev.path);
+      closeDevice(&dev);
+      return EXIT_FAILURE;
+    }
+    benchDevice(&cfg, &dev);
+    closeDevice(&dev);
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -29,6 +29,7 @@
  *****************************************************************************/
  
 #include "big_ng.h"
+#include "sampler.h"
 #include "common.h"
 
 
@@ -51,36 +52,16 @@
 #define BIGNG_SER_MODE             0x3A
 
 /*****************************************************************************
- * System answer index values
+ * System answer index values are in fields.h (BIGNG_FIELDS)
  *****************************************************************************/
 
-/* Output mode */
-#define BIGNG_OUT_MODE         136 /* Code reviewed verif ok 2006-10-02 */
+static int bigNG_statusReceived(struct TBan* tban);
 
-/* Overtemp indication */
-#define BIGNG_SYS_OT           145 /* Code reviewed verif ok 2006-10-02 */
+/* The BigNG status frame (SOURCE2) */
+static const struct TBanFrameSpec bigNG_statusFrame = {
+  285, 285, 0, 0, { 0 }, { 0 }
+};
 
-/* Sensor - channel assignement */
-#define BIGNG_DSENS_ASSIGN             45
-#define BIGNG_ASENS_ASSIGN             49
-#define BIGNG_SPECIFIC_SENS_ASSIGN    164
-
-/* BigNG analog sensors */
-#define BIGNG_AS_CALIBRATED_VALUE     260
-#define BIGNG_AS_RAW_VALUE            256
-#define BIGNG_AS_SCALING_FACTOR       129
-#define BIGNG_AS_ABS_SCALING_FACTOR   142
-#define BIGNG_DS_ABS_SCALING_FACTOR   128
-#define BIGNG_DS_SCALING_FACTOR        19
-#define BIGNG_DS_CALIBRATED_VALUE     238
-#define BIGNG_DS_RAW_VALUE            208
-#define BIGNG_TARGET_TEMP             118
-#define BIGNG_TARGET_MODE             122
-#define BIGNG_PWM                     137
-#define BIGNG_TEMP                    252
-#define BIGNG_MODE                    101
-
-static int bigNG_getChMaxPwmMapping[]   = { 148, 150, 152, 154 };
 
 
 /**********************************************************************
@@ -154,7 +135,7 @@ int bigNG_getOutputMode(struct TBan* tban, unsigned char mode[]) {
   if(tban == NULL)
     return TBAN_STRUCT_NULL_PTR;
   
-  CHECK_RESULT(tban_getValue(tban, BIGNG_OUT_MODE, &modeval));
+  CHECK_RESULT(tban_getValue(tban, TBAN_FIELD_AT(bigNGoutMode, 0), &modeval));
 
   for(i=0; i<4; i++) {
     mask = 1<<i;
@@ -182,7 +163,7 @@ int bigNG_getOvertemp(struct TBan* tban, unsigned char* ot) {
   if(ot == NULL)
     return TBAN_VALUE_NULL_PTR;
 
-  CHECK_RESULT(tban_getValue(tban, BIGNG_SYS_OT, ot));
+  CHECK_RESULT(tban_getValue(tban, TBAN_FIELD_AT(bigNGovertemp, 0), ot));
 
   return TBAN_OK;
 }
@@ -217,9 +198,9 @@ int bigNG_getChSensAssignment(struct TBan* tban, unsigned char index, unsigned c
 
   /* Fetch all sensor information (The standars ones that are same as
    * TBan classic and the specific ones for BigNG) */
-  CHECK_RESULT(tban_getValue(tban, BIGNG_DSENS_ASSIGN+index, dsens));
-  CHECK_RESULT(tban_getValue(tban, BIGNG_ASENS_ASSIGN+index, asens));
-  CHECK_RESULT(tban_getValue(tban, BIGNG_SPECIFIC_SENS_ASSIGN+index, bngsens));
+  CHECK_RESULT(tban_getValue(tban, TBAN_FIELD_AT(chDsens, index), dsens));
+  CHECK_RESULT(tban_getValue(tban, TBAN_FIELD_AT(chAsens, index), asens));
+  CHECK_RESULT(tban_getValue(tban, TBAN_FIELD_AT(bigNGchSens, index), bngsens));
 
   return TBAN_OK;
 }
@@ -333,10 +314,10 @@ int bigNG_getaSensorTemp(struct TBan* tban, int index, unsigned char* temp, unsi
     return TBAN_NOT_OPENED;
 
   /* Get the temperature of the analog sensor */
-  CHECK_RESULT(tban_getValue(tban, BIGNG_AS_CALIBRATED_VALUE + index, temp));
-  CHECK_RESULT(tban_getValue(tban, BIGNG_AS_RAW_VALUE + index, rawTemp));
-  CHECK_RESULT(tban_getValue(tban, BIGNG_AS_SCALING_FACTOR + index, cal));
-  CHECK_RESULT(bigNG_getValue(tban, BIGNG_AS_ABS_SCALING_FACTOR + index, abscal));
+  CHECK_RESULT(tban_getValue(tban, TBAN_FIELD_AT(bigNGasTemp, index), temp));
+  CHECK_RESULT(tban_getValue(tban, TBAN_FIELD_AT(bigNGasRawTemp, index), rawTemp));
+  CHECK_RESULT(tban_getValue(tban, TBAN_FIELD_AT(bigNGasCal, index), cal));
+  CHECK_RESULT(bigNG_getValue(tban, TBAN_FIELD_AT(bigNGasAbsCal, index), abscal));
 
   return TBAN_OK;
 
@@ -372,10 +353,10 @@ int bigNG_getdSensorTemp(struct TBan* tban, int index, unsigned char* temp, unsi
     return TBAN_NOT_OPENED;
 
   /* Get the temperature of the digital sensor */
-  CHECK_RESULT(tban_getValue(tban, BIGNG_DS_CALIBRATED_VALUE + index, temp));
-  CHECK_RESULT(tban_getValue(tban, BIGNG_DS_RAW_VALUE + index, rawTemp));
-  CHECK_RESULT(tban_getValue(tban, BIGNG_DS_SCALING_FACTOR + index, cal));
-  CHECK_RESULT(bigNG_getValue(tban, BIGNG_DS_ABS_SCALING_FACTOR + index, abscal));
+  CHECK_RESULT(tban_getValue(tban, TBAN_FIELD_AT(dsTemp, index), temp));
+  CHECK_RESULT(tban_getValue(tban, TBAN_FIELD_AT(dsRawTemp, index), rawTemp));
+  CHECK_RESULT(tban_getValue(tban, TBAN_FIELD_AT(dsCal, index), cal));
+  CHECK_RESULT(bigNG_getValue(tban, TBAN_FIELD_AT(bigNGdsAbsCal, index), abscal));
 
   return TBAN_OK;
 }
@@ -394,34 +375,121 @@ int bigNG_getdSensorTemp(struct TBan* tban, int index, unsigned char* temp, unsi
  **********************************************************************/
 
 int bigNG_queryStatus(struct TBan* tban) {
-  unsigned char sndBuf[8];
-  
   /* Sanity check */
   if(tban == NULL)
     return TBAN_STRUCT_NULL_PTR;
   if(tban->opened == 0)
     return TBAN_NOT_OPENED;
-  
-  /* Send the query command. Make sure that the command is sent to the
-   * TBan itself and not to the add-on modules such as miniNG. */
-  sndBuf[0] = TBAN_SER_SOURCE2;
-  sndBuf[1] = TBAN_SER_REQUEST;
-  CHECK_RESULT(tban_sendCommand(tban, sndBuf, 2));
-  
-  /* Receive the result from the HW */
-  CHECK_RESULT(tban_readData(tban, tban->bigNG.buf, 285));
 
+  /* The sampler thread already has a fresh vector */
+  if(tban_samplerCovers(tban, TBAN_SAMPLE_BIGNG))
+    return tban_samplerCopy(tban, TBAN_SAMPLE_BIGNG);
+
+  CHECK_RESULT(bigNG_fetchStatus(tban, tban->bigNG.buf));
+
+  return bigNG_statusReceived(tban);
+}
+
+
+/**********************************************************************
+ * Name        : bigNG_statusReceived
+ * Description : Validate a freshly received second status vector and
+ *               update the time stamp. Shared by bigNG_queryStatus and
+ *               bigNG_queryStatusStart.
+ * Arguments   : tban = The TBan structure.
+ * Returning   : TBAN_OK
+ *               TBAN_CORRUPT_DATA
+ **********************************************************************/
+static int bigNG_statusReceived(struct TBan* tban) {
   if(bigNG_dataPresent(tban) != TBAN_OK) {
+    tban_statsCount(tban, &tban->stats.corrupt);
     return TBAN_CORRUPT_DATA;
   }
   
   /*Update the time stamp for the last update, but only if we suceeded
    * with the update */
   tban->bigNG.lastQuery = time(NULL);
+  tban_shmUpdate(tban, TBAN_SAMPLE_BIGNG, NULL, tban->bigNG.buf, NULL, tban->bigNG.lastQuery);
+  tban_recorderUpdate(tban, TBAN_SAMPLE_BIGNG, NULL, tban->bigNG.buf, NULL);
+
+  return TBAN_OK;
+}
+
+
+/**********************************************************************
+ * Name        : bigNG_queryStatusStart
+ * Description : Ask the BigNG for the second status vector without
+ *               waiting for the answer, see tban_queryStatusStart. The
+ *               transfer is driven by an event loop (tban_loop.h).
+ * Arguments   : tban = The TBan structure.
+ *               cb   = Completion callback.
+ *               ptr  = Passed to the callback unaltered.
+ * Returning   : TBAN_OK
+ *               TBAN_STRUCT_NULL_PTR
+ *               TBAN_NOT_OPENED
+ *               TBAN_ALREADY_IN_USE
+ *               TBAN_ESEND
+ **********************************************************************/
+int bigNG_queryStatusStart(struct TBan* tban, tban_rxCb* cb, void* ptr) {
+  unsigned char sndBuf[2];
+
+  /* Sanity check */
+  if(tban == NULL)
+    return TBAN_STRUCT_NULL_PTR;
+
+  CHECK_RESULT(tban_rxStart(tban, &bigNG_statusFrame, tban->bigNG.buf, 0, tban->timeout,
+                            bigNG_statusReceived, cb, ptr));
+  tban_discardInput(tban);
+
+  sndBuf[0] = TBAN_SER_SOURCE2;
+  sndBuf[1] = TBAN_SER_REQUEST;
+  if(tban_writeCommand(tban, sndBuf, 2) != TBAN_OK) {
+    tban->rx.pending = TBAN_FALSE;
+    tban->rx.cb      = NULL;
+    return TBAN_ESEND;
+  }
 
   return TBAN_OK;
 }
 
+
+/**********************************************************************
+ * Name        : bigNG_fetchStatus
+ * Description : Request the second status vector and store it in the
+ *               buffer supplied. The request and the answer form one
+ *               transaction on the port.
+ * Arguments   : tban = The TBan structure.
+ *               buf  = Receive buffer, at least 285 bytes.
+ * Returning   : TBAN_OK
+ *               TBAN_ESEND
+ *               TBAN_ERECEIVE
+ **********************************************************************/
+int bigNG_fetchStatus(struct TBan* tban, unsigned char* buf) {
+  unsigned char sndBuf[8];
+  int result;
+
+  result = tban_portLock(tban);
+  if(result != TBAN_OK)
+    return result;
+
+  /* Leftovers from an earlier aborted transfer would end up in front
+   * of the frame */
+  tban_discardInput(tban);
+
+  /* Send the query command to the second source */
+  sndBuf[0] = TBAN_SER_SOURCE2;
+  sndBuf[1] = TBAN_SER_REQUEST;
+  result = tban_writeCommand(tban, sndBuf, 2);
+  
+  /* Receive the result from the HW */
+  if(result == TBAN_OK)
+    result = tban_readFrame(tban, &bigNG_statusFrame, buf, NULL);
+
+  tban_portUnlock(tban);
+
+  return result;
+}
+
 /**********************************************************************
  * Name        : bigNG_dataPresent
  * Description : Checks the data in the second status vector
@@ -589,6 +657,7 @@ int bigNG_setDsAbsScalingFact(struct TBan* tban, unsigned char index, unsigned c
  **********************************************************************/
 int bigNG_setChTargetTemp(struct TBan* tban, unsigned char index, unsigned char target) {
   unsigned char sndBuf[8];
+  struct TBanShadowRef ref;
   
   /* Argument sanity check */
   if(tban == NULL)
@@ -599,9 +668,12 @@ int bigNG_setChTargetTemp(struct TBan* tban, unsigned char index, unsigned char
   /* Send the manual mode command */
   sndBuf[0] = BIGNG_SER_ZT+index;
   sndBuf[1] = 2*target;
+  ref.index  = TBAN_FIELD_AT(bigNGchTarget, index);
+  ref.value  = ref.expect = sndBuf[1];
+  ref.verify = (tban->buf[TBAN_INFO_TYPE] == TBAN_DEVICE_TYPE_BIGNG);
   
   /* Perform the command */
-  CHECK_RESULT(tban_sendCommand(tban, sndBuf, 2));
+  CHECK_RESULT(tban_sendShadowed(tban, sndBuf, 2, &ref, 1));
   
   /* Update progress */
   tban_updateProgress(tban, 1, 1);
@@ -629,6 +701,7 @@ int bigNG_setChTargetTemp(struct TBan* tban, unsigned char index, unsigned char
  **********************************************************************/
 int bigNG_setChTargetMode(struct TBan* tban, unsigned char index, unsigned char mode) {
   unsigned char sndBuf[8];
+  struct TBanShadowRef ref;
   
   /* Argument sanity check */
   if(tban == NULL)
@@ -641,9 +714,12 @@ int bigNG_setChTargetMode(struct TBan* tban, unsigned char index, unsigned char
   /* Send the manual mode command */
   sndBuf[0] = BIGNG_SER_MODE+index;
   sndBuf[1] = mode;
+  ref.index  = TBAN_FIELD_AT(bigNGchTargetMode, index);
+  ref.value  = ref.expect = mode;
+  ref.verify = (tban->buf[TBAN_INFO_TYPE] == TBAN_DEVICE_TYPE_BIGNG);
   
   /* Perform the command */
-  CHECK_RESULT(tban_sendCommand(tban, sndBuf, 2));
+  CHECK_RESULT(tban_sendShadowed(tban, sndBuf, 2, &ref, 1));
   
   /* Update progress */
   tban_updateProgress(tban, 1, 1);
@@ -686,11 +762,11 @@ int bigNG_getChInfo(struct TBan* tban, int index, unsigned int* rpmMax, unsigned
     return TBAN_NOT_OPENED;
 
   /* Get the maximum pwm */
-  CHECK_RESULT(tban_getValue(tban, bigNG_getChMaxPwmMapping[index], &lb));
-  CHECK_RESULT(tban_getValue(tban, bigNG_getChMaxPwmMapping[index]+1, &hb));
+  CHECK_RESULT(tban_getValue(tban, TBAN_FIELD_AT(chRpmMax, index), &lb));
+  CHECK_RESULT(tban_getValue(tban, TBAN_FIELD_AT(chRpmMax, index)+1, &hb));
 
   /* Calculate the maximum rpm  */
-  *rpmMax = (unsigned int) (((float) 256*hb + lb) * (float) 10.5);
+  *rpmMax = TBAN_RPM_MAX(hb, lb);
 
   /* Get the pwm */
   if(index >= TBAN_NUMBER_CHANNELS) {
@@ -698,19 +774,19 @@ int bigNG_getChInfo(struct TBan* tban, int index, unsigned int* rpmMax, unsigned
   }
 
   /* Get the pwm */
-  CHECK_RESULT(tban_getValue(tban, BIGNG_PWM + index, pwm));
+  CHECK_RESULT(tban_getValue(tban, TBAN_FIELD_AT(chPwm, index), pwm));
 
   /* The pwm needs to be corrected to be valid according to the max-rpm */
   (*pwm) = 2*(*pwm);
 
   /* Get temp. Strangely enough the european product TBan returns the
    * temperature in Farenheit so we need to convert it to Celsius... */
-  CHECK_RESULT(tban_getValue(tban, BIGNG_TEMP + index, resTemp));
+  CHECK_RESULT(tban_getValue(tban, TBAN_FIELD_AT(chTemp, index), resTemp));
 
   /* Get mode */
-  CHECK_RESULT(tban_getValue(tban, BIGNG_MODE + index, mode));
-  CHECK_RESULT(tban_getValue(tban, BIGNG_TARGET_TEMP + index, target));
-  CHECK_RESULT(tban_getValue(tban, BIGNG_TARGET_MODE + index, targetmode));
+  CHECK_RESULT(tban_getValue(tban, TBAN_FIELD_AT(chMode, index), mode));
+  CHECK_RESULT(tban_getValue(tban, TBAN_FIELD_AT(bigNGchTarget, index), target));
+  CHECK_RESULT(tban_getValue(tban, TBAN_FIELD_AT(bigNGchTargetMode, index), targetmode));
 
   return TBAN_OK;
 }
@@ -30,6 +30,8 @@
 #ifndef __COMMON_H
 #define __COMMON_H
 
+#include "fields.h"
+
 /*****************************************************************************
  * Check if the result from the function called is anything else than
  * TBAN_OK. If so return from the function with the obtained return
@@ -42,6 +44,12 @@
                                } \
                              }
 
+/*****************************************************************************
+ * Maximum rpm of a channel from the two bytes in the status vector. The
+ * vector counts in units of 10.5 rpm.
+ *****************************************************************************/
+#define TBAN_RPM_MAX(hb, lb)  (((256*(unsigned int) (hb)) + (unsigned int) (lb)) * 21 / 2)
+
 /**********************************************************************
  * Name        : local_nanosleep
  * Description : Sleep for some time
@@ -71,6 +79,67 @@ static void local_nanosleep(long sec, long nano) {
 }
 
 
+/**********************************************************************
+ * Name        : local_monotonicMs
+ * Description : Read the monotonic clock. Used for timeouts since it
+ *               is not affected by changes to the wall clock.
+ * Arguments   : none
+ * Returning   : Milliseconds since some unspecified starting point
+ **********************************************************************/
+static long long local_monotonicMs(void) {
+  struct timespec now;
+
+  (void) clock_gettime(CLOCK_MONOTONIC, &now);
+  return ((long long) now.tv_sec)*1000 + now.tv_nsec/1000000;
+}
+
+
+/**********************************************************************
+ * Name        : local_monotonicUs
+ * Description : Read the monotonic clock with microsecond resolution.
+ *               Used for the latency statistics.
+ * Arguments   : none
+ * Returning   : Microseconds since some unspecified starting point
+ **********************************************************************/
+static long long local_monotonicUs(void) {
+  struct timespec now;
+
+  (void) clock_gettime(CLOCK_MONOTONIC, &now);
+  return ((long long) now.tv_sec)*1000000 + now.tv_nsec/1000;
+}
+
+
+/**********************************************************************
+ * Name        : tban_ioLock / tban_ioUnlock
+ * Description : Take/release the port of the handle. Used around every
+ *               transaction (command + answer) so that the sampler
+ *               thread and the application do not interleave.
+ * Arguments   : tban = The TBan handle
+ * Returning   : none
+ **********************************************************************/
+static void tban_ioLock(struct TBan* tban) {
+  (void) pthread_mutex_lock(&tban->ioLock);
+}
+
+static void tban_ioUnlock(struct TBan* tban) {
+  (void) pthread_mutex_unlock(&tban->ioLock);
+}
+
+
+/*****************************************************************************
+ * A status vector index affected by a setter command, see
+ * tban_sendShadowed. value is the argument as given to the setter and
+ * expect the value the index will read back. verify tells if the
+ * current vector may be trusted for the comparison.
+ *****************************************************************************/
+struct TBanShadowRef {
+  int           index;
+  unsigned char value;
+  unsigned char expect;
+  int           verify;
+};
+
+
 /*****************************************************************************
  * Declaration of functions needed by all subcomponents within the XBan
  * project
@@ -78,6 +147,57 @@ static void local_nanosleep(long sec, long nano) {
 void tban_updateProgress(struct TBan* tban, int cur, int max);
 int tban_sendCommand(struct TBan* tban, unsigned char* sndBuf, int cmdLen);
 int tban_readData(struct TBan* tban, unsigned char* buf, int expected);
+int tban_readDataTimeout(struct TBan* tban, unsigned char* buf, int expected, int timeoutMs);
+int tban_writeCommand(struct TBan* tban, unsigned char* sndBuf, int cmdLen);
+int tban_statusReceived(struct TBan* tban);
+
+/* Write-through setter cache (struct TBanShadow) */
+int tban_sendShadowed(struct TBan* tban, unsigned char* sndBuf, int cmdLen,
+                      const struct TBanShadowRef* refs, int count);
+void tban_shadowConfirm(struct TBan* tban, int first, int last);
+
+/* Port transactions, the I/O mutex and in TBAN_LOCK_TRANSACTION mode
+ * the device lock */
+int tban_portLock(struct TBan* tban);
+void tban_portUnlock(struct TBan* tban);
+
+/* I/O statistics (struct TBanStats) */
+void tban_statsCount(struct TBan* tban, unsigned long* counter);
+
+/* Command batch (struct TBanBatch), writing without the command delay */
+struct TBanBatch* tban_batchOwned(struct TBan* tban);
+int tban_batchWrite(struct TBan* tban, int wait);
+void tban_commandDelay(struct TBan* tban);
+
+void tban_discardInput(struct TBan* tban);
+int tban_readFrame(struct TBan* tban, const struct TBanFrameSpec* spec, unsigned char* buf, int* len);
+int tban_queryStatusStart(struct TBan* tban, tban_rxCb* cb, void* ptr);
+int bigNG_queryStatusStart(struct TBan* tban, tban_rxCb* cb, void* ptr);
+
+/* Raw status transactions, the vectors are stored in buf */
+int tban_fetchStatus(struct TBan* tban, unsigned char* buf);
+int bigNG_fetchStatus(struct TBan* tban, unsigned char* buf);
+int miniNG_fetchStatus(struct TBan* tban, unsigned char* buf);
+
+/* Copy the latest sampler snapshot into the handle */
+int tban_samplerCovers(struct TBan* tban, int which);
+int tban_samplerCopy(struct TBan* tban, int which);
+
+/* Publish received vectors in shared memory (see shm.h) */
+void tban_shmUpdate(struct TBan* tban, int which, const unsigned char* tbanBuf,
+                    const unsigned char* bigNGBuf, const unsigned char* miniNGBuf, time_t when);
+
+/* Record received vectors (see recorder.h) */
+void tban_recorderUpdate(struct TBan* tban, int which, const unsigned char* tbanBuf,
+                         const unsigned char* bigNGBuf, const unsigned char* miniNGBuf);
+
+/* Per handle receive state machine (see struct TBanRx) */
+int tban_rxStart(struct TBan* tban, const struct TBanFrameSpec* spec,
+                 unsigned char* dest, int expected, int timeoutMs,
+                 int (*finish)(struct TBan*), tban_rxCb* cb, void* ptr);
+int tban_rxFeed(struct TBan* tban);
+int tban_rxComplete(struct TBan* tban, int result);
+long long tban_rxIdleDeadline(struct TBan* tban);
 
 
 
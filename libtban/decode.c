@@ -0,0 +1,310 @@
+/*****************************************************************************
+ ** This program is free software; you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation; either version 2 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program; if not, write to the Free Software
+ ** Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ **
+ **
+ ** FILE INFORMATION
+ ** ----------------
+ ** Filename:        decode.c
+ ** Initial author:  marcus.jagemar@gmail.com
+ **
+ **
+ ** DESCRIPTION
+ ** -----------
+ ** Implementation of the bulk decoder, see decode.h.
+ **
+ ** The field lists of fields.h are expanded into one table per device
+ ** type. Each entry says which vector a value is read from, where the
+ ** first element is, the distance between the elements in the vector
+ ** and in the state, and how the byte is converted. A decode walks the
+ ** tables of the device types asked for once, there are no per value
+ ** checks. A second expansion gives the field information for
+ ** tban_getField.
+ **
+ **
+ *****************************************************************************/
+
+#include <stddef.h>
+
+#include "decode.h"
+#include "common.h"
+
+
+/*****************************************************************************
+ * One field of the decode tables: count elements of width bytes,
+ * byte j of element i is read from vec[offset+i*step+j] and written to
+ * the state at dest+i*stride+j.
+ *****************************************************************************/
+struct TBanField {
+  unsigned char  vector;    /* TBAN_VEC_* */
+  unsigned char  kind;      /* TBAN_FIELD_* */
+  unsigned char  count;
+  unsigned char  width;
+  unsigned short offset;
+  unsigned char  step;
+  unsigned char  stride;
+  unsigned short dest;
+  unsigned char  fwMin;
+};
+
+#define TBAN_STATE_STRIDE(member, count) \
+  (sizeof(((struct TBanState*) 0)->member) / (count))
+
+#define TBAN_DECODE_FIELD(name, vec, kind, offset, count, step, width, member, pos, unit, fwMin, doc) \
+  { vec, kind, count, width, offset, step, TBAN_STATE_STRIDE(member, count), \
+    offsetof(struct TBanState, member) + (pos), fwMin },
+
+static const struct TBanField tban_decodeTBan[] = {
+  TBAN_FIELDS(TBAN_DECODE_FIELD)
+};
+
+static const struct TBanField tban_decodeBigNG[] = {
+  BIGNG_FIELDS(TBAN_DECODE_FIELD)
+};
+
+static const struct TBanField tban_decodeMiniNG[] = {
+  MINI_NG_FIELDS(TBAN_DECODE_FIELD)
+};
+
+/* All fields in field number order, for tban_getField */
+static const struct TBanField tban_fieldInfo[TBAN_NUMBER_FIELDS] = {
+  TBAN_FIELDS(TBAN_DECODE_FIELD)
+  BIGNG_FIELDS(TBAN_DECODE_FIELD)
+  MINI_NG_FIELDS(TBAN_DECODE_FIELD)
+};
+
+#define TBAN_TABLE_SIZE(table)  (sizeof(table)/sizeof(table[0]))
+
+
+/**********************************************************************
+ * Name        : tban_fieldValue
+ * Description : Convert one raw value of a field.
+ * Arguments   : f   = The field
+ *               src = The raw value in the vector
+ * Returning   : The converted value
+ **********************************************************************/
+static unsigned int tban_fieldValue(const struct TBanField* f, const unsigned char* src) {
+  switch(f->kind) {
+    case TBAN_FIELD_PWM:
+      return 2*src[0];
+    case TBAN_FIELD_HALF:
+      return src[0]/2;
+    case TBAN_FIELD_RPM:
+      return TBAN_RPM_MAX(src[1], src[0]);
+    case TBAN_FIELD_CONST:
+      return f->offset;
+  }
+  return src[0];
+}
+
+
+/**********************************************************************
+ * Name        : tban_decodeTable
+ * Description : Decode all fields of a table.
+ * Arguments   : table = The fields
+ *               size  = Number of fields
+ *               vecs  = The vectors, indexed by TBAN_VEC_*
+ *               base  = The state
+ * Returning   : none
+ **********************************************************************/
+static void tban_decodeTable(const struct TBanField table[], unsigned int size,
+                             const unsigned char* vecs[], unsigned char* base) {
+  unsigned int i, j, k;
+
+  for(i=0; i<size; i++) {
+    const struct TBanField* f   = &table[i];
+    unsigned char*          dst = base + f->dest;
+    const unsigned char*    src;
+
+    if(f->kind == TBAN_FIELD_CONST) {
+      for(j=0; j<f->count; j++)
+        dst[j*f->stride] = (unsigned char) f->offset;
+      continue;
+    }
+
+    src = vecs[f->vector] + f->offset;
+    switch(f->kind) {
+      case TBAN_FIELD_BYTE:
+        for(j=0; j<f->count; j++)
+          for(k=0; k<f->width; k++)
+            dst[j*f->stride+k] = src[j*f->step+k];
+        break;
+      case TBAN_FIELD_PWM:
+        for(j=0; j<f->count; j++)
+          dst[j*f->stride] = 2*src[j*f->step];
+        break;
+      case TBAN_FIELD_HALF:
+        for(j=0; j<f->count; j++)
+          for(k=0; k<f->width; k++)
+            dst[j*f->stride+k] = src[j*f->step+k]/2;
+        break;
+      case TBAN_FIELD_RPM:
+        for(j=0; j<f->count; j++)
+          *(unsigned int*) (dst + j*f->stride) = TBAN_RPM_MAX(src[j*f->step+1], src[j*f->step]);
+        break;
+    }
+  }
+}
+
+
+/**********************************************************************
+ * Name        : tban_decodeVectors
+ * Description : Decode status vectors into the state. Only the fields
+ *               of the device types selected by the mask are written,
+ *               the rest of the state is left as it is.
+ * Arguments   : mask      = TBAN_SAMPLE_* of the decodes to run
+ *               tbanVec   = The TBan status vector (TBAN and BIGNG)
+ *               bigNGVec  = The second BigNG vector (BIGNG)
+ *               miniNGVec = The miniNG status vector (MINING)
+ *               state     = The state to fill in
+ * Returning   : TBAN_OK
+ *               TBAN_STRUCT_NULL_PTR
+ *               TBAN_VALUE_NULL_PTR
+ **********************************************************************/
+int tban_decodeVectors(int mask, const unsigned char tbanVec[], const unsigned char bigNGVec[],
+                       const unsigned char miniNGVec[], struct TBanState* state) {
+  const unsigned char* vecs[TBAN_VEC_COUNT];
+  unsigned char* base = (unsigned char*) state;
+
+  /* Sanity check */
+  if(state == NULL)
+    return TBAN_STRUCT_NULL_PTR;
+  if(((mask & (TBAN_SAMPLE_TBAN | TBAN_SAMPLE_BIGNG)) && (tbanVec == NULL)) ||
+     ((mask & TBAN_SAMPLE_BIGNG) && (bigNGVec == NULL)) ||
+     ((mask & TBAN_SAMPLE_MINING) && (miniNGVec == NULL)))
+    return TBAN_VALUE_NULL_PTR;
+
+  vecs[TBAN_VEC_TBAN]   = tbanVec;
+  vecs[TBAN_VEC_BIGNG]  = bigNGVec;
+  vecs[TBAN_VEC_MINING] = miniNGVec;
+
+  if(mask & TBAN_SAMPLE_TBAN)
+    tban_decodeTable(tban_decodeTBan, TBAN_TABLE_SIZE(tban_decodeTBan), vecs, base);
+  if(mask & TBAN_SAMPLE_BIGNG)
+    tban_decodeTable(tban_decodeBigNG, TBAN_TABLE_SIZE(tban_decodeBigNG), vecs, base);
+  if(mask & TBAN_SAMPLE_MINING)
+    tban_decodeTable(tban_decodeMiniNG, TBAN_TABLE_SIZE(tban_decodeMiniNG), vecs, base);
+
+  return TBAN_OK;
+}
+
+
+/**********************************************************************
+ * Name        : tban_getField
+ * Description : Get one value from the local vectors by its field
+ *               number. For fields with several bytes per element
+ *               (the curves) index counts the bytes, element
+ *               index/width, byte index%width.
+ * Arguments   : tban  = The TBan struct to work on
+ *               field = TBAN_F_*, see fields.h
+ *               index = Element (channel, sensor) of the field
+ *               value = The converted value
+ * Returning   : TBAN_OK
+ *               TBAN_STRUCT_NULL_PTR
+ *               TBAN_VALUE_NULL_PTR
+ *               TBAN_VALUE_OUT_OF_BOUNDS (unknown field)
+ *               TBAN_INDEX_OUT_OF_BOUNDS
+ *               TBAN_NOT_OPENED
+ *               TBAN_FW_TOO_OLD
+ **********************************************************************/
+int tban_getField(struct TBan* tban, int field, int index, unsigned int* value) {
+  const struct TBanField* f;
+  const unsigned char*    vec;
+
+  /* Sanity check */
+  if(tban == NULL)
+    return TBAN_STRUCT_NULL_PTR;
+  if(value == NULL)
+    return TBAN_VALUE_NULL_PTR;
+  if((field < 0) || (field >= TBAN_NUMBER_FIELDS))
+    return TBAN_VALUE_OUT_OF_BOUNDS;
+  f = &tban_fieldInfo[field];
+  if((index < 0) || (index >= f->count*f->width))
+    return TBAN_INDEX_OUT_OF_BOUNDS;
+  if(tban->opened == 0)
+    return TBAN_NOT_OPENED;
+  if(f->fwMin != 0)
+    CHECK_RESULT(tban_checkFw(tban, f->fwMin));
+
+  vec = (f->vector == TBAN_VEC_BIGNG)  ? tban->bigNG.buf  :
+        (f->vector == TBAN_VEC_MINING) ? tban->miniNG.buf : tban->buf;
+  *value = tban_fieldValue(f, vec + f->offset + (index/f->width)*f->step + index%f->width);
+
+  return TBAN_OK;
+}
+
+
+/**********************************************************************
+ * Name        : tban_decodeAll
+ * Description : Decode every TBan value of the local status vector.
+ *               Call tban_queryStatus first to get fresh values.
+ * Arguments   : tban  = The TBan struct to work on
+ *               state = The state to fill in
+ * Returning   : TBAN_OK
+ *               TBAN_STRUCT_NULL_PTR
+ *               TBAN_NOT_OPENED
+ **********************************************************************/
+int tban_decodeAll(struct TBan* tban, struct TBanState* state) {
+  /* Sanity check */
+  if((tban == NULL) || (state == NULL))
+    return TBAN_STRUCT_NULL_PTR;
+  if(tban->opened == 0)
+    return TBAN_NOT_OPENED;
+
+  return tban_decodeVectors(TBAN_SAMPLE_TBAN, tban->buf, NULL, NULL, state);
+}
+
+
+/**********************************************************************
+ * Name        : bigNG_decodeAll
+ * Description : Decode every value of a BigNG, the values shared with
+ *               the TBan and the BigNG specific ones. Call
+ *               tban_queryStatus and bigNG_queryStatus first.
+ * Arguments   : tban  = The TBan struct to work on
+ *               state = The state to fill in
+ * Returning   : TBAN_OK
+ *               TBAN_STRUCT_NULL_PTR
+ *               TBAN_NOT_OPENED
+ **********************************************************************/
+int bigNG_decodeAll(struct TBan* tban, struct TBanState* state) {
+  /* Sanity check */
+  if((tban == NULL) || (state == NULL))
+    return TBAN_STRUCT_NULL_PTR;
+  if(tban->opened == 0)
+    return TBAN_NOT_OPENED;
+
+  return tban_decodeVectors(TBAN_SAMPLE_TBAN | TBAN_SAMPLE_BIGNG, tban->buf,
+                            tban->bigNG.buf, NULL, state);
+}
+
+
+/**********************************************************************
+ * Name        : miniNG_decodeAll
+ * Description : Decode every miniNG value of the local miniNG vector.
+ *               Call miniNG_queryStatus first.
+ * Arguments   : tban  = The TBan struct to work on
+ *               state = The state to fill in
+ * Returning   : TBAN_OK
+ *               TBAN_STRUCT_NULL_PTR
+ *               TBAN_NOT_OPENED
+ **********************************************************************/
+int miniNG_decodeAll(struct TBan* tban, struct TBanState* state) {
+  /* Sanity check */
+  if((tban == NULL) || (state == NULL))
+    return TBAN_STRUCT_NULL_PTR;
+  if(tban->opened == 0)
+    return TBAN_NOT_OPENED;
+
+  return tban_decodeVectors(TBAN_SAMPLE_MINING, NULL, NULL, tban->miniNG.buf, state);
+}
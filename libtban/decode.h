@@ -0,0 +1,139 @@
+/*****************************************************************************
+ ** This program is free software; you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation; either version 2 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program; if not, write to the Free Software
+ ** Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ **
+ **
+ ** FILE INFORMATION
+ ** ----------------
+ ** Filename:        decode.h
+ ** Initial author:  marcus.jagemar@gmail.com
+ **
+ **
+ ** DESCRIPTION
+ ** -----------
+ ** Bulk decoding of the status vectors. Instead of calling
+ ** tban_getChInfo, tban_getdSensorTemp, tban_getChCurve... one value at
+ ** a time, tban_decodeAll fills a struct TBanState with every value of
+ ** the vector in one pass. The values are the same as the getters
+ ** return (pwm in percent, temperatures doubled, curves including the
+ ** fixed points).
+ **
+ ** bigNG_decodeAll and miniNG_decodeAll add the values that are
+ ** specific to the BigNG and the miniNG. tban_decodeVectors does the
+ ** same on vectors that are not in a handle, a sampler snapshot or a
+ ** replayed recording for instance.
+ **
+ ** tban_getField reads a single value by its field number (fields.h),
+ ** with the index and firmware checks the field table gives.
+ **
+ **
+ ** REVISION HISTORY
+ ** ----------------
+ **
+ ** Date        Comment
+ ** =================================================================
+ ** 2026-10-17  File created
+ ** 2026-10-17  The decoders are generated from fields.h, added
+ **             tban_getField
+ **
+ *****************************************************************************/
+
+/* Muliple inclusion safeguard */
+#ifndef __DECODE_H
+#define __DECODE_H
+
+#include "tban.h"
+#include "sampler.h"
+#include "fields.h"
+
+
+/*****************************************************************************
+ * Points of the response curves, see tban_getChCurve and
+ * miniNG_getChCurve
+ *****************************************************************************/
+#define TBAN_CURVE_POINTS     7
+#define MINI_NG_CURVE_POINTS  6
+
+
+/*****************************************************************************
+ * The decoded state, one array per value
+ *****************************************************************************/
+struct TBanState {
+  /* TBan channels (tban_getChInfo, tban_getChMode, ...) */
+  unsigned int  chRpmMax[TBAN_NUMBER_CHANNELS];
+  unsigned char chPwm[TBAN_NUMBER_CHANNELS];
+  unsigned char chTemp[TBAN_NUMBER_CHANNELS];
+  unsigned char chMode[TBAN_NUMBER_CHANNELS];
+  unsigned char chStartMode[TBAN_NUMBER_CHANNELS];
+  unsigned char chHysteresis[TBAN_NUMBER_CHANNELS];
+  unsigned char chOvertemp[TBAN_NUMBER_CHANNELS];
+  unsigned char chDsens[TBAN_NUMBER_CHANNELS];
+  unsigned char chAsens[TBAN_NUMBER_CHANNELS];
+  unsigned char chCurveX[TBAN_NUMBER_CHANNELS][TBAN_CURVE_POINTS];
+  unsigned char chCurveY[TBAN_NUMBER_CHANNELS][TBAN_CURVE_POINTS];
+
+  /* TBan sensors (tban_getdSensorTemp, tban_getaSensorTemp) */
+  unsigned char dsTemp[TBAN_NUMBER_DIGITAL_SENSORS];
+  unsigned char dsRawTemp[TBAN_NUMBER_DIGITAL_SENSORS];
+  unsigned char dsCal[TBAN_NUMBER_DIGITAL_SENSORS];
+  unsigned char asTemp[TBAN_NUMBER_ANALOG_SENSORS];
+  unsigned char asRawTemp[TBAN_NUMBER_ANALOG_SENSORS];
+  unsigned char asCal[TBAN_NUMBER_ANALOG_SENSORS];
+
+  /* TBan system values (tban_getLED, tban_getWatchdog, ...) */
+  unsigned char pwmFreq;
+  unsigned char led;
+  unsigned char buzzer;
+  unsigned char warnLevel;
+  unsigned char fwVersion;
+  unsigned char protocol;
+  unsigned char wdCounter;
+  unsigned char wdEnabled;
+
+  /* BigNG (bigNG_getChInfo, bigNG_getaSensorTemp, ...) */
+  unsigned char bigNGoutMode;
+  unsigned char bigNGovertemp;
+  unsigned char bigNGchTarget[TBAN_NUMBER_CHANNELS];
+  unsigned char bigNGchTargetMode[TBAN_NUMBER_CHANNELS];
+  unsigned char bigNGchSens[TBAN_NUMBER_CHANNELS];
+  unsigned char bigNGdsAbsCal[TBAN_NUMBER_DIGITAL_SENSORS];
+  unsigned char bigNGasTemp[BIGNG_NUMBER_ADDITIONAL_ANALOG_SENSORS];
+  unsigned char bigNGasRawTemp[BIGNG_NUMBER_ADDITIONAL_ANALOG_SENSORS];
+  unsigned char bigNGasCal[BIGNG_NUMBER_ADDITIONAL_ANALOG_SENSORS];
+  unsigned char bigNGasAbsCal[BIGNG_NUMBER_ADDITIONAL_ANALOG_SENSORS];
+
+  /* miniNG (miniNG_getChRpm, miniNG_getaSensorTemp, ...) */
+  unsigned char miniNGchRpm[MINI_NG_NUMBER_CHANNELS];
+  unsigned char miniNGchRpmMax[MINI_NG_NUMBER_CHANNELS];
+  unsigned char miniNGchHysteresis[MINI_NG_NUMBER_CHANNELS];
+  unsigned char miniNGchOvertemp[MINI_NG_NUMBER_CHANNELS];
+  unsigned char miniNGchCurveX[MINI_NG_NUMBER_CHANNELS][MINI_NG_CURVE_POINTS];
+  unsigned char miniNGchCurveY[MINI_NG_NUMBER_CHANNELS][MINI_NG_CURVE_POINTS];
+  unsigned char miniNGasTemp[MINI_NG_NUMBER_ANALOG_SENSORS];
+  unsigned char miniNGasRawTemp[MINI_NG_NUMBER_ANALOG_SENSORS];
+  unsigned char miniNGasCal[MINI_NG_NUMBER_ANALOG_SENSORS];
+};
+
+
+/*****************************************************************************
+ * Exported functions
+ *****************************************************************************/
+int tban_decodeAll(struct TBan* tban, struct TBanState* state);
+int bigNG_decodeAll(struct TBan* tban, struct TBanState* state);
+int miniNG_decodeAll(struct TBan* tban, struct TBanState* state);
+int tban_decodeVectors(int mask, const unsigned char tbanVec[], const unsigned char bigNGVec[],
+                       const unsigned char miniNGVec[], struct TBanState* state);
+int tban_getField(struct TBan* tban, int field, int index, unsigned int* value);
+
+#endif /* __DECODE_H */
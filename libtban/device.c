@@ -0,0 +1,531 @@
+/*****************************************************************************
+ ** This program is free software; you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation; either version 2 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program; if not, write to the Free Software
+ ** Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ **
+ **
+ ** FILE INFORMATION
+ ** ----------------
+ ** Filename:        device.c
+ ** Initial author:  marcus.jagemar@gmail.com
+ **
+ **
+ ** DESCRIPTION
+ ** -----------
+ ** Operations tables of the module types and the functions working on
+ ** the modules of a handle, see device.h.
+ **
+ **
+ ** REVISION HISTORY
+ ** ----------------
+ **
+ ** Date        Comment
+ ** =================================================================
+ ** 2026-10-17  File created
+ **
+ *****************************************************************************/
+
+#include <stddef.h>
+
+#include "device.h"
+#include "big_ng.h"
+#include "mini_ng.h"
+#include "common.h"
+
+
+/*****************************************************************************
+ * Sensor group titles
+ *****************************************************************************/
+static const char tban_groupTBanAs[]   = "TBan standard analog sensors";
+static const char tban_groupTBanDs[]   = "TBan standard digital sensors";
+static const char tban_groupBigNGDs[]  = "BigNG digital sensors";
+static const char tban_groupBigNGAs[]  = "BigNG analog sensors";
+static const char tban_groupMiniNGAs[] = "MiniNG analog sensors";
+
+
+/**********************************************************************
+ * Name        : tban_deviceTBanChannel
+ * Description : Fill in a channel of the base device. The vector only
+ *               holds the pwm, the rpm is estimated from it.
+ * Arguments   : tban  = The TBan struct to work on
+ *               state = The decoded vectors
+ *               j     = Channel
+ *               ch    = The channel to fill in
+ * Returning   : none
+ **********************************************************************/
+static void tban_deviceTBanChannel(struct TBan* tban, const struct TBanState* state,
+                                   int j, struct TBanChannel* ch) {
+  ch->index      = j;
+  ch->name       = tban->chName[j];
+  ch->flags      = TBAN_CH_MODE | TBAN_CH_SET_PWM;
+  ch->rpmMax     = state->chRpmMax[j];
+  ch->pwm        = state->chPwm[j];
+  ch->rpm        = ch->rpmMax * ch->pwm / 100;
+  ch->temp       = state->chTemp[j];
+  ch->mode       = state->chMode[j];
+  ch->target     = 0;
+  ch->targetMode = 0;
+}
+
+
+/**********************************************************************
+ * Name        : tban_deviceSensor
+ * Description : Fill in one sensor.
+ * Arguments   : sensor = The sensor to fill in
+ *               group  = Title of the sensor group
+ *               index  = Index within the group
+ *               name   = Name from the config file
+ *               flags  = TBAN_SENSOR_*
+ *               temp, rawTemp, cal, absCal = The values
+ * Returning   : none
+ **********************************************************************/
+static void tban_deviceSensor(struct TBanSensor* sensor, const char* group, int index,
+                              const char* name, int flags, unsigned char temp,
+                              unsigned char rawTemp, unsigned char cal, unsigned char absCal) {
+  sensor->group   = group;
+  sensor->index   = index;
+  sensor->name    = name;
+  sensor->flags   = flags;
+  sensor->temp    = temp;
+  sensor->rawTemp = rawTemp;
+  sensor->cal     = cal;
+  sensor->absCal  = absCal;
+}
+
+
+/*****************************************************************************
+ * Classic TBan
+ *****************************************************************************/
+static int tban_opsTBanChannels(struct TBan* tban, const struct TBanState* state,
+                                struct TBanChannel ch[]) {
+  int j;
+
+  for(j=0; j<TBAN_NUMBER_CHANNELS; j++)
+    tban_deviceTBanChannel(tban, state, j, &ch[j]);
+  return TBAN_NUMBER_CHANNELS;
+}
+
+static int tban_opsTBanSensors(struct TBan* tban, const struct TBanState* state,
+                               struct TBanSensor sensor[]) {
+  int i, n = 0;
+
+  for(i=0; i<TBAN_NUMBER_ANALOG_SENSORS; i++, n++)
+    tban_deviceSensor(&sensor[n], tban_groupTBanAs, i, tban->asName[i], 0,
+                      state->asTemp[i], state->asRawTemp[i], state->asCal[i], 0);
+  for(i=0; i<TBAN_NUMBER_DIGITAL_SENSORS; i++, n++)
+    tban_deviceSensor(&sensor[n], tban_groupTBanDs, i, tban->dsName[i], TBAN_SENSOR_DIGITAL,
+                      state->dsTemp[i], state->dsRawTemp[i], state->dsCal[i], 0);
+  return n;
+}
+
+static int tban_opsTBanSetPwm(struct TBan* tban, int index, unsigned char pwm) {
+  return tban_setChPwm(tban, (unsigned char) index, pwm);
+}
+
+static const struct TBanDeviceOps tban_opsTBan = {
+  TBAN_MODEL_TBAN, "TBan", "TBan channels",
+  TBAN_SAMPLE_TBAN,
+  TBAN_NUMBER_CHANNELS,
+  TBAN_NUMBER_ANALOG_SENSORS + TBAN_NUMBER_DIGITAL_SENSORS,
+  tban_queryStatus,
+  tban_opsTBanChannels,
+  tban_opsTBanSensors,
+  tban_opsTBanSetPwm
+};
+
+
+/*****************************************************************************
+ * BigNG. Reads both status vectors, the channels are the ones of the
+ * TBan with a target temperature added.
+ *****************************************************************************/
+static int tban_opsBigNGQuery(struct TBan* tban) {
+  CHECK_RESULT(tban_queryStatus(tban));
+  return bigNG_queryStatus(tban);
+}
+
+static int tban_opsBigNGChannels(struct TBan* tban, const struct TBanState* state,
+                                 struct TBanChannel ch[]) {
+  int j;
+
+  for(j=0; j<TBAN_NUMBER_CHANNELS; j++) {
+    tban_deviceTBanChannel(tban, state, j, &ch[j]);
+    ch[j].flags     |= TBAN_CH_TARGET;
+    ch[j].target     = state->bigNGchTarget[j];
+    ch[j].targetMode = state->bigNGchTargetMode[j];
+  }
+  return TBAN_NUMBER_CHANNELS;
+}
+
+static int tban_opsBigNGSensors(struct TBan* tban, const struct TBanState* state,
+                                struct TBanSensor sensor[]) {
+  int i, n = 0;
+
+  for(i=0; i<TBAN_NUMBER_ANALOG_SENSORS; i++, n++)
+    tban_deviceSensor(&sensor[n], tban_groupTBanAs, i, tban->asName[i], 0,
+                      state->asTemp[i], state->asRawTemp[i], state->asCal[i], 0);
+  for(i=0; i<TBAN_NUMBER_DIGITAL_SENSORS; i++, n++)
+    tban_deviceSensor(&sensor[n], tban_groupBigNGDs, i, tban->dsName[i],
+                      TBAN_SENSOR_DIGITAL | TBAN_SENSOR_ABSCAL,
+                      state->dsTemp[i], state->dsRawTemp[i], state->dsCal[i],
+                      state->bigNGdsAbsCal[i]);
+  for(i=0; i<BIGNG_NUMBER_ADDITIONAL_ANALOG_SENSORS; i++, n++)
+    tban_deviceSensor(&sensor[n], tban_groupBigNGAs, i, tban->bigNG.asName[i], TBAN_SENSOR_ABSCAL,
+                      state->bigNGasTemp[i], state->bigNGasRawTemp[i], state->bigNGasCal[i],
+                      state->bigNGasAbsCal[i]);
+  return n;
+}
+
+static const struct TBanDeviceOps tban_opsBigNG = {
+  TBAN_MODEL_BIGNG, "BigNG", "BigNG channels",
+  TBAN_SAMPLE_TBAN | TBAN_SAMPLE_BIGNG,
+  TBAN_NUMBER_CHANNELS,
+  TBAN_NUMBER_ANALOG_SENSORS + TBAN_NUMBER_DIGITAL_SENSORS + BIGNG_NUMBER_ADDITIONAL_ANALOG_SENSORS,
+  tban_opsBigNGQuery,
+  tban_opsBigNGChannels,
+  tban_opsBigNGSensors,
+  tban_opsTBanSetPwm
+};
+
+
+/*****************************************************************************
+ * miniNG. The channels are regulated by the module itself, only the
+ * curves can be set. The channel temperature is the one of the analog
+ * sensor with the same index.
+ *****************************************************************************/
+static int tban_opsMiniNGChannels(struct TBan* tban, const struct TBanState* state,
+                                  struct TBanChannel ch[]) {
+  int j;
+
+  for(j=0; j<MINI_NG_NUMBER_CHANNELS; j++) {
+    ch[j].index      = j;
+    ch[j].name       = tban->miniNG.chName[j];
+    ch[j].flags      = 0;
+    ch[j].rpm        = state->miniNGchRpm[j];
+    ch[j].rpmMax     = state->miniNGchRpmMax[j];
+    ch[j].pwm        = (ch[j].rpmMax != 0) ? (100 * ch[j].rpm / ch[j].rpmMax) : 0;
+    ch[j].temp       = (j < MINI_NG_NUMBER_ANALOG_SENSORS) ? state->miniNGasTemp[j] : 0;
+    ch[j].mode       = 0;
+    ch[j].target     = 0;
+    ch[j].targetMode = 0;
+  }
+  return MINI_NG_NUMBER_CHANNELS;
+}
+
+static int tban_opsMiniNGSensors(struct TBan* tban, const struct TBanState* state,
+                                 struct TBanSensor sensor[]) {
+  int i;
+
+  for(i=0; i<MINI_NG_NUMBER_ANALOG_SENSORS; i++)
+    tban_deviceSensor(&sensor[i], tban_groupMiniNGAs, i, tban->miniNG.asName[i], 0,
+                      state->miniNGasTemp[i], state->miniNGasRawTemp[i], state->miniNGasCal[i], 0);
+  return MINI_NG_NUMBER_ANALOG_SENSORS;
+}
+
+static const struct TBanDeviceOps tban_opsMiniNG = {
+  TBAN_MODEL_MINING, "miniNG", "miniNG channels",
+  TBAN_SAMPLE_MINING,
+  MINI_NG_NUMBER_CHANNELS,
+  MINI_NG_NUMBER_ANALOG_SENSORS,
+  miniNG_queryStatus,
+  tban_opsMiniNGChannels,
+  tban_opsMiniNGSensors,
+  NULL
+};
+
+
+/**********************************************************************
+ * Name        : tban_deviceSelect
+ * Description : Choose the modules of the setup from the vectors
+ *               already read: the base device from the TBan vector and
+ *               the miniNG if its vector has been read and is valid.
+ *               No I/O is made, call the query functions first or use
+ *               tban_deviceProbe.
+ * Arguments   : tban = The TBan struct to work on
+ * Returning   : TBAN_OK
+ *               TBAN_STRUCT_NULL_PTR
+ *               TBAN_NOT_OPENED
+ *               TBAN_CORRUPT_DATA (no valid TBan vector)
+ **********************************************************************/
+int tban_deviceSelect(struct TBan* tban) {
+  /* Sanity check */
+  if(tban == NULL)
+    return TBAN_STRUCT_NULL_PTR;
+  if(tban->opened == 0)
+    return TBAN_NOT_OPENED;
+
+  tban->numModules = 0;
+  if((tban->lastQuery == 0) || (tban_present(tban) != TBAN_OK))
+    return TBAN_CORRUPT_DATA;
+
+  /* Base device */
+  if(bigNG_present(tban) == BIGNG_PRESENT)
+    tban->modules[tban->numModules++] = &tban_opsBigNG;
+  else
+    tban->modules[tban->numModules++] = &tban_opsTBan;
+
+  /* Add-on modules */
+  if((tban->miniNG.lastQuery != 0) && (miniNG_present(tban) == MINING_PRESENT))
+    tban->modules[tban->numModules++] = &tban_opsMiniNG;
+
+  return TBAN_OK;
+}
+
+
+/**********************************************************************
+ * Name        : tban_deviceProbe
+ * Description : Query the device and choose the modules of the
+ *               setup. A miniNG that does not answer is not an error,
+ *               the setup simply has none.
+ * Arguments   : tban = The TBan struct to work on
+ * Returning   : TBAN_OK
+ *               TBAN_STRUCT_NULL_PTR
+ *               TBAN_NOT_OPENED
+ *               TBAN_ESEND
+ *               TBAN_ERECEIVE
+ *               TBAN_CORRUPT_DATA
+ **********************************************************************/
+int tban_deviceProbe(struct TBan* tban) {
+  /* Sanity check */
+  if(tban == NULL)
+    return TBAN_STRUCT_NULL_PTR;
+  if(tban->opened == 0)
+    return TBAN_NOT_OPENED;
+
+  CHECK_RESULT(tban_queryStatus(tban));
+  if(bigNG_present(tban) == BIGNG_PRESENT)
+    CHECK_RESULT(bigNG_queryStatus(tban));
+  (void) miniNG_queryStatus(tban);
+
+  return tban_deviceSelect(tban);
+}
+
+
+/**********************************************************************
+ * Name        : tban_deviceQuery
+ * Description : Refresh the vectors of all modules of the setup.
+ * Arguments   : tban = The TBan struct to work on
+ * Returning   : TBAN_OK
+ *               TBAN_STRUCT_NULL_PTR
+ *               TBAN_NOT_OPENED
+ *               TBAN_ESEND
+ *               TBAN_ERECEIVE
+ *               TBAN_CORRUPT_DATA
+ **********************************************************************/
+int tban_deviceQuery(struct TBan* tban) {
+  int i;
+
+  /* Sanity check */
+  if(tban == NULL)
+    return TBAN_STRUCT_NULL_PTR;
+  if(tban->opened == 0)
+    return TBAN_NOT_OPENED;
+
+  for(i=0; i<tban->numModules; i++)
+    CHECK_RESULT(tban->modules[i]->query(tban));
+
+  return TBAN_OK;
+}
+
+
+/**********************************************************************
+ * Name        : tban_deviceNumChannels
+ * Description : Number of channels of all modules of the setup.
+ * Arguments   : tban = The TBan struct to work on
+ * Returning   : The number of channels, 0 if not probed
+ **********************************************************************/
+int tban_deviceNumChannels(struct TBan* tban) {
+  int i, n = 0;
+
+  if(tban == NULL)
+    return 0;
+  for(i=0; i<tban->numModules; i++)
+    n += tban->modules[i]->numChannels;
+  return n;
+}
+
+
+/**********************************************************************
+ * Name        : tban_deviceNumSensors
+ * Description : Number of sensors of all modules of the setup.
+ * Arguments   : tban = The TBan struct to work on
+ * Returning   : The number of sensors, 0 if not probed
+ **********************************************************************/
+int tban_deviceNumSensors(struct TBan* tban) {
+  int i, n = 0;
+
+  if(tban == NULL)
+    return 0;
+  for(i=0; i<tban->numModules; i++)
+    n += tban->modules[i]->numSensors;
+  return n;
+}
+
+
+/**********************************************************************
+ * Name        : tban_deviceDecode
+ * Description : Decode the vectors of all modules in one pass.
+ * Arguments   : tban  = The TBan struct to work on
+ *               state = The state to fill in
+ * Returning   : TBAN_OK
+ **********************************************************************/
+static int tban_deviceDecode(struct TBan* tban, struct TBanState* state) {
+  int i, mask = 0;
+
+  for(i=0; i<tban->numModules; i++)
+    mask |= tban->modules[i]->vectors;
+  return tban_decodeVectors(mask, tban->buf, tban->bigNG.buf, tban->miniNG.buf, state);
+}
+
+
+/**********************************************************************
+ * Name        : tban_deviceChannels
+ * Description : Get all channels of the setup from the local vectors.
+ *               Call tban_deviceQuery first to get fresh values.
+ * Arguments   : tban  = The TBan struct to work on
+ *               ch    = The channels to fill in
+ *               size  = Number of entries in ch
+ *               count = The number of channels filled in
+ * Returning   : TBAN_OK
+ *               TBAN_STRUCT_NULL_PTR
+ *               TBAN_VALUE_NULL_PTR
+ *               TBAN_NOT_OPENED
+ *               TBAN_VECTOR_TO_SMALL
+ **********************************************************************/
+int tban_deviceChannels(struct TBan* tban, struct TBanChannel ch[], int size, int* count) {
+  struct TBanState state;
+  int i, j, n = 0;
+
+  /* Sanity check */
+  if(tban == NULL)
+    return TBAN_STRUCT_NULL_PTR;
+  if((ch == NULL) || (count == NULL))
+    return TBAN_VALUE_NULL_PTR;
+  if(tban->opened == 0)
+    return TBAN_NOT_OPENED;
+  if(size < tban_deviceNumChannels(tban))
+    return TBAN_VECTOR_TO_SMALL;
+
+  CHECK_RESULT(tban_deviceDecode(tban, &state));
+
+  for(i=0; i<tban->numModules; i++) {
+    int k = tban->modules[i]->channels(tban, &state, &ch[n]);
+    for(j=0; j<k; j++)
+      ch[n+j].module = tban->modules[i];
+    n += k;
+  }
+  *count = n;
+
+  return TBAN_OK;
+}
+
+
+/**********************************************************************
+ * Name        : tban_deviceSensors
+ * Description : Get all sensors of the setup from the local vectors.
+ *               Call tban_deviceQuery first to get fresh values.
+ * Arguments   : tban   = The TBan struct to work on
+ *               sensor = The sensors to fill in
+ *               size   = Number of entries in sensor
+ *               count  = The number of sensors filled in
+ * Returning   : TBAN_OK
+ *               TBAN_STRUCT_NULL_PTR
+ *               TBAN_VALUE_NULL_PTR
+ *               TBAN_NOT_OPENED
+ *               TBAN_VECTOR_TO_SMALL
+ **********************************************************************/
+int tban_deviceSensors(struct TBan* tban, struct TBanSensor sensor[], int size, int* count) {
+  struct TBanState state;
+  int i, j, n = 0;
+
+  /* Sanity check */
+  if(tban == NULL)
+    return TBAN_STRUCT_NULL_PTR;
+  if((sensor == NULL) || (count == NULL))
+    return TBAN_VALUE_NULL_PTR;
+  if(tban->opened == 0)
+    return TBAN_NOT_OPENED;
+  if(size < tban_deviceNumSensors(tban))
+    return TBAN_VECTOR_TO_SMALL;
+
+  CHECK_RESULT(tban_deviceDecode(tban, &state));
+
+  for(i=0; i<tban->numModules; i++) {
+    int k = tban->modules[i]->sensors(tban, &state, &sensor[n]);
+    for(j=0; j<k; j++)
+      sensor[n+j].module = tban->modules[i];
+    n += k;
+  }
+  *count = n;
+
+  return TBAN_OK;
+}
+
+
+/**********************************************************************
+ * Name        : tban_deviceSetPwm
+ * Description : Set the pwm of several channels. The commands are sent
+ *               as one batch unless the caller already has one open.
+ * Arguments   : tban    = The TBan struct to work on
+ *               count   = Number of channels to set
+ *               channel = Channel numbers (through the whole setup)
+ *               pwm     = The pwm of each channel (0-100)
+ * Returning   : TBAN_OK
+ *               TBAN_STRUCT_NULL_PTR
+ *               TBAN_VALUE_NULL_PTR
+ *               TBAN_NOT_OPENED
+ *               TBAN_INDEX_OUT_OF_BOUNDS
+ *               TBAN_VALUE_OUT_OF_BOUNDS
+ *               TBAN_NOT_IMPLEMENTED (the channel cannot be set)
+ *               TBAN_ESEND
+ **********************************************************************/
+int tban_deviceSetPwm(struct TBan* tban, int count, const int channel[], const unsigned char pwm[]) {
+  struct TBanBatch batch;
+  int ownBatch;
+  int result = TBAN_OK;
+  int i, m, index;
+
+  /* Sanity check */
+  if(tban == NULL)
+    return TBAN_STRUCT_NULL_PTR;
+  if((channel == NULL) || (pwm == NULL))
+    return TBAN_VALUE_NULL_PTR;
+  if(tban->opened == 0)
+    return TBAN_NOT_OPENED;
+
+  ownBatch = (tban_batchOwned(tban) == NULL);
+  if(ownBatch)
+    CHECK_RESULT(tban_batchBegin(tban, &batch));
+
+  for(i=0; (i<count) && (result == TBAN_OK); i++) {
+    /* Find the module of the channel */
+    index = channel[i];
+    for(m=0; (m<tban->numModules) && (index >= tban->modules[m]->numChannels); m++)
+      index -= tban->modules[m]->numChannels;
+
+    if((index < 0) || (m == tban->numModules))
+      result = TBAN_INDEX_OUT_OF_BOUNDS;
+    else if(tban->modules[m]->setPwm == NULL)
+      result = TBAN_NOT_IMPLEMENTED;
+    else
+      result = tban->modules[m]->setPwm(tban, index, pwm[i]);
+  }
+
+  if(ownBatch) {
+    if(result == TBAN_OK)
+      result = tban_batchCommit(tban);
+    else if(tban_batchOwned(tban) != NULL)
+      (void) tban_batchAbort(tban);
+  }
+
+  return result;
+}
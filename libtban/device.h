@@ -0,0 +1,158 @@
+/*****************************************************************************
+ ** This program is free software; you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation; either version 2 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program; if not, write to the Free Software
+ ** Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ **
+ **
+ ** FILE INFORMATION
+ ** ----------------
+ ** Filename:        device.h
+ ** Initial author:  marcus.jagemar@gmail.com
+ **
+ **
+ ** DESCRIPTION
+ ** -----------
+ ** Device model. A setup is a chain of modules: the base device (a
+ ** classic TBan or a BigNG) and the add-on modules on its bus (miniNG,
+ ** later the SensorHub). Each module type has an operations table
+ ** (struct TBanDeviceOps) that knows its vectors, channels and sensors.
+ **
+ ** The modules are chosen once, by tban_deviceProbe (queries the
+ ** device) or tban_deviceSelect (uses the vectors already read). After
+ ** that an application can enumerate all channels and sensors of the
+ ** setup without asking bigNG_present/miniNG_present:
+ **
+ **   tban_deviceQuery     refresh the vectors of all modules
+ **   tban_deviceChannels  all channels, decoded in one pass
+ **   tban_deviceSensors   all sensors, decoded in one pass
+ **   tban_deviceSetPwm    set the pwm of several channels in one batch
+ **
+ ** Channels and sensors are numbered through the whole chain in module
+ ** order, the base device first.
+ **
+ **
+ ** REVISION HISTORY
+ ** ----------------
+ **
+ ** Date        Comment
+ ** =================================================================
+ ** 2026-10-17  File created
+ **
+ *****************************************************************************/
+
+/* Muliple inclusion safeguard */
+#ifndef __DEVICE_H
+#define __DEVICE_H
+
+#include "tban.h"
+#include "decode.h"
+
+
+/*****************************************************************************
+ * Module types
+ *****************************************************************************/
+#define TBAN_MODEL_TBAN       0
+#define TBAN_MODEL_BIGNG      1
+#define TBAN_MODEL_MINING     2
+#define TBAN_MODEL_SENSORHUB  3
+
+
+/*****************************************************************************
+ * Limits, over all modules of a setup
+ *****************************************************************************/
+#define TBAN_DEVICE_MAX_CHANNELS  (TBAN_NUMBER_CHANNELS + MINI_NG_NUMBER_CHANNELS)
+#define TBAN_DEVICE_MAX_SENSORS   (TBAN_NUMBER_ANALOG_SENSORS + TBAN_NUMBER_DIGITAL_SENSORS + \
+                                   BIGNG_NUMBER_ADDITIONAL_ANALOG_SENSORS + MINI_NG_NUMBER_ANALOG_SENSORS)
+
+
+/*****************************************************************************
+ * Channel and sensor flags, which values are valid
+ *****************************************************************************/
+#define TBAN_CH_MODE         0x01   /* mode (auto/manual) */
+#define TBAN_CH_TARGET       0x02   /* target and targetMode (BigNG) */
+#define TBAN_CH_SET_PWM      0x04   /* tban_deviceSetPwm works */
+
+#define TBAN_SENSOR_DIGITAL  0x01   /* Digital sensor, otherwise analog */
+#define TBAN_SENSOR_ABSCAL   0x02   /* absCal (BigNG) */
+
+
+struct TBanDeviceOps;
+
+
+/*****************************************************************************
+ * One channel, in the units of the getters (pwm in percent, temperature
+ * doubled)
+ *****************************************************************************/
+struct TBanChannel {
+  const struct TBanDeviceOps* module;
+  int           index;       /* Index within the module */
+  const char*   name;
+  int           flags;       /* TBAN_CH_* */
+  unsigned int  rpm;
+  unsigned int  rpmMax;
+  unsigned char pwm;
+  unsigned char temp;
+  unsigned char mode;
+  unsigned char target;
+  unsigned char targetMode;
+};
+
+
+/*****************************************************************************
+ * One sensor. group is the title of the sensor group it belongs to.
+ *****************************************************************************/
+struct TBanSensor {
+  const struct TBanDeviceOps* module;
+  const char*   group;
+  int           index;       /* Index within the group */
+  const char*   name;
+  int           flags;       /* TBAN_SENSOR_* */
+  unsigned char temp;
+  unsigned char rawTemp;
+  unsigned char cal;
+  unsigned char absCal;
+};
+
+
+/*****************************************************************************
+ * Operations of a module type. channels and sensors fill in
+ * numChannels and numSensors entries from a decoded state. setPwm is
+ * NULL if the channels cannot be set.
+ *****************************************************************************/
+struct TBanDeviceOps {
+  int         model;         /* TBAN_MODEL_* */
+  const char* name;
+  const char* channelTitle;
+  int         vectors;       /* TBAN_SAMPLE_* the module is read from */
+  int         numChannels;
+  int         numSensors;
+  int (*query)(struct TBan* tban);
+  int (*channels)(struct TBan* tban, const struct TBanState* state, struct TBanChannel ch[]);
+  int (*sensors)(struct TBan* tban, const struct TBanState* state, struct TBanSensor sensor[]);
+  int (*setPwm)(struct TBan* tban, int index, unsigned char pwm);
+};
+
+
+/*****************************************************************************
+ * Exported functions
+ *****************************************************************************/
+int tban_deviceProbe(struct TBan* tban);
+int tban_deviceSelect(struct TBan* tban);
+int tban_deviceQuery(struct TBan* tban);
+int tban_deviceNumChannels(struct TBan* tban);
+int tban_deviceNumSensors(struct TBan* tban);
+int tban_deviceChannels(struct TBan* tban, struct TBanChannel ch[], int size, int* count);
+int tban_deviceSensors(struct TBan* tban, struct TBanSensor sensor[], int size, int* count);
+int tban_deviceSetPwm(struct TBan* tban, int count, const int channel[], const unsigned char pwm[]);
+
+#endif /* __DEVICE_H */
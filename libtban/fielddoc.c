@@ -0,0 +1,95 @@
+/*****************************************************************************
+ ** This program is free software; you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation; either version 2 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program; if not, write to the Free Software
+ ** Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ **
+ **
+ ** FILE INFORMATION
+ ** ----------------
+ ** Filename:        fielddoc.c
+ ** Initial author:  marcus.jagemar@gmail.com
+ **
+ **
+ ** DESCRIPTION
+ ** -----------
+ ** Build time tool printing the field reference (Markdown) from the
+ ** field lists in fields.h. The build writes it to FIELDS.md.
+ **
+ **
+ ** REVISION HISTORY
+ ** ----------------
+ **
+ ** Date        Comment
+ ** =================================================================
+ ** 2026-10-17  File created
+ **
+ *****************************************************************************/
+
+#include <stdio.h>
+
+#include "fields.h"
+
+
+/**********************************************************************
+ * Name        : printField
+ * Description : Print one row of the reference.
+ * Arguments   : name, vec, ... = The columns of the field list
+ * Returning   : none
+ **********************************************************************/
+static void printField(const char* name, int vec, int kind, int offset, int count,
+                       int step, int width, const char* unit, int fwMin, const char* doc) {
+  static const char* vectors[TBAN_VEC_COUNT] = { "TBan", "BigNG 2", "miniNG" };
+  static const char* kinds[]                 = { "byte", "pwm x2", "rpm (lb,hb) x10.5", "/2", "constant" };
+
+  printf("| %s | %s | ", name, vectors[vec]);
+  if(kind == TBAN_FIELD_CONST)
+    printf("= %d", offset);
+  else if(count == 1)
+    printf("%d", offset);
+  else if(width > 1)
+    printf("%d + %d*i .. +%d", offset, step, width-1);
+  else
+    printf("%d + %d*i", offset, step);
+  printf(" | %d | %s | %s | ", count, kinds[kind], unit);
+  if(fwMin != 0)
+    printf("%d.%d", fwMin/10, fwMin%10);
+  printf(" | %s |\n", doc);
+}
+
+
+#define PRINT_FIELD(name, vec, kind, offset, count, step, width, member, pos, unit, fwMin, doc) \
+  printField(#name, vec, kind, offset, count, step, width, unit, fwMin, doc);
+
+#define PRINT_HEADER(title) \
+  printf("\n## %s\n\n", title); \
+  printf("| Field | Vector | Index | Count | Conversion | Unit | Min fw | Description |\n"); \
+  printf("|---|---|---|---|---|---|---|---|\n");
+
+
+int main(void) {
+  printf("# libtban status vector fields\n\n");
+  printf("Generated from libtban/fields.h, do not edit. Index is the position in\n");
+  printf("the vector of element i (channel, sensor), see TBAN_FIELD_AT and\n");
+  printf("tban_getField.\n");
+
+  PRINT_HEADER("TBan (and BigNG)");
+  TBAN_FIELDS(PRINT_FIELD)
+
+  PRINT_HEADER("BigNG");
+  BIGNG_FIELDS(PRINT_FIELD)
+
+  PRINT_HEADER("miniNG");
+  MINI_NG_FIELDS(PRINT_FIELD)
+
+  return 0;
+}
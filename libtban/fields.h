@@ -0,0 +1,183 @@
+/*****************************************************************************
+ ** This program is free software; you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation; either version 2 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program; if not, write to the Free Software
+ ** Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ **
+ **
+ ** FILE INFORMATION
+ ** ----------------
+ ** Filename:        fields.h
+ ** Initial author:  marcus.jagemar@gmail.com
+ **
+ **
+ ** DESCRIPTION
+ ** -----------
+ ** The values of the status vectors, one list per device type. This is
+ ** the only place where the position of a value in a vector is given.
+ ** The lists are X-macros, everything else is generated from them:
+ **
+ **   - TBAN_FIELD_AT(name, i), the vector index of element i, used by
+ **     the getters and setters in tban.c, big_ng.c and mini_ng.c
+ **   - the field numbers TBAN_F_<name> for tban_getField (decode.h)
+ **   - the bulk decoders of decode.c, one table per device type
+ **   - the field reference FIELDS.md, written by tban_fielddoc at build
+ **     time
+ **
+ ** Adding a value means adding a line here and, when it should be part
+ ** of the bulk decode, a member to struct TBanState. Single values that
+ ** have a public index name in tban.h (for tban_getValue) refer to it.
+ **
+ ** Columns of X(name, vec, kind, offset, count, step, width, member,
+ **              pos, unit, fwMin, doc):
+ **
+ **   name    Field name, TBAN_F_<name> and TBAN_FIELD_AT(name, i)
+ **   vec     TBAN_VEC_* the value is read from
+ **   kind    TBAN_FIELD_* conversion (scaling) of the raw byte
+ **   offset  Vector index of the first element
+ **   count   Number of elements (channels, sensors)
+ **   step    Distance between the elements in the vector
+ **   width   Bytes per element (curve points), 1 otherwise
+ **   member  struct TBanState array the elements are decoded to
+ **   pos     First byte within member[i]
+ **   unit    Unit of the converted value
+ **   fwMin   Minimum TBan firmware (major*10+minor), 0 for any
+ **   doc     Description
+ **
+ **
+ ** REVISION HISTORY
+ ** ----------------
+ **
+ ** Date        Comment
+ ** =================================================================
+ ** 2026-10-17  File created
+ **
+ *****************************************************************************/
+
+/* Muliple inclusion safeguard */
+#ifndef __FIELDS_H
+#define __FIELDS_H
+
+#include "tban.h"
+
+
+/*****************************************************************************
+ * The vectors a field can be read from
+ *****************************************************************************/
+#define TBAN_VEC_TBAN    0   /* tban->buf */
+#define TBAN_VEC_BIGNG   1   /* tban->bigNG.buf */
+#define TBAN_VEC_MINING  2   /* tban->miniNG.buf */
+#define TBAN_VEC_COUNT   3
+
+
+/*****************************************************************************
+ * Conversions
+ *****************************************************************************/
+#define TBAN_FIELD_BYTE   0   /* The byte as it is */
+#define TBAN_FIELD_PWM    1   /* Doubled, the vector counts in 2% steps */
+#define TBAN_FIELD_RPM    2   /* Two bytes (lb, hb) to rpm, see TBAN_RPM_MAX */
+#define TBAN_FIELD_HALF   3   /* Halved */
+#define TBAN_FIELD_CONST  4   /* offset is the value, nothing is read */
+
+
+/*****************************************************************************
+ * TBan values. The BigNG uses the same positions for these.
+ *****************************************************************************/
+#define TBAN_FIELDS(X) \
+  X(chRpmMax,       TBAN_VEC_TBAN, TBAN_FIELD_RPM,   148, 4, 2, 1, chRpmMax,     0, "rpm",   0, "Maximum rpm of the channel") \
+  X(chPwm,          TBAN_VEC_TBAN, TBAN_FIELD_PWM,   137, 4, 1, 1, chPwm,        0, "%",     0, "Current pwm of the channel") \
+  X(chTemp,         TBAN_VEC_TBAN, TBAN_FIELD_BYTE,  252, 4, 1, 1, chTemp,       0, "0.5 C", 0, "Temperature the channel is regulated on") \
+  X(chMode,         TBAN_VEC_TBAN, TBAN_FIELD_BYTE,  101, 4, 1, 1, chMode,       0, "-",     0, "0 automatic, 1 manual") \
+  X(chStartMode,    TBAN_VEC_TBAN, TBAN_FIELD_BYTE,    5, 4, 1, 1, chStartMode,  0, "%",     0, "Initial pwm of the channel") \
+  X(chHysteresis,   TBAN_VEC_TBAN, TBAN_FIELD_BYTE,   37, 4, 1, 1, chHysteresis, 0, "0.5 C", 0, "Hysteresis of the channel") \
+  X(chOvertemp,     TBAN_VEC_TBAN, TBAN_FIELD_BYTE, TBAN_TEMP_MAXWARN0, 4, 1, 1, chOvertemp,   0, "0.5 C", 0, "Over temperature limit of the channel") \
+  X(chDsens,        TBAN_VEC_TBAN, TBAN_FIELD_BYTE,   45, 4, 1, 1, chDsens,      0, "mask",  0, "Digital sensors assigned to the channel") \
+  X(chAsens,        TBAN_VEC_TBAN, TBAN_FIELD_BYTE,   49, 4, 1, 1, chAsens,      0, "mask",  0, "Analog sensors assigned to the channel") \
+  X(chCurveX,       TBAN_VEC_TBAN, TBAN_FIELD_BYTE,   53, 4, 6, 6, chCurveX,     0, "C",     0, "Response curve temperatures") \
+  X(chCurveXMax,    TBAN_VEC_TBAN, TBAN_FIELD_BYTE, TBAN_TEMP_MaxGrenz0, 4, 1, 1, chCurveX,     6, "C",     0, "Response curve temperature of 100% pwm") \
+  X(chCurveY,       TBAN_VEC_TBAN, TBAN_FIELD_BYTE,   77, 4, 6, 6, chCurveY,     0, "%",     0, "Response curve pwm values") \
+  X(chCurveYMax,    TBAN_VEC_TBAN, TBAN_FIELD_CONST, 100, 4, 0, 1, chCurveY,     6, "%",     0, "Last response curve point, always 100%") \
+  X(dsTemp,         TBAN_VEC_TBAN, TBAN_FIELD_BYTE,  238, 8, 1, 1, dsTemp,       0, "0.5 C", 0, "Calibrated digital sensor temperature") \
+  X(dsRawTemp,      TBAN_VEC_TBAN, TBAN_FIELD_BYTE,  208, 8, 1, 1, dsRawTemp,    0, "0.5 C", 0, "Raw digital sensor temperature") \
+  X(dsCal,          TBAN_VEC_TBAN, TBAN_FIELD_BYTE,   19, 8, 1, 1, dsCal,        0, "-",     0, "Digital sensor scaling factor") \
+  X(asTemp,         TBAN_VEC_TBAN, TBAN_FIELD_BYTE,  246, 6, 1, 1, asTemp,       0, "0.5 C", 0, "Calibrated analog sensor temperature") \
+  X(asRawTemp,      TBAN_VEC_TBAN, TBAN_FIELD_BYTE,  225, 6, 1, 1, asRawTemp,    0, "0.5 C", 0, "Raw analog sensor temperature") \
+  X(asCal,          TBAN_VEC_TBAN, TBAN_FIELD_BYTE,   27, 6, 1, 1, asCal,        0, "-",     0, "Analog sensor scaling factor") \
+  X(pwmFreq,        TBAN_VEC_TBAN, TBAN_FIELD_BYTE,    4, 1, 1, 1, pwmFreq,      0, "-",     0, "PWM frequency") \
+  X(led,            TBAN_VEC_TBAN, TBAN_FIELD_BYTE, TBAN_LED_ENABLE, 1, 1, 1, led,          0, "-",     0, "LED enabled") \
+  X(buzzer,         TBAN_VEC_TBAN, TBAN_FIELD_BYTE, TBAN_BUZ_ENABLE, 1, 1, 1, buzzer,       0, "-",     0, "Buzzer enabled") \
+  X(warnLevel,      TBAN_VEC_TBAN, TBAN_FIELD_BYTE, TBAN_WARN_LEVEL, 1, 1, 1, warnLevel,    0, "-",     0, "Warning level") \
+  X(fwVersion,      TBAN_VEC_TBAN, TBAN_FIELD_BYTE, TBAN_INFO_VER, 1, 1, 1, fwVersion,    0, "-",     0, "Firmware version, major in the high nibble") \
+  X(protocol,       TBAN_VEC_TBAN, TBAN_FIELD_BYTE, TBAN_INFO_PROT, 1, 1, 1, protocol,     0, "-",     0, "Protocol version") \
+  X(wdCounter,      TBAN_VEC_TBAN, TBAN_FIELD_BYTE, TBAN_WD_COUNTER, 1, 1, 1, wdCounter,    0, "-",    28, "USB watchdog counter") \
+  X(wdEnabled,      TBAN_VEC_TBAN, TBAN_FIELD_BYTE, TBAN_WD_ENABLED, 1, 1, 1, wdEnabled,    0, "-",    28, "USB watchdog enabled")
+
+
+/*****************************************************************************
+ * BigNG specific values, in addition to TBAN_FIELDS
+ *****************************************************************************/
+#define BIGNG_FIELDS(X) \
+  X(bigNGoutMode,      TBAN_VEC_TBAN,  TBAN_FIELD_BYTE, 136, 1, 1, 1, bigNGoutMode,      0, "mask",  0, "Channels in analog output mode") \
+  X(bigNGovertemp,     TBAN_VEC_TBAN,  TBAN_FIELD_BYTE, 145, 1, 1, 1, bigNGovertemp,     0, "-",     0, "Over temperature indication") \
+  X(bigNGchTarget,     TBAN_VEC_TBAN,  TBAN_FIELD_BYTE, 118, 4, 1, 1, bigNGchTarget,     0, "0.5 C", 0, "Target temperature of the channel") \
+  X(bigNGchTargetMode, TBAN_VEC_TBAN,  TBAN_FIELD_BYTE, 122, 4, 1, 1, bigNGchTargetMode, 0, "-",     0, "Target mode of the channel") \
+  X(bigNGchSens,       TBAN_VEC_TBAN,  TBAN_FIELD_BYTE, 164, 4, 1, 1, bigNGchSens,       0, "mask",  0, "BigNG sensors assigned to the channel") \
+  X(bigNGdsAbsCal,     TBAN_VEC_BIGNG, TBAN_FIELD_BYTE, 128, 8, 1, 1, bigNGdsAbsCal,     0, "-",     0, "Digital sensor absolute calibration") \
+  X(bigNGasTemp,       TBAN_VEC_TBAN,  TBAN_FIELD_BYTE, 260, 4, 1, 1, bigNGasTemp,       0, "0.5 C", 0, "Calibrated additional analog sensor temperature") \
+  X(bigNGasRawTemp,    TBAN_VEC_TBAN,  TBAN_FIELD_BYTE, 256, 4, 1, 1, bigNGasRawTemp,    0, "0.5 C", 0, "Raw additional analog sensor temperature") \
+  X(bigNGasCal,        TBAN_VEC_TBAN,  TBAN_FIELD_BYTE, 129, 4, 1, 1, bigNGasCal,        0, "-",     0, "Additional analog sensor scaling factor") \
+  X(bigNGasAbsCal,     TBAN_VEC_BIGNG, TBAN_FIELD_BYTE, 142, 4, 1, 1, bigNGasAbsCal,     0, "-",     0, "Additional analog sensor absolute calibration")
+
+
+/*****************************************************************************
+ * miniNG values
+ *****************************************************************************/
+#define MINI_NG_FIELDS(X) \
+  X(miniNGchRpm,        TBAN_VEC_MINING, TBAN_FIELD_BYTE,   44, 2,  2, 1, miniNGchRpm,        0, "-",     0, "Current rpm of the channel") \
+  X(miniNGchRpmMax,     TBAN_VEC_MINING, TBAN_FIELD_BYTE,   45, 2,  2, 1, miniNGchRpmMax,     0, "-",     0, "Maximum rpm of the channel") \
+  X(miniNGchHysteresis, TBAN_VEC_MINING, TBAN_FIELD_BYTE,   58, 2,  1, 1, miniNGchHysteresis, 0, "0.5 C", 0, "Hysteresis of the channel") \
+  X(miniNGchOvertemp,   TBAN_VEC_MINING, TBAN_FIELD_BYTE,   18, 2,  1, 1, miniNGchOvertemp,   0, "0.5 C", 0, "Over temperature limit of the channel") \
+  X(miniNGchCurveXMin,  TBAN_VEC_MINING, TBAN_FIELD_CONST,   0, 2,  0, 1, miniNGchCurveX,     0, "C",     0, "First response curve point, always 0 C") \
+  X(miniNGchCurveX,     TBAN_VEC_MINING, TBAN_FIELD_HALF,   20, 2, 10, 5, miniNGchCurveX,     1, "C",     0, "Response curve temperatures") \
+  X(miniNGchCurveY,     TBAN_VEC_MINING, TBAN_FIELD_BYTE,   25, 2, 10, 5, miniNGchCurveY,     0, "%",     0, "Response curve pwm values") \
+  X(miniNGchCurveYMax,  TBAN_VEC_MINING, TBAN_FIELD_CONST, 100, 2,  0, 1, miniNGchCurveY,     5, "%",     0, "Last response curve point, always 100%") \
+  X(miniNGasTemp,       TBAN_VEC_MINING, TBAN_FIELD_BYTE,    6, 2,  1, 1, miniNGasTemp,       0, "0.5 C", 0, "Calibrated sensor temperature") \
+  X(miniNGasRawTemp,    TBAN_VEC_MINING, TBAN_FIELD_BYTE,    8, 2,  1, 1, miniNGasRawTemp,    0, "0.5 C", 0, "Raw sensor temperature") \
+  X(miniNGasCal,        TBAN_VEC_MINING, TBAN_FIELD_BYTE,   77, 2,  1, 1, miniNGasCal,        0, "-",     0, "Sensor calibration")
+
+
+/*****************************************************************************
+ * Generated: field numbers for tban_getField and the vector positions
+ *****************************************************************************/
+#define TBAN_FIELD_ENUM(name, vec, kind, offset, count, step, width, member, pos, unit, fwMin, doc) \
+  TBAN_F_##name,
+#define TBAN_FIELD_POS(name, vec, kind, offset, count, step, width, member, pos, unit, fwMin, doc) \
+  TBAN_OFS_##name = (offset), TBAN_STEP_##name = (step),
+
+enum {
+  TBAN_FIELDS(TBAN_FIELD_ENUM)
+  BIGNG_FIELDS(TBAN_FIELD_ENUM)
+  MINI_NG_FIELDS(TBAN_FIELD_ENUM)
+  TBAN_NUMBER_FIELDS
+};
+
+enum {
+  TBAN_FIELDS(TBAN_FIELD_POS)
+  BIGNG_FIELDS(TBAN_FIELD_POS)
+  MINI_NG_FIELDS(TBAN_FIELD_POS)
+  TBAN_FIELD_POS_END
+};
+
+/* Vector index of element i of a field */
+#define TBAN_FIELD_AT(name, i)  (TBAN_OFS_##name + (i)*TBAN_STEP_##name)
+
+#endif /* __FIELDS_H */
@@ -0,0 +1,383 @@
+/*****************************************************************************
+ ** This program is free software; you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation; either version 2 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program; if not, write to the Free Software
+ ** Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ **
+ **
+ ** FILE INFORMATION
+ ** ----------------
+ ** Filename:        fleet.c
+ ** Initial author:  marcus.jagemar@gmail.com
+ **
+ **
+ ** DESCRIPTION
+ ** -----------
+ ** Many T-Balancers on one event loop, see fleet.h.
+ **
+ **
+ ** REVISION HISTORY
+ ** ----------------
+ **
+ ** Date        Comment
+ ** =================================================================
+ ** 2026-10-17  File created
+ **
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fleet.h"
+#include "big_ng.h"
+#include "mini_ng.h"
+#include "device.h"
+#include "common.h"
+
+
+/**********************************************************************
+ * Name        : tban_fleetDone
+ * Description : A member has read all its vectors, or failed.
+ * Arguments   : member = The member
+ *               result = TBAN_OK or the error
+ * Returning   : none
+ **********************************************************************/
+static void tban_fleetDone(struct TBanFleetMember* member, int result) {
+  member->stage  = 0;
+  member->result = result;
+  if(result == TBAN_OK) {
+    member->errors  = 0;
+    member->queryMs = local_monotonicMs();
+    (void) tban_deviceSelect(&member->tban);
+  } else {
+    member->errors++;
+  }
+}
+
+
+/**********************************************************************
+ * Name        : tban_fleetReceived
+ * Description : Completion callback of the status requests. A BigNG
+ *               continues with its second vector.
+ * Arguments   : tban   = The handle
+ *               result = TBAN_OK or the error of the request
+ *               ptr    = The member
+ * Returning   : none
+ **********************************************************************/
+static void tban_fleetReceived(struct TBan* tban, int result, void* ptr) {
+  struct TBanFleetMember* member = ptr;
+
+  if((result == TBAN_OK) && (member->stage == TBAN_SAMPLE_TBAN) &&
+     (bigNG_present(tban) == BIGNG_PRESENT)) {
+    member->stage = TBAN_SAMPLE_BIGNG;
+    result = bigNG_queryStatusStart(tban, tban_fleetReceived, member);
+    if(result == TBAN_OK)
+      return;
+  }
+
+  tban_fleetDone(member, result);
+}
+
+
+/**********************************************************************
+ * Name        : tban_fleetFree
+ * Description : Close and free a member.
+ * Arguments   : member = The member
+ * Returning   : none
+ **********************************************************************/
+static void tban_fleetFree(struct TBanFleetMember* member) {
+  if(member->tban.opened)
+    (void) tban_close(&member->tban);
+  (void) tban_free(&member->tban);
+  free(member);
+}
+
+
+/**********************************************************************
+ * Name        : tban_fleetInit
+ * Description : Create an empty fleet.
+ * Arguments   : fleet = The fleet to initialise
+ * Returning   : TBAN_OK
+ *               TBAN_STRUCT_NULL_PTR
+ *               TBAN_ERROR (the event loop could not be created)
+ **********************************************************************/
+int tban_fleetInit(struct TBanFleet* fleet) {
+  /* Sanity check */
+  if(fleet == NULL)
+    return TBAN_STRUCT_NULL_PTR;
+
+  fleet->members = NULL;
+  fleet->count   = 0;
+  fleet->size    = 0;
+
+  return tbanLoop_init(&fleet->loop);
+}
+
+
+/**********************************************************************
+ * Name        : tban_fleetClose
+ * Description : Close all devices of the fleet and free it.
+ * Arguments   : fleet = The fleet
+ * Returning   : TBAN_OK
+ *               TBAN_STRUCT_NULL_PTR
+ **********************************************************************/
+int tban_fleetClose(struct TBanFleet* fleet) {
+  int i;
+
+  /* Sanity check */
+  if(fleet == NULL)
+    return TBAN_STRUCT_NULL_PTR;
+
+  for(i=0; i<fleet->count; i++) {
+    (void) tbanLoop_remove(&fleet->loop, &fleet->members[i]->tban);
+    tban_fleetFree(fleet->members[i]);
+  }
+  free(fleet->members);
+  fleet->members = NULL;
+  fleet->count   = 0;
+  fleet->size    = 0;
+
+  return tbanLoop_close(&fleet->loop);
+}
+
+
+/**********************************************************************
+ * Name        : tban_fleetAdd
+ * Description : Open a device and add it to the fleet. Nothing is read
+ *               from the device until tban_fleetQuery.
+ * Arguments   : fleet      = The fleet
+ *               deviceName = The serial device, "/dev/ttyUSB0" ...
+ *               index      = Index of the new member (may be NULL)
+ * Returning   : TBAN_OK
+ *               TBAN_STRUCT_NULL_PTR
+ *               TBAN_VALUE_NULL_PTR
+ *               TBAN_CANNOT_MALLOC
+ *               TBAN_ALREADY_IN_USE
+ *               TBAN_EOPEN
+ *               TBAN_ERROR
+ **********************************************************************/
+int tban_fleetAdd(struct TBanFleet* fleet, char* deviceName, int* index) {
+  struct TBanFleetMember* member;
+  int    result;
+
+  /* Sanity check */
+  if(fleet == NULL)
+    return TBAN_STRUCT_NULL_PTR;
+  if(deviceName == NULL)
+    return TBAN_VALUE_NULL_PTR;
+
+  /* Grow the member array when needed */
+  if(fleet->count == fleet->size) {
+    int newSize = (fleet->size == 0) ? 8 : 2*fleet->size;
+    struct TBanFleetMember** newMembers = realloc(fleet->members, newSize*sizeof(struct TBanFleetMember*));
+    if(newMembers == NULL)
+      return TBAN_CANNOT_MALLOC;
+    fleet->members = newMembers;
+    fleet->size    = newSize;
+  }
+
+  member = calloc(1, sizeof(struct TBanFleetMember));
+  if(member == NULL)
+    return TBAN_CANNOT_MALLOC;
+
+  result = tban_init(&member->tban, deviceName);
+  if(result != TBAN_OK) {
+    free(member);
+    return result;
+  }
+  if(((result = bigNG_init(&member->tban)) != TBAN_OK) ||
+     ((result = miniNG_init(&member->tban)) != TBAN_OK) ||
+     ((result = tban_open(&member->tban)) != TBAN_OK) ||
+     ((result = tbanLoop_add(&fleet->loop, &member->tban)) != TBAN_OK)) {
+    tban_fleetFree(member);
+    return result;
+  }
+  member->result = TBAN_NO_MORE_DATA;
+
+  if(index != NULL)
+    *index = fleet->count;
+  fleet->members[fleet->count++] = member;
+
+  return TBAN_OK;
+}
+
+
+/**********************************************************************
+ * Name        : tban_fleetQuery
+ * Description : Read the status vectors of all devices. The requests
+ *               are sent to all devices before any answer is awaited.
+ *               Every member gets its result, also when some of them
+ *               fail.
+ * Arguments   : fleet = The fleet
+ * Returning   : TBAN_OK (every member answered)
+ *               TBAN_STRUCT_NULL_PTR
+ *               TBAN_ERROR (the event loop failed)
+ *               The error of the first member that failed
+ **********************************************************************/
+int tban_fleetQuery(struct TBanFleet* fleet) {
+  struct TBanFleetMember* member;
+  int result = TBAN_OK;
+  int i;
+
+  /* Sanity check */
+  if(fleet == NULL)
+    return TBAN_STRUCT_NULL_PTR;
+
+  for(i=0; i<fleet->count; i++) {
+    member = fleet->members[i];
+    member->stage = TBAN_SAMPLE_TBAN;
+    result = tban_queryStatusStart(&member->tban, tban_fleetReceived, member);
+    if(result != TBAN_OK)
+      tban_fleetDone(member, result);
+  }
+
+  /* Every request has its own deadline, the loop ends them all */
+  while(tbanLoop_pending(&fleet->loop) > 0)
+    CHECK_RESULT(tbanLoop_run(&fleet->loop, -1));
+
+  result = TBAN_OK;
+  for(i=0; (i<fleet->count) && (result == TBAN_OK); i++)
+    result = fleet->members[i]->result;
+
+  return result;
+}
+
+
+/**********************************************************************
+ * Name        : tban_fleetBegin
+ * Description : Open a command batch on every device. The setters
+ *               called on the member handles are queued until
+ *               tban_fleetCommit.
+ * Arguments   : fleet = The fleet
+ * Returning   : TBAN_OK
+ *               TBAN_STRUCT_NULL_PTR
+ *               TBAN_ALREADY_IN_USE (a batch is already open)
+ **********************************************************************/
+int tban_fleetBegin(struct TBanFleet* fleet) {
+  int result, i;
+
+  /* Sanity check */
+  if(fleet == NULL)
+    return TBAN_STRUCT_NULL_PTR;
+
+  for(i=0; i<fleet->count; i++) {
+    result = tban_batchBegin(&fleet->members[i]->tban, &fleet->members[i]->batch);
+    if(result != TBAN_OK) {
+      while(--i >= 0)
+        (void) tban_batchAbort(&fleet->members[i]->tban);
+      return result;
+    }
+  }
+
+  return TBAN_OK;
+}
+
+
+/**********************************************************************
+ * Name        : tban_fleetCommit
+ * Description : Write the queued commands of every device, wait once
+ *               for the devices to process them and close the batches.
+ * Arguments   : fleet = The fleet
+ * Returning   : TBAN_OK
+ *               TBAN_STRUCT_NULL_PTR
+ *               The error of the first device that failed
+ **********************************************************************/
+int tban_fleetCommit(struct TBanFleet* fleet) {
+  struct TBan* wait = NULL;
+  int result = TBAN_OK;
+  int i;
+
+  /* Sanity check */
+  if(fleet == NULL)
+    return TBAN_STRUCT_NULL_PTR;
+
+  for(i=0; i<fleet->count; i++) {
+    struct TBan* tban = &fleet->members[i]->tban;
+    if((tban_batchOwned(tban) == NULL) || (tban_batchOwned(tban)->len == 0))
+      continue;
+    if(tban_batchWrite(tban, TBAN_FALSE) == TBAN_OK)
+      wait = tban;
+  }
+  if(wait != NULL)
+    tban_commandDelay(wait);
+
+  for(i=0; i<fleet->count; i++) {
+    struct TBan* tban = &fleet->members[i]->tban;
+    int r;
+    if(tban_batchOwned(tban) == NULL)
+      continue;
+    r = tban_batchCommit(tban);
+    if(result == TBAN_OK)
+      result = r;
+  }
+
+  return result;
+}
+
+
+/**********************************************************************
+ * Name        : tban_fleetSummary
+ * Description : Aggregate the state of the members whose last query
+ *               succeeded.
+ * Arguments   : fleet   = The fleet
+ *               summary = The summary to fill in
+ * Returning   : TBAN_OK
+ *               TBAN_STRUCT_NULL_PTR
+ *               TBAN_VALUE_NULL_PTR
+ **********************************************************************/
+int tban_fleetSummary(struct TBanFleet* fleet, struct TBanFleetSummary* summary) {
+  struct TBanChannel ch[TBAN_DEVICE_MAX_CHANNELS];
+  struct TBanSensor  sensor[TBAN_DEVICE_MAX_SENSORS];
+  int i, j, count;
+
+  /* Sanity check */
+  if(fleet == NULL)
+    return TBAN_STRUCT_NULL_PTR;
+  if(summary == NULL)
+    return TBAN_VALUE_NULL_PTR;
+
+  (void) memset(summary, 0, sizeof(*summary));
+  summary->members       = fleet->count;
+  summary->maxTempMember = -1;
+  summary->maxTempSensor = -1;
+
+  for(i=0; i<fleet->count; i++) {
+    struct TBan* tban = &fleet->members[i]->tban;
+    if(fleet->members[i]->result != TBAN_OK)
+      continue;
+    summary->ok++;
+
+    if(tban_deviceChannels(tban, ch, TBAN_DEVICE_MAX_CHANNELS, &count) == TBAN_OK) {
+      summary->channels += count;
+      for(j=0; j<count; j++) {
+        if((ch[j].flags & TBAN_CH_MODE) && (ch[j].mode != 0))
+          summary->manual++;
+        if(ch[j].pwm > summary->maxPwm)
+          summary->maxPwm = ch[j].pwm;
+      }
+    }
+
+    if(tban_deviceSensors(tban, sensor, TBAN_DEVICE_MAX_SENSORS, &count) == TBAN_OK) {
+      summary->sensors += count;
+      for(j=0; j<count; j++) {
+        if((summary->maxTempMember < 0) || (sensor[j].temp > summary->maxTemp)) {
+          summary->maxTemp       = sensor[j].temp;
+          summary->maxTempMember = i;
+          summary->maxTempSensor = j;
+        }
+      }
+    }
+  }
+
+  return TBAN_OK;
+}
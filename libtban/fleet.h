@@ -0,0 +1,132 @@
+/*****************************************************************************
+ ** This program is free software; you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation; either version 2 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program; if not, write to the Free Software
+ ** Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ **
+ **
+ ** FILE INFORMATION
+ ** ----------------
+ ** Filename:        fleet.h
+ ** Initial author:  marcus.jagemar@gmail.com
+ **
+ **
+ ** DESCRIPTION
+ ** -----------
+ ** Many T-Balancers driven from one process. A fleet keeps one struct
+ ** TBan per device, all registered with one event loop (tban_loop.h).
+ **
+ ** tban_fleetQuery sends the status request to every device and then
+ ** waits for all answers at the same time, so a query of the whole
+ ** fleet takes about as long as the query of its slowest device. The
+ ** second vector of a BigNG is requested as soon as its first vector
+ ** has arrived. The miniNG is not read by the fleet.
+ **
+ ** Writes use the normal setters on the member handles. Between
+ ** tban_fleetBegin and tban_fleetCommit they are queued in a batch per
+ ** device; the commit writes every batch and then waits the command
+ ** delay once for all devices:
+ **
+ **   tban_fleetInit(&fleet);
+ **   tban_fleetAdd(&fleet, "/dev/ttyUSB0", NULL);
+ **   tban_fleetAdd(&fleet, "/dev/ttyUSB1", NULL);
+ **   tban_fleetQuery(&fleet);
+ **   tban_fleetBegin(&fleet);
+ **   for(i=0; i<fleet.count; i++)
+ **     tban_setChPwm(&fleet.members[i]->tban, 0, 60);
+ **   tban_fleetCommit(&fleet);
+ **   tban_fleetClose(&fleet);
+ **
+ ** Every member locks its own device node for the whole session. The
+ ** asynchronous queries do not take the lock per transaction, so
+ ** TBAN_LOCK_TRANSACTION is not used in a fleet.
+ **
+ **
+ ** REVISION HISTORY
+ ** ----------------
+ **
+ ** Date        Comment
+ ** =================================================================
+ ** 2026-10-17  File created
+ **
+ *****************************************************************************/
+
+/* Muliple inclusion safeguard */
+#ifndef __FLEET_H
+#define __FLEET_H
+
+#include "tban.h"
+#include "tban_loop.h"
+
+
+/*****************************************************************************
+ * One device of the fleet
+ *****************************************************************************/
+struct TBanFleetMember {
+  struct TBan tban;
+
+  /* Result of the last query, TBAN_OK or the error of the first vector
+   * that failed */
+  int       result;
+  /* Consecutive failed queries */
+  int       errors;
+  /* When the last complete query ended (monotonic clock, ms) */
+  long long queryMs;
+
+  /* Private: the vector being read (TBAN_SAMPLE_*, 0 when idle) and
+   * the batch between tban_fleetBegin and tban_fleetCommit */
+  int              stage;
+  struct TBanBatch batch;
+};
+
+
+/*****************************************************************************
+ * The fleet. members stay at the same address while the fleet exists.
+ *****************************************************************************/
+struct TBanFleet {
+  struct TBanLoop          loop;
+  struct TBanFleetMember** members;
+  int                      count;
+  int                      size;
+};
+
+
+/*****************************************************************************
+ * Aggregated state of the members whose last query succeeded.
+ * Temperatures are doubled as everywhere else. The member and index of
+ * the hottest sensor are -1 when there are no sensors.
+ *****************************************************************************/
+struct TBanFleetSummary {
+  int           members;
+  int           ok;
+  int           channels;
+  int           sensors;
+  int           manual;          /* Channels in manual mode */
+  unsigned char maxPwm;
+  unsigned char maxTemp;
+  int           maxTempMember;
+  int           maxTempSensor;
+};
+
+
+/*****************************************************************************
+ * Exported functions
+ *****************************************************************************/
+int tban_fleetInit(struct TBanFleet* fleet);
+int tban_fleetClose(struct TBanFleet* fleet);
+int tban_fleetAdd(struct TBanFleet* fleet, char* deviceName, int* index);
+int tban_fleetQuery(struct TBanFleet* fleet);
+int tban_fleetBegin(struct TBanFleet* fleet);
+int tban_fleetCommit(struct TBanFleet* fleet);
+int tban_fleetSummary(struct TBanFleet* fleet, struct TBanFleetSummary* summary);
+
+#endif /* __FLEET_H */
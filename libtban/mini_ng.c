@@ -29,16 +29,21 @@
  *****************************************************************************/
  
 #include "mini_ng.h"
+#include "sampler.h"
 #include "common.h"
 #include "tban_hw_def.h"
 
 /*****************************************************************************
- * How long should the application wait after each command has been sent
- * to the miniNG. According to mCubed 600ms should be enough. The unit
- * is nano seconds.
+ * Pass-through flow control. Frames to the miniNG are relayed by the
+ * TBan, one at a time, through the B1-B3 buffer. Instead of sleeping a
+ * fixed time per frame the time it takes for the buffer to drain is
+ * estimated (running average) and the buffer is only polled when it is
+ * expected to be empty. All values in milliseconds.
  *****************************************************************************/
-#define MINI_NG_COMMAND_DELAY_S  0            /* seconds */
-#define MINI_NG_COMMAND_DELAY_NS 250000000    /* nano seconds */
+#define MINI_NG_DRAIN_INITIAL_MS      250   /* First estimate */
+#define MINI_NG_DRAIN_MIN_MS           10   /* Lower bound for estimate */
+#define MINI_NG_DRAIN_POLL_MIN_MS      20   /* Min interval between polls */
+#define MINI_NG_PASSTHROUGH_TIMEOUT_MS 5000 /* Max time for one frame */
 
 
 /*****************************************************************************
@@ -60,14 +65,8 @@
 #define MINI_NG_POT1               4
 #define MINI_NG_POT2               5
 
-#define MINI_NG_UEBERTEMP1        18
-#define MINI_NG_UEBERTEMP2        19
-
 #define MINI_NG_TIMEBASE          57
 
-#define MINI_NG_HYSTERESE_CH1     58
-#define MINI_NG_HYSTERESE_CH2     59
-
 /* Frame information */
 #define MINI_NG_START_TWI         1
 #define MINI_NG_END_TWI           62
@@ -84,17 +83,17 @@
 #define MINI_NG_ABSCAL2           78
 
 
-/* Channel response curve mappings */
-static int miniNG_getChCurveXMap[]        = { 20, 30 };
-static int miniNG_getChCurveYMap[]        = { 25, 35 };
+/* The miniNG status frame. Its length is not fixed so the frame is
+ * considered complete once everything up to the last value used has
+ * arrived and the line has gone quiet. */
+#define MINI_NG_FRAME_IDLE_GAP_MS 50
 
-/* RPM reading mappings */
-static int miniNG_getChRpmMap[]           = { 44, 46 };
-static int miniNG_getChMaxRpmMap[]        = { 45, 47 };
+static const struct TBanFrameSpec miniNG_statusFrame = {
+  285, MINI_NG_ABSCAL2+1, MINI_NG_FRAME_IDLE_GAP_MS,
+  2, { MINI_NG_START_TWI, MINI_NG_END_TWI }, { 253, 254 }
+};
 
-/* Temp reading mappings */
-static int miniNG_getChTempMap[]          = { 6, 7 };
-static int miniNG_getChCalTempMap[]       = { 8, 9 };
+/* The channel and sensor positions are in fields.h (MINI_NG_FIELDS) */
 
 
 
@@ -109,6 +108,8 @@ static int miniNG_getChCalTempMap[]       = { 8, 9 };
  **********************************************************************/
 int miniNG_init(struct TBan* tban)  {
   int i;
+
+  tban->miniNG.drainEstimateMs = MINI_NG_DRAIN_INITIAL_MS;
  
   for(i=0; i<MINI_NG_NUMBER_ANALOG_SENSORS; i++) {
     char string[16];
@@ -177,34 +178,6 @@ char* miniNG_strstat(unsigned int code) {
 
 
 
-/**********************************************************************
- * Name        : miniNG_sendCommand
- * Description : Send a miniNG command
- * Arguments   : tban   = The TBan struct to use when communicating
- *               sndBuf = The buffer containing the command.
- *               cmdLen = The length of the command (usually 1 or 2
- *                        bytes) 
- * Returning   : TBAN_OK
- *               TBAN_ESEND
- *               TBAN_STRUCT_NULL_PTR
- *               TBAN_BUF_NULL_PTR
- *               TBAN_NOT_OPENED
- **********************************************************************/
-int miniNG_sendCommand(struct TBan* tban, unsigned char* sndBuf, int cmdLen) {
-  int result = tban_sendCommand(tban, sndBuf, cmdLen);
-  if(result == TBAN_OK) {
-    /* Wait a while so that the command can safelt be clocked into the
-     * miniNG. Please note that since the tban_sendCommand() function
-     * also waits for a short while we shouldn't really need this long
-     * delay but typically for miniNG we need 600ms and the tban only
-     * needs 25ms so we disregard this fact for the time being. */
-    local_nanosleep(MINI_NG_COMMAND_DELAY_S, MINI_NG_COMMAND_DELAY_NS);
-  }
-  return result;
-}
-
-
-
 /**********************************************************************
  * Name        : miniNG_getValue
  * Description : Return the status for the index supplied. This function
@@ -249,37 +222,84 @@ int miniNG_getValue(struct TBan* tban, int index, unsigned char* value) {
  *               TBAN_CORRUPT_DATA
  **********************************************************************/
 int miniNG_queryStatus(struct TBan* tban) {
-  unsigned char sndBuf[8];
-  unsigned char buf[285];
-
   /* Sanity check */
   if(tban == NULL)
     return TBAN_STRUCT_NULL_PTR;
   if(tban->opened == 0)
     return TBAN_NOT_OPENED;
 
+  /* The sampler thread already has a fresh vector */
+  if(tban_samplerCovers(tban, TBAN_SAMPLE_MINING))
+    return tban_samplerCopy(tban, TBAN_SAMPLE_MINING);
+
+  CHECK_RESULT(miniNG_fetchStatus(tban, tban->miniNG.buf));
+
+  /* Update the time stamp for the last update, but only if we suceeded
+   * with the update */
+  tban->miniNG.lastQuery = time(NULL);
+  tban_shmUpdate(tban, TBAN_SAMPLE_MINING, NULL, NULL, tban->miniNG.buf, tban->miniNG.lastQuery);
+  tban_recorderUpdate(tban, TBAN_SAMPLE_MINING, NULL, NULL, tban->miniNG.buf);
+
+  return TBAN_OK;
+}
+
+
+/**********************************************************************
+ * Name        : miniNG_fetchStatus
+ * Description : Request the miniNG status vector and store it in the
+ *               buffer supplied. The request and the answer form one
+ *               transaction on the port.
+ * Arguments   : tban = The TBan structure.
+ *               buf  = Receive buffer, MINI_NG_BUFSIZE bytes. Bytes
+ *                      not sent by the miniNG are cleared.
+ * Returning   : TBAN_OK
+ *               TBAN_ESEND
+ *               TBAN_ERECEIVE
+ *               TBAN_CORRUPT_DATA
+ **********************************************************************/
+int miniNG_fetchStatus(struct TBan* tban, unsigned char* buf) {
+  unsigned char sndBuf[8];
+  unsigned char frame[285];
+  int           len = 0;
+  int           result;
+
+  result = tban_portLock(tban);
+  if(result != TBAN_OK)
+    return result;
+
+  /* Leftovers from an earlier aborted transfer would end up in front
+   * of the frame */
+  tban_discardInput(tban);
+
   /* Change the USB serial address to the miniNG (second port) and send
    * the query command */
   sndBuf[0] = TBAN_SER_SOURCE2;
   sndBuf[1] = TBAN_SER_REQUEST;
-  CHECK_RESULT(tban_sendCommand(tban, sndBuf, 2));
+  result = tban_writeCommand(tban, sndBuf, 2);
 
   /* Receive the result from the HW */
-  CHECK_RESULT(tban_readData(tban, buf, 285));
-  memcpy(tban->miniNG.buf, buf, 128);
+  if(result == TBAN_OK)
+    result = tban_readFrame(tban, &miniNG_statusFrame, frame, &len);
+
+  tban_portUnlock(tban);
+
+  if(result != TBAN_OK)
+    return result;
+
+  if(len > MINI_NG_BUFSIZE)
+    len = MINI_NG_BUFSIZE;
+  memset(buf, 0, MINI_NG_BUFSIZE);
+  memcpy(buf, frame, len);
 
   /* Make some simple checks on the returned vector. Like that it
    * contains the value "100" in the first position */
-  if((tban->miniNG.buf[0] != 100) ||
-     (tban->miniNG.buf[MINI_NG_START_TWI] != 253) ||
-     (tban->miniNG.buf[MINI_NG_END_TWI] != 254)) {
+  if((buf[0] != 100) ||
+     (buf[MINI_NG_START_TWI] != 253) ||
+     (buf[MINI_NG_END_TWI] != 254)) {
+    tban_statsCount(tban, &tban->stats.corrupt);
     return TBAN_CORRUPT_DATA;
   }
 
-  /* Update the time stamp for the last update, but only if we suceeded
-   * with the update */
-  tban->miniNG.lastQuery = time(NULL);
-
   return TBAN_OK;
 }
 
@@ -312,9 +332,9 @@ int miniNG_getaSensorTemp(struct TBan* tban, int index, unsigned char* temp, uns
     return TBAN_NOT_OPENED;
 
   /* Get the temperature of the digital sensor */
-  CHECK_RESULT(miniNG_getValue(tban, miniNG_getChTempMap[index], temp));
-  CHECK_RESULT(miniNG_getValue(tban, miniNG_getChCalTempMap[index], rawTemp));
-  CHECK_RESULT(miniNG_getValue(tban, MINI_NG_ABSCAL1+index, cal));
+  CHECK_RESULT(miniNG_getValue(tban, TBAN_FIELD_AT(miniNGasTemp, index), temp));
+  CHECK_RESULT(miniNG_getValue(tban, TBAN_FIELD_AT(miniNGasRawTemp, index), rawTemp));
+  CHECK_RESULT(miniNG_getValue(tban, TBAN_FIELD_AT(miniNGasCal, index), cal));
   
   return TBAN_OK;
 }
@@ -346,8 +366,8 @@ int miniNG_getChRpm(struct TBan* tban, int index, unsigned char* rpm, unsigned c
     return TBAN_NOT_OPENED;
 
   /* Get the temperature of the digital sensor */
-  CHECK_RESULT(miniNG_getValue(tban, miniNG_getChRpmMap[index], rpm));
-  CHECK_RESULT(miniNG_getValue(tban, miniNG_getChMaxRpmMap[index], rpmMax));
+  CHECK_RESULT(miniNG_getValue(tban, TBAN_FIELD_AT(miniNGchRpm, index), rpm));
+  CHECK_RESULT(miniNG_getValue(tban, TBAN_FIELD_AT(miniNGchRpmMax, index), rpmMax));
 
   return TBAN_OK;
 }
@@ -376,7 +396,7 @@ int miniNG_getChHysteresis(struct TBan* tban, unsigned char index, unsigned char
     return TBAN_VALUE_NULL_PTR;
 
   /* Get Hysteresis for the selected channel  */
-  CHECK_RESULT(miniNG_getValue(tban, MINI_NG_HYSTERESE_CH1+index, hysteresis));
+  CHECK_RESULT(miniNG_getValue(tban, TBAN_FIELD_AT(miniNGchHysteresis, index), hysteresis));
 
   return TBAN_OK;
 }
@@ -406,7 +426,7 @@ int miniNG_getChOverTemp(struct TBan* tban, int index, unsigned char* temp) {
     return TBAN_NOT_OPENED;
 
   /* Get the current over temperature defined for the channel */
-  CHECK_RESULT(miniNG_getValue(tban, MINI_NG_UEBERTEMP1+index, temp));
+  CHECK_RESULT(miniNG_getValue(tban, TBAN_FIELD_AT(miniNGchOvertemp, index), temp));
 
   return TBAN_OK;
 }
@@ -448,11 +468,11 @@ int miniNG_getChCurve(struct TBan* tban, int index, unsigned char x[], unsigned
   for(i=0; i<5; i++) {
     unsigned char value;
     /* Get the temperature */
-    CHECK_RESULT(miniNG_getValue(tban, miniNG_getChCurveXMap[index]+i, &value));
+    CHECK_RESULT(miniNG_getValue(tban, TBAN_FIELD_AT(miniNGchCurveX, index)+i, &value));
     x[i+1] = value/2;
     
     /* Get the requested pwm */
-    CHECK_RESULT(miniNG_getValue(tban, miniNG_getChCurveYMap[index]+i, &(y[i])));
+    CHECK_RESULT(miniNG_getValue(tban, TBAN_FIELD_AT(miniNGchCurveY, index)+i, &(y[i])));
   }
 
   return TBAN_OK;
@@ -494,6 +514,155 @@ int miniNG_getHwInfo(struct TBan* tban, unsigned char* status, unsigned char* ju
 
 
 
+/**********************************************************************
+ * Name        : miniNG_passThroughEmpty
+ * Description : Check the TBan pass-through buffer in a miniNG status
+ *               vector.
+ * Arguments   : buf = The miniNG status vector
+ * Returning   : TBAN_TRUE when B1-B3 are all 0
+ **********************************************************************/
+static int miniNG_passThroughEmpty(unsigned char* buf) {
+  return ((buf[MINI_NG_TBAN_BUFFER_B1] == 0) &&
+          (buf[MINI_NG_TBAN_BUFFER_B2] == 0) &&
+          (buf[MINI_NG_TBAN_BUFFER_B3] == 0)) ? TBAN_TRUE : TBAN_FALSE;
+}
+
+
+/**********************************************************************
+ * Name        : miniNG_waitPassThrough
+ * Description : Wait until the pass-through buffer in the TBan has been
+ *               emptied. The first poll is made when the buffer is
+ *               expected to be empty according to the drain estimate,
+ *               then at shorter intervals. The estimate is updated with
+ *               the observed time.
+ * Arguments   : tban  = The TBan struct to work on
+ *               start = When the frame was handed to the TBan
+ *                       (local_monotonicMs)
+ * Returning   : TBAN_OK
+ *               TBAN_ERECEIVE (buffer not drained within
+ *                              MINI_NG_PASSTHROUGH_TIMEOUT_MS)
+ *               Errors from miniNG_queryStatus
+ **********************************************************************/
+static int miniNG_waitPassThrough(struct TBan* tban, long long start) {
+  unsigned char buf[MINI_NG_BUFSIZE];
+  long long now, elapsed;
+  long long wait = tban->miniNG.drainEstimateMs;
+  int       interval, sample, polls = 0;
+  int       result;
+
+  interval = tban->miniNG.drainEstimateMs/4;
+  if(interval < MINI_NG_DRAIN_POLL_MIN_MS)
+    interval = MINI_NG_DRAIN_POLL_MIN_MS;
+
+  for(;;) {
+    /* Sleep until the next poll is due */
+    now = local_monotonicMs();
+    if(start + wait > now) {
+      long long ms = start + wait - now;
+      local_nanosleep(ms/1000, (ms%1000)*1000000);
+    }
+
+    /* Poll the device directly, a running sampler would only give us
+     * an old vector */
+    result = miniNG_fetchStatus(tban, buf);
+    if(polls++ > 0)
+      tban_statsCount(tban, &tban->stats.retries);
+    elapsed = local_monotonicMs() - start;
+    if((result == TBAN_OK) && miniNG_passThroughEmpty(buf))
+      break;
+    if(elapsed >= MINI_NG_PASSTHROUGH_TIMEOUT_MS)
+      return (result == TBAN_OK) ? TBAN_ERECEIVE : result;
+
+    wait = elapsed + interval;
+  }
+
+  /* Empty on the first poll means the estimate may be too long, probe
+   * a shorter time next round. Otherwise use the observed time. */
+  if(polls == 1)
+    sample = (tban->miniNG.drainEstimateMs*3)/4;
+  else
+    sample = (int) elapsed;
+
+  tban->miniNG.drainEstimateMs = (3*tban->miniNG.drainEstimateMs + sample)/4;
+  if(tban->miniNG.drainEstimateMs < MINI_NG_DRAIN_MIN_MS)
+    tban->miniNG.drainEstimateMs = MINI_NG_DRAIN_MIN_MS;
+
+  return TBAN_OK;
+}
+
+
+/**********************************************************************
+ * Name        : miniNG_passThrough
+ * Description : Transfer a number of frames to the miniNG through the
+ *               TBan pass-through buffer. Each frame is a command byte
+ *               followed by two values. The next frame is handed to
+ *               the TBan as soon as the previous one has left the
+ *               buffer (B1-B3 = 0).
+ * Arguments   : tban   = The TBan struct to work on
+ *               frames = The frames to send
+ *               count  = Number of frames
+ * Returning   : TBAN_OK
+ *               TBAN_STRUCT_NULL_PTR
+ *               TBAN_VALUE_NULL_PTR
+ *               TBAN_NOT_OPENED
+ *               TBAN_ESEND
+ *               TBAN_ERECEIVE
+ **********************************************************************/
+int miniNG_passThrough(struct TBan* tban, unsigned char frames[][3], int count) {
+  unsigned char sndBuf[8];
+  unsigned char buf[MINI_NG_BUFSIZE];
+  int result;
+  int i;
+
+  /* Argument sanity check */
+  if(tban == NULL)
+    return TBAN_STRUCT_NULL_PTR;
+  if(frames == NULL)
+    return TBAN_VALUE_NULL_PTR;
+  if(tban->opened == 0)
+    return TBAN_NOT_OPENED;
+
+  if(tban->miniNG.drainEstimateMs <= 0)
+    tban->miniNG.drainEstimateMs = MINI_NG_DRAIN_INITIAL_MS;
+
+  /* The whole transfer is one transaction on the port */
+  result = tban_portLock(tban);
+  if(result != TBAN_OK)
+    return result;
+
+  /* Something may still be on its way from an earlier transfer */
+  result = miniNG_fetchStatus(tban, buf);
+  if((result == TBAN_OK) && !miniNG_passThroughEmpty(buf))
+    result = miniNG_waitPassThrough(tban, local_monotonicMs());
+
+  for(i=0; (i<count) && (result == TBAN_OK); i++) {
+    long long start;
+
+    /* Load the frame into the TBan and tell it to pass it on */
+    sndBuf[0] = TBAN_SER_MINI_S1;
+    sndBuf[1] = frames[i][0];
+    sndBuf[2] = TBAN_SER_MINI_S2;
+    sndBuf[3] = frames[i][1];
+    sndBuf[4] = TBAN_SER_MINI_S2_2;
+    sndBuf[5] = frames[i][2];
+    sndBuf[6] = TBAN_SER_MINI_SEND1;
+
+    start = local_monotonicMs();
+    result = tban_sendCommand(tban, sndBuf, 7);
+    if(result == TBAN_OK)
+      result = miniNG_waitPassThrough(tban, start);
+
+    /* Update progress */
+    tban_updateProgress(tban, i+1, count);
+  }
+
+  tban_portUnlock(tban);
+
+  return result;
+}
+
+
+
 /**********************************************************************
  * Name        : miniNG_setChCurve
  * Description : Set the response curve for a particular channel.
@@ -511,8 +680,7 @@ int miniNG_getHwInfo(struct TBan* tban, unsigned char* status, unsigned char* ju
  *               TBAN_NOT_OPENED
  **********************************************************************/
 int miniNG_setChCurve(struct TBan* tban, int nr, unsigned char x[], unsigned char y[]) {
-  unsigned char sndBuf[16];
-  int result;
+  unsigned char frames[5][3];
   int i;
 
   /* Argument sanity check */
@@ -525,51 +693,22 @@ int miniNG_setChCurve(struct TBan* tban, int nr, unsigned char x[], unsigned cha
   if(tban->opened == 0)
     return TBAN_NOT_OPENED;
 
-  /* Build the communication string */
+  /* Build the frames */
   for(i=0; i<5; i++) {
     /* Calculate the function to use. The base address for the channel
      * is MINI_NG_SETCURVE1 and the next channel is located 0x10 above. */
     unsigned char base = MINI_NG_SETCURVE1 + (nr * 0x10);
 
-    /* Add the command to the vector */
-    sndBuf[0] = TBAN_SER_MINI_S1;
-    sndBuf[1] = base+i;
-
-    /* x-axis : temperature */
-    sndBuf[2] = TBAN_SER_MINI_S2;
-    sndBuf[3] = 2*x[i]; /* Needs to be doubled since each step is 0.5
-                         * degrees */
-
+    frames[i][0] = base+i;
+    /* x-axis : temperature. Needs to be doubled since each step is 0.5
+     * degrees */
+    frames[i][1] = 2*x[i];
     /* y-axis : pwm */
-    sndBuf[4] = TBAN_SER_MINI_S2_2;
-    sndBuf[5] = y[i];
-
-    /* Flush the send buffer to miniNG */
-    sndBuf[6] = TBAN_SER_MINI_SEND1;
-    
-    /* Send it */
-    CHECK_RESULT(miniNG_sendCommand(tban, sndBuf, 7));
-
-    /* Poll the miniNG and wait here until we see that the internal
-     * pass-through buffer is 0. This means that the frame sent above
-     * has been handled by the miniNG and that we can continue to send
-     * the next frame. */
-    result = miniNG_queryStatus(tban);
-    while((tban->miniNG.buf[MINI_NG_TBAN_BUFFER_B1] != 0) ||
-          (tban->miniNG.buf[MINI_NG_TBAN_BUFFER_B2] != 0) ||
-          (tban->miniNG.buf[MINI_NG_TBAN_BUFFER_B3] != 0)) {
-      /* Frame not transmitted yet, lets wait a while and update the
-       * status vector for new checks. */
-      local_nanosleep(MINI_NG_COMMAND_DELAY_S, MINI_NG_COMMAND_DELAY_NS);
-      result = miniNG_queryStatus(tban);
-    }
-
-    /* Update progress */
-    tban_updateProgress(tban, i,4);
+    frames[i][2] = y[i];
   }
-  
+
   /* Set the curve */
-  return TBAN_OK;
+  return miniNG_passThrough(tban, frames, 5);
 }
 
 
@@ -89,6 +89,19 @@
  **  	         miniNG. Removed the static delay and implemented a
  **  	         check for B1-B3 bytes in the system response.
  **  	       - miniNG_gethwinfo (Added timebase information)
+ ** 2026-10-17 General improvements
+ **            - Frames are relayed with miniNG_passThrough. The fixed
+ **              250ms delay per frame is gone, the B1-B3 buffer is
+ **              polled when it is expected to have drained (running
+ **              estimate in struct MiniNG) and a frame that does not
+ **              drain within 5s fails with TBAN_ERECEIVE instead of
+ **              hanging forever.
+ **            - miniNG_queryStatus reads the frame using its TWI
+ **              markers and returns when the frame has arrived
+ **              instead of waiting for 285 bytes.
+ **            Added functions:
+ **            - miniNG_passThrough
+ **            - miniNG_present is declared here
  **
  *****************************************************************************/
 
@@ -143,6 +156,7 @@ static const MiniNG_statusTextStruct MiniNG_statusText[] = {
 /* miniNG functions */
 int miniNG_init(struct TBan* tban);
 int miniNG_queryStatus(struct TBan* tban);
+int miniNG_present(struct TBan* tban);
 int miniNG_getHwInfo(struct TBan* tban, unsigned char* status, unsigned char* jumper, unsigned char* pot1, unsigned char* pot2, unsigned char* timebase);
 
 /* Error management functions */
@@ -158,6 +172,9 @@ int miniNG_getChHysteresis(struct TBan* tban, unsigned char index, unsigned char
 /* Channel setters */
 int miniNG_setChCurve(struct TBan* tban, int nr, unsigned char x[], unsigned char y[]);
 
+/* Raw frame transfer through the TBan */
+int miniNG_passThrough(struct TBan* tban, unsigned char frames[][3], int count);
+
 #endif /* __MINI_NG_H */
 
 
@@ -0,0 +1,286 @@
+/*****************************************************************************
+ ** This program is free software; you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation; either version 2 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program; if not, write to the Free Software
+ ** Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ **
+ ** 
+ ** FILE INFORMATION
+ ** ----------------
+ ** Filename:        profile.c
+ ** Initial author:  marcus.jagemar@gmail.com
+ **
+ ** 
+ ** DESCRIPTION
+ ** -----------
+ ** Implementation of the declarative configuration, see profile.h.
+ **
+ ** The current state is decoded with the ordinary getter functions
+ ** and compared part by part and channel by channel. Only the setters
+ ** of the differing parts are called. Within a part (for example the
+ ** seven frames of a response curve) the write-through setter cache
+ ** drops the frames that would not change anything, it is switched on
+ ** for the duration of the apply if the application has not done so.
+ **
+ ** 
+ *****************************************************************************/
+
+#include "profile.h"
+#include "big_ng.h"
+#include "common.h"
+
+
+/**********************************************************************
+ * Name        : tban_profileChDiff
+ * Description : Compare the per channel parts of two profiles for one
+ *               channel.
+ * Arguments   : a, b = The profiles to compare
+ *               ch   = The channel index
+ *               set  = TBAN_PROFILE_* of the parts to compare
+ * Returning   : TBAN_PROFILE_* of the parts that differ
+ **********************************************************************/
+static int tban_profileChDiff(const struct TBanProfile* a, const struct TBanProfile* b, int ch, int set) {
+  int diff = 0;
+
+  if((set & TBAN_PROFILE_CURVE) &&
+     ((memcmp(a->curveX[ch], b->curveX[ch], 7) != 0) ||
+      (memcmp(a->curveY[ch], b->curveY[ch], 6) != 0)))
+    diff |= TBAN_PROFILE_CURVE;
+  if((set & TBAN_PROFILE_HYSTERESIS) && (a->hysteresis[ch] != b->hysteresis[ch]))
+    diff |= TBAN_PROFILE_HYSTERESIS;
+  if((set & TBAN_PROFILE_SENSORS) &&
+     ((a->dsens[ch] != b->dsens[ch]) || (a->asens[ch] != b->asens[ch])))
+    diff |= TBAN_PROFILE_SENSORS;
+  if((set & TBAN_PROFILE_SCALE) && (a->scale[ch] != b->scale[ch]))
+    diff |= TBAN_PROFILE_SCALE;
+  if((set & TBAN_PROFILE_TARGET) &&
+     ((a->target[ch] != b->target[ch]) || (a->targetMode[ch] != b->targetMode[ch])))
+    diff |= TBAN_PROFILE_TARGET;
+
+  return diff;
+}
+
+
+/**********************************************************************
+ * Name        : tban_compareProfile
+ * Description : Compare two profiles.
+ * Arguments   : a, b = The profiles to compare
+ *               set  = TBAN_PROFILE_* of the parts to compare
+ * Returning   : TBAN_PROFILE_* of the parts that differ (0 if equal)
+ **********************************************************************/
+int tban_compareProfile(const struct TBanProfile* a, const struct TBanProfile* b, int set) {
+  int diff = 0;
+  int i;
+
+  if((a == NULL) || (b == NULL))
+    return set;
+
+  for(i=0; i<TBAN_NUMBER_CHANNELS; i++)
+    diff |= tban_profileChDiff(a, b, i, set);
+
+  if((set & TBAN_PROFILE_FREQ) && (a->pwmFreq != b->pwmFreq))
+    diff |= TBAN_PROFILE_FREQ;
+  if((set & TBAN_PROFILE_MOTION) &&
+     ((a->motionLower != b->motionLower) ||
+      (a->motionUpper != b->motionUpper) ||
+      (a->motionError != b->motionError)))
+    diff |= TBAN_PROFILE_MOTION;
+
+  return diff;
+}
+
+
+/**********************************************************************
+ * Name        : tban_readProfile
+ * Description : Decode the current configuration from the local status
+ *               vector (tban_queryStatus must have been called). The
+ *               BigNG part is only read from a BigNG, the set member
+ *               tells which parts were filled in.
+ * Arguments   : tban    = The TBan struct to work on
+ *               profile = Where to store the configuration
+ * Returning   : TBAN_OK
+ *               TBAN_STRUCT_NULL_PTR
+ *               TBAN_VALUE_NULL_PTR
+ *               TBAN_NOT_OPENED
+ **********************************************************************/
+int tban_readProfile(struct TBan* tban, struct TBanProfile* profile) {
+  unsigned char override[4], rotate[4], current[4];
+  unsigned int  rpmMax;
+  unsigned char pwm, resTemp, mode, target;
+  int i, j;
+
+  /* Sanity check */
+  if(tban == NULL)
+    return TBAN_STRUCT_NULL_PTR;
+  if(profile == NULL)
+    return TBAN_VALUE_NULL_PTR;
+  if(tban->opened == 0)
+    return TBAN_NOT_OPENED;
+
+  (void) memset(profile, 0, sizeof(*profile));
+  profile->set = TBAN_PROFILE_ALL;
+
+  for(i=0; i<TBAN_NUMBER_CHANNELS; i++) {
+    /* The temperatures are stored in half degrees */
+    CHECK_RESULT(tban_getChCurve(tban, i, profile->curveX[i], profile->curveY[i]));
+    for(j=0; j<7; j++)
+      profile->curveX[i][j] /= 2;
+
+    CHECK_RESULT(tban_getChHysteresis(tban, i, &profile->hysteresis[i]));
+    CHECK_RESULT(tban_getChSensAssignment(tban, i, &profile->dsens[i], &profile->asens[i]));
+    CHECK_RESULT(tban_getDSensorScaleFact(tban, i, &profile->scale[i]));
+  }
+
+  CHECK_RESULT(tban_getPwmFreq(tban, &profile->pwmFreq));
+  CHECK_RESULT(tban_getMotionSettings(tban, &profile->motionLower, &profile->motionError,
+                                      &profile->motionUpper, override, rotate, current));
+
+  if(bigNG_present(tban) == BIGNG_PRESENT) {
+    for(i=0; i<TBAN_NUMBER_CHANNELS; i++) {
+      CHECK_RESULT(bigNG_getChInfo(tban, i, &rpmMax, &pwm, &resTemp, &mode,
+                                   &target, &profile->targetMode[i]));
+      profile->target[i] = target/2;
+    }
+    profile->set |= TBAN_PROFILE_TARGET;
+  }
+
+  return TBAN_OK;
+}
+
+
+/**********************************************************************
+ * Name        : tban_applyProfileCh
+ * Description : Send the commands for the differing parts of one
+ *               channel.
+ * Arguments   : tban    = The TBan struct to work on
+ *               profile = The desired configuration
+ *               ch      = The channel index
+ *               diff    = TBAN_PROFILE_* of the parts to write
+ * Returning   : TBAN_OK or the error of the failing setter
+ **********************************************************************/
+static int tban_applyProfileCh(struct TBan* tban, const struct TBanProfile* profile, int ch, int diff) {
+  unsigned char x[7], y[7];
+
+  if(diff & TBAN_PROFILE_CURVE) {
+    (void) memcpy(x, profile->curveX[ch], sizeof(x));
+    (void) memcpy(y, profile->curveY[ch], sizeof(y));
+    CHECK_RESULT(tban_setChCurve(tban, ch, x, y));
+  }
+  if(diff & TBAN_PROFILE_HYSTERESIS)
+    CHECK_RESULT(tban_setChHysteresis(tban, ch, profile->hysteresis[ch]));
+  if(diff & TBAN_PROFILE_SENSORS)
+    CHECK_RESULT(tban_setChSensAssignment(tban, ch, profile->dsens[ch], profile->asens[ch]));
+  if(diff & TBAN_PROFILE_SCALE)
+    CHECK_RESULT(tban_setSensorScaleFact(tban, ch, profile->scale[ch]));
+  if(diff & TBAN_PROFILE_TARGET) {
+    CHECK_RESULT(bigNG_setChTargetTemp(tban, ch, profile->target[ch]));
+    CHECK_RESULT(bigNG_setChTargetMode(tban, ch, profile->targetMode[ch]));
+  }
+
+  return TBAN_OK;
+}
+
+
+/**********************************************************************
+ * Name        : tban_applyProfile
+ * Description : Bring the device to the configuration of the profile.
+ *               The status is queried, the commands needed are sent
+ *               as one batch (or added to the batch already open) and
+ *               the result is verified with one more query.
+ * Arguments   : tban    = The TBan struct to work on
+ *               profile = The desired configuration
+ *               frames  = Number of command frames sent (may be NULL)
+ * Returning   : TBAN_OK
+ *               TBAN_STRUCT_NULL_PTR
+ *               TBAN_VALUE_NULL_PTR
+ *               TBAN_VALUE_OUT_OF_BOUNDS (motion setting 0)
+ *               TBAN_NOT_IMPLEMENTED (BigNG part on other devices)
+ *               TBAN_NOT_OPENED
+ *               TBAN_ESEND
+ *               TBAN_ERECEIVE
+ *               TBAN_VERIFY_FAILED
+ **********************************************************************/
+int tban_applyProfile(struct TBan* tban, const struct TBanProfile* profile, int* frames) {
+  struct TBanProfile current;
+  struct TBanBatch   batch;
+  int diff, ownBatch, ownCache, first;
+  int result = TBAN_OK;
+  int i;
+
+  /* Sanity check */
+  if(tban == NULL)
+    return TBAN_STRUCT_NULL_PTR;
+  if(profile == NULL)
+    return TBAN_VALUE_NULL_PTR;
+  if(tban->opened == 0)
+    return TBAN_NOT_OPENED;
+  if((profile->set & TBAN_PROFILE_MOTION) &&
+     ((profile->motionLower == 0) || (profile->motionUpper == 0) || (profile->motionError == 0)))
+    return TBAN_VALUE_OUT_OF_BOUNDS;
+  if(frames != NULL)
+    *frames = 0;
+
+  /* Current state */
+  CHECK_RESULT(tban_queryStatus(tban));
+  CHECK_RESULT(tban_readProfile(tban, &current));
+  if((profile->set & TBAN_PROFILE_TARGET) && !(current.set & TBAN_PROFILE_TARGET))
+    return TBAN_NOT_IMPLEMENTED;
+
+  diff = tban_compareProfile(profile, &current, profile->set);
+  if(diff == 0)
+    return TBAN_OK;
+
+  /* The setter cache trims the frames within each part */
+  ownCache = !tban->shadow.enabled;
+  if(ownCache)
+    (void) tban_configureWriteCache(tban, TBAN_TRUE);
+
+  ownBatch = (tban_batchOwned(tban) == NULL);
+  if(ownBatch)
+    result = tban_batchBegin(tban, &batch);
+  first = (result == TBAN_OK) ? tban_batchOwned(tban)->frames : 0;
+
+  for(i=0; (i<TBAN_NUMBER_CHANNELS) && (result == TBAN_OK); i++)
+    result = tban_applyProfileCh(tban, profile, i,
+                                 tban_profileChDiff(profile, &current, i, profile->set));
+  if((result == TBAN_OK) && (diff & TBAN_PROFILE_FREQ))
+    result = tban_setPwmFreq(tban, profile->pwmFreq);
+  if((result == TBAN_OK) && (diff & TBAN_PROFILE_MOTION))
+    result = tban_setMotion(tban, profile->motionLower, profile->motionUpper, profile->motionError);
+
+  if((frames != NULL) && (tban_batchOwned(tban) != NULL))
+    *frames = tban_batchOwned(tban)->frames - first;
+
+  if(ownBatch) {
+    if(result == TBAN_OK)
+      result = tban_batchCommit(tban);
+    else if(tban_batchOwned(tban) != NULL)
+      (void) tban_batchAbort(tban);
+  } else if(result == TBAN_OK) {
+    result = tban_batchFlush(tban);
+  }
+
+  if(ownCache)
+    (void) tban_configureWriteCache(tban, TBAN_FALSE);
+  if(result != TBAN_OK)
+    return result;
+
+  /* Verify with a vector read after the commands, never an older
+   * sampler snapshot */
+  CHECK_RESULT(tban_fetchStatus(tban, tban->buf));
+  CHECK_RESULT(tban_statusReceived(tban));
+  CHECK_RESULT(tban_readProfile(tban, &current));
+  if(tban_compareProfile(profile, &current, profile->set) != 0)
+    return TBAN_VERIFY_FAILED;
+
+  return TBAN_OK;
+}
@@ -0,0 +1,105 @@
+/*****************************************************************************
+ ** This program is free software; you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation; either version 2 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program; if not, write to the Free Software
+ ** Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ **
+ ** 
+ ** FILE INFORMATION
+ ** ----------------
+ ** Filename:        profile.h
+ ** Initial author:  marcus.jagemar@gmail.com
+ **
+ ** 
+ ** DESCRIPTION
+ ** -----------
+ ** Declarative configuration. A profile holds the complete desired
+ ** configuration of a device. tban_applyProfile reads the current
+ ** state from the status vector, sends only the commands needed to
+ ** reach the profile (in one batch) and verifies the result with a
+ ** single new query.
+ **
+ ** All values use the units of the corresponding setter function, for
+ ** example whole degrees for the curve temperatures and the BigNG
+ ** target temperature.
+ **
+ ** 
+ ** REVISION HISTORY
+ ** ----------------
+ ** 
+ ** Date        Comment
+ ** =================================================================
+ ** 2026-10-17  File created
+ **
+ *****************************************************************************/
+
+/* Muliple inclusion safeguard */
+#ifndef __PROFILE_H
+#define __PROFILE_H
+
+#include "tban.h"
+
+
+/*****************************************************************************
+ * Parts of a profile (the set member). Parts not set are neither
+ * compared nor written.
+ *****************************************************************************/
+#define TBAN_PROFILE_CURVE       0x01
+#define TBAN_PROFILE_HYSTERESIS  0x02
+#define TBAN_PROFILE_SENSORS     0x04
+#define TBAN_PROFILE_SCALE       0x08
+#define TBAN_PROFILE_FREQ        0x10
+#define TBAN_PROFILE_MOTION      0x20
+#define TBAN_PROFILE_TARGET      0x40  /* BigNG only */
+#define TBAN_PROFILE_ALL         0x3f  /* Everything a TBan supports */
+
+
+/*****************************************************************************
+ * Desired configuration
+ *****************************************************************************/
+struct TBanProfile {
+  int set;
+
+  /* Response curves, see tban_setChCurve (curveY[][6] is always 100) */
+  unsigned char curveX[TBAN_NUMBER_CHANNELS][7];
+  unsigned char curveY[TBAN_NUMBER_CHANNELS][7];
+
+  unsigned char hysteresis[TBAN_NUMBER_CHANNELS];
+
+  /* Sensor assignment, see tban_setChSensAssignment */
+  unsigned char dsens[TBAN_NUMBER_CHANNELS];
+  unsigned char asens[TBAN_NUMBER_CHANNELS];
+
+  /* Sensor scaling factors, see tban_setSensorScaleFact */
+  unsigned char scale[TBAN_NUMBER_CHANNELS];
+
+  unsigned char pwmFreq;
+
+  /* Motion settings, see tban_setMotion (none of them may be 0) */
+  unsigned char motionLower;
+  unsigned char motionUpper;
+  unsigned char motionError;
+
+  /* BigNG target temperature and mode per channel */
+  unsigned char target[TBAN_NUMBER_CHANNELS];
+  unsigned char targetMode[TBAN_NUMBER_CHANNELS];
+};
+
+
+/*****************************************************************************
+ * Exported functions
+ *****************************************************************************/
+int tban_readProfile(struct TBan* tban, struct TBanProfile* profile);
+int tban_compareProfile(const struct TBanProfile* a, const struct TBanProfile* b, int set);
+int tban_applyProfile(struct TBan* tban, const struct TBanProfile* profile, int* frames);
+
+#endif /* __PROFILE_H */
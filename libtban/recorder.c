@@ -0,0 +1,706 @@
+/*****************************************************************************
+ ** This program is free software; you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation; either version 2 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program; if not, write to the Free Software
+ ** Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ **
+ ** 
+ ** FILE INFORMATION
+ ** ----------------
+ ** Filename:        recorder.c
+ ** Initial author:  marcus.jagemar@gmail.com
+ **
+ **
+ ** 
+ ** DESCRIPTION
+ ** -----------
+ ** Implementation of the status vector recorder, see recorder.h for
+ ** the file format.
+ **
+ ** The writer keeps the last vector of every source to compute the
+ ** deltas. Records may come from the application thread and from the
+ ** sampler thread, a mutex orders them.
+ **
+ ** 
+ *****************************************************************************/
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "tban.h"
+#include "recorder.h"
+#include "common.h"
+
+
+/*****************************************************************************
+ * Number of sources (TBan, BigNG, miniNG)
+ *****************************************************************************/
+#define TBAN_REC_SOURCES  3
+
+
+/*****************************************************************************
+ * Writer state, one per handle
+ *****************************************************************************/
+struct TBanRecorder {
+  int                   fd;
+  int                   idxFd;
+  unsigned char*        map;
+  size_t                capacity;
+  size_t                used;
+  pthread_mutex_t       lock;
+
+  int                   indexIntervalMs;
+  long long             lastIndexMs;
+  long long             lastTimeMs;
+  int                   keyNeeded;   /* TBAN_SAMPLE_* due for a keyframe */
+
+  unsigned char         prev[TBAN_REC_SOURCES][TBAN_STATUS_SIZE];
+  int                   prevLen[TBAN_REC_SOURCES];
+};
+
+
+/**********************************************************************
+ * Name        : tban_recNowMs
+ * Description : Read the wall clock.
+ * Arguments   : none
+ * Returning   : Milliseconds since the epoch
+ **********************************************************************/
+static long long tban_recNowMs(void) {
+  struct timespec now;
+
+  (void) clock_gettime(CLOCK_REALTIME, &now);
+  return ((long long) now.tv_sec)*1000 + now.tv_nsec/1000000;
+}
+
+
+/**********************************************************************
+ * Name        : tban_recPutVarint
+ * Description : Store an unsigned number, 7 bits per byte, the high
+ *               bit set on all but the last byte.
+ * Arguments   : out = Where to store it
+ *               v   = The number
+ * Returning   : Number of bytes used
+ **********************************************************************/
+static int tban_recPutVarint(unsigned char* out, unsigned long long v) {
+  int n = 0;
+
+  while(v >= 0x80) {
+    out[n++] = (unsigned char) (v | 0x80);
+    v >>= 7;
+  }
+  out[n++] = (unsigned char) v;
+
+  return n;
+}
+
+
+/**********************************************************************
+ * Name        : tban_recGetVarint
+ * Description : Read a number stored by tban_recPutVarint.
+ * Arguments   : map = The segment
+ *               end = First byte not to be read
+ *               pos = Position, advanced past the number
+ *               v   = The number
+ * Returning   : TBAN_OK
+ *               TBAN_CORRUPT_DATA
+ **********************************************************************/
+static int tban_recGetVarint(const unsigned char* map, size_t end, size_t* pos, unsigned long long* v) {
+  int shift = 0;
+
+  *v = 0;
+  for(;;) {
+    if((*pos >= end) || (shift > 63))
+      return TBAN_CORRUPT_DATA;
+    *v |= ((unsigned long long) (map[*pos] & 0x7f)) << shift;
+    if((map[(*pos)++] & 0x80) == 0)
+      return TBAN_OK;
+    shift += 7;
+  }
+}
+
+
+/**********************************************************************
+ * Name        : tban_recEncode
+ * Description : Encode one record.
+ * Arguments   : out  = Where to store it (TBAN_REC_MAX_RECORD bytes)
+ *               src  = Source index
+ *               key  = Keyframe or delta
+ *               time = Time field (absolute or zigzag difference)
+ *               vec  = The vector
+ *               prev = The previous vector of the source (deltas)
+ *               len  = Length of the vector
+ * Returning   : Number of bytes used
+ **********************************************************************/
+static int tban_recEncode(unsigned char* out, int src, int key, unsigned long long time,
+                          const unsigned char* vec, const unsigned char* prev, int len) {
+  int n = 0, i = 0, z, l, j;
+
+#define TBAN_REC_DELTA(k) (key ? vec[k] : (unsigned char) (vec[k] ^ prev[k]))
+
+  out[n++] = (unsigned char) (src | (key ? TBAN_REC_KEYFRAME : 0));
+  n += tban_recPutVarint(out+n, time);
+  n += tban_recPutVarint(out+n, len);
+
+  while(i < len) {
+    /* Unchanged bytes */
+    for(z=0; (i+z < len) && (TBAN_REC_DELTA(i+z) == 0); z++)
+      ;
+    i += z;
+
+    /* Changed bytes. A single unchanged byte is cheaper to carry along
+     * than to start a new pair of runs for. */
+    for(l=0; i+l < len; l++) {
+      if((TBAN_REC_DELTA(i+l) == 0) &&
+         ((i+l+1 >= len) || (TBAN_REC_DELTA(i+l+1) == 0)))
+        break;
+    }
+
+    n += tban_recPutVarint(out+n, z);
+    n += tban_recPutVarint(out+n, l);
+    for(j=0; j<l; j++)
+      out[n++] = TBAN_REC_DELTA(i+j);
+    i += l;
+  }
+
+#undef TBAN_REC_DELTA
+
+  return n;
+}
+
+
+/**********************************************************************
+ * Name        : tban_recGrow
+ * Description : Make sure the segment has room for another record.
+ * Arguments   : w = The writer
+ * Returning   : TBAN_OK
+ *               TBAN_EOPEN (see errno)
+ **********************************************************************/
+static int tban_recGrow(struct TBanRecorder* w) {
+  size_t         capacity;
+  unsigned char* map;
+
+  if(w->used + TBAN_REC_MAX_RECORD <= w->capacity)
+    return TBAN_OK;
+
+  capacity = w->capacity + TBAN_REC_GROW;
+  if(ftruncate(w->fd, capacity) != 0)
+    return TBAN_EOPEN;
+  map = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, w->fd, 0);
+  if(map == MAP_FAILED)
+    return TBAN_EOPEN;
+
+  (void) munmap(w->map, w->capacity);
+  w->map      = map;
+  w->capacity = capacity;
+
+  return TBAN_OK;
+}
+
+
+/**********************************************************************
+ * Name        : tban_recAppend
+ * Description : Append a vector to the segment.
+ * Arguments   : w      = The writer
+ *               src    = Source index
+ *               timeMs = When the vector was received
+ *               vec    = The vector
+ *               len    = Its length
+ * Returning   : TBAN_OK
+ *               TBAN_EOPEN (segment could not be grown)
+ **********************************************************************/
+static int tban_recAppend(struct TBanRecorder* w, int src, long long timeMs,
+                          const unsigned char* vec, int len) {
+  struct TBanRecHeader* hdr;
+  struct TBanRecIndex   entry;
+  unsigned long long    time;
+  long long             diff;
+  int                   key;
+
+  CHECK_RESULT(tban_recGrow(w));
+
+  /* Index point: every source starts over with a keyframe */
+  if((w->lastIndexMs == 0) || (timeMs - w->lastIndexMs >= w->indexIntervalMs)) {
+    entry.timeMs = timeMs;
+    entry.offset = w->used;
+    if(write(w->idxFd, &entry, sizeof(entry)) == sizeof(entry)) {
+      w->lastIndexMs = timeMs;
+      w->keyNeeded   = TBAN_SAMPLE_ALL;
+    }
+  }
+
+  key = (w->keyNeeded & (1 << src)) || (w->prevLen[src] != len);
+  if(key) {
+    time = timeMs;
+    w->keyNeeded &= ~(1 << src);
+  } else {
+    diff = timeMs - w->lastTimeMs;
+    time = (diff < 0) ? ((unsigned long long) (-diff) << 1) - 1 : (unsigned long long) diff << 1;
+  }
+
+  w->used += tban_recEncode(w->map + w->used, src, key, time, vec, w->prev[src], len);
+  (void) memcpy(w->prev[src], vec, len);
+  w->prevLen[src] = len;
+  w->lastTimeMs   = timeMs;
+
+  /* Publish the record to readers */
+  hdr = (struct TBanRecHeader*) w->map;
+  __atomic_store_n(&hdr->used, w->used, __ATOMIC_RELEASE);
+
+  return TBAN_OK;
+}
+
+
+/**********************************************************************
+ * Name        : tban_recorderUpdate
+ * Description : Record freshly received vectors. Does nothing unless
+ *               tban_recorderStart has been called.
+ * Arguments   : tban      = The TBan handle
+ *               which     = TBAN_SAMPLE_* of the vectors received
+ *               tbanBuf   = The TBan vector (or NULL)
+ *               bigNGBuf  = The BigNG vector (or NULL)
+ *               miniNGBuf = The miniNG vector (or NULL)
+ * Returning   : none
+ **********************************************************************/
+void tban_recorderUpdate(struct TBan* tban, int which, const unsigned char* tbanBuf,
+                         const unsigned char* bigNGBuf, const unsigned char* miniNGBuf) {
+  struct TBanRecorder* w = tban->recorder;
+  long long            now;
+
+  if(w == NULL)
+    return;
+  now = tban_recNowMs();
+
+  (void) pthread_mutex_lock(&w->lock);
+  if((which & TBAN_SAMPLE_TBAN) && (tbanBuf != NULL))
+    (void) tban_recAppend(w, 0, now, tbanBuf, TBAN_STATUS_SIZE);
+  if((which & TBAN_SAMPLE_BIGNG) && (bigNGBuf != NULL))
+    (void) tban_recAppend(w, 1, now, bigNGBuf, BIGNG_STATUS_SIZE);
+  if((which & TBAN_SAMPLE_MINING) && (miniNGBuf != NULL))
+    (void) tban_recAppend(w, 2, now, miniNGBuf, MINI_NG_BUFSIZE);
+  (void) pthread_mutex_unlock(&w->lock);
+}
+
+
+/**********************************************************************
+ * Name        : tban_recorderStart
+ * Description : Start recording the vectors received by the handle.
+ *               An existing segment is appended to, otherwise it is
+ *               created. The vectors already in the handle are
+ *               recorded at once.
+ * Arguments   : tban            = The TBan handle
+ *               path            = The segment file, the index is kept
+ *                                 in path + ".idx"
+ *               indexIntervalMs = Keyframe/index interval, 0 for the
+ *                                 one of an existing segment or
+ *                                 TBAN_REC_INDEX_INTERVAL_MS
+ * Returning   : TBAN_OK
+ *               TBAN_STRUCT_NULL_PTR
+ *               TBAN_VALUE_NULL_PTR
+ *               TBAN_ALREADY_IN_USE (already recording)
+ *               TBAN_CANNOT_MALLOC
+ *               TBAN_CORRUPT_DATA (not a segment file)
+ *               TBAN_EOPEN (see errno)
+ **********************************************************************/
+int tban_recorderStart(struct TBan* tban, const char* path, int indexIntervalMs) {
+  struct TBanRecorder*  w;
+  struct TBanRecHeader* hdr;
+  struct stat           st;
+  char*                 idxPath;
+  int                   result = TBAN_EOPEN;
+
+  /* Sanity check */
+  if(tban == NULL)
+    return TBAN_STRUCT_NULL_PTR;
+  if(path == NULL)
+    return TBAN_VALUE_NULL_PTR;
+  if(tban->recorder != NULL)
+    return TBAN_ALREADY_IN_USE;
+
+  w = calloc(1, sizeof(struct TBanRecorder));
+  idxPath = malloc(strlen(path) + 5);
+  if((w == NULL) || (idxPath == NULL)) {
+    free(w);
+    free(idxPath);
+    return TBAN_CANNOT_MALLOC;
+  }
+  (void) sprintf(idxPath, "%s.idx", path);
+  w->idxFd = -1;
+
+  w->fd = open(path, O_RDWR | O_CREAT, 0644);
+  if((w->fd < 0) || (fstat(w->fd, &st) != 0))
+    goto fail;
+
+  if(st.st_size == 0) {
+    /* New segment */
+    w->capacity = TBAN_REC_GROW;
+    if(ftruncate(w->fd, w->capacity) != 0)
+      goto fail;
+  } else {
+    w->capacity = st.st_size;
+  }
+  w->map = mmap(NULL, w->capacity, PROT_READ | PROT_WRITE, MAP_SHARED, w->fd, 0);
+  if(w->map == MAP_FAILED) {
+    w->map = NULL;
+    goto fail;
+  }
+  hdr = (struct TBanRecHeader*) w->map;
+
+  if(st.st_size == 0) {
+    (void) memcpy(hdr->magic, TBAN_REC_MAGIC, sizeof(TBAN_REC_MAGIC));
+    hdr->version         = TBAN_REC_VERSION;
+    hdr->headerSize      = sizeof(struct TBanRecHeader);
+    hdr->created         = tban_recNowMs();
+    hdr->indexIntervalMs = (indexIntervalMs > 0) ? indexIntervalMs : TBAN_REC_INDEX_INTERVAL_MS;
+    hdr->used            = hdr->headerSize;
+  } else if((w->capacity < sizeof(struct TBanRecHeader)) ||
+            (memcmp(hdr->magic, TBAN_REC_MAGIC, sizeof(TBAN_REC_MAGIC)) != 0) ||
+            (hdr->version != TBAN_REC_VERSION) ||
+            (hdr->used > w->capacity)) {
+    result = TBAN_CORRUPT_DATA;
+    goto fail;
+  }
+  w->used            = hdr->used;
+  w->indexIntervalMs = (indexIntervalMs > 0) ? indexIntervalMs : (int) hdr->indexIntervalMs;
+
+  w->idxFd = open(idxPath, O_WRONLY | O_CREAT | O_APPEND, 0644);
+  if(w->idxFd < 0)
+    goto fail;
+  free(idxPath);
+
+  /* Nothing is known about the earlier records */
+  w->keyNeeded = TBAN_SAMPLE_ALL;
+  (void) pthread_mutex_init(&w->lock, NULL);
+  tban->recorder = w;
+
+  /* What the handle already knows */
+  if(tban->lastQuery != 0)
+    tban_recorderUpdate(tban, TBAN_SAMPLE_TBAN, tban->buf, NULL, NULL);
+  if(tban->bigNG.lastQuery != 0)
+    tban_recorderUpdate(tban, TBAN_SAMPLE_BIGNG, NULL, tban->bigNG.buf, NULL);
+  if(tban->miniNG.lastQuery != 0)
+    tban_recorderUpdate(tban, TBAN_SAMPLE_MINING, NULL, NULL, tban->miniNG.buf);
+
+  return TBAN_OK;
+
+ fail:
+  if(w->map != NULL)
+    (void) munmap(w->map, w->capacity);
+  if(w->fd >= 0)
+    (void) close(w->fd);
+  free(idxPath);
+  free(w);
+  return result;
+}
+
+
+/**********************************************************************
+ * Name        : tban_recorderStop
+ * Description : Stop recording. The segment is cut to the bytes in
+ *               use. Must not be called while the sampler runs.
+ * Arguments   : tban = The TBan handle
+ * Returning   : TBAN_OK
+ *               TBAN_STRUCT_NULL_PTR
+ *               TBAN_VALUE_NULL_PTR (not recording)
+ *               TBAN_ALREADY_IN_USE (sampler running)
+ **********************************************************************/
+int tban_recorderStop(struct TBan* tban) {
+  struct TBanRecorder* w;
+
+  /* Sanity check */
+  if(tban == NULL)
+    return TBAN_STRUCT_NULL_PTR;
+  if(tban->recorder == NULL)
+    return TBAN_VALUE_NULL_PTR;
+  if(tban->sampler != NULL)
+    return TBAN_ALREADY_IN_USE;
+
+  w = tban->recorder;
+  tban->recorder = NULL;
+
+  (void) munmap(w->map, w->capacity);
+  (void) ftruncate(w->fd, w->used);
+  (void) close(w->fd);
+  (void) close(w->idxFd);
+  (void) pthread_mutex_destroy(&w->lock);
+  free(w);
+
+  return TBAN_OK;
+}
+
+
+/**********************************************************************
+ * Name        : tban_recStep
+ * Description : Decode the next record and apply it to the replay
+ *               state. Deltas of a source without a keyframe yet are
+ *               skipped.
+ * Arguments   : r   = The reader
+ *               src = The source index of the record
+ * Returning   : TBAN_OK
+ *               TBAN_NO_MORE_DATA
+ *               TBAN_CORRUPT_DATA
+ **********************************************************************/
+static int tban_recStep(struct TBanRecReader* r, int* src) {
+  unsigned long long v, z, l;
+  unsigned char      type;
+  size_t             pos = r->pos;
+  int                key, apply, len, cover = 0;
+
+  if(pos >= r->used)
+    return TBAN_NO_MORE_DATA;
+
+  type = r->map[pos++];
+  key  = (type & TBAN_REC_KEYFRAME) != 0;
+  *src = type & ~TBAN_REC_KEYFRAME;
+  if(*src >= TBAN_REC_SOURCES)
+    return TBAN_CORRUPT_DATA;
+
+  CHECK_RESULT(tban_recGetVarint(r->map, r->used, &pos, &v));
+  if(key)
+    r->timeMs = (long long) v;
+  else
+    r->timeMs += (v & 1) ? -(long long) ((v+1) >> 1) : (long long) (v >> 1);
+
+  CHECK_RESULT(tban_recGetVarint(r->map, r->used, &pos, &v));
+  len = (int) v;
+  if((v == 0) || (v > TBAN_STATUS_SIZE))
+    return TBAN_CORRUPT_DATA;
+
+  apply = key || (r->known & (1 << *src));
+  if(apply && !key && (r->len[*src] != len))
+    return TBAN_CORRUPT_DATA;
+
+  while(cover < len) {
+    CHECK_RESULT(tban_recGetVarint(r->map, r->used, &pos, &z));
+    CHECK_RESULT(tban_recGetVarint(r->map, r->used, &pos, &l));
+    if((z + l > (unsigned long long) (len - cover)) || (pos + l > r->used) ||
+       ((z + l) == 0))
+      return TBAN_CORRUPT_DATA;
+
+    if(key)
+      (void) memset(r->state[*src] + cover, 0, z);
+    cover += z;
+    if(key) {
+      (void) memcpy(r->state[*src] + cover, r->map + pos, l);
+    } else if(apply) {
+      unsigned long long j;
+      for(j=0; j<l; j++)
+        r->state[*src][cover+j] ^= r->map[pos+j];
+    }
+    cover += l;
+    pos   += l;
+  }
+
+  if(key) {
+    r->known   |= 1 << *src;
+    r->len[*src] = len;
+  }
+  r->pos = pos;
+
+  return TBAN_OK;
+}
+
+
+/**********************************************************************
+ * Name        : tban_recOpen
+ * Description : Open a segment for replay, positioned at the first
+ *               record. Records appended later are not seen, open the
+ *               segment again to follow a running recorder.
+ * Arguments   : reader = Reader handle to fill in
+ *               path   = The segment file
+ * Returning   : TBAN_OK
+ *               TBAN_STRUCT_NULL_PTR
+ *               TBAN_VALUE_NULL_PTR
+ *               TBAN_CORRUPT_DATA (not a segment file)
+ *               TBAN_EOPEN (see errno)
+ **********************************************************************/
+int tban_recOpen(struct TBanRecReader* reader, const char* path) {
+  const struct TBanRecHeader* hdr;
+  struct stat                 st;
+  char*                       idxPath;
+  void*                       map;
+  int                         fd;
+
+  /* Sanity check */
+  if(reader == NULL)
+    return TBAN_STRUCT_NULL_PTR;
+  if(path == NULL)
+    return TBAN_VALUE_NULL_PTR;
+  (void) memset(reader, 0, sizeof(*reader));
+
+  fd = open(path, O_RDONLY);
+  if(fd < 0)
+    return TBAN_EOPEN;
+  if((fstat(fd, &st) != 0) || (st.st_size < (off_t) sizeof(struct TBanRecHeader))) {
+    (void) close(fd);
+    return TBAN_CORRUPT_DATA;
+  }
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  (void) close(fd);
+  if(map == MAP_FAILED)
+    return TBAN_EOPEN;
+
+  hdr = map;
+  if((memcmp(hdr->magic, TBAN_REC_MAGIC, sizeof(TBAN_REC_MAGIC)) != 0) ||
+     (hdr->version != TBAN_REC_VERSION) ||
+     (hdr->headerSize < sizeof(struct TBanRecHeader))) {
+    (void) munmap(map, st.st_size);
+    return TBAN_CORRUPT_DATA;
+  }
+  reader->map  = map;
+  reader->size = st.st_size;
+  reader->used = __atomic_load_n(&hdr->used, __ATOMIC_ACQUIRE);
+  if(reader->used > reader->size)
+    reader->used = reader->size;
+  reader->pos  = hdr->headerSize;
+
+  /* The index is optional, without it seeking decodes from the start */
+  idxPath = malloc(strlen(path) + 5);
+  if(idxPath == NULL)
+    return TBAN_OK;
+  (void) sprintf(idxPath, "%s.idx", path);
+  fd = open(idxPath, O_RDONLY);
+  free(idxPath);
+  if(fd < 0)
+    return TBAN_OK;
+  if((fstat(fd, &st) == 0) && (st.st_size >= (off_t) sizeof(struct TBanRecIndex))) {
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if(map != MAP_FAILED) {
+      reader->index      = map;
+      reader->indexCount = st.st_size / sizeof(struct TBanRecIndex);
+    }
+  }
+  (void) close(fd);
+
+  return TBAN_OK;
+}
+
+
+/**********************************************************************
+ * Name        : tban_recSeek
+ * Description : Position the reader at the first record at or after a
+ *               point in time. The time index is searched for the
+ *               last index point before it, from there on at most one
+ *               index interval is decoded.
+ * Arguments   : reader = The reader
+ *               timeMs = ms since the epoch
+ * Returning   : TBAN_OK
+ *               TBAN_STRUCT_NULL_PTR
+ *               TBAN_NO_MORE_DATA (nothing recorded after timeMs)
+ *               TBAN_CORRUPT_DATA
+ **********************************************************************/
+int tban_recSeek(struct TBanRecReader* reader, long long timeMs) {
+  const struct TBanRecHeader* hdr;
+  size_t lo, hi, mid;
+  int    src, result;
+
+  /* Sanity check */
+  if((reader == NULL) || (reader->map == NULL))
+    return TBAN_STRUCT_NULL_PTR;
+
+  /* Last index point not after timeMs */
+  hdr = (const struct TBanRecHeader*) reader->map;
+  reader->pos = hdr->headerSize;
+  lo = 0;
+  hi = reader->indexCount;
+  while(lo < hi) {
+    mid = (lo + hi)/2;
+    if(reader->index[mid].timeMs <= timeMs)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  while(lo > 0) {
+    /* Index points of a crashed writer may lie beyond the data */
+    if(reader->index[lo-1].offset < reader->used) {
+      reader->pos = reader->index[lo-1].offset;
+      break;
+    }
+    lo--;
+  }
+  reader->known   = 0;
+  reader->pending = 0;
+
+  for(;;) {
+    result = tban_recStep(reader, &src);
+    if(result != TBAN_OK)
+      return result;
+    if((reader->known & (1 << src)) && (reader->timeMs >= timeMs)) {
+      reader->pending = src + 1;
+      return TBAN_OK;
+    }
+  }
+}
+
+
+/**********************************************************************
+ * Name        : tban_recNext
+ * Description : Replay the next record.
+ * Arguments   : reader = The reader
+ *               source = TBAN_SAMPLE_TBAN, _BIGNG or _MINING
+ *               timeMs = When the vector was received (ms since the
+ *                        epoch)
+ *               vec    = The vector (TBAN_STATUS_SIZE bytes)
+ *               len    = Length of the vector
+ * Returning   : TBAN_OK
+ *               TBAN_STRUCT_NULL_PTR
+ *               TBAN_VALUE_NULL_PTR
+ *               TBAN_NO_MORE_DATA
+ *               TBAN_CORRUPT_DATA
+ **********************************************************************/
+int tban_recNext(struct TBanRecReader* reader, int* source, long long* timeMs,
+                 unsigned char* vec, int* len) {
+  int src;
+
+  /* Sanity check */
+  if((reader == NULL) || (reader->map == NULL))
+    return TBAN_STRUCT_NULL_PTR;
+  if((source == NULL) || (timeMs == NULL) || (vec == NULL) || (len == NULL))
+    return TBAN_VALUE_NULL_PTR;
+
+  if(reader->pending != 0) {
+    src = reader->pending - 1;
+    reader->pending = 0;
+  } else {
+    do {
+      CHECK_RESULT(tban_recStep(reader, &src));
+    } while(!(reader->known & (1 << src)));
+  }
+
+  *source = 1 << src;
+  *timeMs = reader->timeMs;
+  *len    = reader->len[src];
+  (void) memcpy(vec, reader->state[src], reader->len[src]);
+
+  return TBAN_OK;
+}
+
+
+/**********************************************************************
+ * Name        : tban_recClose
+ * Description : Release the reader.
+ * Arguments   : reader = The reader
+ * Returning   : TBAN_OK
+ *               TBAN_STRUCT_NULL_PTR
+ **********************************************************************/
+int tban_recClose(struct TBanRecReader* reader) {
+  /* Sanity check */
+  if(reader == NULL)
+    return TBAN_STRUCT_NULL_PTR;
+
+  if(reader->map != NULL)
+    (void) munmap((void*) reader->map, reader->size);
+  if(reader->index != NULL)
+    (void) munmap((void*) reader->index, reader->indexCount * sizeof(struct TBanRecIndex));
+  (void) memset(reader, 0, sizeof(*reader));
+
+  return TBAN_OK;
+}
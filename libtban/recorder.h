@@ -0,0 +1,148 @@
+/*****************************************************************************
+ ** This program is free software; you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation; either version 2 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program; if not, write to the Free Software
+ ** Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ **
+ ** 
+ ** FILE INFORMATION
+ ** ----------------
+ ** Filename:        recorder.h
+ ** Initial author:  marcus.jagemar@gmail.com
+ **
+ **
+ ** 
+ ** DESCRIPTION
+ ** -----------
+ ** Persistent time series of the status vectors. After
+ ** tban_recorderStart every vector the handle receives (from the query
+ ** functions or the sampler thread) is appended to a segment file
+ ** together with a millisecond time stamp.
+ **
+ ** Most bytes of a vector do not change between two samples. Each
+ ** record is therefore the XOR of the vector with the previous one of
+ ** the same source, run length encoded as alternating runs of unchanged
+ ** and changed bytes, with all numbers as varints. A record where
+ ** nothing changed takes eight bytes for the 285 byte TBan vector
+ ** sampled once a second: the source byte, two bytes each for the
+ ** time difference, the length and the unchanged run, and one byte
+ ** for the empty changed run. A vector shorter than 128 bytes saves a
+ ** byte on the length and one on the run, an interval below 64 ms one
+ ** on the time difference. Every TBAN_REC_INDEX_INTERVAL_MS
+ ** each source writes one keyframe (the full vector) and the position
+ ** is added to a sparse time index in <file>.idx, so a reader can start
+ ** at any point in time after decoding at most one interval.
+ **
+ ** The segment is memory mapped and grown in steps of TBAN_REC_GROW
+ ** bytes. The header holds the number of bytes in use, it is updated
+ ** after each record so a reader never sees half a record.
+ **
+ ** Record layout:
+ **   byte    source (0 = TBan, 1 = BigNG, 2 = miniNG), 0x80 = keyframe
+ **   varint  time: ms since the epoch for a keyframe, otherwise the
+ **           zigzag encoded difference to the previous record
+ **   varint  vector length
+ **   runs    varint unchanged bytes, varint changed bytes, the changed
+ **           bytes (XOR with the previous vector), until the whole
+ **           vector is covered
+ **
+ ** 
+ ** REVISION HISTORY
+ ** ----------------
+ ** 
+ ** Date        Comment
+ ** =================================================================
+ ** 2026-10-17  File created
+ **
+ *****************************************************************************/
+
+/* Muliple inclusion safeguard */
+#ifndef __RECORDER_H
+#define __RECORDER_H
+
+#include <stdint.h>
+
+#include "tban.h"
+#include "sampler.h"
+
+
+/*****************************************************************************
+ * Segment format
+ *****************************************************************************/
+#define TBAN_REC_MAGIC              "TBANREC"
+#define TBAN_REC_VERSION            1
+#define TBAN_REC_INDEX_INTERVAL_MS  60000     /* Default keyframe/index interval */
+#define TBAN_REC_GROW               (1 << 20) /* Segment growth step */
+#define TBAN_REC_MAX_RECORD         1024      /* Worst case encoded record */
+#define TBAN_REC_KEYFRAME           0x80
+
+
+/*****************************************************************************
+ * Segment header, at the start of the file
+ *****************************************************************************/
+struct TBanRecHeader {
+  char     magic[8];
+  uint32_t version;
+  uint32_t headerSize;
+  uint64_t used;              /* Bytes in use including the header */
+  int64_t  created;           /* ms since the epoch */
+  uint32_t indexIntervalMs;
+  uint32_t reserved[7];
+};
+
+
+/*****************************************************************************
+ * Entry of the time index. The record at offset is a keyframe and so is
+ * the first record of every other source after it.
+ *****************************************************************************/
+struct TBanRecIndex {
+  int64_t  timeMs;
+  uint64_t offset;
+};
+
+
+/*****************************************************************************
+ * Reader side handle
+ *****************************************************************************/
+struct TBanRecReader {
+  const unsigned char*       map;
+  size_t                     size;
+  size_t                     used;
+  const struct TBanRecIndex* index;
+  size_t                     indexCount;
+
+  /* Replay state */
+  size_t        pos;
+  long long     timeMs;
+  int           known;     /* TBAN_SAMPLE_* of the sources with a keyframe */
+  int           pending;   /* Source already decoded by tban_recSeek */
+  unsigned char state[3][TBAN_STATUS_SIZE];
+  int           len[3];
+};
+
+
+/*****************************************************************************
+ * Exported functions
+ *****************************************************************************/
+
+/* Owner of the device */
+int tban_recorderStart(struct TBan* tban, const char* path, int indexIntervalMs);
+int tban_recorderStop(struct TBan* tban);
+
+/* Readers */
+int tban_recOpen(struct TBanRecReader* reader, const char* path);
+int tban_recSeek(struct TBanRecReader* reader, long long timeMs);
+int tban_recNext(struct TBanRecReader* reader, int* source, long long* timeMs,
+                 unsigned char* vec, int* len);
+int tban_recClose(struct TBanRecReader* reader);
+
+#endif /* __RECORDER_H */
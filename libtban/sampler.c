@@ -0,0 +1,378 @@
+/*****************************************************************************
+ ** This program is free software; you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation; either version 2 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program; if not, write to the Free Software
+ ** Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ **
+ ** 
+ ** FILE INFORMATION
+ ** ----------------
+ ** Filename:        sampler.c
+ ** Initial author:  marcus.jagemar@gmail.com
+ **
+ ** 
+ ** DESCRIPTION
+ ** -----------
+ ** Implementation of the background sampler, see sampler.h.
+ **
+ ** The two snapshot slots each have a sequence counter which is odd
+ ** while the slot is being written. The writer only ever writes the
+ ** slot that is not published, then publishes it by switching the
+ ** active index. A reader copies the active slot and retries if the
+ ** counter changed (or was odd) during the copy, which only happens
+ ** when the reader is slower than a full sampling interval.
+ **
+ ** 
+ *****************************************************************************/
+
+#include "sampler.h"
+#include "big_ng.h"
+#include "common.h"
+
+
+/*****************************************************************************
+ * Sampler state, one per handle
+ *****************************************************************************/
+struct TBanSampler {
+  pthread_t       thread;
+  int             intervalMs;
+  int             mask;
+
+  /* Stop request, the condition wakes the thread early */
+  int             stop;
+  pthread_mutex_t stopLock;
+  pthread_cond_t  stopCond;
+
+  /* Published snapshots */
+  unsigned int        active;
+  unsigned int        slotSeq[2];
+  struct TBanSnapshot slot[2];
+
+  /* Work area of the sampling thread */
+  struct TBanSnapshot next;
+};
+
+
+/**********************************************************************
+ * Name        : tban_samplerPublish
+ * Description : Make the snapshot in the work area the current one.
+ * Arguments   : s = The sampler
+ * Returning   : none
+ **********************************************************************/
+static void tban_samplerPublish(struct TBanSampler* s) {
+  unsigned int idx = __atomic_load_n(&s->active, __ATOMIC_RELAXED) ^ 1;
+
+  s->next.seq++;
+
+  /* Odd sequence: slot being written */
+  __atomic_store_n(&s->slotSeq[idx], s->slotSeq[idx]+1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  (void) memcpy(&s->slot[idx], &s->next, sizeof(s->next));
+
+  /* Even again, then switch the readers over */
+  __atomic_store_n(&s->slotSeq[idx], s->slotSeq[idx]+1, __ATOMIC_RELEASE);
+  __atomic_store_n(&s->active, idx, __ATOMIC_RELEASE);
+}
+
+
+/**********************************************************************
+ * Name        : tban_samplerRound
+ * Description : Read all vectors selected and publish the result.
+ * Arguments   : tban = The TBan handle
+ *               s    = The sampler
+ * Returning   : TBAN_OK or the first error of the round
+ **********************************************************************/
+static int tban_samplerRound(struct TBan* tban, struct TBanSampler* s) {
+  unsigned char buf[TBAN_STATUS_SIZE];
+  int result = TBAN_OK;
+  int fresh  = 0;
+  int r;
+
+  if(s->mask & TBAN_SAMPLE_TBAN) {
+    r = tban_fetchStatus(tban, buf);
+    if((r == TBAN_OK) && (buf[0] != TBAN_FRAME_START)) {
+      tban_statsCount(tban, &tban->stats.corrupt);
+      r = TBAN_CORRUPT_DATA;
+    }
+    if(r == TBAN_OK) {
+      (void) memcpy(s->next.tban, buf, TBAN_STATUS_SIZE);
+      s->next.valid |= TBAN_SAMPLE_TBAN;
+      fresh |= TBAN_SAMPLE_TBAN;
+    } else {
+      result = r;
+    }
+  }
+
+  /* The second vector only exists on the BigNG */
+  if((s->mask & TBAN_SAMPLE_BIGNG) &&
+     (s->next.valid & TBAN_SAMPLE_TBAN) &&
+     (s->next.tban[TBAN_INFO_TYPE] == TBAN_DEVICE_TYPE_BIGNG)) {
+    r = bigNG_fetchStatus(tban, buf);
+    if((r == TBAN_OK) && (buf[0] != TBAN_FRAME_START)) {
+      tban_statsCount(tban, &tban->stats.corrupt);
+      r = TBAN_CORRUPT_DATA;
+    }
+    if(r == TBAN_OK) {
+      (void) memcpy(s->next.bigNG, buf, BIGNG_STATUS_SIZE);
+      s->next.valid |= TBAN_SAMPLE_BIGNG;
+      fresh |= TBAN_SAMPLE_BIGNG;
+    } else if(result == TBAN_OK) {
+      result = r;
+    }
+  }
+
+  if(s->mask & TBAN_SAMPLE_MINING) {
+    r = miniNG_fetchStatus(tban, buf);
+    if(r == TBAN_OK) {
+      (void) memcpy(s->next.miniNG, buf, MINI_NG_BUFSIZE);
+      s->next.valid |= TBAN_SAMPLE_MINING;
+      fresh |= TBAN_SAMPLE_MINING;
+    } else if(result == TBAN_OK) {
+      result = r;
+    }
+  }
+
+  s->next.time   = time(NULL);
+  s->next.result = result;
+  tban_samplerPublish(s);
+  tban_shmUpdate(tban, fresh, s->next.tban, s->next.bigNG, s->next.miniNG, s->next.time);
+  tban_recorderUpdate(tban, fresh, s->next.tban, s->next.bigNG, s->next.miniNG);
+
+  return result;
+}
+
+
+/**********************************************************************
+ * Name        : tban_samplerThread
+ * Description : The sampling thread. Runs one round per interval until
+ *               asked to stop. The schedule is kept on the monotonic
+ *               clock so slow rounds do not make it drift.
+ * Arguments   : arg = The TBan handle
+ * Returning   : NULL
+ **********************************************************************/
+static void* tban_samplerThread(void* arg) {
+  struct TBan*        tban = arg;
+  struct TBanSampler* s    = tban->sampler;
+  struct timespec     next;
+
+  (void) clock_gettime(CLOCK_MONOTONIC, &next);
+
+  (void) pthread_mutex_lock(&s->stopLock);
+  while(!s->stop) {
+    /* Next point in time on the schedule */
+    next.tv_sec  += s->intervalMs/1000;
+    next.tv_nsec += (s->intervalMs%1000)*1000000L;
+    if(next.tv_nsec >= 1000000000L) {
+      next.tv_sec++;
+      next.tv_nsec -= 1000000000L;
+    }
+
+    while(!s->stop &&
+          (pthread_cond_timedwait(&s->stopCond, &s->stopLock, &next) != ETIMEDOUT))
+      ;
+    if(s->stop)
+      break;
+
+    (void) pthread_mutex_unlock(&s->stopLock);
+    (void) tban_samplerRound(tban, s);
+    (void) pthread_mutex_lock(&s->stopLock);
+  }
+  (void) pthread_mutex_unlock(&s->stopLock);
+
+  return NULL;
+}
+
+
+/**********************************************************************
+ * Name        : tban_samplerStart
+ * Description : Start sampling the status vectors in the background.
+ *               The first round is made before the function returns so
+ *               a snapshot is always available afterwards.
+ * Arguments   : tban       = The opened TBan handle
+ *               intervalMs = Time between two rounds
+ *               mask       = TBAN_SAMPLE_* of the vectors to read
+ * Returning   : TBAN_OK
+ *               TBAN_STRUCT_NULL_PTR
+ *               TBAN_NOT_OPENED
+ *               TBAN_VALUE_OUT_OF_BOUNDS
+ *               TBAN_ALREADY_IN_USE (sampler already running)
+ *               TBAN_CANNOT_MALLOC
+ *               TBAN_ERROR (thread could not be created)
+ *               Errors from the first round
+ **********************************************************************/
+int tban_samplerStart(struct TBan* tban, int intervalMs, int mask) {
+  struct TBanSampler* s;
+  pthread_condattr_t  attr;
+  int                 result;
+
+  /* Sanity check */
+  if(tban == NULL)
+    return TBAN_STRUCT_NULL_PTR;
+  if(tban->opened == 0)
+    return TBAN_NOT_OPENED;
+  if((intervalMs < TBAN_SAMPLER_MIN_INTERVAL) || ((mask & TBAN_SAMPLE_ALL) == 0))
+    return TBAN_VALUE_OUT_OF_BOUNDS;
+  if(tban->sampler != NULL)
+    return TBAN_ALREADY_IN_USE;
+
+  s = calloc(1, sizeof(struct TBanSampler));
+  if(s == NULL)
+    return TBAN_CANNOT_MALLOC;
+  s->intervalMs = intervalMs;
+  s->mask       = mask & TBAN_SAMPLE_ALL;
+
+  /* The first snapshot, taken before anybody can read */
+  result = tban_samplerRound(tban, s);
+  if(!(s->next.valid & TBAN_SAMPLE_TBAN) && (s->mask & TBAN_SAMPLE_TBAN)) {
+    free(s);
+    return result;
+  }
+
+  (void) pthread_mutex_init(&s->stopLock, NULL);
+  (void) pthread_condattr_init(&attr);
+  (void) pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  (void) pthread_cond_init(&s->stopCond, &attr);
+  (void) pthread_condattr_destroy(&attr);
+
+  tban->sampler = s;
+  if(pthread_create(&s->thread, NULL, tban_samplerThread, tban) != 0) {
+    tban->sampler = NULL;
+    (void) pthread_cond_destroy(&s->stopCond);
+    (void) pthread_mutex_destroy(&s->stopLock);
+    free(s);
+    return TBAN_ERROR;
+  }
+
+  return TBAN_OK;
+}
+
+
+/**********************************************************************
+ * Name        : tban_samplerStop
+ * Description : Stop the sampler and wait for the thread to finish.
+ *               The query functions talk to the device again
+ *               afterwards.
+ * Arguments   : tban = The TBan handle
+ * Returning   : TBAN_OK
+ *               TBAN_STRUCT_NULL_PTR
+ *               TBAN_VALUE_NULL_PTR (no sampler running)
+ **********************************************************************/
+int tban_samplerStop(struct TBan* tban) {
+  struct TBanSampler* s;
+
+  /* Sanity check */
+  if(tban == NULL)
+    return TBAN_STRUCT_NULL_PTR;
+  if(tban->sampler == NULL)
+    return TBAN_VALUE_NULL_PTR;
+
+  s = tban->sampler;
+  (void) pthread_mutex_lock(&s->stopLock);
+  s->stop = 1;
+  (void) pthread_cond_signal(&s->stopCond);
+  (void) pthread_mutex_unlock(&s->stopLock);
+  (void) pthread_join(s->thread, NULL);
+
+  tban->sampler = NULL;
+  (void) pthread_cond_destroy(&s->stopCond);
+  (void) pthread_mutex_destroy(&s->stopLock);
+  free(s);
+
+  return TBAN_OK;
+}
+
+
+/**********************************************************************
+ * Name        : tban_getSnapshot
+ * Description : Copy the latest published snapshot. Never blocks.
+ * Arguments   : tban = The TBan handle
+ *               snap = Where to store the snapshot
+ * Returning   : TBAN_OK
+ *               TBAN_STRUCT_NULL_PTR
+ *               TBAN_VALUE_NULL_PTR (snap NULL or no sampler running)
+ **********************************************************************/
+int tban_getSnapshot(struct TBan* tban, struct TBanSnapshot* snap) {
+  struct TBanSampler* s;
+  unsigned int        idx, seq1, seq2;
+
+  /* Sanity check */
+  if(tban == NULL)
+    return TBAN_STRUCT_NULL_PTR;
+  if((snap == NULL) || (tban->sampler == NULL))
+    return TBAN_VALUE_NULL_PTR;
+
+  s = tban->sampler;
+  do {
+    idx  = __atomic_load_n(&s->active, __ATOMIC_ACQUIRE);
+    seq1 = __atomic_load_n(&s->slotSeq[idx], __ATOMIC_ACQUIRE);
+    if(seq1 & 1)
+      continue;
+    (void) memcpy(snap, &s->slot[idx], sizeof(*snap));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    seq2 = __atomic_load_n(&s->slotSeq[idx], __ATOMIC_RELAXED);
+  } while((seq1 & 1) || (seq1 != seq2));
+
+  return TBAN_OK;
+}
+
+
+/**********************************************************************
+ * Name        : tban_samplerCovers
+ * Description : Check whether a running sampler reads a vector. The
+ *               query functions only use the snapshot when it does and
+ *               talk to the device otherwise.
+ * Arguments   : tban  = The TBan handle
+ *               which = TBAN_SAMPLE_TBAN, _BIGNG or _MINING
+ * Returning   : Nonzero if the vector is sampled, 0 otherwise
+ **********************************************************************/
+int tban_samplerCovers(struct TBan* tban, int which) {
+  return (tban->sampler != NULL) && (tban->sampler->mask & which);
+}
+
+
+/**********************************************************************
+ * Name        : tban_samplerCopy
+ * Description : Copy one vector of the latest snapshot into the handle,
+ *               used by the query functions while the sampler runs.
+ * Arguments   : tban  = The TBan handle
+ *               which = TBAN_SAMPLE_TBAN, _BIGNG or _MINING
+ * Returning   : TBAN_OK
+ *               TBAN_ERECEIVE (vector never received)
+ **********************************************************************/
+int tban_samplerCopy(struct TBan* tban, int which) {
+  struct TBanSnapshot snap;
+
+  CHECK_RESULT(tban_getSnapshot(tban, &snap));
+  if(!(snap.valid & which))
+    return TBAN_ERECEIVE;
+
+  switch(which) {
+    case TBAN_SAMPLE_TBAN:
+      (void) memcpy(tban->buf, snap.tban, TBAN_STATUS_SIZE);
+      tban->lastQuery = snap.time;
+      tban_shadowConfirm(tban, 0, TBAN_STATUS_SIZE-1);
+      break;
+    case TBAN_SAMPLE_BIGNG:
+      (void) memcpy(tban->bigNG.buf, snap.bigNG, BIGNG_STATUS_SIZE);
+      tban->bigNG.lastQuery = snap.time;
+      break;
+    case TBAN_SAMPLE_MINING:
+      (void) memcpy(tban->miniNG.buf, snap.miniNG, MINI_NG_BUFSIZE);
+      tban->miniNG.lastQuery = snap.time;
+      break;
+    default:
+      return TBAN_VALUE_OUT_OF_BOUNDS;
+  }
+
+  return TBAN_OK;
+}
@@ -0,0 +1,95 @@
+/*****************************************************************************
+ ** This program is free software; you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation; either version 2 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program; if not, write to the Free Software
+ ** Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ **
+ ** 
+ ** FILE INFORMATION
+ ** ----------------
+ ** Filename:        sampler.h
+ ** Initial author:  marcus.jagemar@gmail.com
+ **
+ ** 
+ ** DESCRIPTION
+ ** -----------
+ ** Optional background sampler. A thread polls the status vectors of
+ ** the TBan (and BigNG/miniNG) at a fixed rate and publishes every
+ ** result as a snapshot with a sequence number. Readers never block:
+ ** the snapshot is double buffered and protected by a sequence lock,
+ ** the writer always fills the buffer not currently published.
+ **
+ ** While the sampler runs, tban_queryStatus, bigNG_queryStatus and
+ ** miniNG_queryStatus do not touch the port for the vectors in its
+ ** mask. They copy the latest snapshot into the handle so the existing
+ ** getter functions work unchanged. Vectors outside the mask are still
+ ** queried from the device. Setters may still be used from the application thread,
+ ** the port is shared through the handle I/O lock. The event loop
+ ** (tban_loop.h) must not be used on a handle with a running sampler.
+ **
+ ** 
+ ** REVISION HISTORY
+ ** ----------------
+ ** 
+ ** Date        Comment
+ ** =================================================================
+ ** 2026-10-17  File created
+ **
+ *****************************************************************************/
+
+/* Muliple inclusion safeguard */
+#ifndef __SAMPLER_H
+#define __SAMPLER_H
+
+#include "tban.h"
+
+
+/*****************************************************************************
+ * Vectors sampled (mask used by tban_samplerStart and the valid member
+ * of the snapshot)
+ *****************************************************************************/
+#define TBAN_SAMPLE_TBAN      0x01
+#define TBAN_SAMPLE_BIGNG     0x02
+#define TBAN_SAMPLE_MINING    0x04
+#define TBAN_SAMPLE_ALL       (TBAN_SAMPLE_TBAN | TBAN_SAMPLE_BIGNG | TBAN_SAMPLE_MINING)
+
+
+/*****************************************************************************
+ * Lowest allowed sampling interval (ms)
+ *****************************************************************************/
+#define TBAN_SAMPLER_MIN_INTERVAL  50
+
+
+/*****************************************************************************
+ * One published sample. A vector whose bit is not set in valid has
+ * never been received. A vector that could not be read in the last
+ * round keeps its previous contents, see result.
+ *****************************************************************************/
+struct TBanSnapshot {
+  unsigned long seq;       /* Increased for every published sample */
+  time_t        time;      /* When the sample was taken */
+  int           valid;     /* TBAN_SAMPLE_* of the vectors present */
+  int           result;    /* Outcome of the last sampling round */
+  unsigned char tban[TBAN_STATUS_SIZE];
+  unsigned char bigNG[BIGNG_STATUS_SIZE];
+  unsigned char miniNG[MINI_NG_BUFSIZE];
+};
+
+
+/*****************************************************************************
+ * Exported functions
+ *****************************************************************************/
+int tban_samplerStart(struct TBan* tban, int intervalMs, int mask);
+int tban_samplerStop(struct TBan* tban);
+int tban_getSnapshot(struct TBan* tban, struct TBanSnapshot* snap);
+
+#endif /* __SAMPLER_H */
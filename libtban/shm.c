@@ -0,0 +1,418 @@
+/*****************************************************************************
+ ** This program is free software; you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation; either version 2 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program; if not, write to the Free Software
+ ** Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ **
+ ** 
+ ** FILE INFORMATION
+ ** ----------------
+ ** Filename:        shm.c
+ ** Initial author:  marcus.jagemar@gmail.com
+ **
+ ** 
+ ** DESCRIPTION
+ ** -----------
+ ** Implementation of the shared memory publication, see shm.h.
+ **
+ ** The writer keeps a work copy of the state. Each update merges the
+ ** vectors received into it, decodes the TBan vector and copies the
+ ** whole state into the slot not currently published, then switches
+ ** the readers over. Updates may come from the application thread and
+ ** from the sampler thread, a mutex orders them.
+ **
+ ** The publisher holds a write lock on the segment for as long as it
+ ** publishes. A segment nobody holds the lock on was left behind by a
+ ** publisher that died and is replaced, one that is locked belongs to
+ ** a live publisher and is never touched.
+ **
+ ** 
+ *****************************************************************************/
+
+#include <sys/mman.h>
+
+#include "shm.h"
+#include "common.h"
+
+
+/*****************************************************************************
+ * Writer state, one per handle
+ *****************************************************************************/
+struct TBanShmWriter {
+  char*              name;
+  int                fd;
+  struct TBanShm*    shm;
+  pthread_mutex_t    lock;
+  struct TBanShmData next;
+};
+
+
+/**********************************************************************
+ * Name        : tban_shmDecode
+ * Description : Fill in the decoded values from the TBan vector of the
+ *               work copy. The ordinary getters are used on a handle
+ *               that only refers to the vector.
+ * Arguments   : data = The state to decode
+ * Returning   : none
+ **********************************************************************/
+static void tban_shmDecode(struct TBanShmData* data) {
+  struct TBan view;
+  int i;
+
+  (void) memset(&view, 0, sizeof(view));
+  view.buf    = data->tban;
+  view.opened = 1;
+
+  for(i=0; i<TBAN_NUMBER_CHANNELS; i++) {
+    (void) tban_getChInfo(&view, i, &data->ch[i].rpmMax, &data->ch[i].pwm,
+                          &data->ch[i].temp, &data->ch[i].mode);
+  }
+  for(i=0; i<TBAN_NUMBER_DIGITAL_SENSORS; i++) {
+    (void) tban_getdSensorTemp(&view, i, &data->ds[i].temp,
+                               &data->ds[i].rawTemp, &data->ds[i].cal);
+  }
+  for(i=0; i<TBAN_NUMBER_ANALOG_SENSORS; i++) {
+    (void) tban_getaSensorTemp(&view, i, &data->as[i].temp,
+                               &data->as[i].rawTemp, &data->as[i].cal);
+  }
+}
+
+
+/**********************************************************************
+ * Name        : tban_shmUpdate
+ * Description : Publish freshly received vectors. Does nothing unless
+ *               tban_shmPublish has been called.
+ * Arguments   : tban      = The TBan handle
+ *               which     = TBAN_SAMPLE_* of the vectors received
+ *               tbanBuf   = The TBan vector (or NULL)
+ *               bigNGBuf  = The BigNG vector (or NULL)
+ *               miniNGBuf = The miniNG vector (or NULL)
+ *               when      = When the vectors were received
+ * Returning   : none
+ **********************************************************************/
+void tban_shmUpdate(struct TBan* tban, int which, const unsigned char* tbanBuf,
+                    const unsigned char* bigNGBuf, const unsigned char* miniNGBuf, time_t when) {
+  struct TBanShmWriter* w = tban->shm;
+  struct TBanShm*       shm;
+  unsigned int          idx;
+
+  if(w == NULL)
+    return;
+  shm = w->shm;
+
+  (void) pthread_mutex_lock(&w->lock);
+
+  if((which & TBAN_SAMPLE_TBAN) && (tbanBuf != NULL)) {
+    (void) memcpy(w->next.tban, tbanBuf, TBAN_STATUS_SIZE);
+    w->next.tbanTime = when;
+    w->next.valid |= TBAN_SAMPLE_TBAN;
+    tban_shmDecode(&w->next);
+  }
+  if((which & TBAN_SAMPLE_BIGNG) && (bigNGBuf != NULL)) {
+    (void) memcpy(w->next.bigNG, bigNGBuf, BIGNG_STATUS_SIZE);
+    w->next.bigNGTime = when;
+    w->next.valid |= TBAN_SAMPLE_BIGNG;
+  }
+  if((which & TBAN_SAMPLE_MINING) && (miniNGBuf != NULL)) {
+    (void) memcpy(w->next.miniNG, miniNGBuf, MINI_NG_BUFSIZE);
+    w->next.miniNGTime = when;
+    w->next.valid |= TBAN_SAMPLE_MINING;
+  }
+  w->next.seq++;
+
+  /* Write the slot not in use, odd sequence while doing so */
+  idx = __atomic_load_n(&shm->active, __ATOMIC_RELAXED) ^ 1;
+  __atomic_store_n(&shm->slotSeq[idx], shm->slotSeq[idx]+1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  (void) memcpy(&shm->slot[idx], &w->next, sizeof(w->next));
+
+  __atomic_store_n(&shm->slotSeq[idx], shm->slotSeq[idx]+1, __ATOMIC_RELEASE);
+  __atomic_store_n(&shm->active, idx, __ATOMIC_RELEASE);
+
+  (void) pthread_mutex_unlock(&w->lock);
+}
+
+
+/**********************************************************************
+ * Name        : tban_shmLock
+ * Description : Take the publisher lock on a segment without waiting.
+ * Arguments   : fd = File descriptor of the segment
+ * Returning   : 0 if locked, -1 if another process holds it (errno)
+ **********************************************************************/
+static int tban_shmLock(int fd) {
+  struct flock fl;
+
+  (void) memset(&fl, 0, sizeof(fl));
+  fl.l_type   = F_WRLCK;
+  fl.l_whence = SEEK_SET;
+
+  return fcntl(fd, F_SETLK, &fl);
+}
+
+
+/**********************************************************************
+ * Name        : tban_shmCreate
+ * Description : Create a new segment and lock it. A segment that
+ *               already exists is only replaced if its publisher is
+ *               gone, that is if nobody holds the lock on it.
+ * Arguments   : name = Segment name
+ * Returning   : The locked file descriptor
+ *               -1 on error (errno, EBUSY if another process publishes)
+ **********************************************************************/
+static int tban_shmCreate(const char* name) {
+  int fd, tries;
+
+  for(tries=0; tries<2; tries++) {
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if(fd >= 0) {
+      if(tban_shmLock(fd) != 0) {
+        /* Lost a race against another publisher */
+        (void) close(fd);
+        errno = EBUSY;
+        return -1;
+      }
+      return fd;
+    }
+    if(errno != EEXIST)
+      return -1;
+
+    /* Left behind by a publisher that died? */
+    fd = shm_open(name, O_RDWR, 0);
+    if(fd < 0) {
+      if(errno == ENOENT)
+        continue;
+      return -1;
+    }
+    if(tban_shmLock(fd) != 0) {
+      (void) close(fd);
+      errno = EBUSY;
+      return -1;
+    }
+    (void) shm_unlink(name);
+    (void) close(fd);
+  }
+
+  errno = EBUSY;
+  return -1;
+}
+
+
+/**********************************************************************
+ * Name        : tban_shmPublish
+ * Description : Create the shared memory segment and start publishing
+ *               the state of the handle. The vectors already in the
+ *               handle are published at once. Only one process can
+ *               publish under a name, see tban_shmCreate.
+ * Arguments   : tban = The TBan handle
+ *               name = Segment name (TBAN_SHM_NAME if NULL)
+ * Returning   : TBAN_OK
+ *               TBAN_STRUCT_NULL_PTR
+ *               TBAN_ALREADY_IN_USE (already publishing, or another
+ *                                    process publishes under the name)
+ *               TBAN_CANNOT_MALLOC
+ *               TBAN_EOPEN (segment could not be created, see errno)
+ **********************************************************************/
+int tban_shmPublish(struct TBan* tban, const char* name) {
+  struct TBanShmWriter* w;
+
+  /* Sanity check */
+  if(tban == NULL)
+    return TBAN_STRUCT_NULL_PTR;
+  if(tban->shm != NULL)
+    return TBAN_ALREADY_IN_USE;
+  if(name == NULL)
+    name = TBAN_SHM_NAME;
+
+  w = calloc(1, sizeof(struct TBanShmWriter));
+  if(w == NULL)
+    return TBAN_CANNOT_MALLOC;
+  w->name = malloc(strlen(name)+1);
+  if(w->name == NULL) {
+    free(w);
+    return TBAN_CANNOT_MALLOC;
+  }
+  (void) strcpy(w->name, name);
+
+  /* The lock is held through the descriptor until tban_shmUnpublish */
+  w->fd = tban_shmCreate(name);
+  if(w->fd < 0) {
+    int busy = (errno == EBUSY);
+    free(w->name);
+    free(w);
+    return busy ? TBAN_ALREADY_IN_USE : TBAN_EOPEN;
+  }
+  if(ftruncate(w->fd, sizeof(struct TBanShm)) != 0) {
+    (void) shm_unlink(name);
+    (void) close(w->fd);
+    free(w->name);
+    free(w);
+    return TBAN_EOPEN;
+  }
+  w->shm = mmap(NULL, sizeof(struct TBanShm), PROT_READ | PROT_WRITE, MAP_SHARED, w->fd, 0);
+  if(w->shm == MAP_FAILED) {
+    (void) shm_unlink(name);
+    (void) close(w->fd);
+    free(w->name);
+    free(w);
+    return TBAN_EOPEN;
+  }
+
+  w->shm->version = TBAN_SHM_VERSION;
+  (void) pthread_mutex_init(&w->lock, NULL);
+  tban->shm = w;
+
+  /* What the handle already knows */
+  if(tban->lastQuery != 0)
+    tban_shmUpdate(tban, TBAN_SAMPLE_TBAN, tban->buf, NULL, NULL, tban->lastQuery);
+  if(tban->bigNG.lastQuery != 0)
+    tban_shmUpdate(tban, TBAN_SAMPLE_BIGNG, NULL, tban->bigNG.buf, NULL, tban->bigNG.lastQuery);
+  if(tban->miniNG.lastQuery != 0)
+    tban_shmUpdate(tban, TBAN_SAMPLE_MINING, NULL, NULL, tban->miniNG.buf, tban->miniNG.lastQuery);
+
+  /* Readers check the magic last */
+  __atomic_store_n(&w->shm->magic, TBAN_SHM_MAGIC, __ATOMIC_RELEASE);
+
+  return TBAN_OK;
+}
+
+
+/**********************************************************************
+ * Name        : tban_shmUnpublish
+ * Description : Stop publishing and remove the segment. Readers still
+ *               attached keep their mapping of the last state. Must
+ *               not be called while the sampler runs.
+ * Arguments   : tban = The TBan handle
+ * Returning   : TBAN_OK
+ *               TBAN_STRUCT_NULL_PTR
+ *               TBAN_VALUE_NULL_PTR (not publishing)
+ *               TBAN_ALREADY_IN_USE (sampler running)
+ **********************************************************************/
+int tban_shmUnpublish(struct TBan* tban) {
+  struct TBanShmWriter* w;
+
+  /* Sanity check */
+  if(tban == NULL)
+    return TBAN_STRUCT_NULL_PTR;
+  if(tban->shm == NULL)
+    return TBAN_VALUE_NULL_PTR;
+  if(tban->sampler != NULL)
+    return TBAN_ALREADY_IN_USE;
+
+  w = tban->shm;
+  tban->shm = NULL;
+  (void) munmap(w->shm, sizeof(struct TBanShm));
+  (void) shm_unlink(w->name);
+  (void) close(w->fd);
+  (void) pthread_mutex_destroy(&w->lock);
+  free(w->name);
+  free(w);
+
+  return TBAN_OK;
+}
+
+
+/**********************************************************************
+ * Name        : tban_shmAttach
+ * Description : Map a published segment for reading.
+ * Arguments   : reader = The reader handle to fill in
+ *               name   = Segment name (TBAN_SHM_NAME if NULL)
+ * Returning   : TBAN_OK
+ *               TBAN_VALUE_NULL_PTR
+ *               TBAN_EOPEN (no such segment, see errno)
+ *               TBAN_CORRUPT_DATA (not a segment of this version)
+ **********************************************************************/
+int tban_shmAttach(struct TBanShmReader* reader, const char* name) {
+  struct TBanShm* shm;
+  int fd;
+
+  /* Sanity check */
+  if(reader == NULL)
+    return TBAN_VALUE_NULL_PTR;
+  if(name == NULL)
+    name = TBAN_SHM_NAME;
+
+  fd = shm_open(name, O_RDONLY, 0);
+  if(fd < 0)
+    return TBAN_EOPEN;
+  shm = mmap(NULL, sizeof(struct TBanShm), PROT_READ, MAP_SHARED, fd, 0);
+  (void) close(fd);
+  if(shm == MAP_FAILED)
+    return TBAN_EOPEN;
+
+  if((__atomic_load_n(&shm->magic, __ATOMIC_ACQUIRE) != TBAN_SHM_MAGIC) ||
+     (shm->version != TBAN_SHM_VERSION)) {
+    (void) munmap(shm, sizeof(struct TBanShm));
+    return TBAN_CORRUPT_DATA;
+  }
+
+  reader->shm = shm;
+  return TBAN_OK;
+}
+
+
+/**********************************************************************
+ * Name        : tban_shmRead
+ * Description : Copy the latest published state. Never blocks and
+ *               makes no system calls. A copy is only retried a
+ *               limited number of times, so a publisher that died in
+ *               the middle of an update cannot make the reader spin.
+ * Arguments   : reader = The attached reader
+ *               data   = Where to store the state
+ * Returning   : TBAN_OK
+ *               TBAN_VALUE_NULL_PTR
+ *               TBAN_ERECEIVE (no consistent copy within
+ *                              TBAN_SHM_READ_RETRIES attempts)
+ **********************************************************************/
+int tban_shmRead(struct TBanShmReader* reader, struct TBanShmData* data) {
+  const struct TBanShm* shm;
+  unsigned int          idx, seq1, seq2;
+  int                   tries;
+
+  /* Sanity check */
+  if((reader == NULL) || (reader->shm == NULL) || (data == NULL))
+    return TBAN_VALUE_NULL_PTR;
+
+  shm = reader->shm;
+  for(tries=0; tries<TBAN_SHM_READ_RETRIES; tries++) {
+    idx  = __atomic_load_n(&shm->active, __ATOMIC_ACQUIRE);
+    seq1 = __atomic_load_n(&shm->slotSeq[idx], __ATOMIC_ACQUIRE);
+    if(seq1 & 1)
+      continue;
+    (void) memcpy(data, &shm->slot[idx], sizeof(*data));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    seq2 = __atomic_load_n(&shm->slotSeq[idx], __ATOMIC_RELAXED);
+    if(seq1 == seq2)
+      return TBAN_OK;
+  }
+
+  return TBAN_ERECEIVE;
+}
+
+
+/**********************************************************************
+ * Name        : tban_shmDetach
+ * Description : Unmap the segment.
+ * Arguments   : reader = The attached reader
+ * Returning   : TBAN_OK
+ *               TBAN_VALUE_NULL_PTR
+ **********************************************************************/
+int tban_shmDetach(struct TBanShmReader* reader) {
+  /* Sanity check */
+  if((reader == NULL) || (reader->shm == NULL))
+    return TBAN_VALUE_NULL_PTR;
+
+  (void) munmap((void*) reader->shm, sizeof(struct TBanShm));
+  reader->shm = NULL;
+
+  return TBAN_OK;
+}
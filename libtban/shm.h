@@ -0,0 +1,144 @@
+/*****************************************************************************
+ ** This program is free software; you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation; either version 2 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program; if not, write to the Free Software
+ ** Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ **
+ ** 
+ ** FILE INFORMATION
+ ** ----------------
+ ** Filename:        shm.h
+ ** Initial author:  marcus.jagemar@gmail.com
+ **
+ ** 
+ ** DESCRIPTION
+ ** -----------
+ ** Optional publication of the device state in POSIX shared memory.
+ ** The process owning the device calls tban_shmPublish. From then on
+ ** every status vector it receives (from the query functions or the
+ ** sampler thread) is written to the segment together with the
+ ** decoded channel and sensor values.
+ **
+ ** Other processes attach with tban_shmAttach and read consistent
+ ** copies with tban_shmRead. Reading is a plain memory copy, no system
+ ** call, no lock file and no access to the device. The segment is
+ ** double buffered with a sequence counter per slot, the same way as
+ ** the sampler snapshots (see sampler.h), so the writer never waits
+ ** for the readers.
+ **
+ ** A segment has a single owner. tban_shmPublish refuses a name that
+ ** another live process publishes under, a segment left behind by a
+ ** publisher that died is replaced.
+ **
+ ** 
+ ** REVISION HISTORY
+ ** ----------------
+ ** 
+ ** Date        Comment
+ ** =================================================================
+ ** 2026-10-17  File created
+ **
+ *****************************************************************************/
+
+/* Muliple inclusion safeguard */
+#ifndef __SHM_H
+#define __SHM_H
+
+#include "tban.h"
+#include "sampler.h"
+
+
+/*****************************************************************************
+ * Segment identification
+ *****************************************************************************/
+#define TBAN_SHM_NAME     "/tban"
+#define TBAN_SHM_MAGIC    0x5442414e   /* "TBAN" */
+#define TBAN_SHM_VERSION  1
+
+/* Attempts of tban_shmRead to get a consistent copy */
+#define TBAN_SHM_READ_RETRIES  1000
+
+
+/*****************************************************************************
+ * Decoded values, see tban_getChInfo, tban_getdSensorTemp and
+ * tban_getaSensorTemp
+ *****************************************************************************/
+struct TBanShmChannel {
+  unsigned int  rpmMax;
+  unsigned char pwm;
+  unsigned char temp;
+  unsigned char mode;
+};
+
+struct TBanShmSensor {
+  unsigned char temp;
+  unsigned char rawTemp;
+  unsigned char cal;
+};
+
+
+/*****************************************************************************
+ * One published state. A vector whose bit is not set in valid has never
+ * been received, the decoded values are only set together with the
+ * TBan vector.
+ *****************************************************************************/
+struct TBanShmData {
+  unsigned long seq;           /* Increased for every publication */
+  int           valid;         /* TBAN_SAMPLE_* of the vectors present */
+  time_t        tbanTime;      /* When each vector was received */
+  time_t        bigNGTime;
+  time_t        miniNGTime;
+
+  unsigned char tban[TBAN_STATUS_SIZE];
+  unsigned char bigNG[BIGNG_STATUS_SIZE];
+  unsigned char miniNG[MINI_NG_BUFSIZE];
+
+  struct TBanShmChannel ch[TBAN_NUMBER_CHANNELS];
+  struct TBanShmSensor  ds[TBAN_NUMBER_DIGITAL_SENSORS];
+  struct TBanShmSensor  as[TBAN_NUMBER_ANALOG_SENSORS];
+};
+
+
+/*****************************************************************************
+ * Layout of the segment
+ *****************************************************************************/
+struct TBanShm {
+  unsigned int       magic;
+  unsigned int       version;
+  unsigned int       active;      /* Slot readers should use */
+  unsigned int       slotSeq[2];  /* Odd while the slot is written */
+  struct TBanShmData slot[2];
+};
+
+
+/*****************************************************************************
+ * Reader side handle
+ *****************************************************************************/
+struct TBanShmReader {
+  const struct TBanShm* shm;
+};
+
+
+/*****************************************************************************
+ * Exported functions
+ *****************************************************************************/
+
+/* Owner of the device */
+int tban_shmPublish(struct TBan* tban, const char* name);
+int tban_shmUnpublish(struct TBan* tban);
+
+/* Readers */
+int tban_shmAttach(struct TBanShmReader* reader, const char* name);
+int tban_shmRead(struct TBanShmReader* reader, struct TBanShmData* data);
+int tban_shmDetach(struct TBanShmReader* reader);
+
+#endif /* __SHM_H */
@@ -28,25 +28,26 @@
  ** 
  *****************************************************************************/
 
+/* Open file description locks (F_OFD_SETLK) */
+#define _GNU_SOURCE
+
 #include "tban.h"
+#include "sampler.h"
+#include "shm.h"
+#include "recorder.h"
 #include "common.h"
 
-/* For pid handling */
 #include <unistd.h>
 
 /* Linux */
-#include <sys/signal.h>
 #include <sys/types.h>
+#include <poll.h>
+#include <errno.h>
 
 /* The default receive buffer size. */
 #define TBAN_BUFSIZE   300
 
 
-/* Indicates if we have data to receive. This actually means that the IO
- * callback function has been called. */
-static int tban_dataAvailable = TBAN_FALSE;
-
-
 /*****************************************************************************
  * Debug printf
  *****************************************************************************/
@@ -70,39 +71,54 @@ static int tban_dataAvailable = TBAN_FALSE;
 
 
 /*****************************************************************************
- * Maps channel/sensor index number to a specific value in the buffer
- * read from the driver. PLease note that this array is 0-indexed while
- * the document supplied by mcubed is 1-indexed so the values are not
- * equivalent.
+ * Largest write used by a command batch when the serial buffer size of
+ * the device is not yet known (no status vector received).
+ *****************************************************************************/
+#define TBAN_BATCH_DEFAULT_CHUNK 32
+
+
+/*****************************************************************************
+ * Receive timeouts. The default is how long a complete read may take
+ * (milliseconds), the flush delay is how long the port has to be silent
+ * before tban_flushData considers the queue empty.
  *****************************************************************************/
+#define TBAN_DEFAULT_TIMEOUT_MS  10000
+#define TBAN_FLUSH_QUIET_MS      100
 
-/* Channel read mappings */
-static int tban_getChPwmMapping[]      = { 137, 138, 139, 140 };
-static int tban_getChMaxPwmMapping[]   = { 148, 150, 152, 154 };
-static int tban_getChTempMapping[]     = { 252, 253, 254, 255 };
-static int tban_getHysteresisMap[]     = { 37, 38, 39, 40 };
 
-/* Channel map for sensor assignment */
-static int tban_getDsensorAssignMap[]  = { 45, 46, 47, 48 };
-static int tban_getAsensorAssignMap[]  = { 49, 50, 51, 52 };
+/*****************************************************************************
+ * The positions of the channel and sensor values in the status vector
+ * are given by the field lists in fields.h, use TBAN_FIELD_AT(name, i).
+ * PLease note that the vector is 0-indexed while the document supplied
+ * by mcubed is 1-indexed so the values are not equivalent.
+ *****************************************************************************/
 
-/* Channel response curve mappings */
-static int tban_getChCurveXMap[]       = { 53, 59, 65, 71 };
-static int tban_getChCurveYMap[]       = { 77, 83, 89, 95 };
 
-/* Channel mode mappings (automatic or manual mode) */
-static int tban_getChModeMap[]         = { 101, 102, 103, 104 };
-static int tban_getChStartModeMap[]    = { 5, 6, 7, 8 };
+/*****************************************************************************
+ * The TBan status vector
+ *****************************************************************************/
+static const struct TBanFrameSpec tban_statusFrame = {
+  285, 285, 0, 0, { 0 }, { 0 }
+};
 
-/* Sensor reading mappings */
-static int tban_getDsensorMapping[]    = { 238, 239, 240, 241, 242, 243, 244, 245 };
-static int tban_getDrawSensorMapping[] = { 208, 209, 210, 211, 212, 213, 214, 215, 216, 217, 218, 219, 220, 221 };
-static int tban_getAsensorMapping[]    = { 246, 247, 248, 249, 250, 251 };
-static int tban_getArawSensorMapping[] = { 225, 226, 227, 228, 229, 230 };
 
-/* Scaling factor for sensors */
-static int tban_getDScalingFactorMap[]  = { 19, 20, 21, 22, 23, 24, 25, 26 };
-static int tban_getAScalingFactorMap[]  = { 27, 28, 29, 30, 31, 32 };
+/*****************************************************************************
+ * Partial status requests. Each answer is the start byte followed by the
+ * block of the status vector given by first/last.
+ *****************************************************************************/
+typedef struct {
+  unsigned char        cmd;
+  int                  first;
+  int                  last;
+  struct TBanFrameSpec frame;
+} TBan_partialStruct;
+
+static const TBan_partialStruct tban_partialMap[] = {
+  { TBAN_SER_REQUEST_1, TBAN_SENSORS_FIRST, TBAN_SENSORS_LAST,
+    { 1+TBAN_SENSORS_LAST-TBAN_SENSORS_FIRST+1, 1+TBAN_SENSORS_LAST-TBAN_SENSORS_FIRST+1, 0, 0, { 0 }, { 0 } } },
+  { TBAN_SER_REQUEST_2, TBAN_CONFIG_FIRST, TBAN_CONFIG_LAST,
+    { 1+TBAN_CONFIG_LAST-TBAN_CONFIG_FIRST+1, 1+TBAN_CONFIG_LAST-TBAN_CONFIG_FIRST+1, 0, 0, { 0 }, { 0 } } }
+};
 
 
 /*****************************************************************************
@@ -130,6 +146,8 @@ static const TBan_errorMapStruct TBan_errorMap[] = {
   
   { TBAN_CANNOT_MALLOC,        "TBAN_CANNOT_MALLOC",       "malloc couldn't allocate memory" },
   { TBAN_CORRUPT_DATA,         "TBAN_CORRUPT_DATA",        "The query vector is corrupt and unusable until a correct update is made to it." },
+  { TBAN_VERIFY_FAILED,        "TBAN_VERIFY_FAILED",       "The device did not take the configuration sent to it" },
+  { TBAN_NO_MORE_DATA,         "TBAN_NO_MORE_DATA",        "No more records to read" },
   { TBAN_EOPEN,                "TBAN_EOPEN",               "open function call failed" },
   { TBAN_ECLOSE,               "TBAN_ECLOSE",              "close function call failed" },
   { TBAN_ESEND,                "TBAN_ESEND",               "send function call failed" },
@@ -137,9 +155,9 @@ static const TBan_errorMapStruct TBan_errorMap[] = {
   { TBAN_ESIGACTION, 	       "TBAN_ESIGACTION",          "Error when installing the serial communication handler (sigaction)" }, 
   { TBAN_ESIGEMPTYSET,         "TBAN_ESIGEMPTYSET"         "Error when clearing the sig set" },
 
-  { TBAN_CANNOT_CREATE_LOCKFILE,       "TBAN_CANNOT_CREATE_LOCKFILE",       "Cannot create the lock file" },
+  { TBAN_CANNOT_CREATE_LOCKFILE,       "TBAN_CANNOT_CREATE_LOCKFILE",       "Cannot lock the device" },
   { TBAN_ALREADY_IN_USE,               "TBAN_ALREADY_IN_USE",               "The TBan is already in use by another program, timeout reached" },
-  { TBAN_CANNOT_DELETE_LOCK_FILE,      "TBAN_CANNOT_DELETE_LOCK_FILE",      "Cannot delete the lock file" }
+  { TBAN_CANNOT_DELETE_LOCK_FILE,      "TBAN_CANNOT_DELETE_LOCK_FILE",      "Cannot unlock the device" }
 
 };
 
@@ -260,111 +278,170 @@ static long intToStopBits(int Stop_Bits) {
 
 
 /**********************************************************************
- * Name        : checktimeout
- * Description : Check if the timeout has expired.
- * Arguments   : starttime = The time when the timer started.
- *               timeout   = How many seconds should pass from the start
- *                           of the timer.
- * Returning   : TBAN_TRUE  = Within the timeout (has not expired)
- *               TBAN_FALSE = Greater than the timeoute (has expired)
+ * Name        : tban_lockRequest
+ * Description : Describe a write lock on the whole device.
+ * Arguments   : fl   = The lock description to fill in
+ *               type = F_WRLCK or F_UNLCK
+ * Returning   : none
  **********************************************************************/
-static int checktimeout(time_t starttime, int timeout) {
-  if (time(NULL)-starttime < timeout) {
-    return TBAN_TRUE;
-  } else {
-    return TBAN_FALSE;
-  }
+static void tban_lockRequest(struct flock* fl, short type) {
+  (void) memset(fl, 0, sizeof(*fl));
+  fl->l_type   = type;
+  fl->l_whence = SEEK_SET;
+  fl->l_start  = 0;
+  fl->l_len    = 0;
 }
 
 
+/*****************************************************************************
+ * A wait for the device lock, shared with the waiting thread
+ *****************************************************************************/
+struct TBanLockWait {
+  int             fd;
+  int             result;   /* -1 while waiting, then 0 or errno */
+  pthread_mutex_t mutex;
+  pthread_cond_t  cond;
+};
+
 
 /**********************************************************************
- * Name        : tban_signal_handler_IO
- * Description : The signal handler for IO events on the USB-serial
- *               line. 
- * Arguments   : status
- * Returning   : none
+ * Name        : tban_lockWaiter
+ * Description : Thread blocking in fcntl until the lock is granted.
+ *               The kernel wakes it the moment the holder releases the
+ *               lock. Cancelled when the wait times out.
+ * Arguments   : ptr = struct TBanLockWait
+ * Returning   : NULL
  **********************************************************************/
-static void tban_signal_handler_IO (int status) {
-  (void) status;
-  /* printf("!!! DATA AVAILABLE !!!\n"); */
-  tban_dataAvailable = TBAN_TRUE;
-}
+static void* tban_lockWaiter(void* ptr) {
+  struct TBanLockWait* wait = ptr;
+  struct flock fl;
+  int result;
+
+  tban_lockRequest(&fl, F_WRLCK);
+  result = fcntl(wait->fd, F_OFD_SETLKW, &fl);
+
+  (void) pthread_mutex_lock(&wait->mutex);
+  wait->result = (result == 0) ? 0 : errno;
+  (void) pthread_cond_signal(&wait->cond);
+  (void) pthread_mutex_unlock(&wait->mutex);
 
+  return NULL;
+}
 
 
 /**********************************************************************
- * Name        : tban_fileExists 
- * Description : Check if a file exists, if so lets parse the first
- * 		 bytes of the file to see if we can get the pid located
- * 		 in  it. If so return the pid.
- * Arguments   : filename = The filename to operate on.
- * Returning   : 0  = no file exists
- * 		 >0 = A file exists and the pid in it is returned.
+ * Name        : tban_lock
+ * Description : Take the advisory lock on the device node. The lock
+ *               belongs to the open port (open file description) and
+ *               is released by tban_unlock or when the port is closed,
+ *               also when the process dies. A busy device is waited for
+ *               up to timeoutMs.
+ * Arguments   : tban      = The TBan struct to work on
+ *               timeoutMs = Max time to wait, 0 = do not wait
+ * Returning   : TBAN_OK
+ * 		 TBAN_ALREADY_IN_USE (still locked after timeoutMs)
+ * 		 TBAN_CANNOT_CREATE_LOCKFILE (the lock failed)
  **********************************************************************/
-static int tban_fileExists(char filename[]) {
-  FILE *fp = fopen(filename,"r");
-  if(fp != NULL) {
-    /* The file exists */
-    char buf[16];
-    int  numberBytes;
-    int  value;
+static int tban_lock(struct TBan* tban, int timeoutMs) {
+  struct TBanLockWait wait;
+  struct flock        fl;
+  struct timespec     deadline;
+  pthread_condattr_t  attr;
+  pthread_t           thread;
+  int                 result;
+
+  /* Free device, the normal case */
+  tban_lockRequest(&fl, F_WRLCK);
+  if(fcntl(tban->port, F_OFD_SETLK, &fl) == 0) {
+    tban->locked = 1;
+    return TBAN_OK;
+  }
+  if((errno != EAGAIN) && (errno != EACCES))
+    return TBAN_CANNOT_CREATE_LOCKFILE;
+  if(timeoutMs <= 0)
+    return TBAN_ALREADY_IN_USE;
 
-    /* Read contents of the file */
-    memset(buf, 0, 16);
-    numberBytes = fread(buf, sizeof(char), 16, fp);
+  /* Busy, wait in a thread so that the wait can time out */
+  wait.fd     = tban->port;
+  wait.result = -1;
+  (void) pthread_mutex_init(&wait.mutex, NULL);
+  (void) pthread_condattr_init(&attr);
+  (void) pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  (void) pthread_cond_init(&wait.cond, &attr);
+  (void) pthread_condattr_destroy(&attr);
+
+  (void) clock_gettime(CLOCK_MONOTONIC, &deadline);
+  deadline.tv_sec  += timeoutMs / 1000;
+  deadline.tv_nsec += (long) (timeoutMs % 1000) * 1000000L;
+  if(deadline.tv_nsec >= 1000000000L) {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000L;
+  }
 
-    /* try to convert it to a number (pid) */
-    errno=0;
-    value = atoi(buf);
-    if((value==0) && (errno != 0)) {
-      printf("Error converting number value=%d errno=%d\n", value, errno);
-      return 0;
+  if(pthread_create(&thread, NULL, tban_lockWaiter, &wait) != 0) {
+    result = TBAN_CANNOT_CREATE_LOCKFILE;
+  } else {
+    (void) pthread_mutex_lock(&wait.mutex);
+    while((wait.result < 0) &&
+          (pthread_cond_timedwait(&wait.cond, &wait.mutex, &deadline) != ETIMEDOUT))
+      ;
+    (void) pthread_mutex_unlock(&wait.mutex);
+
+    if(wait.result < 0)
+      (void) pthread_cancel(thread);
+    (void) pthread_join(thread, NULL);
+
+    if(wait.result == 0) {
+      result = TBAN_OK;
+    } else {
+      /* The lock may have been granted just as the wait was cancelled */
+      tban_lockRequest(&fl, F_UNLCK);
+      (void) fcntl(tban->port, F_OFD_SETLK, &fl);
+      result = (wait.result < 0) ? TBAN_ALREADY_IN_USE : TBAN_CANNOT_CREATE_LOCKFILE;
     }
-
-    /* Close the open file and return */
-    fclose(fp);
-    return value;
   }
 
-  /* No file is present */
-  return 0;
+  (void) pthread_cond_destroy(&wait.cond);
+  (void) pthread_mutex_destroy(&wait.mutex);
+
+  if(result == TBAN_OK)
+    tban->locked = 1;
+  return result;
 }
 
 
 
 /**********************************************************************
- * Name        : createLockFile
- * Description : Create a lock file.
- * Arguments   : filename = The lock file name
- * 		 string   = The string to be put in the lockfile.
+ * Name        : tban_portLock / tban_portUnlock
+ * Description : Begin/end a transaction on the port. Takes the I/O
+ *               mutex of the handle and, with TBAN_LOCK_TRANSACTION,
+ *               the device lock when the outermost transaction begins.
+ *               Transactions nest, lockDepth counts them.
+ * Arguments   : tban = The TBan struct to work on
  * Returning   : TBAN_OK
- * 		 TBAN_CANNOT_CREATE_LOCKFILE
+ *               TBAN_ALREADY_IN_USE
+ *               TBAN_CANNOT_CREATE_LOCKFILE
  **********************************************************************/
-static int createLockFile(char* filename, char string[]) {
-  FILE* lock;
-  int result;
-  
-  lock = fopen(filename, "wb+");
-  if(lock == NULL) {
-    printf("Unable to create file(%s) => NULL (errno=%d) %s\n",
-           filename,
-           errno, strerror(errno));
-    return TBAN_CANNOT_CREATE_LOCKFILE;
+int tban_portLock(struct TBan* tban) {
+  tban_ioLock(tban);
+  if((tban->lockMode == TBAN_LOCK_TRANSACTION) && (tban->lockDepth == 0)) {
+    int result = tban_lock(tban, tban->lockTimeoutMs);
+    if(result != TBAN_OK) {
+      tban_ioUnlock(tban);
+      return result;
+    }
   }
-  
-  result = fwrite(string, sizeof(char), strlen(string), lock);
-  if(result == 0)
-    return TBAN_CANNOT_CREATE_LOCKFILE;
-  
-  /* Close and flush data to disk */
-  result = fclose(lock);
-  if(result != 0)
-    return TBAN_CANNOT_CREATE_LOCKFILE;
-  
+  tban->lockDepth++;
+
   return TBAN_OK;
 }
 
+void tban_portUnlock(struct TBan* tban) {
+  tban->lockDepth--;
+  if((tban->lockMode == TBAN_LOCK_TRANSACTION) && (tban->lockDepth == 0))
+    (void) tban_unlock(tban);
+  tban_ioUnlock(tban);
+}
 
 
 /**********************************************************************
@@ -374,94 +451,117 @@ static int createLockFile(char* filename, char string[]) {
  **********************************************************************/
 
 /**********************************************************************
- * Name        : tban_lock
- * Description : Check if a lock file is already present. If
- * Arguments   : -
+ * Name        : tban_unlock
+ * Description : Release the device lock. Closing the port releases it
+ *               as well.
+ * Arguments   : tban = The TBan struct to work on
  * Returning   : TBAN_OK
  * 		 TBAN_STRUCT_NULL_PTR
- * 		 TBAN_ALREADY_IN_USE
- * 		 TBAN_CANNOT_CREATE_LOCKFILE
+ * 		 TBAN_CANNOT_DELETE_LOCK_FILE
  **********************************************************************/
-static int tban_lock(struct TBan* tban) {
-  pid_t pid;
-  char s[16];
-  int  result;
-  int value;
-    
+int tban_unlock(struct TBan* tban) {
+  struct flock fl;
+
   /* Sanity check */
   if(tban == NULL)
     return TBAN_STRUCT_NULL_PTR;
+  if(tban->locked == 0)
+    return TBAN_OK;
 
-  /* Check if there already exists a lock file */
-  value = tban_fileExists(tban->lockfile);
-  if(value > 0) {
-    /* Yes there is a file, lets check if the pid located inside it is
-     * valid. Maybe the process created it is sloppy and didn't clean up
-     * after itself... */
-    result = getsid(value);
-    /* Check if the pid in the file is really pointing to a running
-     * process. Maybe the process that created the file is sloppy and
-     * didn't remove the file? Anyhow it the getsid() function returns
-     * error then we know that the process doesn't exists and we can
-     * remove the file and try again. */
-    if((result == -1) && (errno=ESRCH)) {
-      /* No valid pid in the file */
-      result = tban_unlock(tban);
-      if(result != TBAN_OK) {
-        return TBAN_LOCK_FILE_CHANGE_NOT_ALLOWED;
-      }
-    } else {
-      /* The pid in the lock file is valid */
-      return TBAN_ALREADY_IN_USE;
-    }
-  } /* if */
-
-  /* Put the calling pid in the file */
-  pid =  getpid();
-  if(pid == -1)
-    return TBAN_ERROR;
-  memset(s, 0, 16);
-  sprintf(s, "%d", pid);
-  result = createLockFile(tban->lockfile, s);
-  if(result != TBAN_OK)
-    return result;
+  tban_lockRequest(&fl, F_UNLCK);
+  if(fcntl(tban->port, F_OFD_SETLK, &fl) != 0)
+    return TBAN_CANNOT_DELETE_LOCK_FILE;
 
   /* Toggle the lock inside the tban struct */
-  tban->locked = 1;
+  tban->locked = 0;
 
   return TBAN_OK;
 }
 
 
 /**********************************************************************
- * Name        : tban_unlock
- * Description : Unlock the TBan hadware, i.e. remove the locking file.
- * Arguments   : -
+ * Name        : tban_transactionBegin
+ * Description : Group several library calls into one transaction. With
+ *               TBAN_LOCK_TRANSACTION the device stays locked until
+ *               the matching tban_transactionEnd, other processes wait.
+ *               With TBAN_LOCK_SESSION only the handle is serialised
+ *               (against the sampler thread).
+ * Arguments   : tban = The TBan struct to work on
  * Returning   : TBAN_OK
- * 		 TBAN_STRUCT_NULL_PTR
- * 		 TBAN_CANNOT_CREATE_LOCKFILE
+ *               TBAN_STRUCT_NULL_PTR
+ *               TBAN_NOT_OPENED
+ *               TBAN_ALREADY_IN_USE
+ *               TBAN_CANNOT_CREATE_LOCKFILE
  **********************************************************************/
-int tban_unlock(struct TBan* tban) {
-  int result;
+int tban_transactionBegin(struct TBan* tban) {
+  /* Sanity check */
+  if(tban == NULL)
+    return TBAN_STRUCT_NULL_PTR;
+  if(tban->opened == 0)
+    return TBAN_NOT_OPENED;
+
+  return tban_portLock(tban);
+}
 
+
+/**********************************************************************
+ * Name        : tban_transactionEnd
+ * Description : End a transaction begun with tban_transactionBegin.
+ * Arguments   : tban = The TBan struct to work on
+ * Returning   : TBAN_OK
+ *               TBAN_STRUCT_NULL_PTR
+ *               TBAN_VALUE_OUT_OF_BOUNDS (no transaction open)
+ **********************************************************************/
+int tban_transactionEnd(struct TBan* tban) {
   /* Sanity check */
   if(tban == NULL)
     return TBAN_STRUCT_NULL_PTR;
+  if(tban->lockDepth <= 0)
+    return TBAN_VALUE_OUT_OF_BOUNDS;
 
-  /* Delete the lock file */
-  result = unlink(tban->lockfile);
-  if(result != 0)
-    return TBAN_CANNOT_DELETE_LOCK_FILE;
+  tban_portUnlock(tban);
 
-  /* Toggle the lock inside the tban struct */
-  tban->locked = 0;
+  return TBAN_OK;
+}
+
+
+/**********************************************************************
+ * Name        : tban_configureLocking
+ * Description : Select how the device is locked against other
+ *               processes. TBAN_LOCK_SESSION (default) locks it from
+ *               tban_open to tban_close. TBAN_LOCK_TRANSACTION only
+ *               locks it during each transaction (a query, a setter
+ *               command, tban_transactionBegin..End), so several
+ *               processes can share the device. Must be set before
+ *               tban_open.
+ * Arguments   : tban      = The TBan struct to work on
+ *               mode      = TBAN_LOCK_SESSION or TBAN_LOCK_TRANSACTION
+ *               timeoutMs = Max time to wait for the lock
+ * Returning   : TBAN_OK
+ *               TBAN_STRUCT_NULL_PTR
+ *               TBAN_VALUE_OUT_OF_BOUNDS
+ *               TBAN_EOPEN (the device is already open)
+ **********************************************************************/
+int tban_configureLocking(struct TBan* tban, int mode, int timeoutMs) {
+  /* Sanity check */
+  if(tban == NULL)
+    return TBAN_STRUCT_NULL_PTR;
+  if(((mode != TBAN_LOCK_SESSION) && (mode != TBAN_LOCK_TRANSACTION)) || (timeoutMs < 0))
+    return TBAN_VALUE_OUT_OF_BOUNDS;
+  if(tban->opened != 0)
+    return TBAN_EOPEN;
+
+  tban->lockMode      = mode;
+  tban->lockTimeoutMs = timeoutMs;
 
   return TBAN_OK;
 }
 
 /**********************************************************************
  * Name        : tban_configureLockFile
- * Description : Set the lock file name
+ * Description : Set the lock file name. The lock is taken on the
+ *               device itself, the name is kept for compatibility but
+ *               no file is created.
  * Arguments   : filename
  * Returning   : TBAN_OK
  * 		 TBAN_STRUCT_NULL_PTR
@@ -494,55 +594,205 @@ int tban_configureLockTimeout(struct TBan* tban, int timeout) {
   /* Sanity check */
   if(tban == NULL)
     return TBAN_STRUCT_NULL_PTR;
-  tban->lockTimeout = timeout;
+  tban->lockTimeoutMs = 1000*timeout;
   return TBAN_OK;
 }
 
 
 /**********************************************************************
- * Name        : tban_checkIfDeviceUsed
- * Description : Check if the TBan is currently in use by looking for
- * 		 the lockfile. If this is not present this function will
- * 		 create a new one and signal the calling function that
- * 		 it is ok to use the TBan. An error is returned if the
- * 		 device is not available.
- * Arguments   : -
- * Returning   : TBAN_OK (If a new lock file has been created)
- * 		 TBAN_ALREADY_IN_USE (If the device is already allocated
- * 		 		      by another application)
+ * Name        : tban_configureTimeout
+ * Description : Configure how long a read from the TBan may take before
+ *               it is considered failed.
+ * Arguments   : tban      = The TBan struct to work on.
+ *               timeoutMs = Timeout in milliseconds.
+ * Returning   : TBAN_OK
+ *               TBAN_STRUCT_NULL_PTR
+ *               TBAN_VALUE_OUT_OF_BOUNDS
  **********************************************************************/
-int tban_checkIfDeviceUsed(struct TBan* tban) {
-  time_t t1, t2;
-  int result;
+int tban_configureTimeout(struct TBan* tban, int timeoutMs) {
+  /* Sanity check */
+  if(tban == NULL)
+    return TBAN_STRUCT_NULL_PTR;
+  if(timeoutMs < 0)
+    return TBAN_VALUE_OUT_OF_BOUNDS;
+  tban->timeout = timeoutMs;
+  return TBAN_OK;
+}
 
+
+/**********************************************************************
+ * Name        : tban_configureWriteCache
+ * Description : Enable or disable the write-through setter cache. While
+ *               enabled the setters do not send commands that would
+ *               leave the device unchanged, see struct TBanShadow.
+ *               Switching it on starts with an empty cache.
+ * Arguments   : tban   = The TBan struct to work on.
+ *               enable = TBAN_TRUE or TBAN_FALSE
+ * Returning   : TBAN_OK
+ *               TBAN_STRUCT_NULL_PTR
+ **********************************************************************/
+int tban_configureWriteCache(struct TBan* tban, int enable) {
   /* Sanity check */
   if(tban == NULL)
     return TBAN_STRUCT_NULL_PTR;
 
-  /* Get the current time (comparison base) */
-  t1 = time(NULL);
+  (void) memset(&tban->shadow, 0, sizeof(tban->shadow));
+  tban->shadow.enabled = (enable != TBAN_FALSE);
 
-  /* Check the lock file a  number of times until the timeout is
-   * reached. Then signal to the caller that the device is still
-   * locked. */
-  for(;;) {
-    result = tban_lock(tban);
-    t2 = time(NULL);
-    /* If we reached the timeout exit the loop */
-    if(((t2 - t1) > tban->lockTimeout) || (result == TBAN_OK))
-      break;
-    /* Sleep for some time to let the other part finish with the TBan */
-    local_nanosleep(1, 0);
+  return TBAN_OK;
+}
+
+
+/**********************************************************************
+ * Name        : tban_getStats
+ * Description : Get a copy of the I/O statistics of the handle. The
+ *               counters run from tban_init or the last
+ *               tban_resetStats.
+ * Arguments   : tban  = The TBan struct to work on.
+ *               stats = Where to store the copy.
+ * Returning   : TBAN_OK
+ *               TBAN_STRUCT_NULL_PTR
+ *               TBAN_VALUE_NULL_PTR
+ **********************************************************************/
+int tban_getStats(struct TBan* tban, struct TBanStats* stats) {
+  /* Sanity check */
+  if(tban == NULL)
+    return TBAN_STRUCT_NULL_PTR;
+  if(stats == NULL)
+    return TBAN_VALUE_NULL_PTR;
+
+  tban_ioLock(tban);
+  *stats = tban->stats;
+  tban_ioUnlock(tban);
+
+  return TBAN_OK;
+}
+
+
+/**********************************************************************
+ * Name        : tban_resetStats
+ * Description : Clear the I/O statistics of the handle.
+ * Arguments   : tban = The TBan struct to work on.
+ * Returning   : TBAN_OK
+ *               TBAN_STRUCT_NULL_PTR
+ **********************************************************************/
+int tban_resetStats(struct TBan* tban) {
+  /* Sanity check */
+  if(tban == NULL)
+    return TBAN_STRUCT_NULL_PTR;
+
+  tban_ioLock(tban);
+  (void) memset(&tban->stats, 0, sizeof(tban->stats));
+  tban_ioUnlock(tban);
+
+  return TBAN_OK;
+}
+
+
+/**********************************************************************
+ * Name        : tban_statsCount
+ * Description : Increment a counter in the statistics of the handle.
+ *               For counters updated outside a port transaction.
+ * Arguments   : tban    = The TBan struct to work on.
+ *               counter = The counter, a member of tban->stats.
+ * Returning   : none
+ **********************************************************************/
+void tban_statsCount(struct TBan* tban, unsigned long* counter) {
+  tban_ioLock(tban);
+  (*counter)++;
+  tban_ioUnlock(tban);
+}
+
+
+/**********************************************************************
+ * Name        : tban_statsLatency
+ * Description : Record a latency in one of the statistics histograms.
+ * Arguments   : hist  = The histogram (TBAN_STATS_BUCKETS entries).
+ *               start = Start of the operation, local_monotonicUs.
+ * Returning   : none
+ **********************************************************************/
+static void tban_statsLatency(unsigned long hist[], long long start) {
+  long long us = local_monotonicUs() - start;
+  int bucket = 0;
+
+  while((us > 1) && (bucket < TBAN_STATS_BUCKETS-1)) {
+    us >>= 1;
+    bucket++;
   }
+  hist[bucket]++;
+}
 
-  /* If we reach this point and the result is anything but success we
-   * know that the TBan is still locked. Lets tell the caller. */
-  if(result != TBAN_OK) {
-    return TBAN_ALREADY_IN_USE;
+
+/**********************************************************************
+ * Name        : tban_commandLength
+ * Description : Length of the command frame starting with op. Most
+ *               commands carry one value, the requests and switches
+ *               below are a single byte.
+ * Arguments   : op = The opcode.
+ * Returning   : 1 or 2
+ **********************************************************************/
+static int tban_commandLength(unsigned char op) {
+  switch(op) {
+    case TBAN_SER_LED_EIN:
+    case TBAN_SER_LED_AUS:
+    case TBAN_SER_BUZ_EIN:
+    case TBAN_SER_BUZ_AUS:
+    case TBAN_SER_SOURCE1:
+    case TBAN_SER_SOURCE2:
+    case TBAN_SER_REQUEST:
+    case TBAN_SER_REQUEST_1:
+    case TBAN_SER_REQUEST_2:
+    case TBAN_SER_MAKE_ABGL:
+    case TBAN_SER_MINI_SEND1:
+    case TBAN_SER_MINI_SEND2:
+    case USB_WATCHDOG_ON:
+    case USB_WATCHDOG_OFF:
+      return 1;
+    default:
+      return 2;
   }
+}
 
-  /* TBan ready to be opened */
-  return TBAN_OK;
+
+/**********************************************************************
+ * Name        : tban_commandDelay
+ * Description : Give the device time to process what has been written.
+ *               The time spent is added to the statistics.
+ * Arguments   : tban = The TBan struct to work on.
+ * Returning   : none
+ **********************************************************************/
+void tban_commandDelay(struct TBan* tban) {
+  long long start = local_monotonicUs();
+
+  local_nanosleep(0, TBAN_COMMAND_DELAY);
+  tban->stats.delayUs += local_monotonicUs() - start;
+  tban->stats.delays++;
+}
+
+
+/**********************************************************************
+ * Name        : tban_checkIfDeviceUsed
+ * Description : Take the lock on the opened device node, waiting up to
+ * 		 the lock timeout if another application holds it. The
+ * 		 wait ends as soon as the other application releases the
+ * 		 device. tban_open calls this with TBAN_LOCK_SESSION.
+ * Arguments   : -
+ * Returning   : TBAN_OK (The device is locked by this handle)
+ * 		 TBAN_ALREADY_IN_USE (If the device is already allocated
+ * 		 		      by another application)
+ * 		 TBAN_CANNOT_CREATE_LOCKFILE
+ * 		 TBAN_NOT_OPENED
+ **********************************************************************/
+int tban_checkIfDeviceUsed(struct TBan* tban) {
+  /* Sanity check */
+  if(tban == NULL)
+    return TBAN_STRUCT_NULL_PTR;
+  if(tban->port < 0)
+    return TBAN_NOT_OPENED;
+  if(tban->locked != 0)
+    return TBAN_OK;
+
+  return tban_lock(tban, tban->lockTimeoutMs);
 }
 
 
@@ -651,14 +901,32 @@ int tban_init(struct TBan* tban, char* devStr) {
 
   /* No data has been received yet since the device is not opened. */
   tban->opened = 0;
-  tban_dataAvailable = TBAN_FALSE;
+  (void) memset(&tban->rx, 0, sizeof(tban->rx));
+  tban->batch   = NULL;
+  tban->sampler = NULL;
+  tban->shm      = NULL;
+  tban->recorder = NULL;
+  tban->numModules = 0;
+  (void) memset(&tban->shadow, 0, sizeof(tban->shadow));
+  (void) memset(&tban->stats, 0, sizeof(tban->stats));
+
+  /* Port access lock, recursive since transactions nest */
+  {
+    pthread_mutexattr_t attr;
+    (void) pthread_mutexattr_init(&attr);
+    (void) pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    (void) pthread_mutex_init(&tban->ioLock, &attr);
+    (void) pthread_mutexattr_destroy(&attr);
+  }
 
   /* No query has been made yet */
-  tban->lastQuery = 0;
+  tban->lastQuery        = 0;
+  tban->bigNG.lastQuery  = 0;
+  tban->miniNG.lastQuery = 0;
 
   /* Set standard communication params */
-  tban->port       = 0;
-  tban->timeout    = 10;
+  tban->port       = -1;
+  tban->timeout    = TBAN_DEFAULT_TIMEOUT_MS;
   tban->baudrate   = 19200;
   tban->databits   = 8;
   tban->stopBits   = 0;
@@ -709,7 +977,9 @@ int tban_init(struct TBan* tban, char* devStr) {
   tban->lockfile = malloc(strlen(local_lockfile)+1);
   strcpy(tban->lockfile, local_lockfile);
   tban->locked = 0;
-  tban->lockTimeout = 10;
+  tban->lockTimeoutMs = 10000;
+  tban->lockMode = TBAN_LOCK_SESSION;
+  tban->lockDepth = 0;
 
   return TBAN_OK;
 }
@@ -745,206 +1015,896 @@ int tban_free(struct TBan* tban) {
     tban->buf = NULL;
   }
 
-  return TBAN_OK;
+  (void) pthread_mutex_destroy(&tban->ioLock);
+
+  return TBAN_OK;
+}
+
+
+/**********************************************************************
+ * Name        : tban_setProgressCb
+ * Description : Set the progress callback function that will be called
+ * 		 whenever needed. For example when sending large amount
+ * 		 of data the needed delays will cause the program to
+ * 		 hang for a while, then the callback can display some
+ * 		 useful user-response.
+ * Arguments   : tban = The TBan struct to use when communicating
+ *		 cb   = The application callback (or null if disable)
+ * Returning   : TBAN_OK
+ *               TBAN_STRUCT_NULL_PTR
+ **********************************************************************/
+int tban_setProgressCb(struct TBan* tban, tban_progressCb* func, void* ptr) {
+  /* Sanity check */
+  if(tban == NULL)
+    return TBAN_STRUCT_NULL_PTR;
+
+  tban->progressCb = func;
+  tban->progressCbPtr = ptr;
+  
+  return TBAN_OK;
+}
+
+
+
+/**********************************************************************
+ * Name        : tban_updateProgress
+ * Description : Update the progress for the calling application (if the
+ * 		 callback function has been set)
+ * Arguments   : tban = The TBan struct to use when communicating
+ *		 cur = The current value
+ *		 max = The maximum value
+ * Returning   : TBAN_OK
+ *               TBAN_STRUCT_NULL_PTR
+ **********************************************************************/
+void tban_updateProgress(struct TBan* tban, int cur, int max) {
+  tban_progressCb* func = tban->progressCb;
+  if(func != NULL) {
+    func(tban->progressCbPtr, cur, max);
+  }
+}
+
+
+
+
+/**********************************************************************
+ * Name        : tban_writeCommand
+ * Description : Write a command to the TBan without waiting for it to
+ *               be processed. Used by the event loop where several
+ *               devices are served concurrently; everyone else should
+ *               use tban_sendCommand.
+ * Arguments   : tban   = The TBan device to operate on.
+ *               sndBuf = The command frame.
+ *               cmdLen = Length of the frame.
+ * Returning   : TBAN_OK
+ *               TBAN_ESEND
+ **********************************************************************/
+int tban_writeCommand(struct TBan* tban, unsigned char* sndBuf, int cmdLen) {
+  ssize_t written;
+  int     pos = 0;
+  int     result = TBAN_OK;
+
+  tban_ioLock(tban);
+
+  /* Count the commands in the frame */
+  while(pos < cmdLen) {
+    tban->stats.commands[sndBuf[pos]]++;
+    pos += tban_commandLength(sndBuf[pos]);
+  }
+  tban->stats.writes++;
+
+  pos = 0;
+  while(pos < cmdLen) {
+    written = write(tban->port, sndBuf+pos, cmdLen-pos);
+    if(written < 0) {
+      if(errno == EINTR)
+        continue;
+      if((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+        /* Output queue full, wait for it to drain */
+        struct pollfd pfd;
+        pfd.fd     = tban->port;
+        pfd.events = POLLOUT;
+        if(poll(&pfd, 1, tban->timeout) > 0)
+          continue;
+      }
+      result = TBAN_ESEND;
+      break;
+    }
+    pos += written;
+  }
+  tban->stats.bytesSent += pos;
+
+  tban_ioUnlock(tban);
+
+  return result;
+}
+
+
+/**********************************************************************
+ * Name        : tban_batchChunk
+ * Description : The largest write a batch may use. This is the serial
+ *               buffer length reported by the device, or a
+ *               conservative default when no status has been read yet.
+ * Arguments   : tban = The TBan struct to work on.
+ * Returning   : Number of bytes
+ **********************************************************************/
+static int tban_batchChunk(struct TBan* tban) {
+  int chunk;
+
+  if((tban->lastQuery == 0) || (tban->buf[0] != 100))
+    return TBAN_BATCH_DEFAULT_CHUNK;
+
+  chunk = 256 + tban->buf[TBAN_SER_BUFFERLN];
+  if(chunk > TBAN_BATCH_SIZE)
+    chunk = TBAN_BATCH_SIZE;
+  return chunk;
+}
+
+
+/**********************************************************************
+ * Name        : tban_batchBegin
+ * Description : Open a command batch on the handle. Until the batch is
+ *               committed, commands are queued instead of sent.
+ * Arguments   : tban  = The TBan struct to work on.
+ *               batch = The batch (owned by the caller, must stay
+ *                       valid until committed).
+ * Returning   : TBAN_OK
+ *               TBAN_STRUCT_NULL_PTR
+ *               TBAN_VALUE_NULL_PTR
+ *               TBAN_NOT_OPENED
+ *               TBAN_ALREADY_IN_USE (another batch is open)
+ **********************************************************************/
+int tban_batchBegin(struct TBan* tban, struct TBanBatch* batch) {
+  /* Sanity check */
+  if(tban == NULL)
+    return TBAN_STRUCT_NULL_PTR;
+  if(batch == NULL)
+    return TBAN_VALUE_NULL_PTR;
+  if(tban->opened == 0)
+    return TBAN_NOT_OPENED;
+  if(tban->batch != NULL)
+    return TBAN_ALREADY_IN_USE;
+
+  batch->len       = 0;
+  batch->frames    = 0;
+  batch->written   = 0;
+  batch->writes    = 0;
+  batch->result    = TBAN_OK;
+  batch->completed = TBAN_FALSE;
+  batch->owner     = pthread_self();
+  __atomic_store_n(&tban->batch, batch, __ATOMIC_RELEASE);
+
+  return TBAN_OK;
+}
+
+
+/**********************************************************************
+ * Name        : tban_batchOwned
+ * Description : The open batch if the calling thread opened it. Other
+ *               threads never add to or flush someone else's batch.
+ * Arguments   : tban = The TBan struct to work on.
+ * Returning   : The batch or NULL
+ **********************************************************************/
+struct TBanBatch* tban_batchOwned(struct TBan* tban) {
+  struct TBanBatch* batch = __atomic_load_n(&tban->batch, __ATOMIC_ACQUIRE);
+
+  if((batch == NULL) || !pthread_equal(batch->owner, pthread_self()))
+    return NULL;
+  return batch;
+}
+
+
+/**********************************************************************
+ * Name        : tban_batchWrite
+ * Description : Write the commands queued in the open batch (if any) to
+ *               the device. The batch remains open. Does nothing when
+ *               called by another thread than the owner.
+ * Arguments   : tban = The TBan struct to work on.
+ *               wait = TBAN_TRUE to wait for the device to process the
+ *                      commands. A fleet writes to all its devices and
+ *                      waits once (fleet.c).
+ * Returning   : TBAN_OK
+ *               TBAN_ESEND
+ **********************************************************************/
+int tban_batchWrite(struct TBan* tban, int wait) {
+  struct TBanBatch* batch;
+  long long start;
+  int result;
+
+  batch = tban_batchOwned(tban);
+  if((batch == NULL) || (batch->len == 0))
+    return TBAN_OK;
+  if(batch->result != TBAN_OK)
+    return batch->result;
+
+  result = tban_portLock(tban);
+  if(result != TBAN_OK) {
+    batch->result = result;
+    return result;
+  }
+  start  = local_monotonicUs();
+  result = tban_writeCommand(tban, batch->buf, batch->len);
+  batch->len = 0;
+  if(result == TBAN_OK) {
+    /* Let the device work through its buffer */
+    if(wait)
+      tban_commandDelay(tban);
+    tban_statsLatency(tban->stats.commandHist, start);
+  }
+  tban_portUnlock(tban);
+
+  if(result != TBAN_OK) {
+    batch->result = result;
+    return result;
+  }
+  batch->writes++;
+  batch->written = batch->frames;
+
+  return TBAN_OK;
+}
+
+
+/**********************************************************************
+ * Name        : tban_batchFlush
+ * Description : Write the commands queued in the open batch (if any) to
+ *               the device and wait for them to be processed. The batch
+ *               remains open.
+ * Arguments   : tban = The TBan struct to work on.
+ * Returning   : TBAN_OK
+ *               TBAN_STRUCT_NULL_PTR
+ *               TBAN_ESEND
+ **********************************************************************/
+int tban_batchFlush(struct TBan* tban) {
+  /* Sanity check */
+  if(tban == NULL)
+    return TBAN_STRUCT_NULL_PTR;
+
+  return tban_batchWrite(tban, TBAN_TRUE);
+}
+
+
+/**********************************************************************
+ * Name        : tban_batchAdd
+ * Description : Queue a command frame in the open batch. The batch is
+ *               flushed first when the frame does not fit in the
+ *               current write. Frames are never split.
+ * Arguments   : tban   = The TBan struct to work on.
+ *               batch  = The batch, owned by the calling thread.
+ *               sndBuf = The command frame.
+ *               cmdLen = Length of the frame.
+ * Returning   : TBAN_OK
+ *               TBAN_VALUE_OUT_OF_BOUNDS
+ *               TBAN_ESEND
+ **********************************************************************/
+static int tban_batchAdd(struct TBan* tban, struct TBanBatch* batch,
+                         unsigned char* sndBuf, int cmdLen) {
+
+  if(batch->result != TBAN_OK)
+    return batch->result;
+  if(cmdLen > TBAN_BATCH_SIZE)
+    return TBAN_VALUE_OUT_OF_BOUNDS;
+
+  if(batch->len + cmdLen > tban_batchChunk(tban))
+    CHECK_RESULT(tban_batchFlush(tban));
+
+  (void) memcpy(batch->buf + batch->len, sndBuf, cmdLen);
+  batch->len += cmdLen;
+  batch->frames++;
+
+  return TBAN_OK;
+}
+
+
+/**********************************************************************
+ * Name        : tban_batchCommit
+ * Description : Send the remaining commands of the open batch and close
+ *               it.
+ * Arguments   : tban = The TBan struct to work on.
+ * Returning   : TBAN_OK
+ *               TBAN_STRUCT_NULL_PTR
+ *               TBAN_VALUE_NULL_PTR (no batch open by this thread)
+ *               TBAN_ESEND (the batch result)
+ **********************************************************************/
+int tban_batchCommit(struct TBan* tban) {
+  struct TBanBatch* batch;
+
+  /* Sanity check */
+  if(tban == NULL)
+    return TBAN_STRUCT_NULL_PTR;
+  batch = tban_batchOwned(tban);
+  if(batch == NULL)
+    return TBAN_VALUE_NULL_PTR;
+
+  (void) tban_batchFlush(tban);
+  batch->completed = TBAN_TRUE;
+  __atomic_store_n(&tban->batch, NULL, __ATOMIC_RELEASE);
+
+  return batch->result;
+}
+
+
+/**********************************************************************
+ * Name        : tban_batchAbort
+ * Description : Close the open batch without sending the commands not
+ *               yet written.
+ * Arguments   : tban = The TBan struct to work on.
+ * Returning   : TBAN_OK
+ *               TBAN_STRUCT_NULL_PTR
+ *               TBAN_VALUE_NULL_PTR (no batch open by this thread)
+ **********************************************************************/
+int tban_batchAbort(struct TBan* tban) {
+  struct TBanBatch* batch;
+  int i;
+
+  /* Sanity check */
+  if(tban == NULL)
+    return TBAN_STRUCT_NULL_PTR;
+  batch = tban_batchOwned(tban);
+  if(batch == NULL)
+    return TBAN_VALUE_NULL_PTR;
+
+  batch->len       = 0;
+  batch->completed = TBAN_TRUE;
+  __atomic_store_n(&tban->batch, NULL, __ATOMIC_RELEASE);
+
+  /* Writes recorded in the setter cache may never have been sent */
+  for(i=0; i<TBAN_STATUS_SIZE; i++) {
+    if(tban->shadow.state[i] == TBAN_SHADOW_PENDING)
+      tban->shadow.state[i] = TBAN_SHADOW_DIRTY;
+  }
+
+  return TBAN_OK;
+}
+
+
+/**********************************************************************
+ * Name        : tban_sendCommand
+ * Description : Send a TBan command (either a one-byte command or a
+ *               two-byte one)
+ * Arguments   : tban   = The TBan struct to use when communicating
+ *               sndBuf = The buffer containing the command.
+ *               cmdLen = The length of the command (usually 1 or 2
+ *                        bytes) 
+ * Returning   : TBAN_OK
+ *               TBAN_ESEND
+ *               TBAN_STRUCT_NULL_PTR
+ *               TBAN_BUF_NULL_PTR
+ *               TBAN_NOT_OPENED
+ **********************************************************************/
+int tban_sendCommand(struct TBan* tban, unsigned char* sndBuf, int cmdLen) {
+  struct TBanBatch* batch;
+  long long start;
+  int result, i;
+
+  /* Sanity check */
+  if(tban == NULL)
+    return TBAN_STRUCT_NULL_PTR;
+  if(sndBuf == NULL)
+    return TBAN_BUF_NULL_PTR;
+  if(tban->opened == 0)
+    return TBAN_NOT_OPENED;
+
+  DEBUG(
+    printf("tban_sendCommand: 0x");
+    for (i = 0; i < cmdLen; i++) {
+      printf("%02x", sndBuf[i]);
+    }
+    printf("\n");
+  )
+
+  /* Queue the command if this thread has a batch open */
+  batch = tban_batchOwned(tban);
+  if(batch != NULL)
+    return tban_batchAdd(tban, batch, sndBuf, cmdLen);
+
+  /* Write data to port. The delay is part of the transaction so that
+   * nobody else talks to the device while it is busy. */
+  result = tban_portLock(tban);
+  if(result != TBAN_OK)
+    return result;
+  start  = local_monotonicUs();
+  result = tban_writeCommand(tban, sndBuf, cmdLen);
+  if(result == TBAN_OK) {
+    tban_commandDelay(tban);
+    tban_statsLatency(tban->stats.commandHist, start);
+  }
+  tban_portUnlock(tban);
+
+  return result;
+}
+
+
+/**********************************************************************
+ * Name        : tban_shadowRedundant
+ * Description : Check if a write to a status vector index can be
+ *               skipped since the device already has (or will have)
+ *               the value.
+ * Arguments   : tban = The TBan struct to work on.
+ *               ref  = The index and the value to write.
+ * Returning   : TBAN_TRUE / TBAN_FALSE
+ **********************************************************************/
+static int tban_shadowRedundant(struct TBan* tban, const struct TBanShadowRef* ref) {
+  const struct TBanShadow* shadow = &tban->shadow;
+
+  switch(shadow->state[ref->index]) {
+    case TBAN_SHADOW_PENDING:
+      /* Same value already written, not queried since */
+      return shadow->value[ref->index] == ref->value;
+    case TBAN_SHADOW_CLEAN:
+      /* The vector is authoritative once it has been read */
+      return ref->verify && (tban->lastQuery != 0) &&
+        (tban->buf[ref->index] == ref->expect);
+    default:
+      return TBAN_FALSE;
+  }
+}
+
+
+/**********************************************************************
+ * Name        : tban_sendShadowed
+ * Description : Send a setter command through the write-through cache.
+ *               The command is skipped if none of the status vector
+ *               indexes it affects would change, otherwise it is sent
+ *               (or queued in the open batch) and the indexes are
+ *               marked pending until the next query confirms them.
+ *               Without the cache this is tban_sendCommand.
+ * Arguments   : tban   = The TBan struct to work on.
+ *               sndBuf = The command.
+ *               cmdLen = The length of the command.
+ *               refs   = The status vector indexes affected.
+ *               count  = Number of elements in refs.
+ * Returning   : TBAN_OK
+ *               TBAN_ESEND
+ *               TBAN_STRUCT_NULL_PTR
+ *               TBAN_BUF_NULL_PTR
+ *               TBAN_NOT_OPENED
+ **********************************************************************/
+int tban_sendShadowed(struct TBan* tban, unsigned char* sndBuf, int cmdLen,
+                      const struct TBanShadowRef* refs, int count) {
+  struct TBanShadow* shadow;
+  int i, redundant;
+
+  /* Sanity check */
+  if(tban == NULL)
+    return TBAN_STRUCT_NULL_PTR;
+  shadow = &tban->shadow;
+  if(!shadow->enabled)
+    return tban_sendCommand(tban, sndBuf, cmdLen);
+
+  redundant = TBAN_TRUE;
+  for(i=0; (i<count) && redundant; i++)
+    redundant = tban_shadowRedundant(tban, &refs[i]);
+  if(redundant) {
+    shadow->suppressed++;
+    return TBAN_OK;
+  }
+
+  CHECK_RESULT(tban_sendCommand(tban, sndBuf, cmdLen));
+  shadow->sent++;
+
+  for(i=0; i<count; i++) {
+    shadow->state[refs[i].index]  = TBAN_SHADOW_PENDING;
+    shadow->value[refs[i].index]  = refs[i].value;
+    shadow->expect[refs[i].index] = refs[i].expect;
+  }
+
+  return TBAN_OK;
+}
+
+
+/**********************************************************************
+ * Name        : tban_shadowConfirm
+ * Description : Compare the pending writes of the setter cache with a
+ *               part of the status vector that has just been
+ *               received. Writes showing up in the vector are
+ *               confirmed, the others are marked dirty.
+ * Arguments   : tban  = The TBan struct to work on.
+ *               first = First status vector index received.
+ *               last  = Last status vector index received.
+ * Returning   : none
+ **********************************************************************/
+void tban_shadowConfirm(struct TBan* tban, int first, int last) {
+  struct TBanShadow* shadow = &tban->shadow;
+  int i;
+
+  for(i=first; i<=last; i++) {
+    if(shadow->state[i] == TBAN_SHADOW_CLEAN)
+      continue;
+    if(tban->buf[i] == shadow->expect[i]) {
+      shadow->state[i] = TBAN_SHADOW_CLEAN;
+    } else {
+      if(shadow->state[i] == TBAN_SHADOW_PENDING)
+        shadow->mismatches++;
+      shadow->state[i] = TBAN_SHADOW_DIRTY;
+    }
+  }
+}
+
+
+/**********************************************************************
+ * Name        : tban_waitReadable
+ * Description : Block until the port has data to read or the deadline
+ *               has passed. Signals interrupting the wait are ignored
+ *               and the remaining time is recalculated.
+ * Arguments   : tban     = The TBan device to operate on.
+ *               deadline = Absolute deadline (local_monotonicMs) in
+ *                          milliseconds.
+ * Returning   : TBAN_OK       = Data can be read
+ *               TBAN_ERECEIVE = Deadline passed or poll failed
+ **********************************************************************/
+static int tban_waitReadable(struct TBan* tban, long long deadline) {
+  struct pollfd pfd;
+  long long     remaining;
+  int           result;
+
+  pfd.fd     = tban->port;
+  pfd.events = POLLIN;
+
+  for(;;) {
+    remaining = deadline - local_monotonicMs();
+    if(remaining < 0)
+      remaining = 0;
+
+    pfd.revents = 0;
+    result = poll(&pfd, 1, (int) remaining);
+    if(result > 0) {
+      if(pfd.revents & (POLLERR | POLLHUP | POLLNVAL))
+        return TBAN_ERECEIVE;
+      return TBAN_OK;
+    }
+    if(result == 0)
+      return TBAN_ERECEIVE;
+    if(errno != EINTR)
+      return TBAN_ERECEIVE;
+  }
+}
+
+
+/**********************************************************************
+ * Name        : tban_rxStart
+ * Description : Prepare the receive state of the handle for a new
+ *               transfer. The data is collected by tban_rxFeed.
+ * Arguments   : tban      = The TBan device to operate on.
+ *               spec      = Frame description, or NULL to just read
+ *                           expected bytes.
+ *               dest      = Where to store the received data. Must
+ *                           hold spec->length bytes when spec is given.
+ *               expected  = The number of bytes to receive (ignored
+ *                           when spec is given).
+ *               timeoutMs = Max number of milliseconds the transfer
+ *                           may take.
+ *               finish    = Post processing run when the transfer is
+ *                           complete (may be NULL).
+ *               cb        = Completion callback (NULL for blocking
+ *                           transfers).
+ *               ptr       = Passed to the callback unaltered.
+ * Returning   : TBAN_OK
+ *               TBAN_STRUCT_NULL_PTR
+ *               TBAN_BUF_NULL_PTR
+ *               TBAN_NOT_OPENED
+ *               TBAN_VALUE_OUT_OF_BOUNDS
+ *               TBAN_ALREADY_IN_USE (a transfer is already pending)
+ **********************************************************************/
+int tban_rxStart(struct TBan* tban, const struct TBanFrameSpec* spec,
+                 unsigned char* dest, int expected, int timeoutMs,
+                 int (*finish)(struct TBan*), tban_rxCb* cb, void* ptr) {
+  /* Sanity check */
+  if(tban == NULL)
+    return TBAN_STRUCT_NULL_PTR;
+  if(tban->opened == 0)
+    return TBAN_NOT_OPENED;
+  if(dest == NULL)
+    return TBAN_BUF_NULL_PTR;
+  if(spec != NULL)
+    expected = spec->length;
+  if((expected <= 0) || (timeoutMs < 0))
+    return TBAN_VALUE_OUT_OF_BOUNDS;
+  if(tban->rx.pending)
+    return TBAN_ALREADY_IN_USE;
+
+  tban->rx.dest      = dest;
+  tban->rx.expected  = expected;
+  tban->rx.fill      = 0;
+  tban->rx.spec      = spec;
+  tban->rx.lastRx    = 0;
+  tban->rx.discarded = 0;
+  tban->rx.deadline  = local_monotonicMs() + timeoutMs;
+  tban->rx.started   = local_monotonicUs();
+  tban->rx.finish    = finish;
+  tban->rx.cb        = cb;
+  tban->rx.cbPtr     = ptr;
+  tban->rx.pending   = TBAN_TRUE;
+
+  return TBAN_OK;
+}
+
+
+/**********************************************************************
+ * Name        : tban_frameSync
+ * Description : Make sure the received bytes form the beginning of a
+ *               valid frame. Leading bytes that cannot start a frame,
+ *               or a frame whose markers do not match, are dropped up
+ *               to the next possible start byte.
+ * Arguments   : rx = The receive state.
+ * Returning   : none
+ **********************************************************************/
+static void tban_frameSync(struct TBanRx* rx) {
+  const struct TBanFrameSpec* spec = rx->spec;
+  int i, skip;
+
+  while(rx->fill > 0) {
+    skip = 0;
+    if(rx->dest[0] != TBAN_FRAME_START) {
+      skip = 1;
+    } else {
+      for(i=0; i<spec->markers; i++) {
+        if((spec->markerPos[i] < rx->fill) &&
+           (rx->dest[spec->markerPos[i]] != spec->marker[i])) {
+          skip = 1;
+          break;
+        }
+      }
+    }
+    if(!skip)
+      return;
+
+    /* Drop everything up to the next start byte */
+    for(i=1; (i<rx->fill) && (rx->dest[i] != TBAN_FRAME_START); i++)
+      ;
+    DEBUG(printf("-- resync, dropping %d bytes\n", i));
+    (void) memmove(rx->dest, rx->dest+i, rx->fill-i);
+    rx->fill      -= i;
+    rx->discarded += i;
+  }
+}
+
+
+/**********************************************************************
+ * Name        : tban_rxIdleDeadline
+ * Description : For variable length frames: when the frame can be
+ *               considered complete if nothing more arrives.
+ * Arguments   : tban = The TBan device to operate on.
+ * Returning   : Absolute time (local_monotonicMs), or -1 if the frame
+ *               cannot end yet.
+ **********************************************************************/
+long long tban_rxIdleDeadline(struct TBan* tban) {
+  const struct TBanFrameSpec* spec = tban->rx.spec;
+
+  if((spec == NULL) || (spec->idleGapMs == 0) || (tban->rx.fill < spec->minLength))
+    return -1;
+  return tban->rx.lastRx + spec->idleGapMs;
+}
+
+
+/**********************************************************************
+ * Name        : tban_rxFeed
+ * Description : Read whatever the port has to offer into the transfer
+ *               in progress, without blocking. When the transfer is
+ *               complete rx.pending is cleared. The byte counter is
+ *               updated under the I/O lock, tbanLoop_run calls this
+ *               without it.
+ * Arguments   : tban = The TBan device to operate on.
+ * Returning   : TBAN_OK       (check rx.pending to see if done)
+ *               TBAN_ERECEIVE (read failed or device gone)
+ **********************************************************************/
+int tban_rxFeed(struct TBan* tban) {
+  /* The number of bytes the last read returned */
+  ssize_t bytesread;
+
+  while(tban->rx.pending && (tban->rx.fill < tban->rx.expected)) {
+    bytesread = read(tban->port,
+                     tban->rx.dest + tban->rx.fill,
+                     tban->rx.expected - tban->rx.fill);
+    if(bytesread < 0) {
+      if(errno == EINTR)
+        continue;
+      if((errno == EAGAIN) || (errno == EWOULDBLOCK))
+        return TBAN_OK;
+      DEBUG(printf("TBAN_ERECEIVE (read: %s)\n", strerror(errno)));
+      return TBAN_ERECEIVE;
+    }
+    if(bytesread == 0) {
+      /* End of file, the device has gone away */
+      return TBAN_ERECEIVE;
+    }
+
+    /* Advance the pointer */
+    tban->rx.fill  += bytesread;
+    tban_ioLock(tban);
+    tban->stats.bytesReceived += bytesread;
+    tban_ioUnlock(tban);
+    tban->rx.lastRx = local_monotonicMs();
+    if(tban->rx.spec != NULL)
+      tban_frameSync(&tban->rx);
+    DEBUG(printf("-- %d bytes read of the expected %d \n", tban->rx.fill, tban->rx.expected));
+  }
+
+  if(tban->rx.fill >= tban->rx.expected)
+    tban->rx.pending = TBAN_FALSE;
+
+  return TBAN_OK;
+}
+
+
+/**********************************************************************
+ * Name        : tban_rxComplete
+ * Description : Finish the transfer in progress: run the post
+ *               processing (if the transfer succeeded) and the
+ *               completion callback.
+ * Arguments   : tban   = The TBan device to operate on.
+ *               result = Outcome of the transfer.
+ * Returning   : The final outcome of the transfer
+ **********************************************************************/
+int tban_rxComplete(struct TBan* tban, int result) {
+  tban_rxCb* cb  = tban->rx.cb;
+  void*      ptr = tban->rx.cbPtr;
+
+  tban->rx.pending = TBAN_FALSE;
+  tban->rx.cb      = NULL;
+
+  tban_ioLock(tban);
+  if(result == TBAN_OK) {
+    tban->stats.reads++;
+    tban_statsLatency(tban->stats.readHist, tban->rx.started);
+  } else if(local_monotonicMs() >= tban->rx.deadline) {
+    tban->stats.timeouts++;
+  } else {
+    tban->stats.readErrors++;
+  }
+  tban->stats.discarded += tban->rx.discarded;
+  tban_ioUnlock(tban);
+
+  if((result == TBAN_OK) && (tban->rx.finish != NULL))
+    result = tban->rx.finish(tban);
+  tban->rx.finish = NULL;
+
+  if(cb != NULL)
+    cb(tban, result, ptr);
+
+  return result;
+}
+
+
+/**********************************************************************
+ * Name        : tban_rxWait
+ * Description : Drive the transfer prepared with tban_rxStart to its
+ *               end, sleeping in poll() while waiting for data.
+ * Arguments   : tban = The TBan device to operate on.
+ * Returning   : TBAN_OK
+ *               TBAN_ERECEIVE
+ *               Errors from the finish function of the transfer
+ **********************************************************************/
+static int tban_rxWait(struct TBan* tban) {
+  long long idle, wake;
+  int       result;
+
+  do {
+    /* A variable length frame may end before the deadline */
+    wake = tban->rx.deadline;
+    idle = tban_rxIdleDeadline(tban);
+    if((idle >= 0) && (idle < wake))
+      wake = idle;
+
+    result = tban_waitReadable(tban, wake);
+    if(result == TBAN_OK) {
+      result = tban_rxFeed(tban);
+    } else if((idle >= 0) && (local_monotonicMs() >= idle)) {
+      /* Line idle after a complete (shorter) frame */
+      tban->rx.pending = TBAN_FALSE;
+      result = TBAN_OK;
+    }
+  } while((result == TBAN_OK) && tban->rx.pending);
+
+  return tban_rxComplete(tban, result);
 }
 
 
 /**********************************************************************
- * Name        : tban_setProgressCb
- * Description : Set the progress callback function that will be called
- * 		 whenever needed. For example when sending large amount
- * 		 of data the needed delays will cause the program to
- * 		 hang for a while, then the callback can display some
- * 		 useful user-response.
- * Arguments   : tban = The TBan struct to use when communicating
- *		 cb   = The application callback (or null if disable)
+ * Name        : tban_readDataTimeout
+ * Description : Read exactly expected bytes from the TBan unit. The
+ *               function sleeps in poll() and wakes up as soon as data
+ *               arrives, so it returns once the last byte has been
+ *               received instead of at a fixed polling interval.
+ * Arguments   : tban      = The TBan device to operate on.
+ *               buf       = Where to store the received data.
+ *               expected  = The number of bytes to read from the TBan
+ *                           device.
+ *               timeoutMs = Max number of milliseconds the whole read
+ *                           may take.
  * Returning   : TBAN_OK
  *               TBAN_STRUCT_NULL_PTR
+ *               TBAN_BUF_NULL_PTR
+ *               TBAN_ERECEIVE
+ *               TBAN_NOT_OPENED
+ *               TBAN_VALUE_OUT_OF_BOUNDS
  **********************************************************************/
-int tban_setProgressCb(struct TBan* tban, tban_progressCb* func, void* ptr) {
-  /* Sanity check */
+int tban_readDataTimeout(struct TBan* tban, unsigned char* buf, int expected, int timeoutMs) {
+  int result;
+
   if(tban == NULL)
     return TBAN_STRUCT_NULL_PTR;
 
-  tban->progressCb = func;
-  tban->progressCbPtr = ptr;
-  
-  return TBAN_OK;
-}
+  /* Commands queued in an open batch must reach the device before we
+   * wait for its answer */
+  CHECK_RESULT(tban_batchFlush(tban));
 
+  tban_ioLock(tban);
+  result = tban_rxStart(tban, NULL, buf, expected, timeoutMs, NULL, NULL, NULL);
+  if(result == TBAN_OK)
+    result = tban_rxWait(tban);
+  tban_ioUnlock(tban);
+
+  return result;
+}
 
 
 /**********************************************************************
- * Name        : tban_updateProgress
- * Description : Update the progress for the calling application (if the
- * 		 callback function has been set)
- * Arguments   : tban = The TBan struct to use when communicating
- *		 cur = The current value
- *		 max = The maximum value
- * Returning   : TBAN_OK
- *               TBAN_STRUCT_NULL_PTR
+ * Name        : tban_discardInput
+ * Description : Throw away everything received but not yet read. Used
+ *               before a status request so that stale bytes do not end
+ *               up in front of the answer. Commands queued in a batch
+ *               of the calling thread are sent first.
+ * Arguments   : tban = The TBan device to operate on.
+ * Returning   : none
  **********************************************************************/
-void tban_updateProgress(struct TBan* tban, int cur, int max) {
-  tban_progressCb* func = tban->progressCb;
-  if(func != NULL) {
-    func(tban->progressCbPtr, cur, max);
-  }
+void tban_discardInput(struct TBan* tban) {
+  (void) tban_batchFlush(tban);
+  (void) tcflush(tban->port, TCIFLUSH);
 }
 
 
-
-
 /**********************************************************************
- * Name        : tban_sendCommand
- * Description : Send a TBan command (either a one-byte command or a
- *               two-byte one)
- * Arguments   : tban   = The TBan struct to use when communicating
- *               sndBuf = The buffer containing the command.
- *               cmdLen = The length of the command (usually 1 or 2
- *                        bytes) 
+ * Name        : tban_readFrame
+ * Description : Read one status frame. The read ends as soon as the
+ *               frame is complete. Bytes in front of the frame are
+ *               skipped.
+ * Arguments   : tban = The TBan device to operate on.
+ *               spec = Description of the frame.
+ *               buf  = Where to store the frame (spec->length bytes).
+ *               len  = The length of the frame received (may be NULL).
  * Returning   : TBAN_OK
- *               TBAN_ESEND
  *               TBAN_STRUCT_NULL_PTR
  *               TBAN_BUF_NULL_PTR
+ *               TBAN_ERECEIVE
  *               TBAN_NOT_OPENED
  **********************************************************************/
-int tban_sendCommand(struct TBan* tban, unsigned char* sndBuf, int cmdLen) {
-  int result, i;
+int tban_readFrame(struct TBan* tban, const struct TBanFrameSpec* spec, unsigned char* buf, int* len) {
+  int result;
 
-  /* Sanity check */
   if(tban == NULL)
     return TBAN_STRUCT_NULL_PTR;
-  if(sndBuf == NULL)
-    return TBAN_BUF_NULL_PTR;
-  if(tban->opened == 0)
-    return TBAN_NOT_OPENED;
+  if(spec == NULL)
+    return TBAN_VALUE_NULL_PTR;
 
-  DEBUG(
-    printf("tban_sendCommand: 0x");
-    for (i = 0; i < cmdLen; i++) {
-      printf("%02x", sndBuf[i]);
-    }
-    printf("\n");
-  )
+  CHECK_RESULT(tban_batchFlush(tban));
 
-  /* Write data to port */
-  result = write(tban->port, sndBuf, cmdLen);
-  if(result == -1)
-    return TBAN_ESEND;
-  else {
-    local_nanosleep(0, TBAN_COMMAND_DELAY);
-    return TBAN_OK;
+  tban_ioLock(tban);
+  result = tban_rxStart(tban, spec, buf, 0, tban->timeout, NULL, NULL, NULL);
+  if(result == TBAN_OK) {
+    result = tban_rxWait(tban);
+    if(len != NULL)
+      *len = tban->rx.fill;
   }
+  tban_ioUnlock(tban);
+
+  return result;
 }
 
 
 /**********************************************************************
  * Name        : tban_readData
  * Description : Read data from the TBan unit using the device attached
- *               to earlier. 
+ *               to earlier. The timeout configured with
+ *               tban_configureTimeout is used.
  * Arguments   : tban     = The TBan device to operate on.
- *               expected = The maximum number of bytes to read from the
+ *               expected = The number of bytes to read from the
  *                          TBan device.
- * Returning   : TBAN_OK
- *               TBAN_STRUCT_NULL_PTR
- *               TBAN_ERECEIVE
- *               TBAN_NOT_OPENED
+ * Returning   : See tban_readDataTimeout
  **********************************************************************/
 int tban_readData(struct TBan* tban, unsigned char* buf, int expected) {
-  /* Temp receive buffer. */
-  unsigned char   local_buf[32] = "";
-  /* The number of bytes the last read returned */
-  int             bytesread;
-  /* Keeps track of the current position in memory when the data is to be
-   * dumped. */
-  int             currdest;
-  time_t          starttime;
-
-  /* Sanity check */
   if(tban == NULL)
     return TBAN_STRUCT_NULL_PTR;
-  if(tban->opened == 0)
-    return TBAN_NOT_OPENED;
-  if(buf == NULL)
-    return TBAN_BUF_NULL_PTR;
-
-  /* Get starttime for checking of timeout */
-  starttime = time(NULL);
-  DEBUG(printf("starttime=%d\n", (int) starttime));
-  
-  /* Wait for data to arrive in the queue. The signal function defined
-   * in the tban_openPort function toggles the tban_dataAvailable flag
-   * when this happens. Otherwise just hang on and wait for the timeout
-   * to expire. */
-  tban_dataAvailable = TBAN_FALSE;
-  while ((tban_dataAvailable == TBAN_FALSE) && checktimeout(starttime, tban->timeout)) {
-    local_nanosleep(1,0);
-  }
-
-  /* Nothing received within the timeout so lets signal an error to the
-   * user */
-  if(!checktimeout(starttime,tban->timeout)) {
-    return TBAN_ERECEIVE;
-  }
-
-  /* Read data from port. But keep it within the limits of the temp
-   * buffer. It will becopied to the correct buffer later on.  */
-  redo_read:
-  currdest = 0;
-  bytesread = read(tban->port, local_buf, sizeof(local_buf));
-  tban_dataAvailable = TBAN_FALSE;
-  if(bytesread == -1) {
-    local_nanosleep(1,0);
-    goto redo_read;
-  }
-
-  /* Loop until (if the expected parameter is <> 0) the expected amount of
-   * data is returned, else until timeout. */
-  while (((currdest < expected) || (expected == 0)) && (checktimeout(starttime, tban->timeout))) {
-    /* This doesn't work if we doesn't have NPTL enabled for glibc */
-
-    /* Lets try to avoid overwrite problems in the supplied receive
-     * buffer */
-    if((currdest+bytesread) >= expected) {
-      bytesread = expected-currdest;
-    }
-    
-    DEBUG(printf("before memcpy\n"));
-    (void) memcpy(buf+currdest, &local_buf, bytesread);
-    /* Advance the pointer */
-    currdest += bytesread;
-    if (currdest < expected) {
-      DEBUG(printf("-- %d bytes read of the expected %d \n", currdest, expected));
-      /* */      tban_dataAvailable = TBAN_TRUE;
-      while ((tban_dataAvailable == TBAN_FALSE) && (checktimeout(starttime, tban->timeout))) {
-        local_nanosleep(1,0);
-      }
-      if (checktimeout(starttime, tban->timeout)) {
-        redo_read2:
-        bytesread = read(tban->port, local_buf, sizeof(local_buf));
-        if(bytesread == -1) {
-          local_nanosleep(1,0);
-          if(checktimeout(starttime, tban->timeout)) {
-            DEBUG(printf("goto redo_read2\n"));
-            goto redo_read2;
-          }
-        }
-
-        tban_dataAvailable = TBAN_FALSE;
-      }
-    }
-  }
 
-  /* Make sure we return the correct value depending on the timeout
-   * values */
-  if (!checktimeout(starttime, tban->timeout)) {
-    DEBUG(printf("TBAN_ERECEIVE\n"));
-    return TBAN_ERECEIVE;
-  } else {
-    DEBUG(printf("-- %d bytes read of the expected %d \n", currdest, expected));
-    DEBUG(printf("TBAN_OK\n"));
-    return TBAN_OK;
-  }
+  return tban_readDataTimeout(tban, buf, expected, tban->timeout);
 }
 
 
@@ -952,42 +1912,37 @@ int tban_readData(struct TBan* tban, unsigned char* buf, int expected) {
 /**********************************************************************
  * Name        : tban_flushData
  * Description : Calling this function causes data in the queue to be
- *               discarded.
+ *               discarded. The function waits at most the configured
+ *               timeout for the first byte and then drains the port
+ *               until it has been quiet for TBAN_FLUSH_QUIET_MS.
  * Arguments   : tban = The TBan struct to work on.
  * Returning   : TBAN_OK
  *               TBAN_STRUCT_NULL_PTR
- *               TBAN_EOPEN
+ *               TBAN_NOT_OPENED
  **********************************************************************/
 int tban_flushData(struct TBan* tban) {
-  time_t          starttime;
-  unsigned char* buf;
-  int bytesread;
+  unsigned char buf[128];
+  ssize_t       bytesread;
+  long long     deadline;
 
-  buf = malloc(128);
-
-  /* Get starttime for checking of timeout */
-  starttime = time(NULL);
-  while ((tban_dataAvailable == TBAN_FALSE) && checktimeout(starttime, tban->timeout)) {
-    local_nanosleep(1,0);
-  }
+  /* Sanity check */
+  if(tban == NULL)
+    return TBAN_STRUCT_NULL_PTR;
+  if(tban->opened == 0)
+    return TBAN_NOT_OPENED;
 
-  /* Nothing received within the timeout so lets signal an error to the
-   * user */
-  if(!checktimeout(starttime,tban->timeout)) {
+  deadline = local_monotonicMs() + tban->timeout;
+  if(tban_waitReadable(tban, deadline) != TBAN_OK) {
     printf("Nothing to flush \n");
-    free(buf);
     return TBAN_OK;
   }
 
-  tban_dataAvailable = TBAN_TRUE;
-  while(tban_dataAvailable == TBAN_TRUE) {
-    tban_dataAvailable = TBAN_FALSE;
+  do {
     bytesread = read(tban->port, buf, sizeof(buf));
-    printf("Flushed %d bytes\n", bytesread);
-    local_nanosleep(1,0);
-  }
-
-  free(buf);
+    if(bytesread > 0)
+      printf("Flushed %d bytes\n", (int) bytesread);
+    deadline = local_monotonicMs() + TBAN_FLUSH_QUIET_MS;
+  } while(tban_waitReadable(tban, deadline) == TBAN_OK);
 
   return TBAN_OK;
 }
@@ -997,20 +1952,20 @@ int tban_flushData(struct TBan* tban) {
  * Name        : tban_open
  * Description : Open the TBan port for usage. This basically just opens
  *               the device file (for example "/dev/ttyUSB0") for
- *               reading and writing and links a serial handler to be
- *               called when there are data to be read.
+ *               non-blocking reading and writing and configures the
+ *               serial line.
  * Arguments   : tban = The TBan struct to work on.
  * Returning   : TBAN_OK
  *               TBAN_STRUCT_NULL_PTR
  *               TBAN_EOPEN
+ *               TBAN_ALREADY_IN_USE
+ *               TBAN_CANNOT_CREATE_LOCKFILE
  **********************************************************************/
 int tban_open(struct TBan* tban) {
-  /* The initialisation-snippet is *not very* loosely based on "3.3
-   * Asynchronous Input" from the "Serial-Programing-HOWTO.html" at
-   * http://linuxdoc.org.. Had no real reason to change it much. */
-
-  /* Definition of signal action */
-  struct sigaction saio;
+  /* The initialisation-snippet is loosely based on the
+   * "Serial-Programing-HOWTO.html" at http://linuxdoc.org. The port is
+   * opened non-blocking and read with poll/epoll, no signals are
+   * involved. */
   struct termios   newtio;
   int              result;
 
@@ -1020,51 +1975,39 @@ int tban_open(struct TBan* tban) {
   if(tban->opened != 0)
     return TBAN_EOPEN;
 
-  /* Make sure that noone else is using the device. After this function
-   * call has been called and TBAN_OK is returned the device is
-   * allocated for this application. */
-  result = tban_checkIfDeviceUsed(tban);
-  if(result != TBAN_OK)
-    return result;
-
   /* Open the device */
   result = open(tban->deviceName, O_RDWR | O_NOCTTY | O_NONBLOCK);
   if(result < 0)
     return TBAN_EOPEN;
   tban->port = result;
 
-  /* Install the asynchronous serial handler, i.e. the callback function
-   * that will be called when there are data on the serial port. */
-  saio.sa_handler = tban_signal_handler_IO;
-  result = sigemptyset(&saio.sa_mask);
-  if(result != 0)
-    return TBAN_ESIGEMPTYSET;
-  saio.sa_flags = 0;
-#ifndef DRYRUN
-  saio.sa_restorer = NULL;
-#endif
-
-  result = sigaction(SIGIO, &saio, NULL);
-  if(result != 0)
-    return TBAN_ESIGACTION;
+  /* Make sure that noone else is using the device. After this function
+   * call has been called and TBAN_OK is returned the device is
+   * allocated for this application. In transaction mode the device is
+   * only locked while it is talked to. The port settings are left
+   * alone until the lock is ours. */
+  tban->lockDepth = 0;
+  if(tban->lockMode == TBAN_LOCK_SESSION) {
+    result = tban_checkIfDeviceUsed(tban);
+    if(result != TBAN_OK) {
+      (void) close(tban->port);
+      return result;
+    }
+  }
 
-  /* Allow the process to receive SIGIO */
-  result = fcntl(tban->port, F_SETOWN, getpid());
-  if(result != 0)
-    return TBAN_EOPEN;
-  
-  /* Make the file descriptor asynchronous (the manual page says only
-   * O_APPEND and O_NONBLOCK, will work with F_SETFL...) */
-#ifndef DRYRUN
-  result = fcntl(tban->port, F_SETFL, FASYNC);
-#endif
-  if(result != 0)
-    return TBAN_EOPEN;
+  /* In transaction mode the port settings are only touched while
+   * holding the device lock, another program may be in the middle of
+   * a transaction. */
+  if(tban->lockMode == TBAN_LOCK_TRANSACTION) {
+    result = tban_lock(tban, tban->lockTimeoutMs);
+    if(result != TBAN_OK) {
+      (void) close(tban->port);
+      return result;
+    }
+  }
 
   /* save current port settings */  
   result = tcgetattr(tban->port, &(tban->oldtio)); 
-  if(result != 0)
-    return TBAN_EOPEN;
 
   /* Set new port settings for canonical input processing */
   newtio.c_cflag = intToBaud(tban->baudrate)
@@ -1078,13 +2021,19 @@ int tban_open(struct TBan* tban) {
   newtio.c_lflag     = 0;
   newtio.c_cc[VMIN]  = 1;
   newtio.c_cc[VTIME] = 0;
-  result = tcflush(tban->port, TCIFLUSH);
-  if(result != 0)
-    return TBAN_EOPEN;
+  if(result == 0)
+    result = tcflush(tban->port, TCIFLUSH);
+  if(result == 0)
+    result = tcsetattr(tban->port, TCSANOW, &newtio);
 
-  result = tcsetattr(tban->port, TCSANOW, &newtio);
-  if(result != 0)
+  /* Closing the port releases the device lock */
+  if(result != 0) {
+    (void) close(tban->port);
+    tban->locked = 0;
     return TBAN_EOPEN;
+  }
+  if(tban->lockMode == TBAN_LOCK_TRANSACTION)
+    (void) tban_unlock(tban);
 
   /* Indicate that the port is now opened */
   tban->opened = 1;
@@ -1111,12 +2060,33 @@ int tban_close(struct TBan* tban) {
   if(tban->opened==0)
     return TBAN_NOT_OPENED;
 
-  /* Reset port settings */
-  result = tcsetattr(tban->port,TCSANOW, &(tban->oldtio));
-  if(result != 0)
-    return TBAN_ECLOSE;
+  /* The sampler uses the port */
+  if(tban->sampler != NULL)
+    (void) tban_samplerStop(tban);
+  if(tban->shm != NULL)
+    (void) tban_shmUnpublish(tban);
+  if(tban->recorder != NULL)
+    (void) tban_recorderStop(tban);
+
+  /* Queued commands are lost when the port goes away, whoever
+   * opened the batch */
+  if(tban->batch != NULL) {
+    tban->batch->owner = pthread_self();
+    (void) tban_batchAbort(tban);
+  }
+
+  /* Reset port settings. Not in transaction mode, where the device
+   * lock is not held and another program may be using the port with
+   * the settings of tban_open. */
+  if(tban->lockMode != TBAN_LOCK_TRANSACTION) {
+    result = tcsetattr(tban->port,TCSANOW, &(tban->oldtio));
+    if(result != 0)
+      return TBAN_ECLOSE;
+  }
   
+  /* Closing the port releases the device lock */
   result = close(tban->port);
+  tban->locked = 0;
   if(result != 0)
     return TBAN_ECLOSE;
 
@@ -1143,8 +2113,6 @@ int tban_close(struct TBan* tban) {
  *               TBAN_CORRUPT_DATA
  **********************************************************************/
 int tban_queryStatus(struct TBan* tban) {
-  unsigned char sndBuf[8];
-
   /* Sanity check */
   if(tban == NULL)
     return TBAN_STRUCT_NULL_PTR;
@@ -1153,24 +2121,187 @@ int tban_queryStatus(struct TBan* tban) {
   if(tban->buf == NULL)
     return TBAN_BUF_NULL_PTR;
 
+  /* The sampler thread already has a fresh vector */
+  if(tban_samplerCovers(tban, TBAN_SAMPLE_TBAN))
+    return tban_samplerCopy(tban, TBAN_SAMPLE_TBAN);
+
+  CHECK_RESULT(tban_fetchStatus(tban, tban->buf));
+
+  return tban_statusReceived(tban);
+}
+
+
+/**********************************************************************
+ * Name        : tban_queryPartial
+ * Description : Refresh only a part of the local status vector. This
+ *               transfers far fewer bytes than tban_queryStatus, for
+ *               example 49 instead of 285 for the sensor readings. A
+ *               full query is made instead when no status vector has
+ *               been read yet (the firmware version is unknown), when
+ *               the firmware is older than 2.8 or while the sampler
+ *               runs.
+ * Arguments   : tban = The TBan structure.
+ *               part = TBAN_QUERY_SENSORS, TBAN_QUERY_CONFIG or
+ *                      TBAN_QUERY_FULL
+ * Returning   : TBAN_OK
+ *               TBAN_STRUCT_NULL_PTR
+ *               TBAN_NOT_OPENED
+ *               TBAN_VALUE_OUT_OF_BOUNDS
+ *               TBAN_ESEND
+ *               TBAN_ERECEIVE
+ *               TBAN_CORRUPT_DATA
+ **********************************************************************/
+int tban_queryPartial(struct TBan* tban, int part) {
+  const TBan_partialStruct* map;
+  unsigned char sndBuf[8];
+  unsigned char frame[TBAN_STATUS_SIZE];
+  int result;
+
+  /* Sanity check */
+  if(tban == NULL)
+    return TBAN_STRUCT_NULL_PTR;
+  if(tban->opened == 0)
+    return TBAN_NOT_OPENED;
+  if((part < TBAN_QUERY_FULL) || (part > TBAN_QUERY_CONFIG))
+    return TBAN_VALUE_OUT_OF_BOUNDS;
+
+  if((part == TBAN_QUERY_FULL) ||
+     (tban->sampler != NULL) ||
+     (tban->lastQuery == 0) ||
+     (tban_present(tban) != TBAN_OK) ||
+     (tban_checkFw(tban, 28) != TBAN_OK)) {
+    return tban_queryStatus(tban);
+  }
+  map = &tban_partialMap[part-1];
+
+  result = tban_portLock(tban);
+  if(result != TBAN_OK)
+    return result;
+  tban_discardInput(tban);
+  sndBuf[0] = TBAN_SER_SOURCE1;
+  sndBuf[1] = map->cmd;
+  result = tban_writeCommand(tban, sndBuf, 2);
+  if(result == TBAN_OK)
+    result = tban_readFrame(tban, &map->frame, frame, NULL);
+  tban_portUnlock(tban);
+
+  if(result != TBAN_OK)
+    return result;
+
+  /* Merge the block into the local vector */
+  (void) memcpy(tban->buf + map->first, frame+1, map->last - map->first + 1);
+  tban_shadowConfirm(tban, map->first, map->last);
+  tban_shmUpdate(tban, TBAN_SAMPLE_TBAN, tban->buf, NULL, NULL, time(NULL));
+  tban_recorderUpdate(tban, TBAN_SAMPLE_TBAN, tban->buf, NULL, NULL);
+
+  return TBAN_OK;
+}
+
+
+/**********************************************************************
+ * Name        : tban_fetchStatus
+ * Description : Request the status vector from the TBan and store it in
+ *               the buffer supplied. The request and the answer form
+ *               one transaction on the port.
+ * Arguments   : tban = The TBan structure.
+ *               buf  = Receive buffer, at least 285 bytes.
+ * Returning   : TBAN_OK
+ *               TBAN_ESEND
+ *               TBAN_ERECEIVE
+ **********************************************************************/
+int tban_fetchStatus(struct TBan* tban, unsigned char* buf) {
+  unsigned char sndBuf[8];
+  int result;
+
+  result = tban_portLock(tban);
+  if(result != TBAN_OK)
+    return result;
+
+  /* Leftovers from an earlier aborted transfer would end up in front
+   * of the frame */
+  tban_discardInput(tban);
+
   /* Send the query command. Make sure that the command is sent to the
-   * TBan itself and not to the add-on modules such as miniNG. */
+   * TBan itself and not to the add-on modules such as miniNG. The
+   * request is written directly, never queued in a batch, so it stays
+   * within this transaction. */
   sndBuf[0] = TBAN_SER_SOURCE1;
   sndBuf[1] = TBAN_SER_REQUEST;
-  CHECK_RESULT(tban_sendCommand(tban, sndBuf, 2));
+  result = tban_writeCommand(tban, sndBuf, 2);
   
   /* Receive the result from the HW */
-  CHECK_RESULT(tban_readData(tban, tban->buf, 285));
+  if(result == TBAN_OK)
+    result = tban_readFrame(tban, &tban_statusFrame, buf, NULL);
+
+  tban_portUnlock(tban);
+
+  return result;
+}
+
+
+/**********************************************************************
+ * Name        : tban_queryStatusStart
+ * Description : Asynchronous variant of tban_queryStatus. The request is
+ *               sent and the receive state prepared, the frame is then
+ *               collected by the event loop (tban_loop.c) which calls cb
+ *               when done.
+ * Arguments   : tban = The TBan structure.
+ *               cb   = Completion callback.
+ *               ptr  = Passed to the callback unaltered.
+ * Returning   : TBAN_OK
+ *               TBAN_STRUCT_NULL_PTR
+ *               TBAN_NOT_OPENED
+ *               TBAN_ALREADY_IN_USE
+ *               TBAN_ESEND
+ **********************************************************************/
+int tban_queryStatusStart(struct TBan* tban, tban_rxCb* cb, void* ptr) {
+  unsigned char sndBuf[2];
+
+  /* Sanity check */
+  if(tban == NULL)
+    return TBAN_STRUCT_NULL_PTR;
+  if(tban->buf == NULL)
+    return TBAN_BUF_NULL_PTR;
+
+  CHECK_RESULT(tban_rxStart(tban, &tban_statusFrame, tban->buf, 0, tban->timeout,
+                            tban_statusReceived, cb, ptr));
+  tban_discardInput(tban);
+
+  sndBuf[0] = TBAN_SER_SOURCE1;
+  sndBuf[1] = TBAN_SER_REQUEST;
+  if(tban_writeCommand(tban, sndBuf, 2) != TBAN_OK) {
+    tban->rx.pending = TBAN_FALSE;
+    tban->rx.cb      = NULL;
+    return TBAN_ESEND;
+  }
+
+  return TBAN_OK;
+}
 
+
+/**********************************************************************
+ * Name        : tban_statusReceived
+ * Description : Validate a freshly received status vector and update
+ *               the time stamp. Shared by tban_queryStatus and the
+ *               asynchronous request in tban_loop.c.
+ * Arguments   : tban = The TBan structure.
+ * Returning   : TBAN_OK
+ *               TBAN_CORRUPT_DATA
+ **********************************************************************/
+int tban_statusReceived(struct TBan* tban) {
   /* Make some simple checks on the returned vector. Like that it
    * contains the value "100" in the first position */
   if(tban_present(tban) != TBAN_OK) {
+    tban_statsCount(tban, &tban->stats.corrupt);
     return TBAN_CORRUPT_DATA;
   }
 
   /* Update the time stamp for the last update, but only if we suceeded
    * with the update */
   tban->lastQuery = time(NULL);
+  tban_shadowConfirm(tban, 0, TBAN_STATUS_SIZE-1);
+  tban_shmUpdate(tban, TBAN_SAMPLE_TBAN, tban->buf, NULL, NULL, tban->lastQuery);
+  tban_recorderUpdate(tban, TBAN_SAMPLE_TBAN, tban->buf, NULL, NULL);
 
   return TBAN_OK;
 }
@@ -1294,7 +2425,7 @@ int tban_getPwmFreq(struct TBan* tban, unsigned char* freq) {
     return TBAN_NOT_OPENED;
 
   /* Return data */
-  *freq = tban->buf[4];
+  *freq = tban->buf[TBAN_FIELD_AT(pwmFreq, 0)];
 
   return TBAN_OK;
 }
@@ -1320,7 +2451,7 @@ int tban_getChOvertemp(struct TBan* tban, unsigned char channel, unsigned char*
     return TBAN_NOT_OPENED;
   if(channel >= TBAN_NUMBER_CHANNELS)
     return TBAN_INDEX_OUT_OF_BOUNDS;
-  CHECK_RESULT(tban_getValue(tban, TBAN_TEMP_MAXWARN0+channel, ot));
+  CHECK_RESULT(tban_getValue(tban, TBAN_FIELD_AT(chOvertemp, channel), ot));
   return TBAN_OK;
 }
 
@@ -1389,11 +2520,11 @@ int tban_getChInfo(struct TBan* tban, int index, unsigned int* rpmMax, unsigned
     return TBAN_NOT_OPENED;
 
   /* Get the maximum pwm */
-  CHECK_RESULT(tban_getValue(tban, tban_getChMaxPwmMapping[index], &lb));
-  CHECK_RESULT(tban_getValue(tban, tban_getChMaxPwmMapping[index]+1, &hb));
+  CHECK_RESULT(tban_getValue(tban, TBAN_FIELD_AT(chRpmMax, index), &lb));
+  CHECK_RESULT(tban_getValue(tban, TBAN_FIELD_AT(chRpmMax, index)+1, &hb));
 
   /* Calculate the maximum rpm  */
-  *rpmMax = (unsigned int) (((float) 256*hb + lb) * (float) 10.5);
+  *rpmMax = TBAN_RPM_MAX(hb, lb);
 
   /* Get the pwm */
   if(index >= TBAN_NUMBER_CHANNELS) {
@@ -1401,17 +2532,17 @@ int tban_getChInfo(struct TBan* tban, int index, unsigned int* rpmMax, unsigned
   }
 
   /* Get the pwm */
-  CHECK_RESULT(tban_getValue(tban, tban_getChPwmMapping[index], pwm));
+  CHECK_RESULT(tban_getValue(tban, TBAN_FIELD_AT(chPwm, index), pwm));
 
   /* The pwm needs to be corrected to be valid according to the max-rpm */
   (*pwm) = 2*(*pwm);
 
   /* Get temp. Strangely enough the european product TBan returns the
    * temperature in Farenheit so we need to convert it to Celsius... */
-  CHECK_RESULT(tban_getValue(tban, tban_getChTempMapping[index], resTemp));
+  CHECK_RESULT(tban_getValue(tban, TBAN_FIELD_AT(chTemp, index), resTemp));
 
   /* Get mode */
-  CHECK_RESULT(tban_getValue(tban, tban_getChModeMap[index], mode));
+  CHECK_RESULT(tban_getValue(tban, TBAN_FIELD_AT(chMode, index), mode));
 
   return TBAN_OK;
 }
@@ -1441,7 +2572,7 @@ int tban_getDSensorScaleFact(struct TBan* tban, int index, unsigned char* factor
     return TBAN_NOT_OPENED;
 
   /* Get the scaling factor for the selected sensor */
-  CHECK_RESULT(tban_getValue(tban, tban_getDScalingFactorMap[index], factor));
+  CHECK_RESULT(tban_getValue(tban, TBAN_FIELD_AT(dsCal, index), factor));
 
   return TBAN_OK;
 }
@@ -1475,9 +2606,9 @@ int tban_getdSensorTemp(struct TBan* tban, int index, unsigned char* temp, unsig
     return TBAN_NOT_OPENED;
 
   /* Get the temperature of the digital sensor */
-  CHECK_RESULT(tban_getValue(tban, tban_getDsensorMapping[index],    temp));
-  CHECK_RESULT(tban_getValue(tban, tban_getDrawSensorMapping[index], rawTemp));
-  CHECK_RESULT(tban_getValue(tban, tban_getDScalingFactorMap[index], cal));
+  CHECK_RESULT(tban_getValue(tban, TBAN_FIELD_AT(dsTemp, index),    temp));
+  CHECK_RESULT(tban_getValue(tban, TBAN_FIELD_AT(dsRawTemp, index), rawTemp));
+  CHECK_RESULT(tban_getValue(tban, TBAN_FIELD_AT(dsCal, index), cal));
 
   return TBAN_OK;
 }
@@ -1511,9 +2642,9 @@ int tban_getaSensorTemp(struct TBan* tban, int index, unsigned char* temp, unsig
     return TBAN_NOT_OPENED;
 
   /* Get the temperature of the digital sensor */
-  CHECK_RESULT(tban_getValue(tban, tban_getAsensorMapping[index],    temp));
-  CHECK_RESULT(tban_getValue(tban, tban_getArawSensorMapping[index], rawTemp));
-  CHECK_RESULT(tban_getValue(tban, tban_getAScalingFactorMap[index], cal));
+  CHECK_RESULT(tban_getValue(tban, TBAN_FIELD_AT(asTemp, index),    temp));
+  CHECK_RESULT(tban_getValue(tban, TBAN_FIELD_AT(asRawTemp, index), rawTemp));
+  CHECK_RESULT(tban_getValue(tban, TBAN_FIELD_AT(asCal, index), cal));
 
   return TBAN_OK;
 }
@@ -1610,14 +2741,14 @@ int tban_getChCurve(struct TBan* tban, int index, unsigned char x[], unsigned ch
    * is always 0. */
   for(i=0; i<6; i++) {
     /* Get the temperature */
-    CHECK_RESULT(tban_getValue(tban, tban_getChCurveXMap[index]+i, &(x[i])));
+    CHECK_RESULT(tban_getValue(tban, TBAN_FIELD_AT(chCurveX, index)+i, &(x[i])));
 
     /* Get the requested pwm */
-    CHECK_RESULT(tban_getValue(tban, tban_getChCurveYMap[index]+i, &(y[i])));
+    CHECK_RESULT(tban_getValue(tban, TBAN_FIELD_AT(chCurveY, index)+i, &(y[i])));
   }
 
   /* Get the maximum temp value. For this point the pwm is always 100%  */
-  CHECK_RESULT(tban_getValue(tban, TBAN_TEMP_MaxGrenz0+index, &(x[6])));
+  CHECK_RESULT(tban_getValue(tban, TBAN_FIELD_AT(chCurveXMax, index), &(x[6])));
   y[6]=100;
 
   return TBAN_OK;
@@ -1641,21 +2772,31 @@ int tban_getChCurve(struct TBan* tban, int index, unsigned char x[], unsigned ch
  *               TBAN_NOT_OPENED
  **********************************************************************/
 int tban_setChCurve(struct TBan* tban, int nr, unsigned char x[], unsigned char y[]) {
-  unsigned char sndBuf[4];
-  int i;
+  unsigned char    sndBuf[4];
+  struct TBanShadowRef refs[2];
+  struct TBanBatch batch;
+  int              ownBatch;
+  int              result = TBAN_OK;
+  int              i;
 
   /* Argument sanity check */
   if(tban == NULL)
     return TBAN_STRUCT_NULL_PTR;
-  if(nr > TBAN_NUMBER_CHANNELS)
+  if(nr >= TBAN_NUMBER_CHANNELS)
     return TBAN_INDEX_OUT_OF_BOUNDS;
   if((x == NULL) || (y == NULL))
     return TBAN_VALUE_NULL_PTR;
   if(tban->opened == 0)
     return TBAN_NOT_OPENED;
 
+  /* Send the whole curve as one batch unless the caller already has
+   * one open */
+  ownBatch = (tban_batchOwned(tban) == NULL);
+  if(ownBatch)
+    CHECK_RESULT(tban_batchBegin(tban, &batch));
+
   /* Build the communication string */
-  for(i=0; i<6; i++) {
+  for(i=0; (i<6) && (result == TBAN_OK); i++) {
     unsigned char base = TBAN_SER_SET_KANAL1 + (nr * 16);
     /* x-axis : temperature */
     sndBuf[0] = base+i;
@@ -1663,21 +2804,40 @@ int tban_setChCurve(struct TBan* tban, int nr, unsigned char x[], unsigned char
     /* y-axis : pwm */
     sndBuf[2] = base+6+i;
     sndBuf[3] = y[i];
+    refs[0].index  = TBAN_FIELD_AT(chCurveX, nr)+i;
+    refs[0].value  = refs[0].expect = sndBuf[1];
+    refs[0].verify = TBAN_TRUE;
+    refs[1].index  = TBAN_FIELD_AT(chCurveY, nr)+i;
+    refs[1].value  = refs[1].expect = sndBuf[3];
+    refs[1].verify = TBAN_TRUE;
     /* Send it */
-    CHECK_RESULT(tban_sendCommand(tban, sndBuf, 4));
+    result = tban_sendShadowed(tban, sndBuf, 4, refs, 2);
     /* Update progress */
     tban_updateProgress(tban, i,6);
   }
 
   /* Set the temp value for last response curve point */
-  sndBuf[0] = TBAN_SER_SET_MAX+nr;
-  sndBuf[1] = 2*x[6];
-  /* Send it */
-  CHECK_RESULT(tban_sendCommand(tban, sndBuf, 2));
+  if(result == TBAN_OK) {
+    sndBuf[0] = TBAN_SER_SET_MAX+nr;
+    sndBuf[1] = 2*x[6];
+    refs[0].index  = TBAN_FIELD_AT(chCurveXMax, nr);
+    refs[0].value  = refs[0].expect = sndBuf[1];
+    refs[0].verify = TBAN_TRUE;
+    /* Send it */
+    result = tban_sendShadowed(tban, sndBuf, 2, refs, 1);
+  }
+
+  if(ownBatch) {
+    if(result == TBAN_OK)
+      result = tban_batchCommit(tban);
+    else
+      (void) tban_batchAbort(tban);
+  }
+
   /* Update progress */
   tban_updateProgress(tban, i,6);
 
-  return TBAN_OK;
+  return result;
 }
 
 
@@ -1694,6 +2854,7 @@ int tban_setChCurve(struct TBan* tban, int nr, unsigned char x[], unsigned char
  **********************************************************************/
 int tban_setChHysteresis(struct TBan* tban, unsigned char nr, unsigned char hysteresis) {
   unsigned char sndBuf[8];
+  struct TBanShadowRef ref;
 
   /* Argument sanity check */
   if(tban == NULL)
@@ -1706,9 +2867,13 @@ int tban_setChHysteresis(struct TBan* tban, unsigned char nr, unsigned char hyst
   /* Send the scaling factor command together with the new value */
   sndBuf[0] = TBAN_SER_SET_HYS + nr;
   sndBuf[1] = hysteresis;
+  ref.index  = TBAN_FIELD_AT(chHysteresis, nr);
+  ref.value  = hysteresis;
+  ref.expect = hysteresis;
+  ref.verify = TBAN_TRUE;
 
   /* Perform the command */
-  CHECK_RESULT(tban_sendCommand(tban, sndBuf, 2));
+  CHECK_RESULT(tban_sendShadowed(tban, sndBuf, 2, &ref, 1));
   /* Update progress */
   tban_updateProgress(tban, 1, 1);
 
@@ -1761,6 +2926,8 @@ int tban_resetHardware(struct TBan* tban) {
  **********************************************************************/
 int tban_setChMode(struct TBan* tban, unsigned char modeMask) {
   unsigned char sndBuf[8];
+  struct TBanShadowRef refs[TBAN_NUMBER_CHANNELS];
+  int i;
 
   /* Argument sanity check */
   if(tban == NULL)
@@ -1774,8 +2941,16 @@ int tban_setChMode(struct TBan* tban, unsigned char modeMask) {
   sndBuf[0] = TBAN_SER_MAN;
   sndBuf[1] = modeMask;
 
+  /* The mask is shown as one mode byte per channel */
+  for(i=0; i<TBAN_NUMBER_CHANNELS; i++) {
+    refs[i].index  = TBAN_FIELD_AT(chMode, i);
+    refs[i].value  = (modeMask >> i) & 1;
+    refs[i].expect = refs[i].value;
+    refs[i].verify = TBAN_TRUE;
+  }
+
   /* Perform the command */
-  CHECK_RESULT(tban_sendCommand(tban, sndBuf, 2));
+  CHECK_RESULT(tban_sendShadowed(tban, sndBuf, 2, refs, TBAN_NUMBER_CHANNELS));
   /* Update progress */
   tban_updateProgress(tban, 1, 1);
 
@@ -1831,6 +3006,7 @@ int tban_setSensorScaleFact(struct TBan* tban, unsigned char nr, unsigned char f
  **********************************************************************/
 int tban_setLED(struct TBan* tban, unsigned char status) {
   unsigned char sndBuf[2];
+  struct TBanShadowRef ref;
 
   /* Argument sanity check */
   if(tban == NULL)
@@ -1840,7 +3016,11 @@ int tban_setLED(struct TBan* tban, unsigned char status) {
 
   /* Send the TBAN init command */
   sndBuf[0] = status == 0 ? TBAN_SER_LED_AUS : TBAN_SER_LED_EIN;
-  CHECK_RESULT(tban_sendCommand(tban, sndBuf, 1));
+  ref.index  = TBAN_LED_ENABLE;
+  ref.value  = (status != 0);
+  ref.expect = ref.value;
+  ref.verify = TBAN_TRUE;
+  CHECK_RESULT(tban_sendShadowed(tban, sndBuf, 1, &ref, 1));
   /* Update progress */
   tban_updateProgress(tban, 1, 1);
 
@@ -1858,6 +3038,7 @@ int tban_setLED(struct TBan* tban, unsigned char status) {
  **********************************************************************/
 int tban_setBuz(struct TBan* tban, unsigned char status) {
   unsigned char sndBuf[2];
+  struct TBanShadowRef ref;
 
   /* Argument sanity check */
   if(tban == NULL)
@@ -1867,7 +3048,11 @@ int tban_setBuz(struct TBan* tban, unsigned char status) {
 
   /* Send the TBAN init command */
   sndBuf[0] = status == 0 ? TBAN_SER_BUZ_AUS : TBAN_SER_BUZ_EIN;
-  CHECK_RESULT(tban_sendCommand(tban, sndBuf, 1));
+  ref.index  = TBAN_BUZ_ENABLE;
+  ref.value  = (status != 0);
+  ref.expect = ref.value;
+  ref.verify = TBAN_TRUE;
+  CHECK_RESULT(tban_sendShadowed(tban, sndBuf, 1, &ref, 1));
   /* Update progress */
   tban_updateProgress(tban, 1, 1);
 
@@ -1901,8 +3086,8 @@ int tban_getChMode(struct TBan* tban, unsigned char index, unsigned char* mode,
     return TBAN_VALUE_NULL_PTR;
 
   /* Get mode */
-  CHECK_RESULT(tban_getValue(tban, tban_getChModeMap[index], mode));
-  CHECK_RESULT(tban_getValue(tban, tban_getChStartModeMap[index], startMode));
+  CHECK_RESULT(tban_getValue(tban, TBAN_FIELD_AT(chMode, index), mode));
+  CHECK_RESULT(tban_getValue(tban, TBAN_FIELD_AT(chStartMode, index), startMode));
 
   return TBAN_OK;
 }
@@ -1932,7 +3117,7 @@ int tban_getChHysteresis(struct TBan* tban, unsigned char index, unsigned char*
     return TBAN_VALUE_NULL_PTR;
 
   /* Get Hysteresis for the selected channel  */
-  CHECK_RESULT(tban_getValue(tban, tban_getHysteresisMap[index], hysteresis));
+  CHECK_RESULT(tban_getValue(tban, TBAN_FIELD_AT(chHysteresis, index), hysteresis));
 
   return TBAN_OK;
 }
@@ -1963,8 +3148,8 @@ int tban_getChSensAssignment(struct TBan* tban, unsigned char index, unsigned ch
     return TBAN_VALUE_NULL_PTR;
 
   /* Get sensor assignment */
-  CHECK_RESULT(tban_getValue(tban, tban_getDsensorAssignMap[index], dsens));
-  CHECK_RESULT(tban_getValue(tban, tban_getAsensorAssignMap[index], asens));
+  CHECK_RESULT(tban_getValue(tban, TBAN_FIELD_AT(chDsens, index), dsens));
+  CHECK_RESULT(tban_getValue(tban, TBAN_FIELD_AT(chAsens, index), asens));
 
   return TBAN_OK;
 }
@@ -2062,6 +3247,11 @@ int tban_getMotionSettings(struct TBan* tban, unsigned char* timeConst, unsigned
  **********************************************************************/
 int tban_setMotion(struct TBan* tban, unsigned char lower, unsigned char upper, unsigned char error) {
   unsigned char sndBuf[8];
+  struct TBanShadowRef refs[3] = {
+    { TBAN_MES_CH_UP_EE,    0, 0, TBAN_TRUE },
+    { TBAN_MES_CH_GRENZ_EE, 0, 0, TBAN_TRUE },
+    { TBAN_MES_CH_DOWN_EE,  0, 0, TBAN_TRUE }
+  };
   
   /* Argument sanity check */
   if(tban == NULL)
@@ -2076,9 +3266,12 @@ int tban_setMotion(struct TBan* tban, unsigned char lower, unsigned char upper,
   sndBuf[3] = error;
   sndBuf[4] = TBAN_SER_ERR_DOWN;
   sndBuf[5] = lower;
+  refs[0].value = refs[0].expect = upper;
+  refs[1].value = refs[1].expect = error;
+  refs[2].value = refs[2].expect = lower;
 
   /* Perform the command */
-  CHECK_RESULT(tban_sendCommand(tban, sndBuf, 6));
+  CHECK_RESULT(tban_sendShadowed(tban, sndBuf, 6, refs, 3));
 
   /* Update progress */
   tban_updateProgress(tban, 1, 1);
@@ -2103,6 +3296,7 @@ int tban_setMotion(struct TBan* tban, unsigned char lower, unsigned char upper,
  **********************************************************************/
 int tban_setChSensAssignment(struct TBan* tban, unsigned char index, unsigned char dsens, unsigned char asens) {
   unsigned char sndBuf[8];
+  struct TBanShadowRef refs[2];
   
   /* Argument sanity check */
   if(tban == NULL)
@@ -2115,9 +3309,15 @@ int tban_setChSensAssignment(struct TBan* tban, unsigned char index, unsigned ch
   sndBuf[1] = dsens;
   sndBuf[2] = TBAN_SER_SET_ZUORA + index;
   sndBuf[3] = asens;
+  refs[0].index  = TBAN_FIELD_AT(chDsens, index);
+  refs[0].value  = refs[0].expect = dsens;
+  refs[0].verify = TBAN_TRUE;
+  refs[1].index  = TBAN_FIELD_AT(chAsens, index);
+  refs[1].value  = refs[1].expect = asens;
+  refs[1].verify = TBAN_TRUE;
 
   /* Perform the command */
-  CHECK_RESULT(tban_sendCommand(tban, sndBuf, 4));
+  CHECK_RESULT(tban_sendShadowed(tban, sndBuf, 4, refs, 2));
   /* Update progress */
   tban_updateProgress(tban, 1, 1);
 
@@ -2140,6 +3340,7 @@ int tban_setChSensAssignment(struct TBan* tban, unsigned char index, unsigned ch
  **********************************************************************/
 int tban_setChPwm(struct TBan* tban, unsigned char index, unsigned char pwm) {
   unsigned char sndBuf[8];
+  struct TBanShadowRef ref;
   
   /* Argument sanity check */
   if(tban == NULL)
@@ -2153,8 +3354,16 @@ int tban_setChPwm(struct TBan* tban, unsigned char index, unsigned char pwm) {
   sndBuf[0] = TBAN_SER_SET1 + index;
   sndBuf[1] = pwm;
 
+  /* The vector holds half the pwm. In automatic mode it shows what
+   * the response curve decided, not what was last set. */
+  ref.index  = TBAN_FIELD_AT(chPwm, index);
+  ref.value  = pwm;
+  ref.expect = pwm/2;
+  ref.verify = (tban->buf[TBAN_FIELD_AT(chMode, index)] != 0) &&
+    (tban->shadow.state[TBAN_FIELD_AT(chMode, index)] == TBAN_SHADOW_CLEAN);
+
   /* Perform the command */
-  CHECK_RESULT(tban_sendCommand(tban, sndBuf, 2));
+  CHECK_RESULT(tban_sendShadowed(tban, sndBuf, 2, &ref, 1));
   /* Update progress */
   tban_updateProgress(tban, 1, 1);
 
@@ -2214,6 +3423,7 @@ int tban_setChInitValue(struct TBan* tban, unsigned char index, unsigned char pw
  **********************************************************************/
 int tban_setPwmFreq(struct TBan* tban, unsigned char freq) {
   unsigned char sndBuf[8];
+  struct TBanShadowRef ref;
   
   /* Argument sanity check */
   if(tban == NULL)
@@ -2222,9 +3432,13 @@ int tban_setPwmFreq(struct TBan* tban, unsigned char freq) {
   /* Send the manual mode command */
   sndBuf[0] = TBAN_SER_FREQ;
   sndBuf[1] = freq;
+  ref.index  = TBAN_FIELD_AT(pwmFreq, 0);
+  ref.value  = freq;
+  ref.expect = freq;
+  ref.verify = TBAN_TRUE;
 
   /* Perform the command */
-  CHECK_RESULT(tban_sendCommand(tban, sndBuf, 2));
+  CHECK_RESULT(tban_sendShadowed(tban, sndBuf, 2, &ref, 1));
   /* Update progress */
   tban_updateProgress(tban, 1, 1);
 
@@ -185,6 +185,64 @@
  ** 2007-03-11 First version after release: libtban-0.7
  ** 2007-07-11 Added error messages.
  **            Added code to remove lock file when closing device.
+ ** 2026-10-17 tban_readData waits with poll() against a monotonic
+ **            millisecond deadline instead of sleeping a whole second
+ **            between SIGIO checks.
+ ** 2026-10-17 tban_readData no longer depends on SIGIO. The receive
+ **            state is kept per handle (struct TBanRx) so that many
+ **            devices can be served by one process, see tban_loop.h.
+ ** 2026-10-17 Setter commands can be collected in a batch and sent with
+ **            a few large writes (struct TBanBatch). A batch belongs to
+ **            the thread that opened it.
+ **            Added functions:
+ **            - tban_batchBegin
+ **            - tban_batchFlush
+ **            - tban_batchCommit
+ **            - tban_batchAbort
+ ** 2026-10-17 Status vectors are read frame by frame (struct
+ **            TBanFrameSpec). A read ends as soon as the frame is
+ **            complete and garbage in front of a frame is skipped
+ **            instead of failing with TBAN_CORRUPT_DATA.
+ **            Added functions:
+ **            - tban_queryPartial
+ **            - tban_configureTimeout
+ ** 2026-10-17 Optional background sampler thread (sampler.h). While it
+ **            runs the query functions return its latest snapshot
+ **            without touching the port.
+ ** 2026-10-17 Optional write-through setter cache (struct TBanShadow).
+ **            Setters skip commands that would not change anything.
+ **            Added functions:
+ **            - tban_configureWriteCache
+ ** 2026-10-17 Declarative configuration (profile.h).
+ ** 2026-10-17 Optional publication of the state in POSIX shared memory
+ **            for other processes (shm.h).
+ ** 2026-10-17 I/O counters and latency histograms per handle (struct
+ **            TBanStats).
+ **            Added functions:
+ **            - tban_getStats
+ **            - tban_resetStats
+ ** 2026-10-17 Optional recording of all vectors received to a delta
+ **            compressed segment file (recorder.h).
+ ** 2026-10-17 Bulk decoding of a whole vector into struct TBanState
+ **            (decode.h). tban_getChInfo computes the maximum rpm with
+ **            integers.
+ ** 2026-10-17 The vector positions of all channel and sensor values are
+ **            given by the field lists in fields.h. The mapping arrays
+ **            are gone, the getters use TBAN_FIELD_AT.
+ **            Added functions:
+ **            - tban_getField
+ ** 2026-10-17 Device model with an operations table per module type
+ **            (device.h). The modules are chosen once and stored in the
+ **            handle.
+ ** 2026-10-17 The device is locked with an advisory lock on the device
+ **            node instead of a pid lock file. A waiting process gets
+ **            the device as soon as it is released. The lock can be
+ **            held per transaction instead of per session
+ **            (TBAN_LOCK_TRANSACTION).
+ **            Added functions:
+ **            - tban_configureLocking
+ **            - tban_transactionBegin
+ **            - tban_transactionEnd
  **
  *****************************************************************************/
 
@@ -201,6 +259,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <pthread.h>
 
 
 #include "tban_hw_def.h"
@@ -226,6 +285,8 @@
 /* Runtime error message  */
 #define TBAN_CANNOT_MALLOC          0x40
 #define TBAN_CORRUPT_DATA           0x41
+#define TBAN_VERIFY_FAILED          0x42
+#define TBAN_NO_MORE_DATA           0x43
 
 /* File operation error messages. Check errno to see why these failed */
 #define TBAN_EOPEN                  0x50
@@ -389,6 +450,23 @@
 #define TBAN_WD_ENABLED       278 /* Code reviewed verif ok 2006-10-02 */
 
 
+/*****************************************************************************
+ * Partial status requests (tban_queryPartial). SER_REQUEST_1 returns the
+ * measured values (sensor and channel readings, index 208-255) and
+ * SER_REQUEST_2 the configuration part (index 1-207), each preceded by
+ * the usual start byte. Requires firmware 2.8 or later, older devices
+ * get a full request instead.
+ *****************************************************************************/
+#define TBAN_QUERY_FULL        0
+#define TBAN_QUERY_SENSORS     1
+#define TBAN_QUERY_CONFIG      2
+
+#define TBAN_SENSORS_FIRST   208
+#define TBAN_SENSORS_LAST    255
+#define TBAN_CONFIG_FIRST      1
+#define TBAN_CONFIG_LAST     207
+
+
 /*****************************************************************************
  * Callback function prototype to be used with tban_setProgressCb()
  * Argument 1: A pointer to data defined by the application when
@@ -400,6 +478,78 @@
 typedef void (tban_progressCb)(void*, int, int);
 
 
+/*****************************************************************************
+ * Callback function prototype called when an asynchronous receive
+ * (see tban_loop.h) has finished.
+ * Argument 1: The TBan handle the data was received on.
+ * Argument 2: TBAN_OK or the error code of the failed transfer.
+ * Argument 3: A pointer to data defined by the application when
+ *             starting the request. Passed through unaltered.
+ *****************************************************************************/
+struct TBan;
+typedef void (tban_rxCb)(struct TBan*, int, void*);
+
+
+/*****************************************************************************
+ * Description of a status frame as sent by a device. All frames start
+ * with TBAN_FRAME_START. Some frames carry additional markers at fixed
+ * positions (the miniNG TWI start/end bytes). Frames of variable length
+ * are considered complete when at least minLength bytes have arrived
+ * and the line has then been idle for idleGapMs.
+ *****************************************************************************/
+#define TBAN_FRAME_START        100
+#define TBAN_FRAME_MAX_MARKERS  2
+
+struct TBanFrameSpec {
+  int           length;     /* Max length of the frame */
+  int           minLength;  /* Shortest valid frame */
+  int           idleGapMs;  /* 0 = fixed length frame */
+  int           markers;    /* Number of markers below */
+  int           markerPos[TBAN_FRAME_MAX_MARKERS];
+  unsigned char marker[TBAN_FRAME_MAX_MARKERS];
+};
+
+
+/*****************************************************************************
+ * Receive state of one TBan handle. All receive bookkeeping lives in
+ * the handle itself so that any number of handles can be served from
+ * the same process and the same event loop.
+ *****************************************************************************/
+struct TBanRx {
+  /* Destination of the transfer in progress */
+  unsigned char* dest;
+  int            expected;
+  int            fill;
+
+  /* Framing, NULL for a plain byte transfer */
+  const struct TBanFrameSpec* spec;
+  long long      lastRx;     /* When the last byte arrived */
+  int            discarded;  /* Bytes thrown away to resynchronise */
+
+  /* Absolute deadline (monotonic clock, milliseconds) */
+  long long      deadline;
+  long long      started;    /* When the transfer began (microseconds) */
+
+  /* Set while a transfer is in progress */
+  int            pending;
+
+  /* Post processing of the received frame, run before the callback.
+   * May be NULL. */
+  int            (*finish)(struct TBan*);
+
+  /* Completion callback for asynchronous transfers. NULL when the
+   * transfer is a blocking tban_readData. */
+  tban_rxCb*     cb;
+  void*          cbPtr;
+};
+
+
+/*****************************************************************************
+ * Sizes of the status vectors kept by the library
+ *****************************************************************************/
+#define TBAN_STATUS_SIZE   285
+#define BIGNG_STATUS_SIZE  285
+#define MINI_NG_BUFSIZE    128
 
 
 /*****************************************************************************
@@ -408,7 +558,7 @@ typedef void (tban_progressCb)(void*, int, int);
 struct BigNG {
   
   /* Holds the BigNG status vector (second status vector)*/
-  unsigned char buf[285];
+  unsigned char buf[BIGNG_STATUS_SIZE];
 
   /* The time of the last query made. This can be used to decide if an
    * additional query is needed to update the local cache buffer. */
@@ -417,7 +567,7 @@ struct BigNG {
   /* Sensor names (read from the config file) */
   char* asName[BIGNG_NUMBER_ADDITIONAL_ANALOG_SENSORS];
   char* asDescr[BIGNG_NUMBER_ADDITIONAL_ANALOG_SENSORS];
-} BigNG;
+};
 
 
 /*****************************************************************************
@@ -425,10 +575,14 @@ struct BigNG {
  *****************************************************************************/
 struct MiniNG {
   /* Local cache of status data from the miniNG */
-  unsigned char buf[128];
+  unsigned char buf[MINI_NG_BUFSIZE];
   /* The time of the last query made. This can be used to decide if an
    * additional query is needed to update the local cache buffer. */
   time_t lastQuery;
+
+  /* Estimated time (ms) for a frame to pass the TBan pass-through
+   * buffer, see miniNG_passThrough */
+  int drainEstimateMs;
   
   /* Sensor names (read from the config file) */
   char* asName[MINI_NG_NUMBER_ANALOG_SENSORS];
@@ -437,7 +591,108 @@ struct MiniNG {
   /* Channel names */
   char* chName[MINI_NG_NUMBER_CHANNELS];
   char* chDesc[MINI_NG_NUMBER_CHANNELS];
-} MiniNG;
+};
+
+
+/*****************************************************************************
+ * Command batch. While a batch is open on a handle (tban_batchBegin) all
+ * commands sent by the setter functions are collected and written as
+ * few writes as possible, each write being at most as large as the
+ * serial buffer of the device (TBAN_SER_BUFFERLN). The batch is sent
+ * and closed with tban_batchCommit. The status fields can be inspected
+ * afterwards.
+ *
+ * A batch belongs to the thread that opened it. Commands sent by other
+ * threads (the sampler) bypass it, and only the owner can flush it.
+ *****************************************************************************/
+#define TBAN_BATCH_SIZE   512
+
+struct TBanBatch {
+  /* Frames queued but not yet written */
+  unsigned char buf[TBAN_BATCH_SIZE];
+  int len;
+
+  /* Status */
+  int frames;     /* Number of frames added to the batch */
+  int written;    /* Number of frames actually written */
+  int writes;     /* Number of write operations used */
+  int result;     /* TBAN_OK or the first error encountered */
+  int completed;  /* Set by tban_batchCommit/tban_batchAbort */
+
+  pthread_t owner; /* Thread that opened the batch */
+};
+
+
+/*****************************************************************************
+ * Write-through setter cache (tban_configureWriteCache). The setters
+ * compare each request against the value last written (state
+ * TBAN_SHADOW_PENDING) or, once a query has confirmed the write, against
+ * the status vector itself (TBAN_SHADOW_CLEAN) and skip the command if
+ * nothing would change. An index the vector did not confirm is marked
+ * TBAN_SHADOW_DIRTY and is always written until a query shows the
+ * expected value. There is one entry per status vector index.
+ *****************************************************************************/
+#define TBAN_SHADOW_CLEAN    0
+#define TBAN_SHADOW_PENDING  1
+#define TBAN_SHADOW_DIRTY    2
+
+struct TBanShadow {
+  int enabled;
+
+  unsigned char state[TBAN_STATUS_SIZE];
+  unsigned char value[TBAN_STATUS_SIZE];   /* Argument last written */
+  unsigned char expect[TBAN_STATUS_SIZE];  /* Vector value it results in */
+
+  /* Statistics */
+  int sent;        /* Commands written */
+  int suppressed;  /* Commands skipped since they would change nothing */
+  int mismatches;  /* Writes the following query did not confirm */
+};
+
+
+/*****************************************************************************
+ * I/O statistics of a handle, see tban_getStats. Latencies are kept in
+ * log2 histograms: bucket i counts the operations that took
+ * [2^i, 2^(i+1)) microseconds, the last bucket everything longer.
+ *****************************************************************************/
+#define TBAN_STATS_BUCKETS   24
+
+struct TBanStats {
+  unsigned long bytesSent;
+  unsigned long bytesReceived;
+  unsigned long writes;          /* write() transactions */
+  unsigned long commands[256];   /* Commands sent, by opcode */
+
+  unsigned long reads;           /* Receive transfers completed */
+  unsigned long timeouts;        /* Transfers that ran out of time */
+  unsigned long readErrors;      /* Other failed transfers */
+  unsigned long corrupt;         /* Vectors rejected as TBAN_CORRUPT_DATA */
+  unsigned long retries;         /* Repeated requests (miniNG pass-through) */
+  unsigned long discarded;       /* Bytes dropped to find a frame */
+
+  unsigned long long delayUs;    /* Time spent in command delays */
+  unsigned long delays;
+
+  unsigned long readHist[TBAN_STATS_BUCKETS];     /* Request to complete frame */
+  unsigned long commandHist[TBAN_STATS_BUCKETS];  /* Write incl. the delay */
+};
+
+
+/*****************************************************************************
+ * Device locking, see tban_configureLocking. The device is locked from
+ * tban_open to tban_close, or only during each transaction on the port.
+ *****************************************************************************/
+#define TBAN_LOCK_SESSION         0
+#define TBAN_LOCK_TRANSACTION     1
+
+
+/*****************************************************************************
+ * Modules in a setup: the base device and its add-on modules, see
+ * device.h
+ *****************************************************************************/
+#define TBAN_DEVICE_MAX_MODULES   3
+
+struct TBanDeviceOps;
 
 
 /*****************************************************************************
@@ -450,7 +705,7 @@ struct MiniNG {
 struct TBan {
   /* Port settings */
   int   port;
-  int   timeout;
+  int   timeout;     /* Receive timeout in milliseconds */
   int   baudrate;
   int   databits;
   int   stopBits;
@@ -476,6 +731,35 @@ struct TBan {
   /* BigNG data */
   struct BigNG bigNG;
   
+  /* Receive state */
+  struct TBanRx rx;
+
+  /* The open command batch (NULL if none) */
+  struct TBanBatch* batch;
+
+  /* Write-through setter cache */
+  struct TBanShadow shadow;
+
+  /* I/O statistics, updated under ioLock */
+  struct TBanStats stats;
+
+  /* Serialises all traffic on the port between the application and
+   * the sampler thread (recursive, one transaction at a time) */
+  pthread_mutex_t ioLock;
+
+  /* Background sampler (NULL if not running, see sampler.h) */
+  struct TBanSampler* sampler;
+
+  /* Shared memory publication (NULL if not published, see shm.h) */
+  struct TBanShmWriter* shm;
+
+  /* Status vector recorder (NULL if not recording, see recorder.h) */
+  struct TBanRecorder* recorder;
+
+  /* The modules of the setup, base device first (see device.h) */
+  const struct TBanDeviceOps* modules[TBAN_DEVICE_MAX_MODULES];
+  int numModules;
+
   /* Progress callback function */
   tban_progressCb* progressCb;
   void* progressCbPtr;
@@ -488,12 +772,16 @@ struct TBan {
   char* asDescr[TBAN_NUMBER_ANALOG_SENSORS];
   char* chDescr[TBAN_NUMBER_CHANNELS];
 
-  /* Lock file params */
+  /* Device lock params. The lock is an advisory lock on the device
+   * node (lockfile is only kept for compatibility). lockDepth counts
+   * the nested port transactions. */
   char* lockfile;
   int locked;
-  int lockTimeout;
+  int lockTimeoutMs;
+  int lockMode;
+  int lockDepth;
 
-} TBan;
+};
 
 
 
@@ -530,12 +818,24 @@ int tban_setProgressCb(struct TBan* tban, tban_progressCb* func, void* ptr);
 int tban_ping(struct TBan* tban, unsigned char pingmask);
 int tban_configureLockFile(struct TBan* tban, char lockfile[]);
 int tban_configureLockTimeout(struct TBan* tban, int interval);
+int tban_configureLocking(struct TBan* tban, int mode, int timeoutMs);
+int tban_transactionBegin(struct TBan* tban);
+int tban_transactionEnd(struct TBan* tban);
+int tban_configureTimeout(struct TBan* tban, int timeoutMs);
+int tban_batchBegin(struct TBan* tban, struct TBanBatch* batch);
+int tban_batchFlush(struct TBan* tban);
+int tban_batchCommit(struct TBan* tban);
+int tban_batchAbort(struct TBan* tban);
+int tban_configureWriteCache(struct TBan* tban, int enable);
+int tban_getStats(struct TBan* tban, struct TBanStats* stats);
+int tban_resetStats(struct TBan* tban);
 int tban_checkIfDeviceUsed(struct TBan* tban);
 int tban_unlock(struct TBan* tban);
 int tban_checkFw(struct TBan* tban, unsigned char fw);
 
 /* Update the local cache (Needed before any of the getters are called) */
 int tban_queryStatus(struct TBan* tban);
+int tban_queryPartial(struct TBan* tban, int part);
 
 /* Watchdog commands */
 int tban_getWatchdog(struct TBan* tban, unsigned char* wdenabled, unsigned char* wd);
@@ -0,0 +1,315 @@
+/*****************************************************************************
+ ** This program is free software; you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation; either version 2 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program; if not, write to the Free Software
+ ** Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ **
+ ** 
+ ** FILE INFORMATION
+ ** ----------------
+ ** Filename:        tban_loop.c
+ ** Initial author:  marcus.jagemar@gmail.com
+ **
+ ** 
+ ** DESCRIPTION
+ ** -----------
+ ** Implementation of the event loop, see tban_loop.h.
+ **
+ ** 
+ *****************************************************************************/
+
+#include "tban_loop.h"
+#include "common.h"
+
+/* Linux */
+#include <sys/epoll.h>
+
+
+/*****************************************************************************
+ * Max number of events fetched from the kernel per epoll_wait.
+ *****************************************************************************/
+#define TBAN_LOOP_MAX_EVENTS 32
+
+
+/**********************************************************************
+ * Name        : tbanLoop_init
+ * Description : Create a new empty event loop.
+ * Arguments   : loop = The loop to initialise.
+ * Returning   : TBAN_OK
+ *               TBAN_STRUCT_NULL_PTR
+ *               TBAN_ERROR (epoll could not be created)
+ **********************************************************************/
+int tbanLoop_init(struct TBanLoop* loop) {
+  /* Sanity check */
+  if(loop == NULL)
+    return TBAN_STRUCT_NULL_PTR;
+
+  loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+  if(loop->epfd < 0)
+    return TBAN_ERROR;
+
+  loop->handles = NULL;
+  loop->count   = 0;
+  loop->size    = 0;
+
+  return TBAN_OK;
+}
+
+
+/**********************************************************************
+ * Name        : tbanLoop_close
+ * Description : Destroy the event loop. The registered handles are not
+ *               closed, only forgotten.
+ * Arguments   : loop = The loop to destroy.
+ * Returning   : TBAN_OK
+ *               TBAN_STRUCT_NULL_PTR
+ **********************************************************************/
+int tbanLoop_close(struct TBanLoop* loop) {
+  /* Sanity check */
+  if(loop == NULL)
+    return TBAN_STRUCT_NULL_PTR;
+
+  if(loop->epfd >= 0)
+    (void) close(loop->epfd);
+  loop->epfd = -1;
+
+  free(loop->handles);
+  loop->handles = NULL;
+  loop->count   = 0;
+  loop->size    = 0;
+
+  return TBAN_OK;
+}
+
+
+/**********************************************************************
+ * Name        : tbanLoop_add
+ * Description : Register an opened TBan with the loop.
+ * Arguments   : loop = The loop to operate on.
+ *               tban = The opened TBan handle.
+ * Returning   : TBAN_OK
+ *               TBAN_STRUCT_NULL_PTR
+ *               TBAN_NOT_OPENED
+ *               TBAN_CANNOT_MALLOC
+ *               TBAN_ERROR
+ **********************************************************************/
+int tbanLoop_add(struct TBanLoop* loop, struct TBan* tban) {
+  struct epoll_event ev;
+
+  /* Sanity check */
+  if((loop == NULL) || (tban == NULL))
+    return TBAN_STRUCT_NULL_PTR;
+  if(tban->opened == 0)
+    return TBAN_NOT_OPENED;
+
+  /* Grow the handle array when needed */
+  if(loop->count == loop->size) {
+    int newSize = (loop->size == 0) ? 8 : 2*loop->size;
+    struct TBan** newHandles = realloc(loop->handles, newSize*sizeof(struct TBan*));
+    if(newHandles == NULL)
+      return TBAN_CANNOT_MALLOC;
+    loop->handles = newHandles;
+    loop->size    = newSize;
+  }
+
+  (void) memset(&ev, 0, sizeof(ev));
+  ev.events   = EPOLLIN;
+  ev.data.ptr = tban;
+  if(epoll_ctl(loop->epfd, EPOLL_CTL_ADD, tban->port, &ev) != 0)
+    return TBAN_ERROR;
+
+  loop->handles[loop->count++] = tban;
+
+  return TBAN_OK;
+}
+
+
+/**********************************************************************
+ * Name        : tbanLoop_remove
+ * Description : Unregister a TBan from the loop. A pending request is
+ *               cancelled without calling its callback.
+ * Arguments   : loop = The loop to operate on.
+ *               tban = The TBan handle.
+ * Returning   : TBAN_OK
+ *               TBAN_STRUCT_NULL_PTR
+ *               TBAN_VALUE_OUT_OF_BOUNDS (not registered)
+ **********************************************************************/
+int tbanLoop_remove(struct TBanLoop* loop, struct TBan* tban) {
+  int i;
+
+  /* Sanity check */
+  if((loop == NULL) || (tban == NULL))
+    return TBAN_STRUCT_NULL_PTR;
+
+  for(i=0; i<loop->count; i++) {
+    if(loop->handles[i] == tban) {
+      (void) epoll_ctl(loop->epfd, EPOLL_CTL_DEL, tban->port, NULL);
+      loop->handles[i] = loop->handles[--loop->count];
+      tban->rx.pending = TBAN_FALSE;
+      tban->rx.cb      = NULL;
+      return TBAN_OK;
+    }
+  }
+
+  return TBAN_VALUE_OUT_OF_BOUNDS;
+}
+
+
+/**********************************************************************
+ * Name        : tbanLoop_requestStatus
+ * Description : Ask a TBan for its status vector without waiting for
+ *               the answer. The callback is called from tbanLoop_run
+ *               when tban->buf has been refreshed, or when the request
+ *               failed. The handle timeout (tban_configureTimeout)
+ *               applies.
+ * Arguments   : loop = The loop the handle is registered with.
+ *               tban = The TBan handle.
+ *               cb   = Completion callback.
+ *               ptr  = Passed to the callback unaltered.
+ * Returning   : TBAN_OK
+ *               TBAN_STRUCT_NULL_PTR
+ *               TBAN_NOT_OPENED
+ *               TBAN_VALUE_OUT_OF_BOUNDS (not registered with the loop)
+ *               TBAN_ALREADY_IN_USE (a request is already pending)
+ *               TBAN_ESEND
+ **********************************************************************/
+int tbanLoop_requestStatus(struct TBanLoop* loop, struct TBan* tban, tban_rxCb* cb, void* ptr) {
+  int i;
+
+  /* Sanity check */
+  if((loop == NULL) || (tban == NULL))
+    return TBAN_STRUCT_NULL_PTR;
+
+  /* Only the loop the handle is registered with completes the request */
+  for(i=0; (i<loop->count) && (loop->handles[i] != tban); i++)
+    ;
+  if(i == loop->count)
+    return TBAN_VALUE_OUT_OF_BOUNDS;
+
+  return tban_queryStatusStart(tban, cb, ptr);
+}
+
+
+/**********************************************************************
+ * Name        : tbanLoop_pending
+ * Description : Count the requests not yet completed.
+ * Arguments   : loop = The loop to operate on.
+ * Returning   : Number of pending requests
+ **********************************************************************/
+int tbanLoop_pending(struct TBanLoop* loop) {
+  int i, pending = 0;
+
+  if(loop == NULL)
+    return 0;
+
+  for(i=0; i<loop->count; i++) {
+    if(loop->handles[i]->rx.pending)
+      pending++;
+  }
+  return pending;
+}
+
+
+/**********************************************************************
+ * Name        : tbanLoop_run
+ * Description : Wait for data on any of the registered handles and
+ *               feed it to their pending requests. Completed and timed
+ *               out requests get their callbacks called. Returns after
+ *               one round of events, at the latest after timeoutMs or
+ *               when the nearest request deadline has passed. A handle
+ *               whose device has hung up is no longer watched, it
+ *               stays registered.
+ * Arguments   : loop      = The loop to operate on.
+ *               timeoutMs = Max time to wait (-1 = until something
+ *                           happens).
+ * Returning   : TBAN_OK
+ *               TBAN_STRUCT_NULL_PTR
+ *               TBAN_ERROR (epoll failed)
+ **********************************************************************/
+int tbanLoop_run(struct TBanLoop* loop, int timeoutMs) {
+  struct epoll_event events[TBAN_LOOP_MAX_EVENTS];
+  long long          now, nearest;
+  int                i, n, wait;
+
+  /* Sanity check */
+  if(loop == NULL)
+    return TBAN_STRUCT_NULL_PTR;
+
+  /* Do not sleep past the nearest deadline */
+  now     = local_monotonicMs();
+  nearest = -1;
+  for(i=0; i<loop->count; i++) {
+    struct TBan* tban = loop->handles[i];
+    long long    idle;
+    if(!tban->rx.pending)
+      continue;
+    if((nearest < 0) || (tban->rx.deadline < nearest))
+      nearest = tban->rx.deadline;
+    idle = tban_rxIdleDeadline(tban);
+    if((idle >= 0) && (idle < nearest))
+      nearest = idle;
+  }
+  wait = timeoutMs;
+  if(nearest >= 0) {
+    long long left = (nearest > now) ? nearest - now : 0;
+    if((wait < 0) || (left < wait))
+      wait = (int) left;
+  }
+
+  n = epoll_wait(loop->epfd, events, TBAN_LOOP_MAX_EVENTS, wait);
+  if(n < 0) {
+    if(errno != EINTR)
+      return TBAN_ERROR;
+    n = 0;
+  }
+
+  for(i=0; i<n; i++) {
+    struct TBan* tban = events[i].data.ptr;
+    int result;
+
+    if(!tban->rx.pending) {
+      /* Unsolicited data, throw it away */
+      unsigned char junk[64];
+      while(read(tban->port, junk, sizeof(junk)) > 0)
+        ;
+      /* A device that is gone (unplugged) stays readable for ever.
+       * Stop watching it, later requests on it run into their
+       * deadline. */
+      if(events[i].events & (EPOLLERR | EPOLLHUP))
+        (void) epoll_ctl(loop->epfd, EPOLL_CTL_DEL, tban->port, NULL);
+      continue;
+    }
+
+    result = tban_rxFeed(tban);
+    if((result == TBAN_OK) && (events[i].events & (EPOLLERR | EPOLLHUP)) && tban->rx.pending)
+      result = TBAN_ERECEIVE;
+    if((result != TBAN_OK) || !tban->rx.pending)
+      (void) tban_rxComplete(tban, result);
+  }
+
+  /* Complete variable length frames after an idle gap, expire
+   * requests whose deadline has passed */
+  now = local_monotonicMs();
+  for(i=0; i<loop->count; i++) {
+    struct TBan* tban = loop->handles[i];
+    long long    idle;
+    if(!tban->rx.pending)
+      continue;
+    idle = tban_rxIdleDeadline(tban);
+    if((idle >= 0) && (idle <= now))
+      (void) tban_rxComplete(tban, TBAN_OK);
+    else if(tban->rx.deadline <= now)
+      (void) tban_rxComplete(tban, TBAN_ERECEIVE);
+  }
+
+  return TBAN_OK;
+}
@@ -0,0 +1,84 @@
+/*****************************************************************************
+ ** This program is free software; you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation; either version 2 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program; if not, write to the Free Software
+ ** Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ **
+ ** 
+ ** FILE INFORMATION
+ ** ----------------
+ ** Filename:        tban_loop.h
+ ** Initial author:  marcus.jagemar@gmail.com
+ **
+ ** 
+ ** DESCRIPTION
+ ** -----------
+ ** Event loop for driving several T-Balancers from one process. All
+ ** registered handles are multiplexed on one epoll descriptor. A status
+ ** request is started with tbanLoop_requestStatus and the loop calls
+ ** the supplied callback when the vector has arrived (or the request
+ ** timed out). Typical usage:
+ **
+ **   tbanLoop_init(&loop);
+ **   for(i=0; i<n; i++) {
+ **     tbanLoop_add(&loop, &tban[i]);
+ **     tbanLoop_requestStatus(&loop, &tban[i], statusCb, NULL);
+ **   }
+ **   while(tbanLoop_pending(&loop) > 0)
+ **     tbanLoop_run(&loop, 1000);
+ **   tbanLoop_close(&loop);
+ **
+ ** A handle must be removed from the loop before it is closed.
+ **
+ ** 
+ ** REVISION HISTORY
+ ** ----------------
+ ** 
+ ** Date        Comment
+ ** =================================================================
+ ** 2026-10-17  File created
+ **
+ *****************************************************************************/
+
+/* Muliple inclusion safeguard */
+#ifndef __TBAN_LOOP_H
+#define __TBAN_LOOP_H
+
+#include "tban.h"
+
+
+/*****************************************************************************
+ * The event loop. Treat the members as private.
+ *****************************************************************************/
+struct TBanLoop {
+  /* The epoll descriptor all handles are registered with */
+  int epfd;
+
+  /* Registered handles, needed for the timeout scan */
+  struct TBan** handles;
+  int count;
+  int size;
+};
+
+
+/*****************************************************************************
+ * Exported functions
+ *****************************************************************************/
+int tbanLoop_init(struct TBanLoop* loop);
+int tbanLoop_close(struct TBanLoop* loop);
+int tbanLoop_add(struct TBanLoop* loop, struct TBan* tban);
+int tbanLoop_remove(struct TBanLoop* loop, struct TBan* tban);
+int tbanLoop_requestStatus(struct TBanLoop* loop, struct TBan* tban, tban_rxCb* cb, void* ptr);
+int tbanLoop_pending(struct TBanLoop* loop);
+int tbanLoop_run(struct TBanLoop* loop, int timeoutMs);
+
+#endif /* __TBAN_LOOP_H */
@@ -0,0 +1,619 @@
+/*****************************************************************************
+ ** This program is free software; you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation; either version 2 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program; if not, write to the Free Software
+ ** Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ **
+ **
+ ** FILE INFORMATION
+ ** ----------------
+ ** Filename:        format.c
+ ** Initial author:  marcus.jagemar@gmail.com
+ **
+ **
+ ** DESCRIPTION
+ ** -----------
+ ** Output formatter of tbancontrol, see format.h.
+ **
+ **
+ ** REVISION HISTORY
+ ** ----------------
+ **
+ ** Date        Comment
+ ** =================================================================
+ ** 2026-10-17  File created
+ **
+ *****************************************************************************/
+
+/* Standard includes */
+#include <stdio.h>
+#include <stdio_ext.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+/* TBan library interface */
+#include "tban.h"
+
+#include "format.h"
+
+
+/*****************************************************************************
+ * Operations of a record format. key writes the separator and the name
+ * of a field, the value follows. Integers are written with intSuffix
+ * appended.
+ *****************************************************************************/
+struct FormatOps {
+  const char* name;
+  int         format;
+  const char* intSuffix;
+  void (*begin)(struct FormatOut* out, const char* measurement, const char* module,
+                const char* group, int index, const char* name);
+  void (*key)(struct FormatOut* out, const char* key);
+  void (*str)(struct FormatOut* out, const char* value);
+  void (*end)(struct FormatOut* out);
+};
+
+
+/*****************************************************************************
+ * Writing into the buffer. The put functions never write past the
+ * buffer, space for a whole record is made by format_reserve.
+ *****************************************************************************/
+static void format_put(struct FormatOut* out, const char* s, int n) {
+  if(n > FORMAT_BUF_SIZE - out->len)
+    n = FORMAT_BUF_SIZE - out->len;
+  (void) memcpy(out->buf + out->len, s, n);
+  out->len += n;
+}
+
+
+static void format_putc(struct FormatOut* out, char c) {
+  if(out->len < FORMAT_BUF_SIZE)
+    out->buf[out->len++] = c;
+}
+
+
+static void format_puts(struct FormatOut* out, const char* s) {
+  format_put(out, s, strlen(s));
+}
+
+
+/**********************************************************************
+ * Name        : format_putFixed
+ * Description : Write value / 10^decimals with the given number of
+ *               decimals, e.g. 355 with 1 decimal is 35.5.
+ * Arguments   : out      = The output
+ *               value    = The value
+ *               decimals = Number of decimals, 0 for an integer
+ * Returning   : none
+ **********************************************************************/
+static void format_putFixed(struct FormatOut* out, long long value, int decimals) {
+  char               digits[32];
+  int                n = 0;
+  int                minDigits = (decimals > 0) ? decimals + 2 : 1;
+  unsigned long long v;
+
+  if(value < 0) {
+    format_putc(out, '-');
+    v = -(unsigned long long) value;
+  } else {
+    v = value;
+  }
+
+  /* Digits backwards, at least one before the decimal point */
+  do {
+    digits[n++] = '0' + (v % 10);
+    v /= 10;
+    if(n == decimals)
+      digits[n++] = '.';
+  } while((v != 0) || (n < minDigits));
+
+  while(n > 0)
+    format_putc(out, digits[--n]);
+}
+
+
+/**********************************************************************
+ * Name        : format_putEscaped
+ * Description : Write a string, putting a backslash in front of the
+ *               characters in special.
+ * Arguments   : out     = The output
+ *               s       = The string
+ *               special = Characters to escape
+ * Returning   : none
+ **********************************************************************/
+static void format_putEscaped(struct FormatOut* out, const char* s, const char* special) {
+  for(; *s != '\0'; s++) {
+    if(strchr(special, *s) != NULL)
+      format_putc(out, '\\');
+    format_putc(out, *s);
+  }
+}
+
+
+/* Seconds with milliseconds, for the csv and json time column */
+static void format_putTime(struct FormatOut* out) {
+  format_putFixed(out, out->stampNs / 1000000, 3);
+}
+
+
+/*****************************************************************************
+ * CSV. time,measurement,module,group,index,name followed by the
+ * fields. The header line is written in front of a row whose columns
+ * differ from the last header written.
+ *****************************************************************************/
+static void csv_hdr(struct FormatOut* out, const char* column) {
+  int n = strlen(column);
+
+  if(out->hdrLen + n + 1 < FORMAT_HDR_SIZE) {
+    if(out->hdrLen != 0)
+      out->hdr[out->hdrLen++] = ',';
+    (void) memcpy(out->hdr + out->hdrLen, column, n);
+    out->hdrLen += n;
+    out->hdr[out->hdrLen] = '\0';
+  }
+}
+
+
+static void csv_str(struct FormatOut* out, const char* value) {
+  if(strpbrk(value, ",\"\r\n") == NULL) {
+    format_puts(out, value);
+    return;
+  }
+
+  /* Quoted, a quote is doubled */
+  format_putc(out, '"');
+  for(; *value != '\0'; value++) {
+    if(*value == '"')
+      format_putc(out, '"');
+    format_putc(out, *value);
+  }
+  format_putc(out, '"');
+}
+
+
+static void csv_begin(struct FormatOut* out, const char* measurement, const char* module,
+                      const char* group, int index, const char* name) {
+  out->rowStart = out->len;
+  out->hdrLen   = 0;
+  csv_hdr(out, "time");
+  csv_hdr(out, "measurement");
+  csv_hdr(out, "module");
+  csv_hdr(out, "group");
+  csv_hdr(out, "index");
+  csv_hdr(out, "name");
+
+  format_putTime(out);
+  format_putc(out, ',');
+  csv_str(out, measurement);
+  format_putc(out, ',');
+  csv_str(out, module);
+  format_putc(out, ',');
+  if(group != NULL)
+    csv_str(out, group);
+  format_putc(out, ',');
+  format_putFixed(out, index, 0);
+  format_putc(out, ',');
+  if(name != NULL)
+    csv_str(out, name);
+}
+
+
+static void csv_key(struct FormatOut* out, const char* key) {
+  csv_hdr(out, key);
+  format_putc(out, ',');
+}
+
+
+static void csv_end(struct FormatOut* out) {
+  int rowLen;
+
+  format_putc(out, '\n');
+  if((strcmp(out->hdr, out->lastHdr) == 0) ||
+     (out->len + out->hdrLen + 1 > FORMAT_BUF_SIZE))
+    return;
+
+  /* Move the row and put the header in front of it */
+  rowLen = out->len - out->rowStart;
+  (void) memmove(out->buf + out->rowStart + out->hdrLen + 1, out->buf + out->rowStart, rowLen);
+  (void) memcpy(out->buf + out->rowStart, out->hdr, out->hdrLen);
+  out->buf[out->rowStart + out->hdrLen] = '\n';
+  out->len += out->hdrLen + 1;
+  (void) memcpy(out->lastHdr, out->hdr, out->hdrLen + 1);
+}
+
+
+/*****************************************************************************
+ * JSON lines. One object per record.
+ *****************************************************************************/
+static void json_str(struct FormatOut* out, const char* value) {
+  static const char hex[] = "0123456789abcdef";
+
+  format_putc(out, '"');
+  for(; *value != '\0'; value++) {
+    unsigned char c = *value;
+    if((c == '"') || (c == '\\')) {
+      format_putc(out, '\\');
+      format_putc(out, c);
+    } else if(c < 0x20) {
+      format_puts(out, "\\u00");
+      format_putc(out, hex[c >> 4]);
+      format_putc(out, hex[c & 0x0f]);
+    } else {
+      format_putc(out, c);
+    }
+  }
+  format_putc(out, '"');
+}
+
+
+static void json_key(struct FormatOut* out, const char* key) {
+  format_putc(out, ',');
+  json_str(out, key);
+  format_putc(out, ':');
+}
+
+
+static void json_begin(struct FormatOut* out, const char* measurement, const char* module,
+                       const char* group, int index, const char* name) {
+  format_puts(out, "{\"time\":");
+  format_putTime(out);
+  json_key(out, "measurement");
+  json_str(out, measurement);
+  json_key(out, "module");
+  json_str(out, module);
+  if(group != NULL) {
+    json_key(out, "group");
+    json_str(out, group);
+  }
+  json_key(out, "index");
+  format_putFixed(out, index, 0);
+  if(name != NULL) {
+    json_key(out, "name");
+    json_str(out, name);
+  }
+}
+
+
+static void json_end(struct FormatOut* out) {
+  format_puts(out, "}\n");
+}
+
+
+/*****************************************************************************
+ * InfluxDB line protocol. The module, group, index and name are tags,
+ * the time stamp is in nanoseconds.
+ *****************************************************************************/
+static void influx_tag(struct FormatOut* out, const char* key, const char* value) {
+  /* An empty tag value is not allowed */
+  if((value == NULL) || (value[0] == '\0'))
+    return;
+  format_putc(out, ',');
+  format_puts(out, key);
+  format_putc(out, '=');
+  format_putEscaped(out, value, ",= ");
+}
+
+
+static void influx_begin(struct FormatOut* out, const char* measurement, const char* module,
+                         const char* group, int index, const char* name) {
+  format_putEscaped(out, measurement, ", ");
+  influx_tag(out, "module", module);
+  influx_tag(out, "group", group);
+  format_puts(out, ",index=");
+  format_putFixed(out, index, 0);
+  influx_tag(out, "name", name);
+}
+
+
+static void influx_key(struct FormatOut* out, const char* key) {
+  format_putc(out, (out->fields == 0) ? ' ' : ',');
+  format_putEscaped(out, key, ",= ");
+  format_putc(out, '=');
+}
+
+
+static void influx_str(struct FormatOut* out, const char* value) {
+  format_putc(out, '"');
+  format_putEscaped(out, value, "\"\\");
+  format_putc(out, '"');
+}
+
+
+static void influx_end(struct FormatOut* out) {
+  format_putc(out, ' ');
+  format_putFixed(out, out->stampNs, 0);
+  format_putc(out, '\n');
+}
+
+
+/*****************************************************************************
+ * The formats by name
+ *****************************************************************************/
+static const struct FormatOps format_opsCsv = {
+  "csv", XBAN_FORMAT_CSV, "", csv_begin, csv_key, csv_str, csv_end
+};
+
+static const struct FormatOps format_opsJson = {
+  "json", XBAN_FORMAT_JSON, "", json_begin, json_key, json_str, json_end
+};
+
+static const struct FormatOps format_opsInflux = {
+  "influx", XBAN_FORMAT_INFLUX, "i", influx_begin, influx_key, influx_str, influx_end
+};
+
+static const struct FormatOps* format_ops[] = {
+  &format_opsCsv,
+  &format_opsJson,
+  &format_opsInflux,
+  NULL
+};
+
+
+/**********************************************************************
+ * Name        : format_reserve
+ * Description : Make room for n bytes. Text already printed on stdout
+ *               is written first so the output stays in order.
+ * Arguments   : out = The output
+ *               n   = Bytes needed
+ * Returning   : none
+ **********************************************************************/
+static void format_reserve(struct FormatOut* out, int n) {
+  if((out->fd == STDOUT_FILENO) && (__fpending(stdout) != 0))
+    (void) fflush(stdout);
+  if(FORMAT_BUF_SIZE - out->len < n)
+    (void) format_flush(out);
+}
+
+
+/**********************************************************************
+ * Name        : format_init
+ * Description : Set up an empty output.
+ * Arguments   : out    = The output
+ *               fd     = Where format_flush writes
+ *               format = XBAN_FORMAT_*
+ * Returning   : none
+ **********************************************************************/
+void format_init(struct FormatOut* out, int fd, int format) {
+  (void) memset(out, 0, offsetof(struct FormatOut, buf));
+  out->fd     = fd;
+  out->textFd = -1;
+  format_select(out, format);
+}
+
+
+/**********************************************************************
+ * Name        : format_byName
+ * Description : Look up a format by its name.
+ * Arguments   : name = std, gnuplot, csv, json or influx
+ * Returning   : XBAN_FORMAT_* or -1 if unknown
+ **********************************************************************/
+int format_byName(const char* name) {
+  int i;
+
+  if(strcmp(name, "std") == 0)
+    return XBAN_FORMAT_STD;
+  if(strcmp(name, "gnuplot") == 0)
+    return XBAN_FORMAT_GNUPLOT;
+  for(i=0; format_ops[i] != NULL; i++) {
+    if(strcmp(format_ops[i]->name, name) == 0)
+      return format_ops[i]->format;
+  }
+  return -1;
+}
+
+
+/**********************************************************************
+ * Name        : format_select
+ * Description : Change the format. A new CSV header is written before
+ *               the next row. When the output is stdout, anything else
+ *               printed to stdout goes to stderr while a record format
+ *               is selected.
+ * Arguments   : out    = The output
+ *               format = XBAN_FORMAT_*
+ * Returning   : none
+ **********************************************************************/
+void format_select(struct FormatOut* out, int format) {
+  int i;
+
+  /* Keep stdout to the formatter, the records must not be mixed with
+   * free text printed by stdio */
+  if(XBAN_FORMAT_RECORD(format) && (out->fd == STDOUT_FILENO)) {
+    (void) fflush(stdout);
+    out->textFd = dup(STDOUT_FILENO);
+    if(out->textFd >= 0) {
+      out->fd = out->textFd;
+      (void) dup2(STDERR_FILENO, STDOUT_FILENO);
+    }
+  } else if(!XBAN_FORMAT_RECORD(format) && (out->textFd >= 0)) {
+    (void) fflush(stdout);
+    (void) dup2(out->textFd, STDOUT_FILENO);
+    (void) close(out->textFd);
+    out->fd     = STDOUT_FILENO;
+    out->textFd = -1;
+  }
+
+  out->format     = format;
+  out->ops        = NULL;
+  out->lastHdr[0] = '\0';
+  for(i=0; format_ops[i] != NULL; i++) {
+    if(format_ops[i]->format == format)
+      out->ops = format_ops[i];
+  }
+}
+
+
+/**********************************************************************
+ * Name        : format_printf
+ * Description : Free text output, for the std and gnuplot formats.
+ *               Text longer than the buffer is cut.
+ * Arguments   : out = The output
+ *               fmt = printf format
+ * Returning   : none
+ **********************************************************************/
+void format_printf(struct FormatOut* out, const char* fmt, ...) {
+  va_list args;
+  int     room, n;
+
+  format_reserve(out, 0);
+
+  room = FORMAT_BUF_SIZE - out->len;
+  va_start(args, fmt);
+  n = vsnprintf(out->buf + out->len, room, fmt, args);
+  va_end(args);
+  if(n < 0)
+    return;
+
+  if((n >= room) && (out->len != 0)) {
+    (void) format_flush(out);
+    room = FORMAT_BUF_SIZE;
+    va_start(args, fmt);
+    n = vsnprintf(out->buf, room, fmt, args);
+    va_end(args);
+  }
+  out->len += (n < room) ? n : room - 1;
+}
+
+
+/**********************************************************************
+ * Name        : format_recordBegin
+ * Description : Start a record. The time stamp is taken at the first
+ *               record after a flush. Ignored by std and gnuplot.
+ * Arguments   : out         = The output
+ *               measurement = What the record is about (channel,
+ *                             sensor, raw)
+ *               module      = Module name, e.g. TBan
+ *               group       = Sensor group or NULL
+ *               index       = Index within the module or group
+ *               name        = Name or NULL
+ * Returning   : none
+ **********************************************************************/
+void format_recordBegin(struct FormatOut* out, const char* measurement, const char* module,
+                        const char* group, int index, const char* name) {
+  struct timespec ts;
+
+  if(out->ops == NULL)
+    return;
+
+  format_reserve(out, FORMAT_RECORD_MAX);
+  if(out->stampNs == 0) {
+    (void) clock_gettime(CLOCK_REALTIME, &ts);
+    out->stampNs = ((long long) ts.tv_sec)*1000000000 + ts.tv_nsec;
+  }
+  out->fields = 0;
+  out->ops->begin(out, measurement, module, group, index, name);
+}
+
+
+/**********************************************************************
+ * Name        : format_fieldInt
+ * Description : Add an integer field to the record.
+ * Arguments   : out   = The output
+ *               key   = Field name
+ *               value = The value
+ * Returning   : none
+ **********************************************************************/
+void format_fieldInt(struct FormatOut* out, const char* key, long value) {
+  if(out->ops == NULL)
+    return;
+  out->ops->key(out, key);
+  format_putFixed(out, value, 0);
+  format_puts(out, out->ops->intSuffix);
+  out->fields++;
+}
+
+
+/**********************************************************************
+ * Name        : format_fieldFixed
+ * Description : Add a fixed point field, value / 10^decimals. Written
+ *               as a float in all formats.
+ * Arguments   : out      = The output
+ *               key      = Field name
+ *               value    = The value, scaled
+ *               decimals = Number of decimals (>0)
+ * Returning   : none
+ **********************************************************************/
+void format_fieldFixed(struct FormatOut* out, const char* key, long value, int decimals) {
+  if(out->ops == NULL)
+    return;
+  out->ops->key(out, key);
+  format_putFixed(out, value, decimals);
+  out->fields++;
+}
+
+
+/**********************************************************************
+ * Name        : format_fieldStr
+ * Description : Add a string field to the record.
+ * Arguments   : out   = The output
+ *               key   = Field name
+ *               value = The value
+ * Returning   : none
+ **********************************************************************/
+void format_fieldStr(struct FormatOut* out, const char* key, const char* value) {
+  if(out->ops == NULL)
+    return;
+  out->ops->key(out, key);
+  out->ops->str(out, value);
+  out->fields++;
+}
+
+
+/**********************************************************************
+ * Name        : format_recordEnd
+ * Description : End the record.
+ * Arguments   : out = The output
+ * Returning   : none
+ **********************************************************************/
+void format_recordEnd(struct FormatOut* out) {
+  if(out->ops == NULL)
+    return;
+  out->ops->end(out);
+}
+
+
+/**********************************************************************
+ * Name        : format_flush
+ * Description : Write the buffer with one write() (more only if the
+ *               write is cut short) and start a new sample.
+ * Arguments   : out = The output
+ * Returning   : TBAN_OK
+ *               TBAN_ESEND
+ **********************************************************************/
+int format_flush(struct FormatOut* out) {
+  int     done = 0;
+  ssize_t n;
+
+  out->stampNs = 0;
+  if(out->len == 0)
+    return TBAN_OK;
+
+  if(out->fd == STDOUT_FILENO)
+    (void) fflush(stdout);
+
+  while(done < out->len) {
+    n = write(out->fd, out->buf + done, out->len - done);
+    if(n < 0) {
+      if(errno == EINTR)
+        continue;
+      out->len = 0;
+      return TBAN_ESEND;
+    }
+    done += n;
+  }
+  out->len = 0;
+
+  return TBAN_OK;
+}
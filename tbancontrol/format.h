@@ -0,0 +1,121 @@
+/*****************************************************************************
+ ** This program is free software; you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation; either version 2 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program; if not, write to the Free Software
+ ** Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ **
+ **
+ ** FILE INFORMATION
+ ** ----------------
+ ** Filename:        format.h
+ ** Initial author:  marcus.jagemar@gmail.com
+ **
+ **
+ ** DESCRIPTION
+ ** -----------
+ ** Output formatter of tbancontrol. Everything a command prints about
+ ** channels and sensors is collected in one output buffer that is
+ ** reused for the whole run and written with a single write() when
+ ** the command (or a monitor sample) is done.
+ **
+ ** The std and gnuplot formats are free text (format_printf). The
+ ** record formats (csv, json lines, influx line protocol) are written
+ ** one record at a time:
+ **
+ **   format_recordBegin  measurement and tags (module, group, index, name)
+ **   format_fieldInt     an integer field
+ **   format_fieldFixed   a fixed point field, e.g. a temperature
+ **   format_fieldStr     a string field
+ **   format_recordEnd    end of the record
+ **
+ ** Each record format has its own operations table, numbers are
+ ** converted without printf. All records of one sample get the same
+ ** time stamp. While a record format is selected stdio's stdout is
+ ** pointed at stderr, so messages and the text of other commands do
+ ** not end up between the records.
+ **
+ **
+ ** REVISION HISTORY
+ ** ----------------
+ **
+ ** Date        Comment
+ ** =================================================================
+ ** 2026-10-17  File created
+ **
+ *****************************************************************************/
+
+/* Muliple inclusion safeguard */
+#ifndef __FORMAT_H
+#define __FORMAT_H
+
+
+/*****************************************************************************
+ * Output formats. The _HEADER variants are only used as print modes of
+ * the print functions in tbancontrol.c.
+ *****************************************************************************/
+#define XBAN_FORMAT_STD            0
+#define XBAN_FORMAT_STD_HEADER     1
+#define XBAN_FORMAT_GNUPLOT        2
+#define XBAN_FORMAT_GNUPLOT_HEADER 3
+#define XBAN_FORMAT_CSV            4
+#define XBAN_FORMAT_JSON           5
+#define XBAN_FORMAT_INFLUX         6
+
+/* True for the formats written with format_recordBegin.. */
+#define XBAN_FORMAT_RECORD(f)      ((f) >= XBAN_FORMAT_CSV)
+
+/*****************************************************************************
+ * Sizes. A record (and a CSV header) is always given FORMAT_RECORD_MAX
+ * bytes, the buffer is written out early if it has less room left.
+ *****************************************************************************/
+#define FORMAT_BUF_SIZE            65536
+#define FORMAT_RECORD_MAX          2048
+#define FORMAT_HDR_SIZE            512
+
+struct FormatOps;
+
+struct FormatOut {
+  int                     fd;
+  int                     textFd;       /* stdout while stdio goes to stderr, -1 */
+  int                     format;       /* XBAN_FORMAT_* */
+  const struct FormatOps* ops;          /* NULL for std and gnuplot */
+  long long               stampNs;      /* Time of the sample, 0 = not taken */
+  int                     len;
+  int                     fields;       /* Fields in the current record */
+
+  /* CSV: The header is written again when the columns change */
+  int                     rowStart;
+  int                     hdrLen;
+  char                    hdr[FORMAT_HDR_SIZE];
+  char                    lastHdr[FORMAT_HDR_SIZE];
+
+  char                    buf[FORMAT_BUF_SIZE];
+};
+
+
+/*****************************************************************************
+ * Function declarations
+ *****************************************************************************/
+void format_init(struct FormatOut* out, int fd, int format);
+int  format_byName(const char* name);
+void format_select(struct FormatOut* out, int format);
+void format_printf(struct FormatOut* out, const char* fmt, ...)
+  __attribute__ ((format (printf, 2, 3)));
+void format_recordBegin(struct FormatOut* out, const char* measurement, const char* module,
+                        const char* group, int index, const char* name);
+void format_fieldInt(struct FormatOut* out, const char* key, long value);
+void format_fieldFixed(struct FormatOut* out, const char* key, long value, int decimals);
+void format_fieldStr(struct FormatOut* out, const char* key, const char* value);
+void format_recordEnd(struct FormatOut* out);
+int  format_flush(struct FormatOut* out);
+
+#endif
@@ -150,6 +150,30 @@
  **            - settacho
  **            - scaling factor
  ** 2007-03-11 First version after release: tbancontrol-0.7
+ ** 2026-10-17 Added commands
+ **            - stats, resetstats (I/O statistics of libtban)
+ **            - history (query the status vector recording, see
+ **              recorder.h)
+ **            - fleet (many devices on one event loop, see fleet.h)
+ **            getallch and getallsens enumerate the channels and
+ **            sensors through the device model (device.h)
+ **            - locking (lock the device per session or per
+ **              transaction, timeout in ms). The device node itself
+ **              is locked, lockfile has no effect any more.
+ **            - script (run commands from a file or stdin against one
+ **              opened device)
+ **            - maxage (status vectors are re-read only when a command
+ **              needs them and they are stale)
+ **            - monitor (fixed rate sampling on absolute deadlines)
+ **            iterate re-reads the status vectors on each pass
+ **            - statefile (cache of the device topology)
+ **            The device is no longer probed when it is opened. Each
+ **            command reads the vectors it needs, the miniNG presence
+ **            is cached per device. Failed queries are retried after
+ **            50 ms, doubling up to 1 s, instead of 5 s.
+ **            - format (std, gnuplot, csv, json, influx). Channel and
+ **              sensor output is collected in one buffer (format.h)
+ **              and written once per command or monitor sample.
  ** 
  *****************************************************************************/
 
@@ -170,6 +194,13 @@
 #include "tban.h"
 #include "mini_ng.h"
 #include "big_ng.h"
+#include "recorder.h"
+#include "device.h"
+#include "fleet.h"
+#include "sampler.h"
+
+/* Output formatter */
+#include "format.h"
 
 
 #define BIGNG_DEVICE_NOT_FOUND  -99
@@ -187,12 +218,10 @@
 /**********************************************************************/
 
 /*****************************************************************************
- * Output format
+ * Output of the print functions, written once per command or monitor
+ * sample (see format.h)
  *****************************************************************************/
-#define XBAN_FORMAT_STD            0
-#define XBAN_FORMAT_STD_HEADER     1
-#define XBAN_FORMAT_GNUPLOT        2
-#define XBAN_FORMAT_GNUPLOT_HEADER 3
+static struct FormatOut output;
 
 /* Use a global timer to time stamp some commands */
 static time_t startTime;
@@ -202,6 +231,127 @@ static time_t startTime;
  *****************************************************************************/
 int nrRetries    = 3;
 int verbose      = 0;
+int pretendmode  = 0;
+int printformat  = 0;
+
+/* Select if watchdog should be used or not */
+int watchdogmode = 0;
+
+
+/*****************************************************************************
+ * Session state. The command line and all script lines run against the
+ * same opened device. vectorTime is when each status vector (index
+ * 0..2 = TBAN_SAMPLE_TBAN, _BIGNG, _MINING) was read, 0 when stale.
+ *****************************************************************************/
+#define SESSION_MAX_SCRIPT_DEPTH  8
+#define SESSION_MAX_LINE          1024
+#define SESSION_MAX_WORDS         128
+
+static int       maxAgeMs    = 1000;
+static long long vectorTime[3];
+static int       scriptDepth = 0;
+
+/* Set while a monitor runs, Ctrl-C then ends the monitor */
+static int                   monitorActive = 0;
+static volatile sig_atomic_t monitorStop   = 0;
+
+/* Failed queries are retried after 50, 100, 200.. ms */
+#define SESSION_RETRY_FIRST_MS    50
+#define SESSION_RETRY_MAX_MS      1000
+
+
+/*****************************************************************************
+ * Topology of the opened device. Nothing is probed when the device is
+ * opened, the vectors are read when the first command needs them. The
+ * miniNG presence (which costs a whole read timeout to find out when
+ * there is none) is cached per device in a state file, keyed by the
+ * series numbers, hardware type and firmware version of the first TBan
+ * vector.
+ *****************************************************************************/
+#define TOPO_STATE_FILE     ".tban.state"
+#define TOPO_MAX_LINE       512
+#define TOPO_MAX_ENTRIES    64
+#define TOPO_UNKNOWN        -1
+
+struct Topology {
+  unsigned char ser1;
+  unsigned char ser2;
+  unsigned char type;
+  unsigned char ver;
+  int           bigNG;
+  int           miniNG;    /* 0, 1 or TOPO_UNKNOWN */
+};
+
+static char*           stateFile      = NULL;
+static struct Topology topology       = { 0, 0, 0, 0, 0, TOPO_UNKNOWN };
+static struct Topology topologyCache;
+static int             topologyCached = 0;  /* topologyCache holds an entry */
+static int             topologyKnown  = 0;  /* topology has the identity */
+static int             topologyMatch  = 0;  /* ..and it matches the cache */
+
+
+/*****************************************************************************
+ * The status vectors read by a command and if it changes the device.
+ * Commands not listed neither read nor write the device.
+ *****************************************************************************/
+#define VEC_TBAN    TBAN_SAMPLE_TBAN
+#define VEC_BIGNG   TBAN_SAMPLE_BIGNG
+#define VEC_MINING  TBAN_SAMPLE_MINING
+#define VEC_ALL     (VEC_TBAN | VEC_BIGNG | VEC_MINING)
+
+struct SessionCmd {
+  char* name;
+  int   vectors;
+  int   writes;
+};
+
+static const struct SessionCmd sessionCmds[] = {
+  { "gethwinfo",       VEC_ALL,               0 },
+  { "getstat",         VEC_TBAN,              0 },
+  { "getindex",        VEC_TBAN,              0 },
+  { "getallch",        VEC_ALL,               0 },
+  { "getds",           VEC_TBAN,              0 },
+  { "getas",           VEC_TBAN,              0 },
+  { "getallsens",      VEC_ALL,               0 },
+  { "getch",           VEC_TBAN,              0 },
+  { "getchhyst",       VEC_TBAN,              0 },
+  { "getchsens",       VEC_TBAN | VEC_BIGNG,  0 },
+  { "getchcurve",      VEC_TBAN,              0 },
+  { "getchmode",       VEC_TBAN,              0 },
+  { "getpwmfreq",      VEC_TBAN,              0 },
+  { "bgetoutmode",     VEC_TBAN | VEC_BIGNG,  0 },
+  { "bgetas",          VEC_TBAN | VEC_BIGNG,  0 },
+  { "bgetds",          VEC_TBAN | VEC_BIGNG,  0 },
+  { "bgetch",          VEC_TBAN | VEC_BIGNG,  0 },
+  { "bgetstat",        VEC_TBAN | VEC_BIGNG,  0 },
+  { "mgetstat",        VEC_MINING,            0 },
+  { "mgetch",          VEC_MINING,            0 },
+  { "mgetchcurve",     VEC_MINING,            0 },
+  { "mgetchhyst",      VEC_MINING,            0 },
+  { "resethw",         0,                     1 },
+  { "ping",            0,                     1 },
+  { "setchmode",       0,                     1 },
+  { "setchpwm",        0,                     1 },
+  { "setchinitpwm",    0,                     1 },
+  { "setchsens",       0,                     1 },
+  { "setpwmfreq",      0,                     1 },
+  { "setscfact",       0,                     1 },
+  { "setbuz",          0,                     1 },
+  { "setchhyst",       0,                     1 },
+  { "setmotion",       0,                     1 },
+  { "setled",          0,                     1 },
+  { "setchcurve",      0,                     1 },
+  { "settacho",        0,                     1 },
+  { "bsetoutmode",     0,                     1 },
+  { "bsetchsens",      0,                     1 },
+  { "bsetscfactas",    0,                     1 },
+  { "bsettargetmode",  0,                     1 },
+  { "bsettargettemp",  0,                     1 },
+  { "bsetabsscfactas", 0,                     1 },
+  { "bsetabsscfactds", 0,                     1 },
+  { "msetchcurve",     0,                     1 },
+  { NULL,              0,                     0 }
+};
 
 
 /*****************************************************************************
@@ -214,6 +364,7 @@ struct TBan* tban;
  * Function declarations
  *****************************************************************************/
 static void closeDevice();
+static void runCommands(int argc, char* argv[]);
 
 
 /**********************************************************************
@@ -244,6 +395,20 @@ static void local_nanosleep(long sec, long nano) {
 }
 
 
+/**********************************************************************
+ * Name        : monotonicMs
+ * Description : Read the monotonic clock.
+ * Arguments   : none
+ * Returning   : Milliseconds since some unspecified starting point
+ **********************************************************************/
+static long long monotonicMs(void) {
+  struct timespec now;
+
+  (void) clock_gettime(CLOCK_MONOTONIC, &now);
+  return ((long long) now.tv_sec)*1000 + now.tv_nsec/1000000;
+}
+
+
 /**********************************************************************
  * Name        : readWord
  * Description : Read one word (until reaching a selected stopChar)
@@ -392,14 +557,28 @@ static int parseCmdArgumentUC(char argv[], unsigned char* v) {
 }
 
 
-void print_numerical_data(unsigned char* thedata, int count) {
+/**********************************************************************
+ * Name        : print_numerical_data
+ * Description : Dump a status vector, one byte per line (one record
+ *               per byte in the record formats).
+ * Arguments   : module    = Module the vector belongs to
+ *               thedata   = The vector
+ *               count     = Number of bytes
+ *               printmode = XBAN_FORMAT_*
+ * Returning   : -
+ **********************************************************************/
+void print_numerical_data(const char* module, unsigned char* thedata, int count, int printmode) {
   unsigned char In1;
   int           i;
-  char          message[20000];
   for (i=0; i< count; i++) {
     In1 = thedata[i];
-    sprintf(message,"%3i - 0x%02x  %3u ", i, In1, In1);
-    printf("%s\n", message);
+    if(XBAN_FORMAT_RECORD(printmode)) {
+      format_recordBegin(&output, "raw", module, NULL, i, NULL);
+      format_fieldInt(&output, "value", In1);
+      format_recordEnd(&output);
+    } else {
+      format_printf(&output, "%3i - 0x%02x  %3u \n", i, In1, In1);
+    }
   }
 }
 
@@ -442,6 +621,7 @@ void print_numerical_data(unsigned char* thedata, int count) {
                                  result=COMMAND; \
                                  while((result!=TBAN_OK) && (__retryCounter<nrRetries)) { \
                                    VERBOSE(printf("Retry command (%d/%d)\n", __retryCounter, nrRetries)); \
+                                   tban->stats.retries++; \
                                    result = COMMAND; \
                                    __retryCounter++; \
                                  } \
@@ -467,49 +647,61 @@ void print_numerical_data(unsigned char* thedata, int count) {
  *               the console. First call to this function could use the
  *               XBAN_FORMAT_STD_HEADER parameter to print the
  *               header. Subsequent calls use the XBAN_FORMAT_STD
- *               printmode for formatted output.
+ *               printmode for formatted output. The record formats
+ *               write one sensor record per call.
  * Arguments   : 
  * Returning   : 
  **********************************************************************/
 static int printSensorInfo(char* sensorName, int printmode, 
 			   unsigned char index, unsigned char temp,
-                           unsigned char rawTemp, unsigned char cal)  {
+                           unsigned char rawTemp, unsigned char cal,
+                           const char* module, const char* group)  {
   /* Print the result */
   switch(printmode) {
       case XBAN_FORMAT_STD_HEADER:
-        printf("%s\n", sensorName);
-        printf("%-2s %-12s %10s %11s %11s\n",
-               "#",
-               "Name",
-               "Raw temp",
-               "Cal fact",
-               "Temp");
+        format_printf(&output, "%s\n%-2s %-12s %10s %11s %11s\n",
+                      sensorName,
+                      "#",
+                      "Name",
+                      "Raw temp",
+                      "Cal fact",
+                      "Temp");
         break;
 
       case XBAN_FORMAT_STD:
-        printf("%-2d %-12s %10.1f  %10.2f  %10.1f\n",
-               index,
-               sensorName,
-               (float) rawTemp / 2.0,
-               (float) cal / 100.0,
-               (float) temp / 2.0);
+        format_printf(&output, "%-2d %-12s %10.1f  %10.2f  %10.1f\n",
+                      index,
+                      sensorName,
+                      (float) rawTemp / 2.0,
+                      (float) cal / 100.0,
+                      (float) temp / 2.0);
         break;
 
       case XBAN_FORMAT_GNUPLOT_HEADER: {
-        struct tm* localTime;
         time_t tt;
         tt = time(NULL);
-        localTime = localtime(&tt);
-        printf("%d", (int) tt);
+        format_printf(&output, "%d", (int) tt);
         break;
       }
 
       case XBAN_FORMAT_GNUPLOT: {
-        printf(" %.1f", (float)temp/2.0);
+        format_printf(&output, " %.1f", (float)temp/2.0);
         break;
       }
+
+      case XBAN_FORMAT_CSV:
+      case XBAN_FORMAT_JSON:
+      case XBAN_FORMAT_INFLUX:
+        /* Half degrees and hundredths as fixed point */
+        format_recordBegin(&output, "sensor", module, group, index, sensorName);
+        format_fieldFixed(&output, "raw_temp", rawTemp * 5, 1);
+        format_fieldFixed(&output, "cal", cal, 2);
+        format_fieldFixed(&output, "temp", temp * 5, 1);
+        format_recordEnd(&output);
+        break;
+
       default:
-        printf("Unknown format\n");
+        format_printf(&output, "Unknown format\n");
   }
 }
 
@@ -520,52 +712,64 @@ static int printSensorInfo(char* sensorName, int printmode,
  *               the console. First call to this function could use the
  *               XBAN_FORMAT_STD_HEADER parameter to print the
  *               header. Subsequent calls use the XBAN_FORMAT_STD
- *               printmode for formatted output.
+ *               printmode for formatted output. The record formats
+ *               write one sensor record per call.
  * Arguments   : 
  * Returning   : 
  **********************************************************************/
 static int printSensorInfobigNG(char* sensorName, int printmode, 
 				unsigned char index, unsigned char temp,
 				unsigned char rawTemp, unsigned char cal, 
-				unsigned char abscal) {
+				unsigned char abscal,
+                                const char* module, const char* group) {
   /* Print the result */
   switch(printmode) {
       case XBAN_FORMAT_STD_HEADER:
-        printf("%s\n", sensorName);
-        printf("%-2s %-12s %10s %11s %11s %10s\n",
-               "#",
-               "Name",
-               "Raw temp",
-               "Cal fact",
-	       "Abs fact",
-               "Temp");
+        format_printf(&output, "%s\n%-2s %-12s %10s %11s %11s %10s\n",
+                      sensorName,
+                      "#",
+                      "Name",
+                      "Raw temp",
+                      "Cal fact",
+                      "Abs fact",
+                      "Temp");
         break;
 
       case XBAN_FORMAT_STD:
-        printf("%-2d %-12s %10.1f  %10.2f  %10.1f %10.1f\n",
-               index,
-               sensorName,
-               (float) rawTemp / 2.0,
-               (float) cal / 100.0,
-	       (float) (1.*abscal-100.0)/2.,
-               (float) temp / 2.0);
+        format_printf(&output, "%-2d %-12s %10.1f  %10.2f  %10.1f %10.1f\n",
+                      index,
+                      sensorName,
+                      (float) rawTemp / 2.0,
+                      (float) cal / 100.0,
+                      (float) (1.*abscal-100.0)/2.,
+                      (float) temp / 2.0);
         break;
 
       case XBAN_FORMAT_GNUPLOT_HEADER: {
-        struct tm* localTime;
         time_t tt;
         tt = time(NULL);
-        localTime = localtime(&tt);
-        printf("%d", (int) tt);
+        format_printf(&output, "%d", (int) tt);
         break;
       }
 
       case XBAN_FORMAT_GNUPLOT: {
-        printf(" %.1f", (float)temp/2.0);
+        format_printf(&output, " %.1f", (float)temp/2.0);
         break;
       }
+
+      case XBAN_FORMAT_CSV:
+      case XBAN_FORMAT_JSON:
+      case XBAN_FORMAT_INFLUX:
+        format_recordBegin(&output, "sensor", module, group, index, sensorName);
+        format_fieldFixed(&output, "raw_temp", rawTemp * 5, 1);
+        format_fieldFixed(&output, "cal", cal, 2);
+        format_fieldFixed(&output, "abs_cal", (abscal - 100) * 5, 1);
+        format_fieldFixed(&output, "temp", temp * 5, 1);
+        format_recordEnd(&output);
+        break;
+
       default:
-        printf("Unknown format\n");
+        format_printf(&output, "Unknown format\n");
   }
 }
 
@@ -705,8 +909,9 @@ static int cmdPrintStatusCont(struct TBan* tban, int index) {
 
 
 /**********************************************************************
- * Name        : 
- * Description : 
+ * Name        : printChannelInfo
+ * Description : Print one channel. Works like printSensorInfo, the
+ *               record formats write one channel record per call.
  * Arguments   : 
  * Returning   : 
  **********************************************************************/
@@ -714,76 +919,97 @@ static int printChannelInfo(struct TBan* tban, int printmode, int index,
 			    char* channelName, unsigned int rpmMax, 
 			    unsigned char pwm, unsigned char mode,
                             unsigned char temp, unsigned char target,
-			    unsigned char targetmode, TBan_deviceType device) {
+			    unsigned char targetmode, TBan_deviceType device,
+                            const char* module) {
   unsigned int rpm;
   switch(printmode) {
 
       case XBAN_FORMAT_STD_HEADER: {
-        printf("%s\n", channelName);
-        printf("%-2s %12s %10s %10s %10s %10s %10s",
-               "#",
-               "Name",
-               "RPM",
-               "Max-RPM",
-               "PWM",
-               "temp",
-               "Mode");
+        format_printf(&output, "%s\n%-2s %12s %10s %10s %10s %10s %10s",
+                      channelName,
+                      "#",
+                      "Name",
+                      "RPM",
+                      "Max-RPM",
+                      "PWM",
+                      "temp",
+                      "Mode");
         /* BigNG specific stuff */
         if(device == TBAN_DEVICE_TYPE_BIGNG) {
-          printf("%12s %10s %13s", 
-		 "Outputmode",
-		 "Target",
-		 "Targetmode");
+          format_printf(&output, "%12s %10s %13s", 
+                        "Outputmode",
+                        "Target",
+                        "Targetmode");
 	}
 
-        printf("\n");
+        format_printf(&output, "\n");
         break;
       }
         
       case XBAN_FORMAT_STD: {
         rpm = (int) ( (float) rpmMax * (float) pwm / 100.0);
-        printf("%-2d %12s %10d %10d %10d %10.1f %10s",
-               index,
-               channelName,
-               rpm,
-               rpmMax,
-               pwm,
-               (float)temp/2.0,
-               mode==0?"auto":"manual");
+        format_printf(&output, "%-2d %12s %10d %10d %10d %10.1f %10s",
+                      index,
+                      channelName,
+                      rpm,
+                      rpmMax,
+                      pwm,
+                      (float)temp/2.0,
+                      mode==0?"auto":"manual");
         /* BigNG specific stuff */
         if(device == TBAN_DEVICE_TYPE_BIGNG) {
           int result;
           unsigned char outmode[4];
           result = bigNG_getOutputMode(tban, outmode);
-          printf("%12s %10.1f %13d",
-                 outmode[index]==BIGNG_OUTPUT_MODE_ANALOG ? "analog" :
-                 outmode[index]==BIGNG_OUTPUT_MODE_PWM ? "PWM" : "unknown",
-		 (float)target/2.0,
-		 targetmode);
+          format_printf(&output, "%12s %10.1f %13d",
+                        outmode[index]==BIGNG_OUTPUT_MODE_ANALOG ? "analog" :
+                        outmode[index]==BIGNG_OUTPUT_MODE_PWM ? "PWM" : "unknown",
+                        (float)target/2.0,
+                        targetmode);
         }
-        printf("\n");
+        format_printf(&output, "\n");
         break;
       } /* case */
 
 
       case XBAN_FORMAT_GNUPLOT_HEADER: {
-        time_t currentTime;
-        struct tm* localTime;
         time_t tt;
         tt = time(NULL);
-        localTime = localtime(&tt);
-        printf("%d ", (int) tt);
+        format_printf(&output, "%d ", (int) tt);
         break;
       }
   
       case XBAN_FORMAT_GNUPLOT: {
         rpm = (int) ( (float) rpmMax * (float) pwm / 100.0);
-        printf("%d %d %d %.1f ", rpm, rpmMax, pwm, (float)temp/2.0);
+        format_printf(&output, "%d %d %d %.1f ", rpm, rpmMax, pwm, (float)temp/2.0);
 	if(device == TBAN_DEVICE_TYPE_BIGNG) {
-	  printf("%.1f",(float)target/2.0);
+	  format_printf(&output, "%.1f",(float)target/2.0);
 	}
         break;
       } /* case */
+
+      case XBAN_FORMAT_CSV:
+      case XBAN_FORMAT_JSON:
+      case XBAN_FORMAT_INFLUX: {
+        rpm = (int) ( (float) rpmMax * (float) pwm / 100.0);
+        format_recordBegin(&output, "channel", module, NULL, index, channelName);
+        format_fieldInt(&output, "rpm", rpm);
+        format_fieldInt(&output, "rpm_max", rpmMax);
+        format_fieldInt(&output, "pwm", pwm);
+        format_fieldFixed(&output, "temp", temp * 5, 1);
+        format_fieldStr(&output, "mode", mode==0?"auto":"manual");
+        if(device == TBAN_DEVICE_TYPE_BIGNG) {
+          unsigned char outmode[4];
+          if(bigNG_getOutputMode(tban, outmode) == TBAN_OK)
+            format_fieldStr(&output, "output_mode",
+                            outmode[index]==BIGNG_OUTPUT_MODE_ANALOG ? "analog" :
+                            outmode[index]==BIGNG_OUTPUT_MODE_PWM ? "PWM" : "unknown");
+          format_fieldFixed(&output, "target", target * 5, 1);
+          format_fieldInt(&output, "target_mode", targetmode);
+        }
+        format_recordEnd(&output);
+        break;
+      } /* case */
   } /* switch */
 }
 
@@ -795,59 +1021,37 @@ static int printChannelInfo(struct TBan* tban, int printmode, int index,
  * Returning   : 
  **********************************************************************/
 static int cmdPrintAllChInfo(struct TBan* tban, int printmode) {
-  int           j;
-  unsigned char pwm, temp;
-  unsigned char mode;
-  unsigned int  rpm, rpmMax;
-  unsigned char bigngPresent;
-  unsigned char target, targetmode;
+  struct TBanChannel          ch[TBAN_DEVICE_MAX_CHANNELS];
+  const struct TBanDeviceOps* module = NULL;
+  TBan_deviceType             device;
+  int                         count, j;
 
-  /* */
-  bigngPresent = bigNG_present(tban);
+  /* All channels of the setup, module by module */
+  CHECK_RESULT(tban_deviceChannels(tban, ch, TBAN_DEVICE_MAX_CHANNELS, &count), "tban_deviceChannels");
 
-  /* Print header (if possible) */
-  switch(printmode) {
-      case XBAN_FORMAT_STD :
-        printChannelInfo(tban, XBAN_FORMAT_STD_HEADER, 
-			 0, bigngPresent==BIGNG_PRESENT ? "BigNG channels" : "TBan channels",
-                         0, 0, 0, 0, 0, 0,
-                         bigngPresent==BIGNG_PRESENT ? TBAN_DEVICE_TYPE_BIGNG : TBAN_NO_DEVICE);
-        break;
-      case XBAN_FORMAT_GNUPLOT :
-        printChannelInfo(tban, XBAN_FORMAT_GNUPLOT_HEADER, 0, 0, 0, 0, 0, 
-			 0, 0, 0, -1);
-        break;
+  if(printmode == XBAN_FORMAT_GNUPLOT) {
+    printChannelInfo(tban, XBAN_FORMAT_GNUPLOT_HEADER, 0, 0, 0, 0, 0, 
+                     0, 0, 0, -1, NULL);
   }
 
-  /* TBan standard channels */
-  for(j=0; j<TBAN_NUMBER_CHANNELS; j++) {
-    if(bigngPresent==BIGNG_PRESENT) {
-      CHECK_RESULT(bigNG_getChInfo(tban, j, &rpmMax, &pwm, &temp, &mode, &target, &targetmode), "bigNGgetChInfo");
-      printChannelInfo(tban, printmode, j, tban->chName[j], rpmMax, pwm, mode, temp, target, targetmode, bigngPresent==BIGNG_PRESENT ? TBAN_DEVICE_TYPE_BIGNG : TBAN_DEVICE_TYPE_TBAN);
-    } else {
-      CHECK_RESULT(tban_getChInfo(tban, j, &rpmMax, &pwm, &temp, &mode), "tban_getChInfo");    
-      printChannelInfo(tban, printmode, j, tban->chName[j], rpmMax, pwm, mode, temp, 0, 0, bigngPresent==BIGNG_PRESENT ? TBAN_DEVICE_TYPE_BIGNG : TBAN_DEVICE_TYPE_TBAN);
-    }
-  } /* for */
+  for(j=0; j<count; j++) {
+    device = (ch[j].flags & TBAN_CH_TARGET) ? TBAN_DEVICE_TYPE_BIGNG : TBAN_DEVICE_TYPE_TBAN;
 
-  /* miniNG specific channels */
-  if(miniNG_present(tban)) {
-    unsigned char temp, calTemp, cal;
-    if(printmode == XBAN_FORMAT_STD) {
-      printChannelInfo(tban, XBAN_FORMAT_STD_HEADER, 0, "miniNG channels", 0, 0, 0,0, 0, 0, TBAN_NO_DEVICE);
+    /* Print a header for each module */
+    if((ch[j].module != module) && (printmode == XBAN_FORMAT_STD)) {
+      printChannelInfo(tban, XBAN_FORMAT_STD_HEADER, 0, (char*) ch[j].module->channelTitle,
+                       0, 0, 0, 0, 0, 0, device, NULL);
     }
+    module = ch[j].module;
 
-    for(j=0; j<MINI_NG_NUMBER_CHANNELS; j++) {
-      CHECK_RESULT(miniNG_getChRpm(tban, j, (unsigned char*) &rpm, (unsigned char*) &rpmMax), "miniNG_getChRpm");
-      CHECK_RESULT(miniNG_getaSensorTemp(tban, j, &temp, &calTemp, &cal), "miniNG_getaSensorTemp");
-      pwm = (unsigned char) (100.0 * (float) rpm / (float) rpmMax);
-      printChannelInfo(tban, printmode, j, tban->miniNG.chName[j], rpmMax, pwm, 0, temp, 0, 0, TBAN_NO_DEVICE);
-    }
+    printChannelInfo(tban, printmode, ch[j].index, (char*) ch[j].name, ch[j].rpmMax, ch[j].pwm,
+                     ch[j].mode, ch[j].temp, ch[j].target, ch[j].targetMode, device,
+                     ch[j].module->name);
   }
   
   /* Print footer if needed */
   if(printmode == XBAN_FORMAT_GNUPLOT) {
-    printf("\n");
+    format_printf(&output, "\n");
   }
 
   return TBAN_OK;
@@ -869,26 +1073,30 @@ static int cmdPrintChInfo(struct TBan* tban, int channel, int printmode) {
   rpm = (int) ( (float) rpmMax * (float) pwm / 100.0);
   switch(printmode) {
       case XBAN_FORMAT_STD:
-        printf("Ch%d (%s) : %d/%d rpm  pwm=%d temp=%.1f C (%d=%s) \n",
-               channel,
-               tban->chName[channel],
-               rpm,
-               rpmMax,
-               pwm,
-               (float)temp/2.0,
-               mode,
-               mode==0?"A":"M");
+        format_printf(&output, "Ch%d (%s) : %d/%d rpm  pwm=%d temp=%.1f C (%d=%s) \n",
+                      channel,
+                      tban->chName[channel],
+                      rpm,
+                      rpmMax,
+                      pwm,
+                      (float)temp/2.0,
+                      mode,
+                      mode==0?"A":"M");
         break;
       case XBAN_FORMAT_GNUPLOT: {
-        struct tm* localTime;
         time_t tt;
         tt = time(NULL);
-        localTime = localtime(&tt);
-        printf("%d %d %d %d %.1f\n", (int) tt, rpm, rpmMax, pwm, (float)temp/2.0);
+        format_printf(&output, "%d %d %d %d %.1f\n", (int) tt, rpm, rpmMax, pwm, (float)temp/2.0);
         break;
       }
+      case XBAN_FORMAT_CSV:
+      case XBAN_FORMAT_JSON:
+      case XBAN_FORMAT_INFLUX:
+        printChannelInfo(tban, printmode, channel, tban->chName[channel], rpmMax, pwm,
+                         mode, temp, 0, 0, TBAN_DEVICE_TYPE_TBAN, "TBan");
+        break;
       default:
-        printf("Unknown format\n");
+        format_printf(&output, "Unknown format\n");
   }
 
   return TBAN_OK;
@@ -914,28 +1122,32 @@ static int cmdPrintBigNGChInfo(struct TBan* tban, int channel, int printmode) {
   rpm = (int) ( (float) rpmMax * (float) pwm / 100.0);
   switch(printmode) {
       case XBAN_FORMAT_STD:
-        printf("Ch%d (%s) : %d/%d rpm  pwm=%d temp=%.1f C (%d=%s) tar=%.1f tarmode=%d \n",
-               channel,
-               tban->chName[channel],
-               rpm,
-               rpmMax,
-               pwm,
-               (float)temp/2.0,
-               mode,
-               mode==0?"A":"M",
-	       (float)target/2.0,
-	       targetmode);
+        format_printf(&output, "Ch%d (%s) : %d/%d rpm  pwm=%d temp=%.1f C (%d=%s) tar=%.1f tarmode=%d \n",
+                      channel,
+                      tban->chName[channel],
+                      rpm,
+                      rpmMax,
+                      pwm,
+                      (float)temp/2.0,
+                      mode,
+                      mode==0?"A":"M",
+                      (float)target/2.0,
+                      targetmode);
         break;
       case XBAN_FORMAT_GNUPLOT: {
-        struct tm* localTime;
         time_t tt;
         tt = time(NULL);
-        localTime = localtime(&tt);
-        printf("%d %d %d %d %.1f %.1f\n", (int) tt, rpm, rpmMax, pwm, (float)temp/2.0, (float)target/2.);
+        format_printf(&output, "%d %d %d %d %.1f %.1f\n", (int) tt, rpm, rpmMax, pwm, (float)temp/2.0, (float)target/2.);
         break;
       }
+      case XBAN_FORMAT_CSV:
+      case XBAN_FORMAT_JSON:
+      case XBAN_FORMAT_INFLUX:
+        printChannelInfo(tban, printmode, channel, tban->chName[channel], rpmMax, pwm,
+                         mode, temp, target, targetmode, TBAN_DEVICE_TYPE_BIGNG, "BigNG");
+        break;
       default:
-        printf("Unknown format\n");
+        format_printf(&output, "Unknown format\n");
   }
 
   return TBAN_OK;
@@ -950,18 +1162,26 @@ static int cmdPrintMiniNGChInfo(struct TBan* tban, int channel, int printmode) {
   CHECK_RESULT(miniNG_getChRpm(tban, channel, &rpm, &maxRpm), "miniNG_getChRpm");
   switch(printmode) {
       case XBAN_FORMAT_STD:
-        printf("Ch %d : %d/%d temp=%.1f C ; Calibrated temp=%.1f C\n", channel, rpm, maxRpm, (float)temp/2.0, (float)calTemp/2.0);
+        format_printf(&output, "Ch %d : %d/%d temp=%.1f C ; Calibrated temp=%.1f C\n", channel, rpm, maxRpm, (float)temp/2.0, (float)calTemp/2.0);
         break;
       case XBAN_FORMAT_GNUPLOT: {
-        struct tm* localTime;
         time_t tt;
         tt = time(NULL);
-        localTime = localtime(&tt);
-        printf("%d %d %d %.1f %.1f\n", (int) tt, rpm, maxRpm, (float)temp/2.0, (float)calTemp/2.0);
+        format_printf(&output, "%d %d %d %.1f %.1f\n", (int) tt, rpm, maxRpm, (float)temp/2.0, (float)calTemp/2.0);
         break;
       }
+      case XBAN_FORMAT_CSV:
+      case XBAN_FORMAT_JSON:
+      case XBAN_FORMAT_INFLUX:
+        format_recordBegin(&output, "channel", "miniNG", NULL, channel, tban->miniNG.chName[channel]);
+        format_fieldInt(&output, "rpm", rpm);
+        format_fieldInt(&output, "rpm_max", maxRpm);
+        format_fieldFixed(&output, "temp", temp * 5, 1);
+        format_fieldFixed(&output, "cal_temp", calTemp * 5, 1);
+        format_recordEnd(&output);
+        break;
       default:
-        printf("Unknown format\n");
+        format_printf(&output, "Unknown format\n");
   }
 
   return TBAN_OK;
@@ -1081,8 +1301,10 @@ static int cmdPrintDsInfo(struct TBan* tban, int index, int printmode) {
   CHECK_RESULT(tban_getdSensorTemp(tban, index, &temp, &rawTemp, &cal), "tban_getdSensorTemp");
 
   /* Print header and then data */
-  printSensorInfo("TBan standard digital sensor", XBAN_FORMAT_STD_HEADER, 0, 0, 0, 0);
-  printSensorInfo(tban->dsName[index], printmode, index, temp, rawTemp, cal);
+  if(!XBAN_FORMAT_RECORD(printmode))
+    printSensorInfo("TBan standard digital sensor", XBAN_FORMAT_STD_HEADER, 0, 0, 0, 0, NULL, NULL);
+  printSensorInfo(tban->dsName[index], printmode, index, temp, rawTemp, cal,
+                  "TBan", "TBan standard digital sensors");
 
   return TBAN_OK;
 }
@@ -1101,8 +1323,10 @@ static int cmdPrintAsInfo(struct TBan* tban, int index, int printmode) {
   CHECK_RESULT(tban_getaSensorTemp(tban, index, &temp, &rawTemp, &cal), "tban_getaSensorTemp");
 
   /* Print header and then data */
-  printSensorInfo("TBan standard analog sensor", XBAN_FORMAT_STD_HEADER, 0, 0, 0, 0);
-  printSensorInfo(tban->asName[index], printmode, index, temp, rawTemp, cal);
+  if(!XBAN_FORMAT_RECORD(printmode))
+    printSensorInfo("TBan standard analog sensor", XBAN_FORMAT_STD_HEADER, 0, 0, 0, 0, NULL, NULL);
+  printSensorInfo(tban->asName[index], printmode, index, temp, rawTemp, cal,
+                  "TBan", "TBan standard analog sensors");
 
   return TBAN_OK;
 }
@@ -1121,8 +1345,10 @@ static int cmdPrintAsInfoBigNG(struct TBan* tban, int index, int printmode) {
   CHECK_RESULT(bigNG_getaSensorTemp(tban, index, &temp, &rawTemp, &cal, &abscal), "bigNG_getaSensorTemp");
   
   /* Print header and then data */
-  printSensorInfobigNG("BigNG additional analog sensor", XBAN_FORMAT_STD_HEADER, 0, 0, 0, 0, 0);
-  printSensorInfobigNG(tban->bigNG.asName[index], printmode, index, temp, rawTemp, cal, abscal);
+  if(!XBAN_FORMAT_RECORD(printmode))
+    printSensorInfobigNG("BigNG additional analog sensor", XBAN_FORMAT_STD_HEADER, 0, 0, 0, 0, 0, NULL, NULL);
+  printSensorInfobigNG(tban->bigNG.asName[index], printmode, index, temp, rawTemp, cal, abscal,
+                       "BigNG", "BigNG analog sensors");
 
   return TBAN_OK;
 }
@@ -1140,8 +1366,10 @@ static int cmdPrintDsInfoBigNG(struct TBan* tban, int index, int printmode) {
   CHECK_RESULT(bigNG_getdSensorTemp(tban, index, &temp, &rawTemp, &cal, &abscal), "bigNG_getdSensorTemp");
   
   /* Print header and then data */
-  printSensorInfobigNG("BigNG digital sensor", XBAN_FORMAT_STD_HEADER, 0, 0, 0, 0, 0);
-  printSensorInfobigNG(tban->dsName[index], printmode, index, temp, rawTemp, cal, abscal);
+  if(!XBAN_FORMAT_RECORD(printmode))
+    printSensorInfobigNG("BigNG digital sensor", XBAN_FORMAT_STD_HEADER, 0, 0, 0, 0, 0, NULL, NULL);
+  printSensorInfobigNG(tban->dsName[index], printmode, index, temp, rawTemp, cal, abscal,
+                       "BigNG", "BigNG digital sensors");
 
   return TBAN_OK;
 }
@@ -1153,48 +1381,33 @@ static int cmdPrintDsInfoBigNG(struct TBan* tban, int index, int printmode) {
  * Returning   : 
  **********************************************************************/
 static int cmdPrintAllSensors(struct TBan* tban, int printmode) {
-  unsigned char temp, rawTemp, cal, abscal;
-  int i;
+  struct TBanSensor sensor[TBAN_DEVICE_MAX_SENSORS];
+  const char*       group = NULL;
+  char              title[64];
+  int               count, i;
 
-  /* TBan generic analog sensors */
-  printSensorInfo("TBan standard analog sensors:", XBAN_FORMAT_STD_HEADER, 0, 0, 0, 0);
-  for(i=0; i<TBAN_NUMBER_ANALOG_SENSORS; i++) {
-    CHECK_RESULT(tban_getaSensorTemp(tban, i, &temp, &rawTemp, &cal), "tban_getaSensorTemp");
-    printSensorInfo(tban->asName[i], printmode, i, temp, rawTemp, cal);
-  }
-
-  if(!bigNG_present(tban)){
-    /* TBan digital sensors */
-    printSensorInfo("TBan standard digital sensors:", XBAN_FORMAT_STD_HEADER, 0, 0, 0, 0);
-    for(i=0; i<TBAN_NUMBER_DIGITAL_SENSORS; i++) {
-      CHECK_RESULT(tban_getdSensorTemp(tban, i, &temp, &rawTemp, &cal), "tban_getdSensorTemp");
-      printSensorInfo(tban->dsName[i], printmode, i, temp, rawTemp, cal);
-    }
-  }else{
-    /* BigNG digital sensors */
+  /* All sensors of the setup, group by group */
+  CHECK_RESULT(tban_deviceSensors(tban, sensor, TBAN_DEVICE_MAX_SENSORS, &count), "tban_deviceSensors");
 
-    printSensorInfobigNG("BigNG digital sensors:", XBAN_FORMAT_STD_HEADER, 0, 0, 0, 0, 0);
-    for(i=0; i<TBAN_NUMBER_DIGITAL_SENSORS; i++) {
-      CHECK_RESULT(bigNG_getdSensorTemp(tban, i, &temp, &rawTemp, &cal, &abscal), "bigNG_getdSensorTemp");
-      printSensorInfobigNG(tban->dsName[i], printmode, i, temp, rawTemp, cal, abscal);
-    }
-    
-    /* BigNG analog sensors */
-    
-    printSensorInfobigNG("BigNG analog sensors:", XBAN_FORMAT_STD_HEADER, 0, 0, 0, 0, 0);
-    for(i=0; i<BIGNG_NUMBER_ADDITIONAL_ANALOG_SENSORS; i++) {
-      CHECK_RESULT(bigNG_getaSensorTemp(tban, i,&temp, &rawTemp, &cal, &abscal), "bigNG_getaSensorTemp");
-      printSensorInfobigNG(tban->bigNG.asName[i], printmode, i, temp, rawTemp, cal, abscal);
-    }
-  }
+  for(i=0; i<count; i++) {
+    struct TBanSensor* s = &sensor[i];
 
-  /* MiniNG specific sensors */
-  if(miniNG_present(tban)) {
-    printSensorInfo("MiniNG analog sensors:", XBAN_FORMAT_STD_HEADER, 0, 0, 0, 0);
-    for(i=0; i<MINI_NG_NUMBER_ANALOG_SENSORS; i++) {
-      CHECK_RESULT(miniNG_getaSensorTemp(tban, i,&temp, &rawTemp, &cal), "miniNG_getaSensorTemp");
-      printSensorInfo(tban->miniNG.asName[i], printmode, i, temp, rawTemp, cal);
+    if(s->flags & TBAN_SENSOR_ABSCAL) {
+      if((s->group != group) && !XBAN_FORMAT_RECORD(printmode)) {
+        (void) snprintf(title, sizeof(title), "%s:", s->group);
+        printSensorInfobigNG(title, XBAN_FORMAT_STD_HEADER, 0, 0, 0, 0, 0, NULL, NULL);
+      }
+      printSensorInfobigNG((char*) s->name, printmode, s->index, s->temp, s->rawTemp, s->cal, s->absCal,
+                           s->module->name, s->group);
+    } else {
+      if((s->group != group) && !XBAN_FORMAT_RECORD(printmode)) {
+        (void) snprintf(title, sizeof(title), "%s:", s->group);
+        printSensorInfo(title, XBAN_FORMAT_STD_HEADER, 0, 0, 0, 0, NULL, NULL);
+      }
+      printSensorInfo((char*) s->name, printmode, s->index, s->temp, s->rawTemp, s->cal,
+                      s->module->name, s->group);
     }
+    group = s->group;
   }
 
   return TBAN_OK;
@@ -1228,6 +1441,466 @@ static int cmdPrintRespCurve(struct TBan* tban, unsigned char ch) {
 }
 
 
+/**********************************************************************
+ * Name        : printLatencyHist
+ * Description : Print the non-empty buckets of a latency histogram and
+ *               the buckets holding the median and the 99th percentile.
+ * Arguments   : title = Heading
+ *               hist  = The histogram (log2 microseconds)
+ * Returning   : -
+ **********************************************************************/
+static void printLatencyHist(char* title, unsigned long hist[]) {
+  unsigned long total = 0, sum = 0;
+  int           j, p50 = -1, p99 = -1;
+
+  for(j=0; j<TBAN_STATS_BUCKETS; j++)
+    total += hist[j];
+
+  printf("%s (us), %lu samples\n", title, total);
+  for(j=0; j<TBAN_STATS_BUCKETS; j++) {
+    if(hist[j] == 0)
+      continue;
+    sum += hist[j];
+    if((p50 < 0) && (2*sum >= total))
+      p50 = j;
+    if((p99 < 0) && (100*sum >= 99*total))
+      p99 = j;
+    if(j == TBAN_STATS_BUCKETS-1)
+      printf("  >= %-8lu        : %lu\n", 1UL << j, hist[j]);
+    else
+      printf("  %8lu - %-8lu : %lu\n", (j == 0) ? 0UL : 1UL << j, 1UL << (j+1), hist[j]);
+  }
+  if(total > 0)
+    printf("  p50 < %lu us, p99 < %lu us\n", 1UL << (p50+1), 1UL << (p99+1));
+}
+
+
+/**********************************************************************
+ * Name        : cmdPrintStats
+ * Description : Print the I/O statistics collected by libtban since
+ *               the device was opened (or the last resetstats).
+ * Arguments   : tban = The TBan struct
+ * Returning   : TBAN_OK
+ **********************************************************************/
+static int cmdPrintStats(struct TBan* tban) {
+  struct TBanStats stats;
+  unsigned long    commands = 0;
+  int              j;
+
+  CHECK_RESULT(tban_getStats(tban, &stats), "tban_getStats");
+
+  for(j=0; j<256; j++)
+    commands += stats.commands[j];
+
+  printf("I/O statistics\n");
+  printf("Bytes sent       : %lu\n", stats.bytesSent);
+  printf("Bytes received   : %lu\n", stats.bytesReceived);
+  printf("Writes           : %lu (%lu commands)\n", stats.writes, commands);
+  printf("Reads            : %lu\n", stats.reads);
+  printf("Timeouts         : %lu\n", stats.timeouts);
+  printf("Read errors      : %lu\n", stats.readErrors);
+  printf("Corrupt vectors  : %lu\n", stats.corrupt);
+  printf("Retries          : %lu\n", stats.retries);
+  printf("Discarded bytes  : %lu\n", stats.discarded);
+  printf("Command delays   : %lu (%.1f ms)\n", stats.delays, stats.delayUs/1000.0);
+
+  printf("Commands by opcode\n");
+  for(j=0; j<256; j++) {
+    if(stats.commands[j] != 0)
+      printf("  0x%02x : %lu\n", j, stats.commands[j]);
+  }
+
+  printLatencyHist("Query latency", stats.readHist);
+  printLatencyHist("Command latency", stats.commandHist);
+
+  return TBAN_OK;
+}
+
+
+
+
+
+/*****************************************************************************
+ * A value selected with the history command
+ *****************************************************************************/
+#define HISTORY_MAX_ITEMS   32
+
+#define HISTORY_CH_PWM      0   /* TBan channel */
+#define HISTORY_CH_TEMP     1
+#define HISTORY_CH_RPM      2
+#define HISTORY_DS          3   /* TBan digital sensor */
+#define HISTORY_AS          4   /* TBan analog sensor */
+#define HISTORY_MCH_RPM     5   /* miniNG channel */
+#define HISTORY_MCH_TEMP    6
+
+struct HistoryItem {
+  char   label[48];
+  int    kind;
+  int    index;
+  int    known;     /* A value has been decoded */
+  double value;     /* Latest value */
+  double min, max, sum;
+  long   count;     /* Samples in the current bucket */
+};
+
+
+/**********************************************************************
+ * Name        : historyParseTime
+ * Description : Parse a time argument of the history command: seconds
+ *               since the epoch, "now" or a negative number of seconds
+ *               relative to now.
+ * Arguments   : arg = The argument
+ *               ms  = The time, ms since the epoch
+ * Returning   : TBAN_OK / TBAN_VALUE_OUT_OF_BOUNDS
+ **********************************************************************/
+static int historyParseTime(char arg[], long long* ms) {
+  char* end;
+  long  v;
+
+  if(strcmp(arg, "now") == 0) {
+    *ms = ((long long) time(NULL))*1000;
+    return TBAN_OK;
+  }
+  v = strtol(arg, &end, 0);
+  if((*arg == '\0') || (*end != '\0'))
+    return TBAN_VALUE_OUT_OF_BOUNDS;
+  if(v <= 0)
+    v += time(NULL);
+  *ms = ((long long) v)*1000;
+
+  return TBAN_OK;
+}
+
+
+/**********************************************************************
+ * Name        : historyAddItem
+ * Description : Look up a channel or sensor by the name given in
+ *               .tban.conf (or the default name). A channel gives its
+ *               pwm, add ":temp" or ":rpm" for the other values.
+ * Arguments   : items = The item list
+ *               count = Number of items, increased
+ *               name  = The name
+ * Returning   : TBAN_OK / TBAN_VALUE_OUT_OF_BOUNDS (unknown name)
+ **********************************************************************/
+static int historyAddItem(struct HistoryItem items[], int* count, char name[]) {
+  struct HistoryItem* item;
+  char  base[48];
+  char* field;
+  int   j;
+
+  if(*count >= HISTORY_MAX_ITEMS)
+    return TBAN_VALUE_OUT_OF_BOUNDS;
+  item = &items[*count];
+  (void) memset(item, 0, sizeof(*item));
+  (void) snprintf(item->label, sizeof(item->label), "%s", name);
+  (void) snprintf(base, sizeof(base), "%s", name);
+  field = strchr(base, ':');
+  if(field != NULL)
+    *field++ = '\0';
+
+  item->kind = -1;
+  for(j=0; (j<TBAN_NUMBER_CHANNELS) && (item->kind < 0); j++) {
+    if(strcmp(base, tban->chName[j]) == 0) {
+      item->kind = (field == NULL)                ? HISTORY_CH_PWM  :
+                   (strcmp(field, "temp") == 0)   ? HISTORY_CH_TEMP :
+                   (strcmp(field, "rpm") == 0)    ? HISTORY_CH_RPM  :
+                   (strcmp(field, "pwm") == 0)    ? HISTORY_CH_PWM  : -2;
+      item->index = j;
+    }
+  }
+  for(j=0; (j<TBAN_NUMBER_DIGITAL_SENSORS) && (item->kind == -1); j++) {
+    if(strcmp(base, tban->dsName[j]) == 0) {
+      item->kind  = HISTORY_DS;
+      item->index = j;
+    }
+  }
+  for(j=0; (j<TBAN_NUMBER_ANALOG_SENSORS) && (item->kind == -1); j++) {
+    if(strcmp(base, tban->asName[j]) == 0) {
+      item->kind  = HISTORY_AS;
+      item->index = j;
+    }
+  }
+  for(j=0; (j<MINI_NG_NUMBER_CHANNELS) && (item->kind == -1); j++) {
+    if(strcmp(base, tban->miniNG.chName[j]) == 0) {
+      item->kind  = ((field != NULL) && (strcmp(field, "temp") == 0)) ? HISTORY_MCH_TEMP : HISTORY_MCH_RPM;
+      item->index = j;
+    }
+  }
+  for(j=0; (j<MINI_NG_NUMBER_ANALOG_SENSORS) && (item->kind == -1); j++) {
+    if(strcmp(base, tban->miniNG.asName[j]) == 0) {
+      item->kind  = HISTORY_MCH_TEMP;
+      item->index = j;
+    }
+  }
+  if(item->kind < 0)
+    return TBAN_VALUE_OUT_OF_BOUNDS;
+
+  (*count)++;
+  return TBAN_OK;
+}
+
+
+/**********************************************************************
+ * Name        : historyDecode
+ * Description : Decode the selected values from a replayed vector. The
+ *               ordinary getters are used on a handle that only refers
+ *               to the vector.
+ * Arguments   : view   = Handle used for decoding
+ *               items  = The item list
+ *               count  = Number of items
+ *               source = TBAN_SAMPLE_* of the vector
+ * Returning   : -
+ **********************************************************************/
+static void historyDecode(struct TBan* view, struct HistoryItem items[], int count, int source) {
+  unsigned int  rpmMax;
+  unsigned char pwm, temp, mode, raw, cal, rpm;
+  int j, result;
+
+  for(j=0; j<count; j++) {
+    struct HistoryItem* item = &items[j];
+
+    result = -1;
+    if(source == TBAN_SAMPLE_TBAN) {
+      switch(item->kind) {
+        case HISTORY_CH_PWM:
+        case HISTORY_CH_TEMP:
+        case HISTORY_CH_RPM:
+          result = tban_getChInfo(view, item->index, &rpmMax, &pwm, &temp, &mode);
+          item->value = (item->kind == HISTORY_CH_PWM)  ? pwm :
+                        (item->kind == HISTORY_CH_TEMP) ? temp/2.0 :
+                        (double) rpmMax * pwm / 100.0;
+          break;
+        case HISTORY_DS:
+          result = tban_getdSensorTemp(view, item->index, &temp, &raw, &cal);
+          item->value = temp/2.0;
+          break;
+        case HISTORY_AS:
+          result = tban_getaSensorTemp(view, item->index, &temp, &raw, &cal);
+          item->value = temp/2.0;
+          break;
+      }
+    } else if(source == TBAN_SAMPLE_MINING) {
+      switch(item->kind) {
+        case HISTORY_MCH_RPM:
+          result = miniNG_getChRpm(view, item->index, &rpm, &pwm);
+          item->value = rpm;
+          break;
+        case HISTORY_MCH_TEMP:
+          result = miniNG_getaSensorTemp(view, item->index, &temp, &raw, &cal);
+          item->value = temp/2.0;
+          break;
+      }
+    }
+    if(result != TBAN_OK)
+      continue;
+
+    if((item->count == 0) || (item->value < item->min))
+      item->min = item->value;
+    if((item->count == 0) || (item->value > item->max))
+      item->max = item->value;
+    item->sum += item->value;
+    item->count++;
+    item->known = 1;
+  }
+}
+
+
+/**********************************************************************
+ * Name        : historyPrint
+ * Description : Print one line of the history: the latest values in
+ *               raw mode, min/avg/max of the bucket otherwise.
+ * Arguments   : timeMs = Time of the line
+ *               items  = The item list
+ *               count  = Number of items
+ *               bucket = Aggregate or not
+ * Returning   : -
+ **********************************************************************/
+static void historyPrint(long long timeMs, struct HistoryItem items[], int count, int bucket) {
+  int j;
+
+  printf("%lld.%03lld", timeMs/1000, timeMs%1000);
+  for(j=0; j<count; j++) {
+    if(!bucket) {
+      if(items[j].known)
+        printf(" %.1f", items[j].value);
+      else
+        printf(" -");
+    } else if(items[j].count == 0) {
+      printf(" - - -");
+    } else {
+      printf(" %.1f %.1f %.1f", items[j].min, items[j].sum/items[j].count, items[j].max);
+    }
+    items[j].count = 0;
+    items[j].sum   = 0;
+  }
+  printf("\n");
+}
+
+
+/**********************************************************************
+ * Name        : cmdHistory
+ * Description : Print recorded values for a time range, either every
+ *               sample or aggregated per bucket. The segments are
+ *               decoded straight from the mapped files, segments not
+ *               overlapping the range are skipped by their index and
+ *               the replay starts at the index point before the range.
+ * Arguments   : segments = Comma separated segment files
+ *               fromMs   = Start of the range
+ *               toMs     = End of the range
+ *               bucketMs = Bucket length, 0 for every sample
+ *               names    = Comma separated channel/sensor names, or
+ *                          "all"
+ * Returning   : TBAN_OK or the first error
+ **********************************************************************/
+static int cmdHistory(char segments[], long long fromMs, long long toMs, long long bucketMs, char names[]) {
+  struct HistoryItem   items[HISTORY_MAX_ITEMS];
+  struct TBanRecReader reader;
+  struct TBan          view;
+  unsigned char        vec[TBAN_STATUS_SIZE];
+  long long            timeMs, bucketStart = -1;
+  char*                name;
+  char*                file;
+  int                  count = 0, source, len, result, j;
+
+  /* What to show */
+  if(strcmp(names, "all") == 0) {
+    char spec[64];
+    for(j=0; j<TBAN_NUMBER_CHANNELS; j++)
+      (void) historyAddItem(items, &count, tban->chName[j]);
+    for(j=0; j<TBAN_NUMBER_CHANNELS; j++) {
+      (void) snprintf(spec, sizeof(spec), "%s:temp", tban->chName[j]);
+      (void) historyAddItem(items, &count, spec);
+    }
+    for(j=0; j<TBAN_NUMBER_DIGITAL_SENSORS; j++)
+      (void) historyAddItem(items, &count, tban->dsName[j]);
+    for(j=0; j<TBAN_NUMBER_ANALOG_SENSORS; j++)
+      (void) historyAddItem(items, &count, tban->asName[j]);
+  } else {
+    for(name = strtok(names, ","); name != NULL; name = strtok(NULL, ",")) {
+      if(historyAddItem(items, &count, name) != TBAN_OK) {
+        printf("Unknown channel or sensor: %s\n", name);
+        return TBAN_VALUE_OUT_OF_BOUNDS;
+      }
+    }
+  }
+
+  printf("# time");
+  for(j=0; j<count; j++) {
+    if(bucketMs > 0)
+      printf(" %s:min %s:avg %s:max", items[j].label, items[j].label, items[j].label);
+    else
+      printf(" %s", items[j].label);
+  }
+  printf("\n");
+
+  (void) memset(&view, 0, sizeof(view));
+  view.buf    = vec;
+  view.opened = 1;
+
+  for(file = strtok(segments, ","); file != NULL; file = strtok(NULL, ",")) {
+    result = tban_recOpen(&reader, file);
+    if(result != TBAN_OK)
+      return result;
+
+    /* Segments starting after the range are not decoded at all */
+    if((reader.indexCount > 0) && (reader.index[0].timeMs > toMs)) {
+      (void) tban_recClose(&reader);
+      continue;
+    }
+
+    result = tban_recSeek(&reader, fromMs);
+    while(result == TBAN_OK) {
+      result = tban_recNext(&reader, &source, &timeMs, vec, &len);
+      if(result != TBAN_OK)
+        break;
+      if(timeMs > toMs)
+        break;
+      if(timeMs < fromMs)
+        continue;
+
+      /* The TBan vector stays in vec, the miniNG one is decoded from
+       * the miniNG cache of the view */
+      if(source == TBAN_SAMPLE_MINING) {
+        (void) memcpy(view.miniNG.buf, vec, (len < MINI_NG_BUFSIZE) ? len : MINI_NG_BUFSIZE);
+      }
+      if((source == TBAN_SAMPLE_TBAN) || (source == TBAN_SAMPLE_MINING)) {
+        if((bucketMs > 0) && (bucketStart >= 0) && (timeMs >= bucketStart + bucketMs))
+          historyPrint(bucketStart, items, count, 1);
+        if(bucketMs > 0)
+          bucketStart = timeMs - timeMs % bucketMs;
+        historyDecode(&view, items, count, source);
+        if(bucketMs == 0)
+          historyPrint(timeMs, items, count, 0);
+      }
+    }
+    (void) tban_recClose(&reader);
+    if((result != TBAN_OK) && (result != TBAN_NO_MORE_DATA))
+      return result;
+  }
+  if(bucketStart >= 0)
+    historyPrint(bucketStart, items, count, 1);
+
+  return TBAN_OK;
+}
+
+
+
+/**********************************************************************
+ * Name        : cmdFleet
+ * Description : Query several devices at the same time (fleet.h) and
+ *               print one line per device and the aggregated state.
+ * Arguments   : devices = Comma separated device names
+ * Returning   : TBAN_OK or the error of opening a device
+ **********************************************************************/
+static int cmdFleet(char devices[]) {
+  struct TBanFleet        fleet;
+  struct TBanFleetSummary summary;
+  struct TBanSensor       sensor[TBAN_DEVICE_MAX_SENSORS];
+  struct timespec         t1, t2;
+  char*                   dev;
+  char*                   save;
+  int                     i, count, result;
+
+  CHECK_RESULT(tban_fleetInit(&fleet), "tban_fleetInit");
+  for(dev=strtok_r(devices, ",", &save); dev != NULL; dev=strtok_r(NULL, ",", &save)) {
+    result = tban_fleetAdd(&fleet, dev, NULL);
+    if(result != TBAN_OK) {
+      printf("Cannot open %s: %s\n", dev, tban_strerror(result));
+      (void) tban_fleetClose(&fleet);
+      return result;
+    }
+  }
+
+  (void) clock_gettime(CLOCK_MONOTONIC, &t1);
+  (void) tban_fleetQuery(&fleet);
+  (void) clock_gettime(CLOCK_MONOTONIC, &t2);
+  (void) tban_fleetSummary(&fleet, &summary);
+
+  printf("%-20s %-8s %-24s %8s %8s\n", "Device", "Model", "Status", "Channels", "Sensors");
+  for(i=0; i<fleet.count; i++) {
+    struct TBan* tban = &fleet.members[i]->tban;
+    printf("%-20s %-8s %-24s %8d %8d\n",
+           tban->deviceName,
+           tban->numModules > 0 ? tban->modules[0]->name : "-",
+           tban_strerror(fleet.members[i]->result),
+           fleet.members[i]->result == TBAN_OK ? tban_deviceNumChannels(tban) : 0,
+           fleet.members[i]->result == TBAN_OK ? tban_deviceNumSensors(tban) : 0);
+  }
+
+  printf("Fleet: %d devices, %d ok, %d channels (%d manual), %d sensors, max pwm %d%%, query %ld ms\n",
+         summary.members, summary.ok, summary.channels, summary.manual, summary.sensors, summary.maxPwm,
+         (long) ((t2.tv_sec - t1.tv_sec)*1000 + (t2.tv_nsec - t1.tv_nsec)/1000000));
+  if((summary.maxTempMember >= 0) &&
+     (tban_deviceSensors(&fleet.members[summary.maxTempMember]->tban, sensor,
+                         TBAN_DEVICE_MAX_SENSORS, &count) == TBAN_OK)) {
+    printf("Hottest sensor: %.1f (%s %s)\n", (float) summary.maxTemp / 2.0,
+           fleet.members[summary.maxTempMember]->tban.deviceName, sensor[summary.maxTempSensor].name);
+  }
+
+  return tban_fleetClose(&fleet);
+}
+
+
 
 
 
@@ -1286,6 +1959,9 @@ static void closeDevice() {
   unsigned char wd;
   int           result;
 
+  /* Output not written yet */
+  (void) format_flush(&output);
+
   /* If the watchdog was set lets disable it since we will leave the
    * program soon */
   VERBOSE(printf("Check if watchdog is enabled: "));
@@ -1293,7 +1969,7 @@ static void closeDevice() {
   result = tban_getWatchdog(tban, &wdenabled, &wd);
   VERBOSE(printf("ok\n"));
   if(result == TBAN_OK) {
-    printf("wde=%d wd=%d\n", wdenabled, wd);
+    VERBOSE(printf("wde=%d wd=%d\n", wdenabled, wd));
     if(wdenabled == 1) {
       VERBOSE(printf("Disable watchdog: "));
       VERBOSE(fflush(stdout));
@@ -1314,10 +1990,10 @@ static void closeDevice() {
   (void) tban_close(tban);
   VERBOSE(printf("ok\n"));
 
-  /* Remove file lock if device is locked by this process */
+  /* Release the device lock if still held by this process */
   if(tban->locked == 1)
     if(tban_unlock(tban) != TBAN_OK) {
-      printf("Removing lock file failed\n");
+      printf("Releasing the device lock failed\n");
       exit(EXIT_SUCCESS);
     }
 
@@ -1340,6 +2016,12 @@ static void closeDevice() {
 static void catchIntSignal(int sig_num) {
   /* re-set the signal handler again to catch INT, for next time */
   signal(SIGINT, catchIntSignal);
+
+  /* A monitor ends after the current sample and closes normally */
+  if(monitorActive) {
+    monitorStop = 1;
+    return;
+  }
   
   /* Close the device */
   closeDevice();
@@ -1361,22 +2043,44 @@ static void printHelp() {
   printf("  help                         \tDisplay this help\n");
   printf("  verbose                      \tMake all commands verbose\n");
   printf("  iterate <nr> <delay>         \tIterate all commands following <nr> of times and <delay> seconds between each iteration\n");
+  printf("  monitor <ms> <count> <cmds>  \tRun the commands following every <ms> milliseconds, <count> times (0 until\n");
+  printf("                               \tCtrl-C). Only the status vectors the commands read are queried. Missed\n");
+  printf("                               \tdeadlines are reported on stderr\n");
   printf("  pretend                      \tDont try to call the TBan, just simulate\n");
   printf("  dev                          \tChange the default device (/dev/ttyUSB0). Must be located at the\n");
   printf("                               \tbeginning of the command line\n");
   printf("  gnuplot                      \tChange the output from getch and mgetch  to fit gnuplot \n");
+  printf("  format <std|gnuplot|csv|json|influx>\n");
+  printf("                               \tOutput format of the channel, sensor and getstat commands.\n");
+  printf("                               \tcsv, json (one object per line) and influx (line protocol)\n");
+  printf("                               \twrite one record per channel or sensor\n");
   printf("  retry <nr>                   \tDecide how many retries to perform. \n");
   printf("  separator                    \tPrint a separator line.\n");
   printf("  banner <word>                \tPrint a banner line containing the word.\n");
   printf("  sleep <sec>                  \tSleep for some seconds\n");
+  printf("  script <file|->              \tRun the commands of a file (or stdin), one or more per line, in this\n");
+  printf("                               \tsession. The device is opened and probed only once\n");
+  printf("  maxage <ms>                  \tRe-read a status vector before a command uses it when it is older\n");
+  printf("                               \tthan <ms> (standard 1000, -1 never). Setters always make it stale\n");
+  printf("  statefile <file|->           \tCache of the device topology (standard ~/.tban.state, - for none)\n");
   printf("  lockwait <sec>               \tWait for device lock to be released. Standard value is 10s.\n");
-  printf("  lockfile <filename>          \tLock filename to be used.\n");
+  printf("  locking <mode> <ms>          \tLock the device per session (standard) or per transaction, and\n");
+  printf("                               \twait at most <ms> for the lock\n");
+  printf("  lockfile <filename>          \tObsolete, the device itself is locked.\n");
   printf("  watchdog                     \tReset the TBan if no response within 10 seconds. Firmware >=2.8 needed\n");
 
   printf("Maintenance commands:\n");
   printf("  resethw                      \tReset the TBan HW\n");
   printf("  gethwinfo                    \tPrint hardware info (TBan/BigNG/miniNG)\n");
   printf("  ping <mask>                  \tPing sensor\n");
+  printf("  stats                        \tPrint the I/O statistics of this session\n");
+  printf("  resetstats                   \tClear the I/O statistics\n");
+  printf("  history <seg[,seg]> <from> <to> <bucket> <names>\n");
+  printf("                               \tPrint recorded values between two times (seconds since the epoch,\n");
+  printf("                               \t<=0 relative to now or \"now\"). <bucket> seconds gives min/avg/max\n");
+  printf("                               \tper bucket, 0 every sample. <names> are comma separated channel\n");
+  printf("                               \tand sensor names from .tban.conf (ch:temp, ch:rpm) or \"all\"\n");
+  printf("  fleet <dev[,dev]>            \tQuery several devices at the same time and print their state\n");
   
   printf("Setter commands:\n");
   printf("  setchmode <ch1>...<ch4>        \tSet the channel mode for all channels (1=manual, 0=auto) \n");
@@ -1442,16 +2146,481 @@ static void printHelp() {
 }
 
 
-static void parseArguments(int argc, char* argv[]) {
+/**********************************************************************
+ * Name        : sessionLookup
+ * Description : Find a command in the session command table.
+ * Arguments   : name = The command
+ * Returning   : The entry or NULL if the command is not listed
+ **********************************************************************/
+static const struct SessionCmd* sessionLookup(char* name) {
   int i;
-  int result;
-  int pretendmode  = 0;
-  int printformat  = 0;
 
-  /***************************************************************
-   * Select if watchdog should be used or not
-   ***************************************************************/
-  int watchdogmode = 0;
+  for(i=0; sessionCmds[i].name != NULL; i++) {
+    if(strcmp(sessionCmds[i].name, name) == 0)
+      return &sessionCmds[i];
+  }
+  return NULL;
+}
+
+
+/**********************************************************************
+ * Name        : sessionFresh
+ * Description : Mark status vectors as just read.
+ * Arguments   : vectors = VEC_* mask
+ * Returning   : none
+ **********************************************************************/
+static void sessionFresh(int vectors) {
+  long long now = monotonicMs();
+  int       v;
+
+  for(v=0; v<3; v++) {
+    if(vectors & (1 << v))
+      vectorTime[v] = now;
+  }
+}
+
+
+/**********************************************************************
+ * Name        : sessionInvalidate
+ * Description : Mark all status vectors as stale, after a command that
+ *               changed the device.
+ * Arguments   : none
+ * Returning   : none
+ **********************************************************************/
+static void sessionInvalidate(void) {
+  (void) memset(vectorTime, 0, sizeof(vectorTime));
+}
+
+
+/**********************************************************************
+ * Name        : topologyPath
+ * Description : The state file with the cached topologies.
+ * Arguments   : path = Where to store the name
+ *               size = Size of path
+ * Returning   : TBAN_TRUE or TBAN_FALSE if no cache is used
+ **********************************************************************/
+static int topologyPath(char* path, int size) {
+  char* home;
+
+  if(stateFile != NULL) {
+    if(strcmp(stateFile, "-") == 0)
+      return TBAN_FALSE;
+    (void) snprintf(path, size, "%s", stateFile);
+    return TBAN_TRUE;
+  }
+
+  home = getenv("HOME");
+  if(home == NULL)
+    return TBAN_FALSE;
+  (void) snprintf(path, size, "%s/%s", home, TOPO_STATE_FILE);
+  return TBAN_TRUE;
+}
+
+
+/**********************************************************************
+ * Name        : topologyParse
+ * Description : Parse one line of the state file:
+ *               <device> <ser1> <ser2> <type> <ver> <bigNG> <miniNG>
+ * Arguments   : line   = The line
+ *               device = Where to store the device name
+ *               topo   = Where to store the topology
+ * Returning   : TBAN_TRUE if the line is valid
+ **********************************************************************/
+static int topologyParse(char* line, char device[], struct Topology* topo) {
+  unsigned int ser1, ser2, type, ver;
+
+  if(sscanf(line, "%255s %u %u %u %u %d %d", device, &ser1, &ser2, &type, &ver,
+            &topo->bigNG, &topo->miniNG) != 7)
+    return TBAN_FALSE;
+  topo->ser1 = ser1;
+  topo->ser2 = ser2;
+  topo->type = type;
+  topo->ver  = ver;
+  return TBAN_TRUE;
+}
+
+
+/**********************************************************************
+ * Name        : topologyLoad
+ * Description : Look up the cached topology of the device. It is only
+ *               used once the first TBan vector confirms it, see
+ *               topologyCheck.
+ * Arguments   : none
+ * Returning   : none
+ **********************************************************************/
+static void topologyLoad(void) {
+  FILE* infile;
+  char  path[TOPO_MAX_LINE], line[TOPO_MAX_LINE], device[TOPO_MAX_LINE];
+  struct Topology topo;
+
+  topologyCached = 0;
+  if(!topologyPath(path, sizeof(path)))
+    return;
+  infile = fopen(path, "r");
+  if(infile == NULL)
+    return;
+
+  while(fgets(line, sizeof(line), infile) != NULL) {
+    if(topologyParse(line, device, &topo) && (strcmp(device, tban->deviceName) == 0)) {
+      topologyCache  = topo;
+      topologyCached = 1;
+    }
+  }
+  (void) fclose(infile);
+  VERBOSE(if(topologyCached) printf("* Cached topology: bigNG=%d miniNG=%d\n",
+                                    topologyCache.bigNG, topologyCache.miniNG));
+}
+
+
+/**********************************************************************
+ * Name        : topologySave
+ * Description : Store the topology of the device in the state file,
+ *               keeping the entries of the other devices. The file is
+ *               replaced atomically.
+ * Arguments   : none
+ * Returning   : none
+ **********************************************************************/
+static void topologySave(void) {
+  FILE* infile;
+  FILE* outfile;
+  char  path[TOPO_MAX_LINE], tmpPath[TOPO_MAX_LINE+8];
+  char  line[TOPO_MAX_LINE], device[TOPO_MAX_LINE];
+  struct Topology topo;
+  int   entries = 0;
+
+  if(!topologyPath(path, sizeof(path)))
+    return;
+  (void) snprintf(tmpPath, sizeof(tmpPath), "%s.%d", path, (int) getpid());
+  outfile = fopen(tmpPath, "w");
+  if(outfile == NULL)
+    return;
+
+  infile = fopen(path, "r");
+  if(infile != NULL) {
+    while((fgets(line, sizeof(line), infile) != NULL) && (entries < TOPO_MAX_ENTRIES-1)) {
+      if(topologyParse(line, device, &topo) && (strcmp(device, tban->deviceName) != 0)) {
+        (void) fputs(line, outfile);
+        entries++;
+      }
+    }
+    (void) fclose(infile);
+  }
+  fprintf(outfile, "%s %u %u %u %u %d %d\n", tban->deviceName,
+          topology.ser1, topology.ser2, topology.type, topology.ver,
+          topology.bigNG, topology.miniNG);
+
+  if((fclose(outfile) != 0) || (rename(tmpPath, path) != 0)) {
+    (void) unlink(tmpPath);
+    return;
+  }
+  topologyCache  = topology;
+  topologyCached = 1;
+  topologyMatch  = 1;
+}
+
+
+/**********************************************************************
+ * Name        : topologyMiniNG
+ * Description : Record the result of a miniNG probe and update the
+ *               state file when it changed.
+ * Arguments   : present = 1 if the miniNG answered
+ * Returning   : none
+ **********************************************************************/
+static void topologyMiniNG(int present) {
+  topology.miniNG = present;
+  if(topologyKnown && (!topologyMatch || (topologyCache.miniNG != present)))
+    topologySave();
+}
+
+
+/**********************************************************************
+ * Name        : topologyCheck
+ * Description : Take the identity of the device from the first TBan
+ *               vector. If it matches the cached entry the miniNG
+ *               presence is taken from the cache, otherwise it is
+ *               probed when a command needs it. A miniNG probed
+ *               before the first TBan vector is recorded now.
+ * Arguments   : none
+ * Returning   : none
+ **********************************************************************/
+static void topologyCheck(void) {
+  int miniNG = topology.miniNG;
+
+  topology.ser1   = tban->buf[TBAN_INFO_SER1];
+  topology.ser2   = tban->buf[TBAN_INFO_SER2];
+  topology.type   = tban->buf[TBAN_INFO_TYPE];
+  topology.ver    = tban->buf[TBAN_INFO_VER];
+  topology.bigNG  = (bigNG_present(tban) == BIGNG_PRESENT);
+  topology.miniNG = TOPO_UNKNOWN;
+  topologyKnown   = 1;
+  topologyMatch   = 0;
+
+  if(topologyCached &&
+     (topologyCache.ser1 == topology.ser1) && (topologyCache.ser2 == topology.ser2) &&
+     (topologyCache.type == topology.type) && (topologyCache.ver  == topology.ver) &&
+     (topologyCache.bigNG == topology.bigNG)) {
+    topology.miniNG = topologyCache.miniNG;
+    topologyMatch   = 1;
+    VERBOSE(printf("* Cached topology confirmed\n"));
+  }
+
+  /* The miniNG was already probed by an earlier miniNG command */
+  if(miniNG != TOPO_UNKNOWN)
+    topologyMiniNG(miniNG);
+}
+
+
+/**********************************************************************
+ * Name        : sessionQuery
+ * Description : Query a status vector, retrying after a short and
+ *               growing delay (50 ms doubling up to 1 s).
+ * Arguments   : query = The query function
+ *               name  = Name of the vector for the verbose output
+ * Returning   : The result of the last try
+ **********************************************************************/
+static int sessionQuery(int (*query)(struct TBan*), char* name) {
+  long delayMs = SESSION_RETRY_FIRST_MS;
+  int  retry;
+  int  result;
+
+  result = query(tban);
+  for(retry=0; (result != TBAN_OK) && (retry < nrRetries); retry++) {
+    VERBOSE(printf("  No contact with %s, retrying in %ld ms [%d/%d]\n", name, delayMs, retry+1, nrRetries));
+    tban->stats.retries++;
+    local_nanosleep(delayMs / 1000, (delayMs % 1000) * 1000000);
+    if(delayMs < SESSION_RETRY_MAX_MS)
+      delayMs *= 2;
+    result = query(tban);
+  }
+  return result;
+}
+
+
+/**********************************************************************
+ * Name        : sessionRefresh
+ * Description : Read the status vectors a command needs if they are
+ *               stale or older than maxAgeMs. The BigNG vector is only
+ *               read from a BigNG. The miniNG is only asked when the
+ *               topology does not rule it out, or when the command is
+ *               about the miniNG alone. A miniNG that does not answer is
+ *               not an error. A negative maxAgeMs never reads
+ *               (fakedev). Afterwards the modules of the setup are
+ *               chosen for the commands that enumerate them.
+ * Arguments   : vectors = VEC_* mask
+ * Returning   : TBAN_OK or the error of the failing query
+ **********************************************************************/
+static int sessionRefresh(int vectors) {
+  long long now = monotonicMs();
+  int       result;
+
+  if(maxAgeMs >= 0) {
+    if((vectors & VEC_TBAN) &&
+       ((vectorTime[0] == 0) || (now - vectorTime[0] > maxAgeMs))) {
+      VERBOSE(printf("* Reading the TBan status vector\n"));
+      result = sessionQuery(tban_queryStatus, "TBan");
+      if(result != TBAN_OK)
+        return result;
+      sessionFresh(VEC_TBAN);
+      if(!topologyKnown)
+        topologyCheck();
+    }
+
+    if((vectors & VEC_BIGNG) && bigNG_present(tban) &&
+       ((vectorTime[1] == 0) || (now - vectorTime[1] > maxAgeMs))) {
+      VERBOSE(printf("* Reading the bigNG status vector\n"));
+      result = sessionQuery(bigNG_queryStatus, "bigNG");
+      if(result != TBAN_OK)
+        return result;
+      sessionFresh(VEC_BIGNG);
+    }
+
+    if((vectors & VEC_MINING) && ((topology.miniNG != 0) || (vectors == VEC_MINING)) &&
+       ((vectorTime[2] == 0) || (now - vectorTime[2] > maxAgeMs))) {
+      VERBOSE(printf("* Reading the miniNG status vector\n"));
+      result = miniNG_queryStatus(tban);
+      if((result == TBAN_OK) && (miniNG_present(tban) == MINING_PRESENT)) {
+        sessionFresh(VEC_MINING);
+        topologyMiniNG(1);
+      } else {
+        VERBOSE(printf("  miniNG not present status=%d\n", result));
+        topologyMiniNG(0);
+      }
+    }
+  }
+
+  /* Choose the modules of the setup, no I/O */
+  if(vectors == VEC_ALL) {
+    result = tban_deviceSelect(tban);
+    if(result != TBAN_OK) {
+      VERBOSE(printf("  No device model selected status=%d\n", result));
+    }
+  }
+
+  return TBAN_OK;
+}
+
+
+/**********************************************************************
+ * Name        : cmdScript
+ * Description : Run the commands of a script, one or more per line,
+ *               against the session. Everything after a # is a
+ *               comment. Like on the command line the first failing
+ *               command ends the program.
+ * Arguments   : filename = The script, "-" for stdin
+ * Returning   : TBAN_OK
+ *               TBAN_EOPEN (check errno)
+ *               TBAN_VALUE_OUT_OF_BOUNDS (nesting too deep, line too
+ *               long)
+ **********************************************************************/
+static int cmdScript(char* filename) {
+  FILE* infile;
+  char  line[SESSION_MAX_LINE];
+  char* words[SESSION_MAX_WORDS+1];
+  char* word;
+  int   count;
+  int   lineNr = 0;
+  int   result = TBAN_OK;
+
+  if(scriptDepth >= SESSION_MAX_SCRIPT_DEPTH)
+    return TBAN_VALUE_OUT_OF_BOUNDS;
+
+  if(strcmp(filename, "-") == 0)
+    infile = stdin;
+  else
+    infile = fopen(filename, "r");
+  if(infile == NULL)
+    return TBAN_EOPEN;
+
+  scriptDepth++;
+  while((result == TBAN_OK) && (fgets(line, sizeof(line), infile) != NULL)) {
+    lineNr++;
+    if((strchr(line, '\n') == NULL) && !feof(infile)) {
+      printf("PARSE ERROR: %s line %d is too long\n", filename, lineNr);
+      result = TBAN_VALUE_OUT_OF_BOUNDS;
+      break;
+    }
+
+    /* words[0] stands in for the program name as in argv */
+    words[0] = filename;
+    count    = 1;
+    for(word = strtok(line, " \t\r\n"); word != NULL; word = strtok(NULL, " \t\r\n")) {
+      if(word[0] == '#')
+        break;
+      if(count > SESSION_MAX_WORDS) {
+        printf("PARSE ERROR: %s line %d has too many words\n", filename, lineNr);
+        result = TBAN_VALUE_OUT_OF_BOUNDS;
+        break;
+      }
+      words[count++] = word;
+    }
+    words[count] = NULL;
+
+    if((result == TBAN_OK) && (count > 1)) {
+      VERBOSE(printf("* %s:%d\n", filename, lineNr));
+      runCommands(count, words);
+      (void) fflush(stdout);
+    }
+  }
+  scriptDepth--;
+
+  if(infile != stdin)
+    (void) fclose(infile);
+  return result;
+}
+
+
+/**********************************************************************
+ * Name        : cmdMonitor
+ * Description : Run a list of commands at a fixed rate. The samples are
+ *               started at absolute deadlines on the monotonic clock so
+ *               the rate does not drift with the time the commands
+ *               take. Before each sample all vectors are made stale,
+ *               so that exactly the vectors the commands read are
+ *               queried. A sample that ends after the next deadline
+ *               skips the deadlines it missed and reports them on
+ *               stderr. Runs until count samples are taken (0 = until
+ *               Ctrl-C). The output of a sample is written at once.
+ * Arguments   : intervalMs = Time between the sample starts
+ *               count      = Number of samples, 0 = no limit
+ *               argc, argv = The commands (argv style, argv[0] skipped)
+ * Returning   : TBAN_OK
+ *               TBAN_VALUE_OUT_OF_BOUNDS
+ *               TBAN_ESEND (writing the output failed)
+ **********************************************************************/
+static int cmdMonitor(int intervalMs, int count, int argc, char* argv[]) {
+  struct timespec ts;
+  unsigned long   samples = 0;
+  unsigned long   missed  = 0;
+  long long       interval = ((long long) intervalMs)*1000000;
+  long long       deadline, late, maxLate = 0, skip;
+  int             result = TBAN_OK;
+
+  if((intervalMs <= 0) || (count < 0) || (monitorActive != 0))
+    return TBAN_VALUE_OUT_OF_BOUNDS;
+
+  monitorActive = 1;
+  monitorStop   = 0;
+  (void) clock_gettime(CLOCK_MONOTONIC, &ts);
+  deadline = ((long long) ts.tv_sec)*1000000000 + ts.tv_nsec;
+
+  while(!monitorStop) {
+    sessionInvalidate();
+    runCommands(argc, argv);
+    result = format_flush(&output);
+    if(result != TBAN_OK)
+      break;
+    samples++;
+    if((count != 0) && (samples >= (unsigned long) count))
+      break;
+
+    /* Next deadline, skipping the ones already passed. The first
+     * sample also opens and probes the device, the schedule starts
+     * when it is done. */
+    (void) clock_gettime(CLOCK_MONOTONIC, &ts);
+    if(samples == 1)
+      deadline = ((long long) ts.tv_sec)*1000000000 + ts.tv_nsec;
+    deadline += interval;
+    late = ((long long) ts.tv_sec)*1000000000 + ts.tv_nsec - deadline;
+    if(late > 0) {
+      skip      = late / interval + 1;
+      missed   += skip;
+      deadline += skip * interval;
+      if(late > maxLate)
+        maxLate = late;
+      fprintf(stderr, "monitor: sample %lu late by %lld ms, %lld deadline(s) missed\n",
+              samples, late / 1000000, skip);
+    }
+
+    /* A signal (Ctrl-C) ends the sleep early */
+    ts.tv_sec  = deadline / 1000000000;
+    ts.tv_nsec = deadline % 1000000000;
+    while(!monitorStop &&
+          (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR))
+      ;
+  }
+
+  if(missed != 0)
+    fprintf(stderr, "monitor: %lu samples, %lu deadlines missed, at most %lld ms late\n",
+            samples, missed, maxLate / 1000000);
+  monitorActive = 0;
+
+  return result;
+}
+
+
+/**********************************************************************
+ * Name        : runCommands
+ * Description : Run a list of commands (argv style, the first word is
+ *               skipped) against the session. The device is opened
+ *               by the first command that needs it.
+ * Arguments   : argc, argv = The commands
+ * Returning   : -
+ **********************************************************************/
+static void runCommands(int argc, char* argv[]) {
+  int i;
+  int result;
+  int vectors;
+  const struct SessionCmd* cmd;
 
   /***************************************************************
    * Vars for iterate command
@@ -1466,41 +2635,13 @@ static void parseArguments(int argc, char* argv[]) {
   int iterateNr=0;
   int iterateDelay=0;
 
-  /* Display help text if no arguments are given */
-  if(argc == 1) {
-    printHelp();
-    return;
-  }
-
-  /* So that we know when we start the program */
-  startTime = time(NULL);
-
-  /***************************************************************
-   * set the INT (Ctrl-C) signal handler to 'catch_int'
-   ***************************************************************/
-  signal(SIGINT, catchIntSignal);
-
-  /***************************************************************
-   * Allocate and init the TBan device. This will basically create
-   * the TBan struct and fill it with iseful data.
-   ***************************************************************/
-  tban = malloc(sizeof(struct TBan));
-  CHECK_RESULT_EXIT(tban_init(tban, "/dev/ttyUSB0"), "tban_init");
-  CHECK_RESULT_EXIT(bigNG_init(tban), "bigNG_init");
-  CHECK_RESULT_EXIT(miniNG_init(tban), "miniNG_init");
-
-
-  /***************************************************************
-   * Set application default values
-   ***************************************************************/
-  (void) tban_configureLockTimeout(tban, 10);
-
   /***************************************************************
    * Start parsing the arguments (commands) from the command line.
    ***************************************************************/
   do {
     for(i=iterateStart; i<argc; i++) {
       result  = -1;
+      cmd     = NULL;
     
       /* Let the user choose the device to use */
       if(strcmp(argv[i], "dev")==0) {
@@ -1547,13 +2688,9 @@ static void parseArguments(int argc, char* argv[]) {
         fake_fillData(tban->buf, fake_tbanName);
         fake_fillData(tban->miniNG.buf, fake_miniNGName);
 
-        /* Check if anyone else is using the device right now */
-        (void) tban_configureLockFile(tban, "/tmp/.Xban.lock");
-        if(tban_checkIfDeviceUsed(tban) != TBAN_OK) {
-          printf("Device already in use\n");
-          closeDevice();
-          exit(EXIT_SUCCESS);
-        }
+        /* There is no device node to lock or to refresh the vectors
+         * from, the data comes from the files */
+        maxAgeMs = -1;
 
         /* Fake that the device is opened */
         tban->opened=1;
@@ -1588,7 +2725,93 @@ static void parseArguments(int argc, char* argv[]) {
         tban_configureLockTimeout(tban, timeout);
         continue; /* Continue with the for loop, no need for the rest */
       }
+
+      /* locking */
+      if(strcmp(argv[i], "locking")==0) {
+        int mode, timeoutMs;
+        VERBOSE(printf("* Configure the device locking.\n"));
+        CHECK_NUMBER_ARGUMENTS(argc,i+1, "locking");
+        if(strcmp(argv[i+1], "session")==0) {
+          mode = TBAN_LOCK_SESSION;
+        } else if(strcmp(argv[i+1], "transaction")==0) {
+          mode = TBAN_LOCK_TRANSACTION;
+        } else {
+          printf("locking: Unknown mode %s\n", argv[i+1]);
+          closeDevice();
+          exit(EXIT_FAILURE);
+        }
+        CHECK_RESULT_EXIT(parseCmdArgument(argv[i+2], &timeoutMs),  "locking: Parsing argument 2(timeout_ms)");
+        CHECK_RESULT_EXIT(tban_configureLocking(tban, mode, timeoutMs), "locking: Must be given before the device is opened");
+        i += 2;
+        continue; /* Continue with the for loop, no need for the rest */
+      }
       
+      /* history: Query a recording of the status vectors, no device
+       * needed */
+      if(strcmp(argv[i], "history")==0) {
+        long long fromMs, toMs;
+        int       bucket;
+        VERBOSE(printf("* history\n"));
+        CHECK_NUMBER_ARGUMENTS(argc,i+4, "history");
+        result = tban_parseConfig(tban, ".tban.conf");
+        if((result != TBAN_OK) && (errno!=2)) {
+          printf("Error when parsing config file\n");
+          closeDevice();
+          exit(EXIT_FAILURE);
+        }
+        CHECK_RESULT_EXIT(historyParseTime(argv[i+2], &fromMs), "history: Parsing argument 2(from)");
+        CHECK_RESULT_EXIT(historyParseTime(argv[i+3], &toMs),   "history: Parsing argument 3(to)");
+        CHECK_RESULT_EXIT(parseCmdArgument(argv[i+4], &bucket), "history: Parsing argument 4(bucket)");
+        CHECK_RESULT_EXIT(cmdHistory(argv[i+1], fromMs, toMs, ((long long) bucket)*1000, argv[i+5]), "history");
+        i += 5;
+        continue; /* Continue with the for loop, no need for the rest */
+      }
+
+      /* fleet */
+      if(strcmp(argv[i], "fleet")==0) {
+        VERBOSE(printf("* fleet\n"));
+        CHECK_NUMBER_ARGUMENTS(argc,i, "fleet");
+        CHECK_RESULT_EXIT(cmdFleet(argv[++i]), "fleet");
+        continue; /* Continue with the for loop, no need for the rest */
+      }
+
+      /* script: Run the commands of a file (or stdin) in this session */
+      if(strcmp(argv[i], "script")==0) {
+        VERBOSE(printf("* script\n"));
+        CHECK_NUMBER_ARGUMENTS(argc,i, "script");
+        CHECK_RESULT_EXIT(cmdScript(argv[++i]), "script");
+        continue; /* Continue with the for loop, no need for the rest */
+      }
+
+      /* monitor: Run the rest of the commands at a fixed rate */
+      if(strcmp(argv[i], "monitor")==0) {
+        int intervalMs, count;
+        VERBOSE(printf("* monitor\n"));
+        CHECK_NUMBER_ARGUMENTS(argc,i+2, "monitor");
+        CHECK_RESULT_EXIT(parseCmdArgument(argv[i+1], &intervalMs), "monitor: Parsing argument 1(interval_ms)");
+        CHECK_RESULT_EXIT(parseCmdArgument(argv[i+2], &count),      "monitor: Parsing argument 2(count)");
+        CHECK_RESULT_EXIT(cmdMonitor(intervalMs, count, argc-(i+2), argv+(i+2)), "monitor");
+        i = argc;
+        continue; /* Continue with the for loop, no need for the rest */
+      }
+
+      /* maxage: How old the status vectors may be before a reading
+       * command refreshes them */
+      if(strcmp(argv[i], "maxage")==0) {
+        VERBOSE(printf("* maxage\n"));
+        CHECK_NUMBER_ARGUMENTS(argc,i, "maxage");
+        CHECK_RESULT_EXIT(parseCmdArgument(argv[++i], &maxAgeMs), "maxage: Parsing argument 1(ms)");
+        continue; /* Continue with the for loop, no need for the rest */
+      }
+
+      /* statefile: Where the device topology is cached */
+      if(strcmp(argv[i], "statefile")==0) {
+        VERBOSE(printf("* statefile\n"));
+        CHECK_NUMBER_ARGUMENTS(argc,i, "statefile");
+        stateFile = argv[++i];
+        continue; /* Continue with the for loop, no need for the rest */
+      }
+
       /* lockfile */
       if(strcmp(argv[i], "lockfile")==0) {
         VERBOSE(printf("* Configure the lock file to use.\n"));
@@ -1637,6 +2860,11 @@ static void parseArguments(int argc, char* argv[]) {
 
       /* iterate */
       if(strcmp(argv[i], "iterate")==0) {
+        if((scriptDepth > 0) || monitorActive) {
+          printf("iterate: Not available in a script or monitor\n");
+          closeDevice();
+          exit(EXIT_FAILURE);
+        }
         /* Look for two arguments */
         CHECK_NUMBER_ARGUMENTS(argc,i+1, "iterate");
         CHECK_RESULT_EXIT(parseCmdArgument(argv[++i], &iterateNr),  "iterate: Parsing argument 1(iterations)");
@@ -1656,7 +2884,7 @@ static void parseArguments(int argc, char* argv[]) {
 
       /* separator */
       if(strcmp(argv[i], "separator")==0) {
-        printf("\n");
+        format_printf(&output, "\n");
         continue; /* Continue with the for loop, no need for the rest */
       }
 
@@ -1664,9 +2892,9 @@ static void parseArguments(int argc, char* argv[]) {
       if(strcmp(argv[i], "banner")==0) {
         /* Look for one argument */
         CHECK_NUMBER_ARGUMENTS(argc,i+1, "banner");
-        printf("--------------------------------------------------\n");
-        printf("%s\n", argv[i+1]);
-        printf("--------------------------------------------------\n");
+        format_printf(&output, "--------------------------------------------------\n"
+                      "%s\n"
+                      "--------------------------------------------------\n", argv[i+1]);
         i++;
         continue; /* Continue with the for loop, no need for the rest */
       }
@@ -1675,6 +2903,21 @@ static void parseArguments(int argc, char* argv[]) {
       if(strcmp(argv[i], "gnuplot")==0) {
         VERBOSE(printf("* Adjust output to fit gnuplot.\n"));
         printformat=XBAN_FORMAT_GNUPLOT;
+        format_select(&output, printformat);
+        continue; /* Continue with the for loop, no need for the rest */
+      }
+
+      /* format : Output format of the channel and sensor commands */
+      if(strcmp(argv[i], "format")==0) {
+        VERBOSE(printf("* format\n"));
+        CHECK_NUMBER_ARGUMENTS(argc,i, "format");
+        printformat = format_byName(argv[++i]);
+        if(printformat < 0) {
+          printf("PARSE ERROR: Unknown format: %s\n", argv[i]);
+          closeDevice();
+          exit(EXIT_FAILURE);
+        }
+        format_select(&output, printformat);
         continue; /* Continue with the for loop, no need for the rest */
       }
 
@@ -1689,7 +2932,6 @@ static void parseArguments(int argc, char* argv[]) {
        * device fist so this statement must be located after the "dev" */
       if(!tban->opened) {
         int result;
-        int __retryCounter=0;
 
         /* Open the device if noone else is using it */
         VERBOSE(printf("Opening device %s\n", tban->deviceName));
@@ -1713,59 +2955,24 @@ static void parseArguments(int argc, char* argv[]) {
           exit(EXIT_FAILURE);
         }
 
-        /* Query the device once to make sure that everything works */
-        VERBOSE(printf("* Performing initial TBan query\n"));
-        result = tban_queryStatus(tban);
-        while((result != TBAN_OK) && (__retryCounter<nrRetries)) {
-          result = tban_queryStatus(tban);
-          VERBOSE(printf("  No contact with TBan, reconnecting [%d/%d]\n", __retryCounter, nrRetries));
-          __retryCounter++;
-          local_nanosleep(5, 0);
-        }
-        /* No contact with TBan causes program exit */
-        if(result != TBAN_OK) {
-          printf("  No contact with TBan\n");
-          closeDevice();
-          exit(EXIT_SUCCESS);
-        }
-        VERBOSE(printf("  TBan query ok\n"));
-
-	/* If the module is a BigNG we have to load also the second
-	 * status vector */
-	__retryCounter=0;
-
-	if(bigNG_present(tban)) {
-	  /* Load the second status array */
-          VERBOSE(printf("* Performing initial bigNG query\n"));
-          result=bigNG_queryStatus(tban);
-	  while((result != TBAN_OK) && (__retryCounter<nrRetries)) {
-	    result = bigNG_queryStatus(tban);
-	    VERBOSE(printf("  No contact with bigNG, reconnecting [%d/%d]\n", __retryCounter, nrRetries));
-	    __retryCounter++;
-	    local_nanosleep(5, 0);
-	  }
-          /* No contact with bigNG causes program exit */
-          if(result != TBAN_OK) {
-            printf("  No contact with bigNG\n");
-            closeDevice();
-            exit(EXIT_SUCCESS);
-          }
-          VERBOSE(printf("bigNG query ok\n"));
-        }
+        /* Nothing is read yet, the commands read the vectors they
+         * need. The cached topology is confirmed by the first TBan
+         * vector. */
+        topologyLoad();
+      }
 
-        /* Try to get the status vector from the miniNG (if present). In
-         * the case it is not present we will get an empty vector back
-         * (NULL) so it is pretty easy to see if a miniNG is present. */
-        {
-          int stat;
-          VERBOSE(printf("* Performing initial miniNG query\n"));
-          stat = miniNG_queryStatus(tban);
-          if(stat == TBAN_OK) {
-            VERBOSE(printf("  miniNG present\n"));
-          } else {
-            VERBOSE(printf("  miniNG not present status=%d\n", stat));
-          }
-        }
+      /***************************************************************
+       * Refresh the status vectors the command reads when they are
+       * older than maxAgeMs or a setter has changed the device since
+       * they were read. Setters and the watchdog check the firmware
+       * version, they need a TBan vector of any age.
+       ***************************************************************/
+      cmd     = sessionLookup(argv[i]);
+      vectors = (cmd != NULL) ? cmd->vectors : 0;
+      if((((cmd != NULL) && cmd->writes) || (watchdogmode == 1)) && (tban->lastQuery == 0))
+        vectors |= VEC_TBAN;
+      if((vectors != 0) && !pretendmode) {
+        CHECK_RESULT_EXIT(sessionRefresh(vectors), "Reading the status vectors");
       }
 
       /***************************************************************
@@ -1796,7 +3003,7 @@ static void parseArguments(int argc, char* argv[]) {
       /* getstat */
       if(strcmp(argv[i], "getstat")==0) {
         VERBOSE(printf("* getstat\n"));
-        print_numerical_data(tban->buf, 285);
+        print_numerical_data("TBan", tban->buf, 285, printformat);
         result=TBAN_OK;
       }
 
@@ -2049,6 +3256,18 @@ static void parseArguments(int argc, char* argv[]) {
         printf("PWM freq=%d\n", freq);
       }
 
+      /* stats: Print the I/O statistics */
+      if(strcmp(argv[i], "stats")==0) {
+        VERBOSE(printf("* stats\n"));
+        PRETEND_RUN(cmdPrintStats(tban));
+      }
+
+      /* resetstats: Clear the I/O statistics */
+      if(strcmp(argv[i], "resetstats")==0) {
+        VERBOSE(printf("* resetstats\n"));
+        PRETEND_RUN(tban_resetStats(tban));
+      }
+
       /* ping: Ping digital sensors */
       if(strcmp(argv[i], "ping")==0) {
         unsigned char sensormask;
@@ -2148,7 +3367,7 @@ static void parseArguments(int argc, char* argv[]) {
       /* bgetstat */
       if(strcmp(argv[i], "bgetstat")==0) {
         VERBOSE(printf("* bgetstat\n"));
-        print_numerical_data(tban->bigNG.buf, 285);
+        print_numerical_data("BigNG", tban->bigNG.buf, 285, printformat);
         result=TBAN_OK;
       }
 
@@ -2223,7 +3442,7 @@ static void parseArguments(int argc, char* argv[]) {
       /* mggetstat: Dump the whole miniNG status vector */
       if(strcmp(argv[i], "mgetstat")==0) {
         VERBOSE(printf("* mgetstat\n"));
-        print_numerical_data(tban->miniNG.buf, 128);
+        print_numerical_data("miniNG", tban->miniNG.buf, 128, printformat);
         result=TBAN_OK;
       }
 
@@ -2323,14 +3542,67 @@ static void parseArguments(int argc, char* argv[]) {
         VERBOSE(printf("Result checked ok\n"));
       }
 
+      /* The device has changed, the next read must see it */
+      if((cmd != NULL) && cmd->writes)
+        sessionInvalidate();
+
+      /* Write the output of the command, a monitor writes once per
+       * sample */
+      if(!monitorActive)
+        CHECK_RESULT_EXIT(format_flush(&output), "Writing the output");
+
     } /* for */
 
-    /* Prepare for iteration check */
+    /* Prepare for iteration check. The next pass reads fresh vectors. */
     iterateCount++;
     sleep(iterateDelay);
+    sessionInvalidate();
   } while(iterateCount < iterateNr);
+}
 
 
+/**********************************************************************
+ * Name        : parseArguments
+ * Description : Set up the session and run the commands of the command
+ *               line.
+ * Arguments   : argc, argv = The command line
+ * Returning   : -
+ **********************************************************************/
+static void parseArguments(int argc, char* argv[]) {
+  /* Display help text if no arguments are given */
+  if(argc == 1) {
+    printHelp();
+    return;
+  }
+
+  /* So that we know when we start the program */
+  startTime = time(NULL);
+  format_init(&output, STDOUT_FILENO, XBAN_FORMAT_STD);
+
+  /***************************************************************
+   * set the INT (Ctrl-C) signal handler to 'catch_int'
+   ***************************************************************/
+  signal(SIGINT, catchIntSignal);
+
+  /***************************************************************
+   * Allocate and init the TBan device. This will basically create
+   * the TBan struct and fill it with iseful data.
+   ***************************************************************/
+  tban = malloc(sizeof(struct TBan));
+  CHECK_RESULT_EXIT(tban_init(tban, "/dev/ttyUSB0"), "tban_init");
+  CHECK_RESULT_EXIT(bigNG_init(tban), "bigNG_init");
+  CHECK_RESULT_EXIT(miniNG_init(tban), "miniNG_init");
+
+
+  /***************************************************************
+   * Set application default values
+   ***************************************************************/
+  (void) tban_configureLockTimeout(tban, 10);
+
+  /***************************************************************
+   * Run the commands of the command line
+   ***************************************************************/
+  runCommands(argc, argv);
 
   /***************************************************************
    * All commands executed ok. Lets close the driver.
@@ -0,0 +1,819 @@
+/*****************************************************************************
+ ** This program is free software; you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation; either version 2 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program; if not, write to the Free Software
+ ** Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ **
+ **
+ ** FILE INFORMATION
+ ** ----------------
+ ** Filename:        tband.c
+ ** Initial author:  marcus.jagemar@gmail.com
+ **
+ **
+ ** DESCRIPTION
+ ** -----------
+ ** Resident daemon owning the TBan port. The device is opened once,
+ ** the status vectors are refreshed continuously by the libtban
+ ** sampler thread and clients are served over a Unix domain socket.
+ ** Reads are answered from the latest sample without touching the
+ ** port. Writes are executed one at a time in the order they arrive.
+ **
+ ** The protocol is line based. Every request is one line of
+ ** whitespace separated words, the answer is one line starting with
+ ** "OK" followed by the values or "ERR" followed by the error name and
+ ** description. Indexes are 0-indexed as in tbancontrol. Arguments
+ ** are numbers from 0 to 255 (getindex: up to the vector size), other
+ ** values are answered with "ERR bad argument".
+ **
+ **   age                         OK <sample seq> <sample age (s)>
+ **   getindex <index>            OK <value>
+ **   getstat | bgetstat | mgetstat
+ **                               OK <status vector as hex>
+ **   getch <ch>                  OK <rpm max> <pwm> <temp> <mode>
+ **   getds <nr> | getas <nr>     OK <temp> <raw temp> <calibration>
+ **   getpwmfreq                  OK <freq>
+ **   setchpwm <ch> <pwm>         OK
+ **   setchmode <mask>            OK
+ **   setled <0|1> | setbuz <0|1> OK
+ **   setpwmfreq <freq>           OK
+ **   setchhyst <ch> <hyst>       OK
+ **   setchsens <ch> <ds> <as>    OK
+ **   setscfact <nr> <factor>     OK
+ **   setmotion <lo> <hi> <err>   OK
+ **   bsettargettemp <ch> <temp>  OK
+ **   bsettargetmode <ch> <mode>  OK
+ **
+ ** Example: echo "getch 0" | socat - UNIX-CONNECT:/run/tband/tband.sock
+ **
+ ** Every client can change the fan settings, so the socket is only
+ ** accessible to its owner and group (mode 0660 unless given) and
+ ** lives in /run/tband by default. Errors are written to stderr until
+ ** the daemon detaches and to syslog afterwards.
+ **
+ ** With the shm option the state is also published in shared memory
+ ** (see shm.h) for readers that must not go through the socket.
+ **
+ ** With the record option every refreshed vector is also appended to
+ ** a recording (see recorder.h), query it with "tbancontrol history".
+ **
+ ** REVISION HISTORY
+ ** ----------------
+ **
+ ** Date        Comment
+ ** =================================================================
+ ** 2026-10-17  File created
+ **
+ *****************************************************************************/
+
+/* Standard includes */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <poll.h>
+#include <syslog.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+/* TBan library interface */
+#include "tban.h"
+#include "mini_ng.h"
+#include "big_ng.h"
+#include "sampler.h"
+#include "shm.h"
+#include "recorder.h"
+
+
+/*****************************************************************************
+ * Return from the function if the result is anything else than TBAN_OK
+ *****************************************************************************/
+#define CHECK_RESULT(STRING) { \
+                               int result=STRING; \
+                               if(result != TBAN_OK) { \
+                                 return result; \
+                               } \
+                             }
+
+
+/*****************************************************************************
+ * Defaults
+ *****************************************************************************/
+#define TBAND_SOCKET_DIR        "/run/tband"
+#define TBAND_SOCKET            TBAND_SOCKET_DIR "/tband.sock"
+#define TBAND_SOCKET_MODE       0660
+#define TBAND_INTERVAL_MS       1000
+#define TBAND_MAX_CLIENTS       32
+#define TBAND_LINE_SIZE         256
+#define TBAND_MAX_ARGS          4
+#define TBAND_REPLY_SIZE        (2*TBAN_STATUS_SIZE+16)
+#define TBAND_QUERY_RETRIES     3
+#define TBAND_QUERY_BACKOFF_MS  200
+
+
+/*****************************************************************************
+ * One connected client and the part of a request line received so far
+ *****************************************************************************/
+struct TBandClient {
+  int  fd;
+  int  len;
+  char line[TBAND_LINE_SIZE];
+};
+
+
+/*****************************************************************************
+ * A request. func fills in the values of an OK answer. No argument may
+ * be larger than maxArg, most of them are passed as unsigned char.
+ *****************************************************************************/
+typedef int (tband_cmdFunc)(struct TBan* tban, int args[], char* reply, int size);
+
+typedef struct {
+  char*          name;
+  int            nargs;
+  int            maxArg;
+  tband_cmdFunc* func;
+} TBand_cmdStruct;
+
+
+/*****************************************************************************
+ * Global state
+ *****************************************************************************/
+static volatile sig_atomic_t stopRequested = 0;
+static int                   detached      = 0;
+static struct TBandClient    clients[TBAND_MAX_CLIENTS];
+
+
+/**********************************************************************
+ * Name        : catchStopSignal
+ * Description : SIGINT/SIGTERM handler, ends the main loop.
+ * Arguments   : sig_num = The signal
+ * Returning   : -
+ **********************************************************************/
+static void catchStopSignal(int sig_num) {
+  (void) sig_num;
+  stopRequested = 1;
+}
+
+
+/**********************************************************************
+ * Name        : logError
+ * Description : Report an error, on stderr until the daemon has
+ *               detached and to syslog afterwards.
+ * Arguments   : fmt = printf format, without a trailing newline
+ * Returning   : -
+ **********************************************************************/
+static void logError(const char* fmt, ...) {
+  va_list args;
+
+  va_start(args, fmt);
+  if(detached) {
+    vsyslog(LOG_ERR, fmt, args);
+  } else {
+    (void) vfprintf(stderr, fmt, args);
+    (void) fputc('\n', stderr);
+  }
+  va_end(args);
+}
+
+
+/**********************************************************************
+ * Name        : hexVector
+ * Description : Format a status vector as a hex string.
+ * Arguments   : buf   = The vector
+ *               len   = Length of the vector
+ *               reply = Output string
+ *               size  = Size of reply
+ * Returning   : TBAN_OK
+ *               TBAN_VECTOR_TO_SMALL
+ **********************************************************************/
+static int hexVector(const unsigned char* buf, int len, char* reply, int size) {
+  int i;
+
+  if(size < 2*len+1)
+    return TBAN_VECTOR_TO_SMALL;
+  for(i=0; i<len; i++)
+    (void) sprintf(reply+2*i, "%02x", buf[i]);
+  return TBAN_OK;
+}
+
+
+/**********************************************************************
+ * Read requests. The handle holds a copy of the latest sample
+ * (tban_queryStatus and friends copy it while the sampler runs).
+ **********************************************************************/
+static int cmdAge(struct TBan* tban, int args[], char* reply, int size) {
+  struct TBanSnapshot snap;
+
+  (void) args;
+
+  CHECK_RESULT(tban_getSnapshot(tban, &snap));
+  (void) snprintf(reply, size, "%lu %ld", snap.seq, (long) (time(NULL) - snap.time));
+  return TBAN_OK;
+}
+
+static int cmdGetIndex(struct TBan* tban, int args[], char* reply, int size) {
+  unsigned char value;
+
+  CHECK_RESULT(tban_queryStatus(tban));
+  CHECK_RESULT(tban_getValue(tban, args[0], &value));
+  (void) snprintf(reply, size, "%d", value);
+  return TBAN_OK;
+}
+
+static int cmdGetStat(struct TBan* tban, int args[], char* reply, int size) {
+  (void) args;
+
+  CHECK_RESULT(tban_queryStatus(tban));
+  return hexVector(tban->buf, TBAN_STATUS_SIZE, reply, size);
+}
+
+static int cmdBGetStat(struct TBan* tban, int args[], char* reply, int size) {
+  (void) args;
+
+  CHECK_RESULT(bigNG_queryStatus(tban));
+  return hexVector(tban->bigNG.buf, BIGNG_STATUS_SIZE, reply, size);
+}
+
+static int cmdMGetStat(struct TBan* tban, int args[], char* reply, int size) {
+  (void) args;
+
+  CHECK_RESULT(miniNG_queryStatus(tban));
+  return hexVector(tban->miniNG.buf, MINI_NG_BUFSIZE, reply, size);
+}
+
+static int cmdGetCh(struct TBan* tban, int args[], char* reply, int size) {
+  unsigned int  rpmMax;
+  unsigned char pwm, temp, mode;
+
+  CHECK_RESULT(tban_queryStatus(tban));
+  CHECK_RESULT(tban_getChInfo(tban, args[0], &rpmMax, &pwm, &temp, &mode));
+  (void) snprintf(reply, size, "%u %d %d %d", rpmMax, pwm, temp, mode);
+  return TBAN_OK;
+}
+
+static int cmdGetDs(struct TBan* tban, int args[], char* reply, int size) {
+  unsigned char temp, raw, cal;
+
+  CHECK_RESULT(tban_queryStatus(tban));
+  CHECK_RESULT(tban_getdSensorTemp(tban, args[0], &temp, &raw, &cal));
+  (void) snprintf(reply, size, "%d %d %d", temp, raw, cal);
+  return TBAN_OK;
+}
+
+static int cmdGetAs(struct TBan* tban, int args[], char* reply, int size) {
+  unsigned char temp, raw, cal;
+
+  CHECK_RESULT(tban_queryStatus(tban));
+  CHECK_RESULT(tban_getaSensorTemp(tban, args[0], &temp, &raw, &cal));
+  (void) snprintf(reply, size, "%d %d %d", temp, raw, cal);
+  return TBAN_OK;
+}
+
+static int cmdGetPwmFreq(struct TBan* tban, int args[], char* reply, int size) {
+  unsigned char freq;
+
+  (void) args;
+
+  CHECK_RESULT(tban_queryStatus(tban));
+  CHECK_RESULT(tban_getPwmFreq(tban, &freq));
+  (void) snprintf(reply, size, "%d", freq);
+  return TBAN_OK;
+}
+
+
+/**********************************************************************
+ * Write requests. The sampler shares the port through the handle I/O
+ * lock so no sample is taken in the middle of a command.
+ **********************************************************************/
+static int cmdSetChPwm(struct TBan* tban, int args[], char* reply, int size) {
+  (void) reply;
+  (void) size;
+
+  return tban_setChPwm(tban, args[0], args[1]);
+}
+
+static int cmdSetChMode(struct TBan* tban, int args[], char* reply, int size) {
+  (void) reply;
+  (void) size;
+
+  return tban_setChMode(tban, args[0]);
+}
+
+static int cmdSetLED(struct TBan* tban, int args[], char* reply, int size) {
+  (void) reply;
+  (void) size;
+
+  return tban_setLED(tban, args[0]);
+}
+
+static int cmdSetBuz(struct TBan* tban, int args[], char* reply, int size) {
+  (void) reply;
+  (void) size;
+
+  return tban_setBuz(tban, args[0]);
+}
+
+static int cmdSetPwmFreq(struct TBan* tban, int args[], char* reply, int size) {
+  (void) reply;
+  (void) size;
+
+  return tban_setPwmFreq(tban, args[0]);
+}
+
+static int cmdSetChHyst(struct TBan* tban, int args[], char* reply, int size) {
+  (void) reply;
+  (void) size;
+
+  return tban_setChHysteresis(tban, args[0], args[1]);
+}
+
+static int cmdSetChSens(struct TBan* tban, int args[], char* reply, int size) {
+  (void) reply;
+  (void) size;
+
+  return tban_setChSensAssignment(tban, args[0], args[1], args[2]);
+}
+
+static int cmdSetScFact(struct TBan* tban, int args[], char* reply, int size) {
+  (void) reply;
+  (void) size;
+
+  return tban_setSensorScaleFact(tban, args[0], args[1]);
+}
+
+static int cmdSetMotion(struct TBan* tban, int args[], char* reply, int size) {
+  (void) reply;
+  (void) size;
+
+  return tban_setMotion(tban, args[0], args[1], args[2]);
+}
+
+static int cmdBSetTargetTemp(struct TBan* tban, int args[], char* reply, int size) {
+  (void) reply;
+  (void) size;
+
+  if(bigNG_present(tban) != BIGNG_PRESENT)
+    return TBAN_NOT_IMPLEMENTED;
+  return bigNG_setChTargetTemp(tban, args[0], args[1]);
+}
+
+static int cmdBSetTargetMode(struct TBan* tban, int args[], char* reply, int size) {
+  (void) reply;
+  (void) size;
+
+  if(bigNG_present(tban) != BIGNG_PRESENT)
+    return TBAN_NOT_IMPLEMENTED;
+  return bigNG_setChTargetMode(tban, args[0], args[1]);
+}
+
+
+static const TBand_cmdStruct TBand_cmdMap[] = {
+  { "age",            0, UCHAR_MAX,          cmdAge },
+  { "getindex",       1, TBAN_STATUS_SIZE-1, cmdGetIndex },
+  { "getstat",        0, UCHAR_MAX,          cmdGetStat },
+  { "bgetstat",       0, UCHAR_MAX,          cmdBGetStat },
+  { "mgetstat",       0, UCHAR_MAX,          cmdMGetStat },
+  { "getch",          1, UCHAR_MAX,          cmdGetCh },
+  { "getds",          1, UCHAR_MAX,          cmdGetDs },
+  { "getas",          1, UCHAR_MAX,          cmdGetAs },
+  { "getpwmfreq",     0, UCHAR_MAX,          cmdGetPwmFreq },
+  { "setchpwm",       2, UCHAR_MAX,          cmdSetChPwm },
+  { "setchmode",      1, UCHAR_MAX,          cmdSetChMode },
+  { "setled",         1, UCHAR_MAX,          cmdSetLED },
+  { "setbuz",         1, UCHAR_MAX,          cmdSetBuz },
+  { "setpwmfreq",     1, UCHAR_MAX,          cmdSetPwmFreq },
+  { "setchhyst",      2, UCHAR_MAX,          cmdSetChHyst },
+  { "setchsens",      3, UCHAR_MAX,          cmdSetChSens },
+  { "setscfact",      2, UCHAR_MAX,          cmdSetScFact },
+  { "setmotion",      3, UCHAR_MAX,          cmdSetMotion },
+  { "bsettargettemp", 2, UCHAR_MAX,          cmdBSetTargetTemp },
+  { "bsettargetmode", 2, UCHAR_MAX,          cmdBSetTargetMode }
+};
+
+#define TBAND_NUMBER_CMDS ((int) (sizeof(TBand_cmdMap)/sizeof(TBand_cmdMap[0])))
+
+
+/**********************************************************************
+ * Name        : executeLine
+ * Description : Parse and execute one request line.
+ * Arguments   : tban  = The TBan handle
+ *               line  = The request (modified)
+ *               reply = The answer line including the newline
+ *               size  = Size of reply
+ * Returning   : -
+ **********************************************************************/
+static void executeLine(struct TBan* tban, char* line, char* reply, int size) {
+  char  values[TBAND_REPLY_SIZE];
+  char* word;
+  char* rest;
+  char* end;
+  long  value;
+  int   args[TBAND_MAX_ARGS];
+  int   nargs = 0;
+  int   result;
+  int   i;
+
+  word = strtok_r(line, " \t\r", &rest);
+  if(word == NULL) {
+    (void) snprintf(reply, size, "ERR empty request\n");
+    return;
+  }
+
+  for(i=0; i<TBAND_NUMBER_CMDS; i++) {
+    if(strcmp(word, TBand_cmdMap[i].name) == 0)
+      break;
+  }
+  if(i == TBAND_NUMBER_CMDS) {
+    (void) snprintf(reply, size, "ERR unknown request \"%s\"\n", word);
+    return;
+  }
+
+  /* Numerical arguments */
+  while((word = strtok_r(NULL, " \t\r", &rest)) != NULL) {
+    if(nargs == TBAND_MAX_ARGS) {
+      nargs++;
+      break;
+    }
+    errno = 0;
+    value = strtol(word, &end, 0);
+    if((errno != 0) || (end == word) || (*end != '\0') ||
+       (value < 0) || (value > TBand_cmdMap[i].maxArg)) {
+      (void) snprintf(reply, size, "ERR bad argument \"%s\" (0-%d)\n", word, TBand_cmdMap[i].maxArg);
+      return;
+    }
+    args[nargs++] = (int) value;
+  }
+  if(nargs != TBand_cmdMap[i].nargs) {
+    (void) snprintf(reply, size, "ERR %s takes %d arguments\n", TBand_cmdMap[i].name, TBand_cmdMap[i].nargs);
+    return;
+  }
+
+  values[0] = '\0';
+  result = TBand_cmdMap[i].func(tban, args, values, sizeof(values));
+  if(result != TBAN_OK)
+    (void) snprintf(reply, size, "ERR %s %s\n", tban_strerror(result), tban_strerrordesc(result));
+  else if(values[0] != '\0')
+    (void) snprintf(reply, size, "OK %s\n", values);
+  else
+    (void) snprintf(reply, size, "OK\n");
+}
+
+
+/**********************************************************************
+ * Name        : closeClient
+ * Description : Disconnect a client.
+ * Arguments   : client = The client
+ * Returning   : -
+ **********************************************************************/
+static void closeClient(struct TBandClient* client) {
+  (void) close(client->fd);
+  client->fd  = -1;
+  client->len = 0;
+}
+
+
+/**********************************************************************
+ * Name        : serveClient
+ * Description : Read what the client has sent and execute every
+ *               complete request line, in order.
+ * Arguments   : tban   = The TBan handle
+ *               client = The client
+ * Returning   : -
+ **********************************************************************/
+static void serveClient(struct TBan* tban, struct TBandClient* client) {
+  char    reply[TBAND_REPLY_SIZE+TBAND_LINE_SIZE];
+  char*   nl;
+  ssize_t n;
+  int     used;
+
+  n = read(client->fd, client->line + client->len, TBAND_LINE_SIZE - client->len);
+  if(n < 0) {
+    if((errno == EAGAIN) || (errno == EINTR))
+      return;
+    closeClient(client);
+    return;
+  }
+  if(n == 0) {
+    closeClient(client);
+    return;
+  }
+  client->len += n;
+
+  while((nl = memchr(client->line, '\n', client->len)) != NULL) {
+    *nl = '\0';
+    used = nl - client->line + 1;
+    executeLine(tban, client->line, reply, sizeof(reply));
+    if(send(client->fd, reply, strlen(reply), MSG_NOSIGNAL) < 0) {
+      closeClient(client);
+      return;
+    }
+    (void) memmove(client->line, client->line + used, client->len - used);
+    client->len -= used;
+  }
+
+  /* A line that does not fit is a protocol error */
+  if(client->len == TBAND_LINE_SIZE) {
+    (void) send(client->fd, "ERR request too long\n", 21, MSG_NOSIGNAL);
+    closeClient(client);
+  }
+}
+
+
+/**********************************************************************
+ * Name        : removeStaleSocket
+ * Description : Remove the socket file left by an earlier instance.
+ *               Only a socket of our own that nobody listens on is
+ *               removed, anything else at the path is left alone.
+ * Arguments   : addr = The socket address
+ * Returning   : 0 if the path is free now, -1 otherwise (errno set)
+ **********************************************************************/
+static int removeStaleSocket(const struct sockaddr_un* addr) {
+  struct stat st;
+  int fd, busy;
+
+  if(lstat(addr->sun_path, &st) != 0)
+    return (errno == ENOENT) ? 0 : -1;
+  if(!S_ISSOCK(st.st_mode) || (st.st_uid != geteuid())) {
+    errno = EEXIST;
+    return -1;
+  }
+
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(fd < 0)
+    return -1;
+  busy = (connect(fd, (const struct sockaddr*) addr, sizeof(*addr)) == 0);
+  (void) close(fd);
+  if(busy) {
+    errno = EADDRINUSE;
+    return -1;
+  }
+
+  return unlink(addr->sun_path);
+}
+
+
+/**********************************************************************
+ * Name        : openSocket
+ * Description : Create the listening socket with the given mode. The
+ *               default directory is created if it is missing. The
+ *               socket is created without any permissions for others
+ *               so no client can connect before the mode is set.
+ * Arguments   : path = The socket path
+ *               mode = Permissions of the socket file
+ * Returning   : The socket or -1 on failure (errno set)
+ **********************************************************************/
+static int openSocket(char* path, mode_t mode) {
+  struct sockaddr_un addr;
+  mode_t oldMask;
+  int fd, result;
+
+  if(strlen(path) >= sizeof(addr.sun_path)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+
+  (void) memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  (void) strcpy(addr.sun_path, path);
+
+  if((strcmp(path, TBAND_SOCKET) == 0) &&
+     (mkdir(TBAND_SOCKET_DIR, 0755) != 0) && (errno != EEXIST))
+    return -1;
+  if(removeStaleSocket(&addr) != 0)
+    return -1;
+
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(fd < 0)
+    return -1;
+
+  oldMask = umask(0177);
+  result  = bind(fd, (struct sockaddr*) &addr, sizeof(addr));
+  (void) umask(oldMask);
+
+  if((result != 0) ||
+     (chmod(path, mode) != 0) ||
+     (listen(fd, TBAND_MAX_CLIENTS) != 0)) {
+    result = errno;
+    (void) close(fd);
+    errno = result;
+    return -1;
+  }
+
+  return fd;
+}
+
+
+/**********************************************************************
+ * Name        : initialQuery
+ * Description : Query a status vector once, retrying with a short
+ *               back-off.
+ * Arguments   : tban  = The TBan handle
+ *               query = The query function
+ * Returning   : Result of the last query
+ **********************************************************************/
+static int initialQuery(struct TBan* tban, int (*query)(struct TBan*)) {
+  int result, i;
+
+  result = query(tban);
+  for(i=0; (i<TBAND_QUERY_RETRIES) && (result != TBAN_OK); i++) {
+    (void) usleep(TBAND_QUERY_BACKOFF_MS*1000 << i);
+    result = query(tban);
+  }
+  return result;
+}
+
+
+/**********************************************************************
+ * Name        : printHelp
+ * Description : 
+ * Arguments   : 
+ * Returning   : -
+ **********************************************************************/
+static void printHelp() {
+  printf("usage: tband [options]\n");
+  printf("  dev <device_path>            \tThe TBan device (/dev/ttyUSB0)\n");
+  printf("  socket <path>                \tThe Unix socket to serve (%s)\n", TBAND_SOCKET);
+  printf("  mode <octal>                 \tPermissions of the socket (%o)\n", TBAND_SOCKET_MODE);
+  printf("  interval <ms>                \tStatus refresh interval (%d)\n", TBAND_INTERVAL_MS);
+  printf("  lockfile <filename>          \tObsolete, the device itself is locked\n");
+  printf("  shm [name]                   \tAlso publish the state in shared memory (%s)\n", TBAN_SHM_NAME);
+  printf("  record <file>                \tAppend the status vectors to a recording\n");
+  printf("  foreground                   \tDo not detach from the terminal\n");
+}
+
+
+int main(int argc, char* argv[]) {
+  struct TBan   tban;
+  struct pollfd fds[TBAND_MAX_CLIENTS+1];
+  char* device     = "/dev/ttyUSB0";
+  char* sockPath   = TBAND_SOCKET;
+  char* lockfile   = NULL;
+  char* shmName    = NULL;
+  char* recording  = NULL;
+  int   publish    = 0;
+  int   interval   = TBAND_INTERVAL_MS;
+  int   foreground = 0;
+  int   mask       = TBAN_SAMPLE_TBAN;
+  long  sockMode   = TBAND_SOCKET_MODE;
+  char* end;
+  int   listenFd, result, i, n;
+
+  for(i=1; i<argc; i++) {
+    if((strcmp(argv[i], "dev") == 0) && (i+1 < argc)) {
+      device = argv[++i];
+    } else if((strcmp(argv[i], "socket") == 0) && (i+1 < argc)) {
+      sockPath = argv[++i];
+    } else if((strcmp(argv[i], "mode") == 0) && (i+1 < argc)) {
+      sockMode = strtol(argv[++i], &end, 8);
+      if((*end != '\0') || (sockMode < 0) || (sockMode > 0777)) {
+        printHelp();
+        return EXIT_FAILURE;
+      }
+    } else if((strcmp(argv[i], "interval") == 0) && (i+1 < argc)) {
+      interval = atoi(argv[++i]);
+    } else if((strcmp(argv[i], "lockfile") == 0) && (i+1 < argc)) {
+      lockfile = argv[++i];
+    } else if(strcmp(argv[i], "shm") == 0) {
+      publish = 1;
+      if((i+1 < argc) && (argv[i+1][0] == '/'))
+        shmName = argv[++i];
+    } else if((strcmp(argv[i], "record") == 0) && (i+1 < argc)) {
+      recording = argv[++i];
+    } else if(strcmp(argv[i], "foreground") == 0) {
+      foreground = 1;
+    } else {
+      printHelp();
+      return EXIT_FAILURE;
+    }
+  }
+
+  /* Open the device and read every vector once */
+  if(((result = tban_init(&tban, device)) != TBAN_OK) ||
+     ((result = bigNG_init(&tban)) != TBAN_OK) ||
+     ((result = miniNG_init(&tban)) != TBAN_OK) ||
+     ((lockfile != NULL) && ((result = tban_configureLockFile(&tban, lockfile)) != TBAN_OK)) ||
+     ((result = tban_open(&tban)) != TBAN_OK) ||
+     ((result = initialQuery(&tban, tban_queryStatus)) != TBAN_OK)) {
+    logError("RUNTIME ERROR: %s(%d) \"%s\" when opening %s", tban_strerror(result), result, tban_strerrordesc(result), device);
+    return EXIT_FAILURE;
+  }
+  result = tban_parseConfig(&tban, ".tban.conf");
+  if((result != TBAN_OK) && (errno != ENOENT)) {
+    logError("Error when parsing config file");
+    return EXIT_FAILURE;
+  }
+  if(bigNG_present(&tban) == BIGNG_PRESENT) {
+    if(initialQuery(&tban, bigNG_queryStatus) == TBAN_OK)
+      mask |= TBAN_SAMPLE_BIGNG;
+  }
+  if(miniNG_queryStatus(&tban) == TBAN_OK)
+    mask |= TBAN_SAMPLE_MINING;
+
+  /* Client writes do not need to repeat what the device already has */
+  (void) tban_configureWriteCache(&tban, TBAN_TRUE);
+
+  listenFd = openSocket(sockPath, (mode_t) sockMode);
+  if(listenFd < 0) {
+    logError("Cannot create the socket %s: %s", sockPath, strerror(errno));
+    (void) tban_close(&tban);
+    (void) tban_unlock(&tban);
+    return EXIT_FAILURE;
+  }
+
+  if(!foreground) {
+    if(daemon(1, 0) != 0) {
+      logError("Cannot detach: %s", strerror(errno));
+      return EXIT_FAILURE;
+    }
+    openlog("tband", LOG_PID, LOG_DAEMON);
+    detached = 1;
+  }
+
+  (void) signal(SIGINT,  catchStopSignal);
+  (void) signal(SIGTERM, catchStopSignal);
+  (void) signal(SIGPIPE, SIG_IGN);
+
+  if(publish) {
+    result = tban_shmPublish(&tban, shmName);
+    if(result != TBAN_OK)
+      logError("RUNTIME ERROR: %s(%d) when creating the shared memory segment", tban_strerror(result), result);
+  }
+
+  if(recording != NULL) {
+    result = tban_recorderStart(&tban, recording, TBAN_REC_INDEX_INTERVAL_MS);
+    if(result != TBAN_OK)
+      logError("RUNTIME ERROR: %s(%d) when opening the recording %s", tban_strerror(result), result, recording);
+  }
+
+  result = tban_samplerStart(&tban, interval, mask);
+  if(result != TBAN_OK) {
+    logError("RUNTIME ERROR: %s(%d) when starting the sampler", tban_strerror(result), result);
+    stopRequested = 1;
+  }
+
+  for(i=0; i<TBAND_MAX_CLIENTS; i++)
+    clients[i].fd = -1;
+
+  /* Serve the clients. One request is executed at a time so writes
+   * from different clients never interleave. */
+  while(!stopRequested) {
+    fds[0].fd     = listenFd;
+    fds[0].events = POLLIN;
+    for(i=0; i<TBAND_MAX_CLIENTS; i++) {
+      fds[i+1].fd     = clients[i].fd;
+      fds[i+1].events = POLLIN;
+    }
+
+    n = poll(fds, TBAND_MAX_CLIENTS+1, -1);
+    if(n < 0)
+      continue; /* EINTR, check the stop flag */
+
+    for(i=0; i<TBAND_MAX_CLIENTS; i++) {
+      if((clients[i].fd >= 0) && (fds[i+1].revents != 0))
+        serveClient(&tban, &clients[i]);
+    }
+
+    if(fds[0].revents & POLLIN) {
+      int fd = accept(listenFd, NULL, NULL);
+      if(fd >= 0) {
+        for(i=0; (i<TBAND_MAX_CLIENTS) && (clients[i].fd >= 0); i++)
+          ;
+        if(i == TBAND_MAX_CLIENTS) {
+          (void) send(fd, "ERR too many clients\n", 21, MSG_NOSIGNAL);
+          (void) close(fd);
+        } else {
+          clients[i].fd  = fd;
+          clients[i].len = 0;
+        }
+      }
+    }
+  }
+
+  /* Shut down */
+  for(i=0; i<TBAND_MAX_CLIENTS; i++) {
+    if(clients[i].fd >= 0)
+      closeClient(&clients[i]);
+  }
+  (void) close(listenFd);
+  (void) unlink(sockPath);
+  (void) tban_close(&tban);
+  if(tban.locked == 1)
+    (void) tban_unlock(&tban);
+  (void) tban_free(&tban);
+
+  return EXIT_SUCCESS;
+}
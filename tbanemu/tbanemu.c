@@ -0,0 +1,572 @@
+/*****************************************************************************
+ ** This program is free software; you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation; either version 2 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program; if not, write to the Free Software
+ ** Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ **
+ **
+ ** FILE INFORMATION
+ ** ----------------
+ ** Filename:        tbanemu.c
+ ** Initial author:  marcus.jagemar@gmail.com
+ **
+ **
+ ** DESCRIPTION
+ ** -----------
+ ** Software T-Balancer on a pseudo terminal. The emulator speaks the
+ ** serial protocol of the real device so the complete libtban I/O path
+ ** can be run (and measured) without hardware:
+ **
+ ** - SER_REQUEST is answered with the 285 byte status vector of the
+ **   source selected with SOURCE1/SOURCE2. Source 2 is the second
+ **   vector of a BigNG or, on a TBan with a miniNG attached, the
+ **   miniNG vector. SER_REQUEST_1/_2 return the partial vectors.
+ ** - Setter frames are applied to the status vector.
+ ** - Frames for the miniNG are held in the pass-through buffer
+ **   (B1-B3 in the miniNG vector) until the relay has drained them.
+ ** - The answer is delayed by a configurable latency and paced at the
+ **   configured baud rate.
+ **
+ ** The positions in the vectors are taken from fields.h, the same
+ ** tables libtban decodes them with.
+ **
+ ** The path of the slave side is printed on startup, tbancontrol or
+ ** any other libtban program can then use it as device:
+ **
+ **   tbanemu/tbanemu link /tmp/tban0 &
+ **   tbancontrol/tbancontrol dev /tmp/tban0 getallch
+ **
+ ** REVISION HISTORY
+ ** ----------------
+ **
+ ** Date        Comment
+ ** =================================================================
+ ** 2026-10-17  File created
+ **
+ *****************************************************************************/
+
+/* Standard includes */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <pty.h>
+#include <math.h>
+
+/* TBan protocol definitions */
+#include "tban.h"
+#include "fields.h"
+
+
+/*****************************************************************************
+ * Defaults
+ *****************************************************************************/
+#define EMU_BAUD            19200
+#define EMU_LATENCY_MS      5
+#define EMU_DRAIN_MS        100
+#define EMU_FW              0x28   /* 2.8, supports the partial requests */
+#define EMU_CHUNK           16     /* Bytes written at a time when pacing */
+
+
+/*****************************************************************************
+ * miniNG vector layout, see mini_ng.c
+ *****************************************************************************/
+#define EMU_MINI_START_TWI  1
+#define EMU_MINI_END_TWI    62
+#define EMU_MINI_B1         63
+#define EMU_MINI_B2         64
+#define EMU_MINI_B3         65
+
+
+/*****************************************************************************
+ * Emulated device
+ *****************************************************************************/
+struct Emu {
+  /* Configuration */
+  int  baud;
+  int  latencyMs;
+  int  drainMs;
+  int  bigNG;
+  int  miniNG;
+  int  verbose;
+
+  /* State */
+  unsigned char vec[TBAN_STATUS_SIZE];
+  unsigned char vec2[TBAN_STATUS_SIZE];    /* BigNG second vector */
+  unsigned char mini[TBAN_STATUS_SIZE];    /* miniNG vector */
+  int           source;
+  int           op;                        /* Command waiting for its value */
+  long long     drainDeadline;             /* 0 = pass-through idle */
+
+  /* Statistics */
+  unsigned long commands;
+  unsigned long requests;
+  unsigned long bytesIn;
+  unsigned long bytesOut;
+};
+
+
+static volatile sig_atomic_t stopRequested = 0;
+
+
+/**********************************************************************
+ * Name        : catchStopSignal
+ * Description : SIGINT/SIGTERM handler, ends the main loop.
+ * Arguments   : sig_num = The signal
+ * Returning   : -
+ **********************************************************************/
+static void catchStopSignal(int sig_num) {
+  (void) sig_num;
+  stopRequested = 1;
+}
+
+
+/**********************************************************************
+ * Name        : monotonicMs
+ * Description : Read the monotonic clock.
+ * Arguments   : none
+ * Returning   : Milliseconds since some unspecified starting point
+ **********************************************************************/
+static long long monotonicMs(void) {
+  struct timespec now;
+
+  (void) clock_gettime(CLOCK_MONOTONIC, &now);
+  return ((long long) now.tv_sec)*1000 + now.tv_nsec/1000000;
+}
+
+
+/**********************************************************************
+ * Name        : sleepMs
+ * Description : Sleep for some milliseconds.
+ * Arguments   : ms = Milliseconds
+ * Returning   : none
+ **********************************************************************/
+static void sleepMs(long ms) {
+  struct timespec delay;
+
+  delay.tv_sec  = ms/1000;
+  delay.tv_nsec = (ms%1000)*1000000L;
+  while((nanosleep(&delay, &delay) != 0) && (errno == EINTR))
+    ;
+}
+
+
+/**********************************************************************
+ * Name        : emuInit
+ * Description : Fill in the status vectors of a freshly powered device.
+ * Arguments   : emu = The emulator
+ * Returning   : none
+ **********************************************************************/
+static void emuInit(struct Emu* emu) {
+  unsigned char* v = emu->vec;
+  int i, j;
+
+  (void) memset(emu->vec,  0, sizeof(emu->vec));
+  (void) memset(emu->vec2, 0, sizeof(emu->vec2));
+  (void) memset(emu->mini, 0, sizeof(emu->mini));
+
+  v[0]                           = TBAN_FRAME_START;
+  v[TBAN_FIELD_AT(pwmFreq, 0)]   = 140;
+  v[TBAN_FIELD_AT(led, 0)]       = 1;
+  v[TBAN_MES_CH_DOWN_EE]         = 10;
+  v[TBAN_MES_CH_GRENZ_EE]        = 20;
+  v[TBAN_MES_CH_UP_EE]           = 5;
+  for(i=0; i<TBAN_NUMBER_CHANNELS; i++) {
+    for(j=0; j<6; j++) {
+      v[TBAN_FIELD_AT(chCurveX, i)+j] = 2*(25+5*j);   /* Half degrees */
+      v[TBAN_FIELD_AT(chCurveY, i)+j] = 20*j;
+    }
+    v[TBAN_FIELD_AT(chCurveXMax, i)]  = 2*60;
+    v[TBAN_FIELD_AT(chHysteresis, i)] = 2;
+    v[TBAN_FIELD_AT(chOvertemp, i)]   = 2*70;
+    v[TBAN_FIELD_AT(chDsens, i)]      = 1 << i;
+    v[TBAN_FIELD_AT(chPwm, i)]        = 20;            /* Half the pwm */
+    v[TBAN_FIELD_AT(chRpmMax, i)]     = 200;           /* Units of 10.5 rpm */
+    v[TBAN_FIELD_AT(chTemp, i)]       = 2*35;
+  }
+  v[TBAN_INFO_APP]     = emu->bigNG ? TBAN_APP_TYPE_BIGNG : TBAN_APP_TYPE_TBAN;
+  v[TBAN_INFO_TYPE]    = emu->bigNG ? TBAN_DEVICE_TYPE_BIGNG : TBAN_DEVICE_TYPE_TBAN;
+  v[TBAN_INFO_VER]     = EMU_FW;
+  v[TBAN_INFO_DATE]    = 0x37;
+  v[TBAN_INFO_PROT]    = 1;
+  v[TBAN_SER_BUFFERLN] = 29;      /* 256+29 = 285 bytes */
+
+  emu->vec2[0] = TBAN_FRAME_START;
+
+  emu->mini[0]                  = TBAN_FRAME_START;
+  emu->mini[EMU_MINI_START_TWI] = 253;
+  emu->mini[EMU_MINI_END_TWI]   = 254;
+}
+
+
+/**********************************************************************
+ * Name        : emuTick
+ * Description : Let the measured values move a little between two
+ *               requests, the way real sensors do.
+ * Arguments   : emu = The emulator
+ * Returning   : none
+ **********************************************************************/
+static void emuTick(struct Emu* emu) {
+  double t = monotonicMs()/1000.0;
+  int i;
+
+  for(i=0; i<TBAN_NUMBER_DIGITAL_SENSORS; i++)
+    emu->vec[TBAN_FIELD_AT(dsTemp, i)] = (unsigned char) (2*(30+i) + 4*sin(t/10.0 + i));
+  for(i=0; i<TBAN_NUMBER_ANALOG_SENSORS; i++)
+    emu->vec[TBAN_FIELD_AT(asTemp, i)] = (unsigned char) (2*(35+i) + 4*cos(t/15.0 + i));
+  emu->vec[TBAN_FIELD_AT(wdCounter, 0)]++;
+}
+
+
+/**********************************************************************
+ * Name        : emuWrite
+ * Description : Send an answer, after the latency and paced at the
+ *               baud rate (10 bits per byte).
+ * Arguments   : emu = The emulator
+ *               fd  = Master side of the pty
+ *               buf = The answer
+ *               len = Its length
+ * Returning   : none
+ **********************************************************************/
+static void emuWrite(struct Emu* emu, int fd, const unsigned char* buf, int len) {
+  long long start;
+  int sent = 0, n;
+
+  sleepMs(emu->latencyMs);
+  start = monotonicMs();
+  while(sent < len) {
+    n = (len - sent > EMU_CHUNK) ? EMU_CHUNK : len - sent;
+    n = write(fd, buf + sent, n);
+    if(n < 0) {
+      if(errno == EINTR)
+        continue;
+      return;
+    }
+    sent += n;
+    emu->bytesOut += n;
+
+    /* Wait until the wire would have carried it */
+    if(emu->baud > 0) {
+      long long due = start + (long long) sent*10*1000/emu->baud;
+      long long now = monotonicMs();
+      if(due > now)
+        sleepMs(due - now);
+    }
+  }
+}
+
+
+/**********************************************************************
+ * Name        : emuRequest
+ * Description : Answer a status request.
+ * Arguments   : emu = The emulator
+ *               fd  = Master side of the pty
+ *               cmd = TBAN_SER_REQUEST, _REQUEST_1 or _REQUEST_2
+ * Returning   : none
+ **********************************************************************/
+static void emuRequest(struct Emu* emu, int fd, unsigned char cmd) {
+  unsigned char frame[TBAN_STATUS_SIZE];
+
+  emu->requests++;
+  emuTick(emu);
+
+  if(emu->source == 2) {
+    if(emu->bigNG)
+      emuWrite(emu, fd, emu->vec2, TBAN_STATUS_SIZE);
+    else if(emu->miniNG)
+      emuWrite(emu, fd, emu->mini, TBAN_STATUS_SIZE);
+    /* Nothing attached, nothing answers */
+    return;
+  }
+
+  switch(cmd) {
+    case TBAN_SER_REQUEST_1:
+      frame[0] = TBAN_FRAME_START;
+      (void) memcpy(frame+1, emu->vec + TBAN_SENSORS_FIRST, TBAN_SENSORS_LAST-TBAN_SENSORS_FIRST+1);
+      emuWrite(emu, fd, frame, TBAN_SENSORS_LAST-TBAN_SENSORS_FIRST+2);
+      break;
+    case TBAN_SER_REQUEST_2:
+      frame[0] = TBAN_FRAME_START;
+      (void) memcpy(frame+1, emu->vec + TBAN_CONFIG_FIRST, TBAN_CONFIG_LAST-TBAN_CONFIG_FIRST+1);
+      emuWrite(emu, fd, frame, TBAN_CONFIG_LAST-TBAN_CONFIG_FIRST+2);
+      break;
+    default:
+      emuWrite(emu, fd, emu->vec, TBAN_STATUS_SIZE);
+      break;
+  }
+}
+
+
+/**********************************************************************
+ * Name        : emuRelayDone
+ * Description : The pass-through buffer has been sent to the miniNG.
+ *               Apply curve frames and empty B1-B3.
+ * Arguments   : emu = The emulator
+ * Returning   : none
+ **********************************************************************/
+static void emuRelayDone(struct Emu* emu) {
+  unsigned char cmd = emu->mini[EMU_MINI_B1];
+  int ch, pt;
+
+  if((cmd >= 0x30) && (cmd < 0x50) && ((cmd & 0x0f) < 5)) {
+    ch = (cmd - 0x30) >> 4;
+    pt = cmd & 0x0f;
+    emu->mini[TBAN_FIELD_AT(miniNGchCurveX, ch)+pt] = emu->mini[EMU_MINI_B2];
+    emu->mini[TBAN_FIELD_AT(miniNGchCurveY, ch)+pt] = emu->mini[EMU_MINI_B3];
+  }
+  emu->mini[EMU_MINI_B1] = 0;
+  emu->mini[EMU_MINI_B2] = 0;
+  emu->mini[EMU_MINI_B3] = 0;
+  emu->drainDeadline = 0;
+}
+
+
+/**********************************************************************
+ * Name        : emuSetter
+ * Description : Apply a two byte command to the state.
+ * Arguments   : emu   = The emulator
+ *               op    = Command
+ *               value = Its value
+ * Returning   : none
+ **********************************************************************/
+static void emuSetter(struct Emu* emu, unsigned char op, unsigned char value) {
+  unsigned char* v = emu->vec;
+  int i;
+
+  emu->commands++;
+
+  if((op >= TBAN_SER_SET1) && (op <= TBAN_SER_SET4)) {
+    /* Only followed in manual mode */
+    if(v[TBAN_FIELD_AT(chMode, op - TBAN_SER_SET1)] != 0)
+      v[TBAN_FIELD_AT(chPwm, op - TBAN_SER_SET1)] = value/2;
+  } else if(op == TBAN_SER_FREQ) {
+    v[TBAN_FIELD_AT(pwmFreq, 0)] = value;
+  } else if(op == TBAN_SER_MAN) {
+    for(i=0; i<TBAN_NUMBER_CHANNELS; i++)
+      v[TBAN_FIELD_AT(chMode, i)] = (value >> i) & 1;
+  } else if(emu->bigNG && (op >= 0x30) && (op < 0x34)) {
+    v[TBAN_FIELD_AT(bigNGchTarget, op - 0x30)] = value;
+  } else if(emu->bigNG && (op >= 0x3A) && (op < 0x3E)) {
+    v[TBAN_FIELD_AT(bigNGchTargetMode, op - 0x3A)] = value;
+  } else if(op == TBAN_SER_ERR_UP) {
+    v[TBAN_MES_CH_UP_EE] = value;
+  } else if(op == TBAN_SER_ERR_GRENZ) {
+    v[TBAN_MES_CH_GRENZ_EE] = value;
+  } else if(op == TBAN_SER_ERR_DOWN) {
+    v[TBAN_MES_CH_DOWN_EE] = value;
+  } else if((op >= TBAN_SER_SET_KANAL1) && (op < TBAN_SER_SET_MAX)) {
+    int ch = (op - TBAN_SER_SET_KANAL1) >> 4;
+    int pt = op & 0x0f;
+    if(pt < 6)
+      v[TBAN_FIELD_AT(chCurveX, ch) + pt] = value;
+    else if(pt < 12)
+      v[TBAN_FIELD_AT(chCurveY, ch) + pt-6] = value;
+  } else if((op & 0xf0) == TBAN_SER_SET_MAX) {
+    v[TBAN_FIELD_AT(chCurveXMax, op & 3)] = value;
+  } else if((op & 0xf0) == TBAN_SER_SET_HYS) {
+    v[TBAN_FIELD_AT(chHysteresis, op & 3)] = value;
+  } else if((op & 0xf0) == TBAN_SER_SET_WARN) {
+    v[TBAN_FIELD_AT(chOvertemp, op & 3)] = value;
+  } else if((op >= TBAN_SER_SET_ZUORD) && (op < TBAN_SER_SET_ZUORD+4)) {
+    v[TBAN_FIELD_AT(chDsens, op & 3)] = value;
+  } else if((op >= TBAN_SER_SET_ZUORA) && (op < TBAN_SER_SET_ZUORA+4)) {
+    v[TBAN_FIELD_AT(chAsens, op & 3)] = value;
+  } else if(op == TBAN_SER_MINI_S1) {
+    emu->mini[EMU_MINI_B1] = value;
+  } else if(op == TBAN_SER_MINI_S2) {
+    emu->mini[EMU_MINI_B2] = value;
+  } else if(op == TBAN_SER_MINI_S2_2) {
+    emu->mini[EMU_MINI_B3] = value;
+  }
+}
+
+
+/**********************************************************************
+ * Name        : emuInput
+ * Description : Interpret the bytes received from the host.
+ * Arguments   : emu = The emulator
+ *               fd  = Master side of the pty
+ *               buf = The bytes
+ *               len = Number of bytes
+ * Returning   : none
+ **********************************************************************/
+static void emuInput(struct Emu* emu, int fd, const unsigned char* buf, int len) {
+  int i;
+
+  emu->bytesIn += len;
+
+  for(i=0; i<len; i++) {
+    unsigned char c = buf[i];
+
+    /* Value of a two byte command */
+    if(emu->op != 0) {
+      emuSetter(emu, emu->op, c);
+      emu->op = 0;
+      continue;
+    }
+
+    switch(c) {
+      case TBAN_SER_LED_EIN:
+      case TBAN_SER_LED_AUS:
+        emu->vec[TBAN_FIELD_AT(led, 0)] = (c == TBAN_SER_LED_EIN);
+        emu->commands++;
+        break;
+      case TBAN_SER_BUZ_EIN:
+      case TBAN_SER_BUZ_AUS:
+        emu->vec[TBAN_FIELD_AT(buzzer, 0)] = (c == TBAN_SER_BUZ_EIN);
+        emu->commands++;
+        break;
+      case TBAN_SER_SOURCE1:
+      case TBAN_SER_SOURCE2:
+        emu->source = (c == TBAN_SER_SOURCE1) ? 1 : 2;
+        break;
+      case TBAN_SER_REQUEST:
+      case TBAN_SER_REQUEST_1:
+      case TBAN_SER_REQUEST_2:
+        emuRequest(emu, fd, c);
+        break;
+      case TBAN_SER_MAKE_ABGL:
+        emu->commands++;
+        break;
+      case TBAN_SER_MINI_SEND1:
+      case TBAN_SER_MINI_SEND2:
+        emu->commands++;
+        if(emu->miniNG)
+          emu->drainDeadline = monotonicMs() + emu->drainMs;
+        break;
+      case USB_WATCHDOG_ON:
+      case USB_WATCHDOG_OFF:
+        emu->vec[TBAN_FIELD_AT(wdEnabled, 0)] = (c == USB_WATCHDOG_ON);
+        emu->commands++;
+        break;
+      default:
+        emu->op = c;
+        break;
+    }
+  }
+}
+
+
+/**********************************************************************
+ * Name        : printHelp
+ * Description : 
+ * Arguments   : 
+ * Returning   : -
+ **********************************************************************/
+static void printHelp() {
+  printf("usage: tbanemu [options]\n");
+  printf("  link <path>                  \tCreate a symbolic link to the pty slave\n");
+  printf("  baud <rate>                  \tEmulated wire speed, 0 = unlimited (%d)\n", EMU_BAUD);
+  printf("  latency <ms>                 \tDelay before each answer (%d)\n", EMU_LATENCY_MS);
+  printf("  bigng                        \tEmulate a BigNG instead of a TBan\n");
+  printf("  mining                       \tAttach a miniNG (TBan only)\n");
+  printf("  drain <ms>                   \tminiNG pass-through time per frame (%d)\n", EMU_DRAIN_MS);
+  printf("  verbose                      \tPrint statistics on exit\n");
+}
+
+
+int main(int argc, char* argv[]) {
+  struct Emu     emu;
+  struct termios tio;
+  struct pollfd  pfd;
+  unsigned char  buf[512];
+  char           name[64];
+  char*          link = NULL;
+  int            master, slave, timeout, n, i;
+
+  (void) memset(&emu, 0, sizeof(emu));
+  emu.baud      = EMU_BAUD;
+  emu.latencyMs = EMU_LATENCY_MS;
+  emu.drainMs   = EMU_DRAIN_MS;
+  emu.source    = 1;
+
+  for(i=1; i<argc; i++) {
+    if((strcmp(argv[i], "link") == 0) && (i+1 < argc)) {
+      link = argv[++i];
+    } else if((strcmp(argv[i], "baud") == 0) && (i+1 < argc)) {
+      emu.baud = atoi(argv[++i]);
+    } else if((strcmp(argv[i], "latency") == 0) && (i+1 < argc)) {
+      emu.latencyMs = atoi(argv[++i]);
+    } else if((strcmp(argv[i], "drain") == 0) && (i+1 < argc)) {
+      emu.drainMs = atoi(argv[++i]);
+    } else if(strcmp(argv[i], "bigng") == 0) {
+      emu.bigNG = 1;
+    } else if(strcmp(argv[i], "mining") == 0) {
+      emu.miniNG = 1;
+    } else if(strcmp(argv[i], "verbose") == 0) {
+      emu.verbose = 1;
+    } else {
+      printHelp();
+      return EXIT_FAILURE;
+    }
+  }
+  if(emu.bigNG)
+    emu.miniNG = 0;
+  emuInit(&emu);
+
+  /* The slave stays open here as well so the master does not see a
+   * hangup each time a client closes the device */
+  if(openpty(&master, &slave, name, NULL, NULL) != 0) {
+    printf("Cannot open a pty: %s\n", strerror(errno));
+    return EXIT_FAILURE;
+  }
+  (void) tcgetattr(master, &tio);
+  cfmakeraw(&tio);
+  (void) tcsetattr(master, TCSANOW, &tio);
+
+  if(link != NULL) {
+    (void) unlink(link);
+    if(symlink(name, link) != 0) {
+      printf("Cannot create the link %s: %s\n", link, strerror(errno));
+      return EXIT_FAILURE;
+    }
+  }
+  printf("%s\n", name);
+  (void) fflush(stdout);
+
+  (void) signal(SIGINT,  catchStopSignal);
+  (void) signal(SIGTERM, catchStopSignal);
+
+  pfd.fd     = master;
+  pfd.events = POLLIN;
+  while(!stopRequested) {
+    timeout = -1;
+    if(emu.drainDeadline != 0) {
+      timeout = (int) (emu.drainDeadline - monotonicMs());
+      if(timeout < 0)
+        timeout = 0;
+    }
+
+    n = poll(&pfd, 1, timeout);
+    if((emu.drainDeadline != 0) && (monotonicMs() >= emu.drainDeadline))
+      emuRelayDone(&emu);
+    if((n <= 0) || !(pfd.revents & POLLIN))
+      continue;
+
+    n = read(master, buf, sizeof(buf));
+    if(n > 0)
+      emuInput(&emu, master, buf, n);
+  }
+
+  if(emu.verbose)
+    printf("commands=%lu requests=%lu in=%lu out=%lu\n",
+           emu.commands, emu.requests, emu.bytesIn, emu.bytesOut);
+  if(link != NULL)
+    (void) unlink(link);
+  (void) close(slave);
+  (void) close(master);
+
+  return EXIT_SUCCESS;
+}